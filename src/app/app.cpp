@@ -23,6 +23,7 @@
 #include "app/app.h"
 
 #include "app/app_options.h"
+#include "app/background_save.h"
 #include "app/check_update.h"
 #include "app/color_utils.h"
 #include "app/commands/commands.h"
@@ -132,6 +133,8 @@ App::App(int argc, const char* argv[])
     m_exporter->setDataFilename(options.data());
     m_exporter->setTextureFilename(options.sheet());
     m_exporter->setScale(options.scale());
+    m_exporter->setTrim(options.trim());
+    m_exporter->setMergeDuplicates(options.mergeDuplicates());
   }
 
   // Register well-known image file types.
@@ -229,7 +232,12 @@ int App::run()
   if (m_exporter != NULL) {
     PRINTF("Exporting sheet...\n");
 
-    m_exporter->exportSheet();
+    try {
+      m_exporter->exportSheet();
+    }
+    catch (const std::exception& e) {
+      Console::showException(e);
+    }
     m_exporter.reset(NULL);
   }
 
@@ -253,6 +261,9 @@ int App::run()
     // Run the GUI main message loop
     gui_run();
 
+    // Wait the files that are still being saved
+    BackgroundSave::wait();
+
     // Uninstall support to drop files
     uninstall_drop_files();
 
@@ -46,6 +46,8 @@ public:
   const std::string& data() const { return m_data; }
   const std::string& textureFormat() const { return m_textureFormat; }
   const std::string& sheet() const { return m_sheet; }
+  bool trim() const { return m_trim; }
+  bool mergeDuplicates() const { return m_mergeDuplicates; }
   const double scale() const { return m_scale; }
   const std::string& scaleMode() const { return m_scaleMode; }
 
@@ -72,6 +74,8 @@ private:
   std::string m_data;
   std::string m_textureFormat;
   std::string m_sheet;
+  bool m_trim;
+  bool m_mergeDuplicates;
   double m_scale;
   std::string m_scaleMode;
 };
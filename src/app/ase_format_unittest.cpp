@@ -0,0 +1,225 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "app/document.h"
+#include "app/file/file.h"
+#include "app/file/file_format.h"
+#include "app/file/file_formats_manager.h"
+#include "app/ini_file.h"
+#include "base/unique_ptr.h"
+#include "raster/raster.h"
+
+#include <allegro/system.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace app;
+using namespace raster;
+
+// The options to save .ase files are read from the configuration
+// (which needs Allegro, without any driver).
+class AllegroEnvironment : public testing::Environment {
+public:
+  void SetUp() OVERRIDE {
+    install_allegro(SYSTEM_NONE, &errno, atexit);
+  }
+};
+
+static testing::Environment* const allegro_env =
+  testing::AddGlobalTestEnvironment(new AllegroEnvironment);
+
+static const char* kFilename = "ase_format_unittest.ase";
+
+static color_t test_pixel(int x, int y, int frame)
+{
+  return rgba((x+frame) & 255, (y*3) & 255, frame & 255, 255);
+}
+
+// More cels than ASE_CELS_BATCH_SIZE, so they are compressed and
+// decompressed in several batches.
+TEST(AseFormat, SeveralBatchesOfCels)
+{
+  FileFormatsManager::instance().registerAllFormats();
+  const int w = 128, h = 128, frames = 70;
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, w, h, 256));
+    doc->setFilename(kFilename);
+
+    Sprite* sprite = doc->getSprite();
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    sprite->setTotalFrames(FrameNumber(frames));
+
+    for (int f=0; f<frames; ++f) {
+      Cel* cel = layer->getCel(FrameNumber(f));
+      if (!cel) {
+        cel = new Cel(FrameNumber(f), sprite->getStock()->addImage(Image::create(IMAGE_RGB, w, h)));
+        layer->addCel(cel);
+      }
+      Image* image = sprite->getStock()->getImage(cel->getImage());
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          put_pixel(image, x, y, test_pixel(x, y, f));
+    }
+
+    ASSERT_EQ(0, save_document(doc));
+  }
+
+  {
+    base::UniquePtr<Document> doc(load_document(kFilename));
+    ASSERT_TRUE(doc != NULL);
+
+    Sprite* sprite = doc->getSprite();
+    ASSERT_EQ(frames, sprite->getTotalFrames());
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+
+    for (int f=0; f<frames; ++f) {
+      Cel* cel = layer->getCel(FrameNumber(f));
+      ASSERT_TRUE(cel != NULL);
+      Image* image = sprite->getStock()->getImage(cel->getImage());
+      ASSERT_EQ(w, image->getWidth());
+      ASSERT_EQ(h, image->getHeight());
+      int differences = 0;
+      for (int y=0; y<h; ++y)
+        for (int x=0; x<w; ++x)
+          if (get_pixel(image, x, y) != test_pixel(x, y, f))
+            ++differences;
+      EXPECT_EQ(0, differences) << "Frame " << f;
+    }
+  }
+
+  std::remove(kFilename);
+}
+
+// Cels that share the same image are saved as link cels, cels with
+// identical copies of an image keep their own images.
+TEST(AseFormat, LinkedCels)
+{
+  FileFormatsManager::instance().registerAllFormats();
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 32, 32, 256));
+    doc->setFilename(kFilename);
+
+    Sprite* sprite = doc->getSprite();
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    Cel* cel = layer->getCel(FrameNumber(0));
+    Image* image = sprite->getStock()->getImage(cel->getImage());
+    put_pixel(image, 4, 8, rgba(255, 0, 0, 255));
+
+    // Frame 1 shares the image with frame 0, and frame 2 has an
+    // identical copy of the image
+    sprite->setTotalFrames(FrameNumber(3));
+    layer->addCel(new Cel(FrameNumber(1), cel->getImage()));
+    layer->addCel(new Cel(FrameNumber(2), sprite->getStock()->addImage(Image::createCopy(image))));
+
+    ASSERT_EQ(0, save_document(doc));
+  }
+
+  {
+    base::UniquePtr<Document> doc(load_document(kFilename));
+    ASSERT_TRUE(doc != NULL);
+
+    Sprite* sprite = doc->getSprite();
+    ASSERT_EQ(3, sprite->getTotalFrames());
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+
+    int imageIndex = layer->getCel(FrameNumber(0))->getImage();
+    EXPECT_EQ(imageIndex, layer->getCel(FrameNumber(1))->getImage());
+    EXPECT_NE(imageIndex, layer->getCel(FrameNumber(2))->getImage());
+    EXPECT_TRUE(layer->isLinkedCel(layer->getCel(FrameNumber(0))));
+    EXPECT_FALSE(layer->isLinkedCel(layer->getCel(FrameNumber(2))));
+
+    Image* image = sprite->getStock()->getImage(imageIndex);
+    Image* copy = sprite->getStock()->getImage(layer->getCel(FrameNumber(2))->getImage());
+    EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(image, 4, 8));
+    EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(copy, 4, 8));
+  }
+
+  std::remove(kFilename);
+}
+
+// The thumbnail chunk is a reduced version of the first frame.
+TEST(AseFormat, Thumbnail)
+{
+  FileFormatsManager::instance().registerAllFormats();
+  const int w = 256, h = 64;
+
+  // The thumbnail is saved only if it is enabled
+  set_config_bool("ASE", "SaveThumbnail", true);
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, w, h, 256));
+    doc->setFilename(kFilename);
+
+    Sprite* sprite = doc->getSprite();
+    LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    Image* image = sprite->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        put_pixel(image, x, y, test_pixel(x, y, 0));
+
+    ASSERT_EQ(0, save_document(doc));
+  }
+
+  FileOp* fop = fop_to_load_document(kFilename, FILE_LOAD_SEQUENCE_NONE);
+  ASSERT_TRUE(fop != NULL);
+  ASSERT_TRUE(fop->format->support(FILE_SUPPORT_THUMBNAILS));
+  base::UniquePtr<Image> thumbnail(fop->format->loadThumbnail(kFilename));
+  fop_free(fop);
+
+  ASSERT_TRUE(thumbnail != NULL);
+  ASSERT_EQ(IMAGE_RGB, thumbnail->getPixelFormat());
+  ASSERT_EQ(128, thumbnail->getWidth());
+  ASSERT_EQ(32, thumbnail->getHeight());
+
+  int differences = 0;
+  for (int v=0; v<thumbnail->getHeight(); ++v)
+    for (int u=0; u<thumbnail->getWidth(); ++u)
+      if (get_pixel(thumbnail, u, v) != test_pixel(u*2, v*2, 0))
+        ++differences;
+  EXPECT_EQ(0, differences);
+
+  set_config_bool("ASE", "SaveThumbnail", false);
+  std::remove(kFilename);
+}
+
+// The thumbnail chunk isn't saved by default.
+TEST(AseFormat, NoThumbnailByDefault)
+{
+  FileFormatsManager::instance().registerAllFormats();
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 32, 32, 256));
+    doc->setFilename(kFilename);
+    ASSERT_EQ(0, save_document(doc));
+  }
+
+  FileOp* fop = fop_to_load_document(kFilename, FILE_LOAD_SEQUENCE_NONE);
+  ASSERT_TRUE(fop != NULL);
+  base::UniquePtr<Image> thumbnail(fop->format->loadThumbnail(kFilename));
+  fop_free(fop);
+  EXPECT_TRUE(thumbnail == NULL);
+
+  std::remove(kFilename);
+}
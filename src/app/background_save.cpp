@@ -0,0 +1,172 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/background_save.h"
+
+#include "app/app.h"
+#include "app/console.h"
+#include "app/context.h"
+#include "app/document.h"
+#include "app/document_access.h"
+#include "app/document_snapshot.h"
+#include "app/file/file.h"
+#include "app/modules/gui.h"
+#include "app/recent_files.h"
+#include "app/ui/status_bar.h"
+#include "base/bind.h"
+#include "base/path.h"
+#include "base/thread.h"
+
+#include <algorithm>
+#include <vector>
+
+static const int kMonitoringPeriod = 100;
+
+namespace app {
+
+// Saves in progress (used from the main thread only).
+typedef std::vector<BackgroundSave*> BackgroundSaves;
+static BackgroundSaves saves;
+
+// static
+void BackgroundSave::start(Context* context, const Document* document,
+                           const base::string& filename, bool markAsSaved)
+{
+  // Only one save of the same document at the same time (so the
+  // recorded saving state is the one of the last save).
+  wait(document);
+
+  base::UniquePtr<BackgroundSave> save(
+    new BackgroundSave(context, document, filename, markAsSaved));
+  if (!save->m_fop)
+    return;
+
+  save->m_thread.reset(new base::thread(Bind<void>(&BackgroundSave::thread_proc, save.get())));
+  save->Timer::start();
+  saves.push_back(save.release());
+}
+
+// static
+void BackgroundSave::wait(const Document* document)
+{
+  BackgroundSaves copy = saves;
+  for (BackgroundSaves::iterator it=copy.begin(), end=copy.end(); it != end; ++it) {
+    BackgroundSave* save = *it;
+    if (document && save->m_documentId != document->getId())
+      continue;
+
+    save->m_thread->join();
+    if (save->finish() || !document)
+      delete save;
+  }
+}
+
+BackgroundSave::BackgroundSave(Context* context, const Document* document,
+                               const base::string& filename, bool markAsSaved)
+  : ui::Timer(kMonitoringPeriod)
+  , m_context(context)
+  , m_documentId(document->getId())
+  , m_filename(filename)
+  , m_markAsSaved(markAsSaved)
+  , m_snapshot(new DocumentSnapshot(document))
+  , m_progress(NULL)
+{
+  // The state of the undo history that is being saved (changes done
+  // while the file is written are not marked as saved).
+  if (m_markAsSaved)
+    const_cast<Document*>(document)->markAsSaving();
+
+  m_snapshot->document()->setFilename(filename);
+  m_fop.reset(fop_to_save_document(m_snapshot->document()));
+  if (m_fop)
+    m_progress = StatusBar::instance()->addProgress();
+}
+
+BackgroundSave::~BackgroundSave()
+{
+  if (m_thread)
+    m_thread->join();
+
+  delete m_progress;
+
+  BackgroundSaves::iterator it = std::find(saves.begin(), saves.end(), this);
+  if (it != saves.end())
+    saves.erase(it);
+}
+
+void BackgroundSave::onTick()
+{
+  m_progress->setPos(fop_get_progress(m_fop));
+
+  if (fop_is_done(m_fop)) {
+    m_thread->join();
+    if (finish())
+      delete this;
+  }
+}
+
+// Reports the result of the save, and marks the document as saved.
+// Returns false if the document is locked by other job (so it must be
+// tried again later).
+bool BackgroundSave::finish()
+{
+  if (m_fop->has_error()) {
+    Console console;
+    console.printf(m_fop->error.c_str());
+    return true;
+  }
+
+  if (m_markAsSaved) {
+    // The document could be closed while it was being saved.
+    Document* document = m_context->getDocuments().getById(m_documentId);
+    if (document) {
+      try {
+        DocumentWriter writer(document);
+        writer->markSavingAsSaved();
+        update_screen_for_document(writer);
+      }
+      catch (const LockedDocumentException&) {
+        return false;
+      }
+    }
+  }
+
+  App::instance()->getRecentFiles()->addRecentFile(m_filename.c_str());
+  StatusBar::instance()
+    ->setStatusText(2000, "File %s, saved.",
+                    base::get_file_name(m_filename).c_str());
+  return true;
+}
+
+// Thread to do the hard work: save the file to the disk.
+void BackgroundSave::thread_proc(BackgroundSave* self)
+{
+  try {
+    fop_operate(self->m_fop, NULL);
+  }
+  catch (const std::exception& e) {
+    fop_error(self->m_fop, "Error saving file:\n%s", e.what());
+  }
+  fop_done(self->m_fop);
+}
+
+} // namespace app
@@ -0,0 +1,84 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_BACKGROUND_SAVE_H_INCLUDED
+#define APP_BACKGROUND_SAVE_H_INCLUDED
+
+#include "app/document_id.h"
+#include "base/compiler_specific.h"
+#include "base/disable_copying.h"
+#include "base/string.h"
+#include "base/unique_ptr.h"
+#include "ui/timer.h"
+
+namespace base {
+  class thread;
+}
+
+namespace app {
+  class Context;
+  class Document;
+  class DocumentSnapshot;
+  class Progress;
+  struct FileOp;
+
+  // Saves a document in a background thread from a DocumentSnapshot,
+  // so the user can continue editing the document while the file is
+  // written (there is no modal window, the progress is shown in the
+  // status bar). The document is locked only to create the snapshot,
+  // and then to mark it as saved when the file is written.
+  class BackgroundSave : public ui::Timer {
+  public:
+    // Starts saving the given document with the given file name. It
+    // must be called from the main thread with the document locked to
+    // read (the lock can be released when this function returns).
+    static void start(Context* context, const Document* document,
+                      const base::string& filename, bool markAsSaved);
+
+    // Waits the background saves of the given document (or of all
+    // documents if it is NULL) to finish, e.g. before closing it.
+    static void wait(const Document* document = NULL);
+
+    ~BackgroundSave();
+
+  protected:
+    void onTick() OVERRIDE;
+
+  private:
+    BackgroundSave(Context* context, const Document* document,
+                   const base::string& filename, bool markAsSaved);
+
+    bool finish();
+
+    static void thread_proc(BackgroundSave* self);
+
+    Context* m_context;
+    DocumentId m_documentId;
+    base::string m_filename;
+    bool m_markAsSaved;
+    base::UniquePtr<DocumentSnapshot> m_snapshot;
+    base::UniquePtr<FileOp> m_fop;
+    base::UniquePtr<base::thread> m_thread;
+    Progress* m_progress;
+
+    DISABLE_COPYING(BackgroundSave);
+  };
+
+} // namespace app
+
+#endif
@@ -69,6 +69,8 @@ void ChangePixelFormatCommand::onLoadParams(Params* params)
   std::string dithering = params->get("dithering");
   if (dithering == "ordered")
     m_dithering = DITHERING_ORDERED;
+  else if (dithering == "error-diffusion")
+    m_dithering = DITHERING_ERROR_DIFFUSION;
   else
     m_dithering = DITHERING_NONE;
 }
@@ -81,7 +83,7 @@ bool ChangePixelFormatCommand::onEnabled(Context* context)
   if (sprite != NULL &&
       sprite->getPixelFormat() == IMAGE_INDEXED &&
       m_format == IMAGE_INDEXED &&
-      m_dithering == DITHERING_ORDERED)
+      m_dithering != DITHERING_NONE)
     return false;
 
   return sprite != NULL;
@@ -95,7 +97,7 @@ bool ChangePixelFormatCommand::onChecked(Context* context)
   if (sprite != NULL &&
       sprite->getPixelFormat() == IMAGE_INDEXED &&
       m_format == IMAGE_INDEXED &&
-      m_dithering == DITHERING_ORDERED)
+      m_dithering != DITHERING_NONE)
     return false;
 
   return
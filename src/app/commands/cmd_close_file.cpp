@@ -21,6 +21,7 @@
 #endif
 
 #include "app/app.h"
+#include "app/background_save.h"
 #include "app/commands/command.h"
 #include "app/commands/commands.h"
 #include "app/context_access.h"
@@ -167,6 +168,10 @@ static bool close_active_document(Context* context)
         CommandsModule::instance()->getCommandByName(CommandId::SaveFile);
       context->executeCommand(save_command);
 
+      // The document is saved in background, we need the result to
+      // know if it was saved.
+      BackgroundSave::wait(closedDocument);
+
       try_again = true;
     }
     else
@@ -21,6 +21,7 @@
 #endif
 
 #include "app/app.h"
+#include "app/background_save.h"
 #include "app/commands/command.h"
 #include "app/context.h"
 #include "app/document.h"
@@ -47,6 +48,10 @@ ExitCommand::ExitCommand()
 
 void ExitCommand::onExecute(Context* context)
 {
+  // Finish the files that are being saved (so they aren't modified
+  // anymore).
+  BackgroundSave::wait();
+
   const Documents& docs = context->getDocuments();
   bool modifiedFiles = false;
 
@@ -20,6 +20,7 @@
 #include "config.h"
 #endif
 
+#include "app/background_save.h"
 #include "app/commands/command.h"
 #include "app/commands/commands.h"
 #include "app/context.h"
@@ -239,6 +240,7 @@ protected:
             ->getCommandByName(CommandId::SaveFileAs);
 
           m_context->executeCommand(command);
+          BackgroundSave::wait(m_document);
         }
 
         // If the command was cancelled, we go back to the original
@@ -253,6 +255,7 @@ protected:
             ->getCommandByName(CommandId::SaveFile);
 
           m_context->executeCommand(command);
+          BackgroundSave::wait(m_document);
         }
 
         // Same case as "Save As"
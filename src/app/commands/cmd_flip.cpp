@@ -32,10 +32,13 @@
 #include "raster/algorithm/flip_image.h"
 #include "raster/cel.h"
 #include "raster/image.h"
+#include "raster/layer.h"
 #include "raster/mask.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <set>
+
 namespace app {
 
 FlipCommand::FlipCommand()
@@ -80,6 +83,10 @@ void FlipCommand::onExecute(Context* context)
                                      "Flip Canvas Vertical"));
 
     if (m_flipMask) {
+      // The image of a linked cel is flipped in a copy
+      if (writer.cel() && writer.layer()->isImage())
+        api.unlinkCel(static_cast<LayerImage*>(writer.layer()), writer.cel());
+
       int x, y;
       Image* image = writer.image(&x, &y);
       if (!image)
@@ -140,6 +147,9 @@ void FlipCommand::onExecute(Context* context)
       CelList cels;
       sprite->getCels(cels);
 
+      // Images already flipped (linked cels share the same image)
+      std::set<int> flippedImages;
+
       // for each cel...
       for (CelIterator it = cels.begin(); it != cels.end(); ++it) {
         Cel* cel = *it;
@@ -154,7 +164,8 @@ void FlipCommand::onExecute(Context* context)
             sprite->getHeight() - image->getHeight() - cel->getY():
             cel->getY()));
 
-        api.flipImage(image, image->getBounds(), m_flipType);
+        if (flippedImages.insert(cel->getImage()).second)
+          api.flipImage(image, image->getBounds(), m_flipType);
       }
     }
 
@@ -102,8 +102,13 @@ void MergeDownLayerCommand::onExecute(Context* context)
     else
       src_image = NULL;
 
-    if (dst_cel != NULL)
+    if (dst_cel != NULL) {
+      // Linked cels are merged in their own copy of the image
+      if (src_image != NULL)
+        document->getApi().unlinkCel(static_cast<LayerImage*>(dst_layer), dst_cel);
+
       dst_image.reset(sprite->getStock()->getImage(dst_cel->getImage()));
+    }
 
     // With source image?
     if (src_image != NULL) {
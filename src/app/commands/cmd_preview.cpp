@@ -116,7 +116,9 @@ void PreviewCommand::onExecute(Context* context)
   int delta_x = 0;
   int delta_y = 0;
 
-  int zoom = editor->getZoom();
+  // The preview is rendered with the original images (it cannot be
+  // zoomed out)
+  int zoom = MAX(0, editor->getZoom());
   int w = sprite->getWidth() << zoom;
   int h = sprite->getHeight() << zoom;
 
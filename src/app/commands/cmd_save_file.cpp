@@ -21,87 +21,22 @@
 #endif
 
 #include "app/app.h"
+#include "app/background_save.h"
 #include "app/commands/command.h"
-#include "app/console.h"
 #include "app/context_access.h"
 #include "app/file/file.h"
 #include "app/file_selector.h"
-#include "app/job.h"
 #include "app/modules/gui.h"
-#include "app/recent_files.h"
-#include "app/ui/status_bar.h"
-#include "base/bind.h"
 #include "base/fs.h"
 #include "base/path.h"
-#include "base/thread.h"
-#include "base/unique_ptr.h"
 #include "raster/sprite.h"
 #include "ui/ui.h"
 
-static const int kMonitoringPeriod = 100;
-
 namespace app {
 
-class SaveFileJob : public Job, public IFileOpProgress {
-public:
-  SaveFileJob(FileOp* fop)
-    : Job("Saving file")
-    , m_fop(fop)
-  {
-  }
-
-  void showProgressWindow() {
-    startJob();
-    fop_stop(m_fop);
-  }
-
-private:
-
-  // Thread to do the hard work: save the file to the disk.
-  virtual void onJob() OVERRIDE {
-    try {
-      fop_operate(m_fop, this);
-    }
-    catch (const std::exception& e) {
-      fop_error(m_fop, "Error saving file:\n%s", e.what());
-    }
-    fop_done(m_fop);
-  }
-
-  virtual void ackFileOpProgress(double progress) OVERRIDE {
-    jobProgress(progress);
-  }
-
-  FileOp* m_fop;
-};
-
-static void save_document_in_background(Document* document, bool mark_as_saved)
-{
-  base::UniquePtr<FileOp> fop(fop_to_save_document(document));
-  if (!fop)
-    return;
-
-  SaveFileJob job(fop);
-  job.showProgressWindow();
-
-  if (fop->has_error()) {
-    Console console;
-    console.printf(fop->error.c_str());
-  }
-  else {
-    App::instance()->getRecentFiles()->addRecentFile(document->getFilename().c_str());
-    if (mark_as_saved)
-      document->markAsSaved();
-
-    StatusBar::instance()
-      ->setStatusText(2000, "File %s, saved.",
-                      base::get_file_name(document->getFilename()).c_str());
-  }
-}
-
 //////////////////////////////////////////////////////////////////////
 
-static void save_as_dialog(const ContextReader& reader, const char* dlg_title, bool mark_as_saved)
+static void save_as_dialog(Context* context, const ContextReader& reader, const char* dlg_title, bool mark_as_saved)
 {
   const Document* document = reader.document();
   char exts[4096];
@@ -137,18 +72,16 @@ static void save_as_dialog(const ContextReader& reader, const char* dlg_title, b
     // "no": we must back to select other file-name
   }
 
-  {
+  // Change the document file name (a copy of the document is saved
+  // without changing its file name)
+  if (mark_as_saved) {
     ContextWriter writer(reader);
-    Document* documentWriter = writer.document();
-
-    // Change the document file name
-    documentWriter->setFilename(filename.c_str());
-
-    // Save the document
-    save_document_in_background(documentWriter, mark_as_saved);
-
-    update_screen_for_document(documentWriter);
+    writer.document()->setFilename(filename.c_str());
+    update_screen_for_document(writer.document());
   }
+
+  // Save the document
+  BackgroundSave::start(context, reader.document(), filename, mark_as_saved);
 }
 
 class SaveFileCommand : public Command {
@@ -185,17 +118,13 @@ void SaveFileCommand::onExecute(Context* context)
   // If the document is associated to a file in the file-system, we can
   // save it directly without user interaction.
   if (document->isAssociatedToFile()) {
-    ContextWriter writer(reader);
-    Document* documentWriter = writer.document();
-
-    save_document_in_background(documentWriter, true);
-    update_screen_for_document(documentWriter);
+    BackgroundSave::start(context, document, document->getFilename(), true);
   }
   // If the document isn't associated to a file, we must to show the
   // save-as dialog to the user to select for first time the file-name
   // for this document.
   else {
-    save_as_dialog(reader, "Save File", true);
+    save_as_dialog(context, reader, "Save File", true);
   }
 }
 
@@ -224,7 +153,7 @@ bool SaveFileAsCommand::onEnabled(Context* context)
 void SaveFileAsCommand::onExecute(Context* context)
 {
   const ContextReader reader(context);
-  save_as_dialog(reader, "Save As", true);
+  save_as_dialog(context, reader, "Save As", true);
 }
 
 class SaveFileCopyAsCommand : public Command {
@@ -252,18 +181,9 @@ bool SaveFileCopyAsCommand::onEnabled(Context* context)
 void SaveFileCopyAsCommand::onExecute(Context* context)
 {
   const ContextReader reader(context);
-  const Document* document(reader.document());
-  base::string old_filename = document->getFilename();
 
   // show "Save As" dialog
-  save_as_dialog(reader, "Save Copy As", false);
-
-  // Restore the file name.
-  {
-    ContextWriter writer(reader);
-    writer.document()->setFilename(old_filename.c_str());
-    update_screen_for_document(writer.document());
-  }
+  save_as_dialog(context, reader, "Save Copy As", false);
 }
 
 Command* CommandFactory::createSaveFileCommand()
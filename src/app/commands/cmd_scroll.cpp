@@ -27,6 +27,7 @@
 #include "app/settings/document_settings.h"
 #include "app/settings/settings.h"
 #include "app/ui/editor/editor.h"
+#include "app/util/render.h"
 #include "ui/view.h"
 
 namespace app {
@@ -116,13 +117,13 @@ void ScrollCommand::onExecute(Context* context)
       pixels = gridBounds.h;
       break;
     case ZoomedPixel:
-      pixels = 1 << current_editor->getZoom();
+      pixels = MAX(1, apply_zoom(1, current_editor->getZoom()));
       break;
     case ZoomedTileWidth:
-      pixels = gridBounds.w << current_editor->getZoom();
+      pixels = MAX(1, apply_zoom(gridBounds.w, current_editor->getZoom()));
       break;
     case ZoomedTileHeight:
-      pixels = gridBounds.h << current_editor->getZoom();
+      pixels = MAX(1, apply_zoom(gridBounds.h, current_editor->getZoom()));
       break;
     case ViewportWidth:
       pixels = vp.h;
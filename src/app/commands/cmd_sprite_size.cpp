@@ -43,6 +43,7 @@
 #include "ui/ui.h"
 
 #include <allegro/unicode.h>
+#include <set>
 
 #define PERC_FORMAT     "%.1f"
 
@@ -89,6 +90,9 @@ protected:
     CelList cels;
     m_sprite->getCels(cels);
 
+    // Images already resized (linked cels share the same image)
+    std::set<int> resizedImages;
+
     // For each cel...
     int progress = 0;
     for (CelIterator it = cels.begin(); it != cels.end(); ++it, ++progress) {
@@ -99,7 +103,7 @@ protected:
 
       // Get cel's image
       Image* image = m_sprite->getStock()->getImage(cel->getImage());
-      if (!image)
+      if (!image || !resizedImages.insert(cel->getImage()).second)
         continue;
 
       // Resize the image
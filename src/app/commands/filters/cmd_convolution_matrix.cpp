@@ -138,6 +138,7 @@ private:
     SharedPtr<ConvolutionMatrix> matrix = m_stock.getByName(selected->getText().c_str());
     Target newTarget = matrix->getDefaultTarget();
 
+    cancelPreview();
     m_filter.setMatrix(matrix);
 
     setNewTarget(newTarget);
@@ -71,6 +71,7 @@ public:
 private:
   void onSizeChange()
   {
+    cancelPreview();
     m_filter.setSize(m_widthEntry->getTextInt(),
                      m_heightEntry->getTextInt());
     restartPreview();
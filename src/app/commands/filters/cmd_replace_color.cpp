@@ -94,18 +94,21 @@ public:
 protected:
   void onFromChange(const app::Color& color)
   {
+    cancelPreview();
     m_filter.setFrom(color);
     restartPreview();
   }
 
   void onToChange(const app::Color& color)
   {
+    cancelPreview();
     m_filter.setTo(color);
     restartPreview();
   }
 
   void onToleranceChange()
   {
+    cancelPreview();
     m_filter.setTolerance(m_toleranceSlider->getValue());
     restartPreview();
   }
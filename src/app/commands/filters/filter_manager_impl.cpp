@@ -23,17 +23,21 @@
 #include "app/commands/filters/filter_manager_impl.h"
 
 #include "app/context_access.h"
+#include "app/document_api.h"
 #include "app/ini_file.h"
 #include "app/modules/editors.h"
 #include "app/ui/editor/editor.h"
 #include "app/undo_transaction.h"
 #include "app/undoers/image_area.h"
+#include "app/util/render.h"
 #include "filters/filter.h"
 #include "raster/cel.h"
 #include "raster/image.h"
 #include "raster/images_collector.h"
 #include "raster/layer.h"
 #include "raster/mask.h"
+#include "raster/primitives.h"
+#include "raster/rgbmap.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
 #include "ui/manager.h"
@@ -59,6 +63,7 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   int offset_x, offset_y;
 
   m_src = NULL;
+  m_rgbMap = NULL;
   m_row = 0;
   m_offset_x = 0;
   m_offset_y = 0;
@@ -71,6 +76,8 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
     throw NoImageException();
 
   init(m_location.layer(), image, offset_x, offset_y);
+
+  m_previewDst.reset(Image::createCopy(m_dst));
 }
 
 FilterManagerImpl::~FilterManagerImpl()
@@ -104,6 +111,8 @@ void FilterManagerImpl::begin()
 
   m_row = 0;
   m_mask = (document->isMaskVisible() ? document->getMask(): NULL);
+  m_rgbMap = m_location.sprite()->getRgbMap(m_location.frame());
+  m_previewSrc.reset(NULL);
 
   updateMask(m_mask, m_src);
 }
@@ -124,6 +133,19 @@ void FilterManagerImpl::beginForPreview()
   m_row = 0;
   m_mask = m_preview_mask;
 
+  // The preview thread reads a copy-on-write copy of the source image
+  // (so it reads the same pixels even if the image is modified while
+  // the preview is calculated).
+  m_previewSrc.reset(Image::createCopyOnWrite(m_src));
+
+  // The preview is calculated in a background thread, so it cannot
+  // use the sprite's RgbMap (which is filled on demand and used by the
+  // main thread at the same time).
+  if (!m_previewRgbMap)
+    m_previewRgbMap.reset(new RgbMap);
+  m_previewRgbMap->regenerate(getPalette());
+  m_rgbMap = m_previewRgbMap;
+
   {
     Editor* editor = current_editor;
     Sprite* sprite = m_location.sprite();
@@ -247,7 +269,17 @@ void FilterManagerImpl::applyToTarget()
   for (ImagesCollector::ItemsIterator it = images.begin();
        it != images.end() && !cancelled;
        ++it) {
-    applyToImage(it->layer(), it->image(), it->cel()->getX(), it->cel()->getY());
+    Cel* cel = it->cel();
+    Image* image = it->image();
+
+    // Linked cels are modified in their own copy of the image
+    LayerImage* layer = static_cast<LayerImage*>(it->layer());
+    if (layer->isLinkedCel(cel)) {
+      writer.document()->getApi().unlinkCel(layer, cel);
+      image = writer.sprite()->getStock()->getImage(cel->getImage());
+    }
+
+    applyToImage(layer, image, cel->getX(), cel->getY());
 
     // Is there a delegate to know if the process was cancelled by the user?
     if (m_progressDelegate)
@@ -260,17 +292,19 @@ void FilterManagerImpl::applyToTarget()
   undo.commit();
 }
 
-void FilterManagerImpl::flush()
+void FilterManagerImpl::flush(int fromRow, int toRow)
 {
-  if (m_row >= 0) {
-    gfx::Rect rect;
+  if (fromRow < toRow) {
+    copy_image(m_previewDst, m_dst,
+               gfx::Region(gfx::Rect(m_x, m_y+fromRow, m_w, toRow-fromRow)));
 
     Editor* editor = current_editor;
-    editor->editorToScreen(m_x+m_offset_x,
-                           m_y+m_offset_y+m_row-1,
-                           &rect.x, &rect.y);
-    rect.w = (m_w << editor->getZoom());
-    rect.h = (1 << editor->getZoom());
+    gfx::Rect rect = apply_zoom(gfx::Rect(m_x+m_offset_x,
+                                          m_y+m_offset_y+fromRow,
+                                          m_w, toRow-fromRow), editor->getZoom());
+    int x, y;
+    editor->editorToScreen(0, 0, &x, &y);
+    rect.offset(x, y);
 
     gfx::Region reg1(rect);
     gfx::Region reg2;
@@ -283,11 +317,13 @@ void FilterManagerImpl::flush()
 
 const void* FilterManagerImpl::getSourceAddress()
 {
-  return m_src->getPixelAddress(m_x, m_row+m_y);
+  return getSourceImage()->getPixelAddress(m_x, m_row+m_y);
 }
 
 void* FilterManagerImpl::getDestinationAddress()
 {
+  // The filter writes the row directly
+  m_dst->invalidateRows(m_row+m_y, 1);
   return m_dst->getPixelAddress(m_x, m_row+m_y);
 }
 
@@ -312,7 +348,8 @@ Palette* FilterManagerImpl::getPalette()
 
 RgbMap* FilterManagerImpl::getRgbMap()
 {
-  return m_location.sprite()->getRgbMap(m_location.frame());
+  ASSERT(m_rgbMap != NULL);
+  return m_rgbMap;
 }
 
 void FilterManagerImpl::init(const Layer* layer, Image* image, int offset_x, int offset_y)
@@ -34,6 +34,7 @@ namespace raster {
   class Image;
   class Layer;
   class Mask;
+  class RgbMap;
   class Sprite;
 }
 
@@ -96,8 +97,16 @@ namespace app {
     Layer* getLayer() { return m_location.layer(); }
     Image* getDestinationImage() const { return m_dst; }
 
-    // Updates the current editor to show the progress of the preview.
-    void flush();
+    // Image shown in the editor as preview. The preview thread writes
+    // in the destination image, and the calculated rows are copied to
+    // this one by flush() (so the editor never paints a row that is
+    // being modified).
+    Image* getPreviewImage() const { return m_previewDst; }
+
+    // Copies the rows in the [fromRow, toRow) range (already
+    // calculated by the preview thread) to the preview image and
+    // updates the current editor to show them.
+    void flush(int fromRow, int toRow);
 
     // FilterManager implementation
     const void* getSourceAddress();
@@ -106,7 +115,7 @@ namespace app {
     Target getTarget() { return m_target; }
     FilterIndexedData* getIndexedData() { return this; }
     bool skipPixel();
-    const Image* getSourceImage() { return m_src; }
+    const Image* getSourceImage() { return (m_previewSrc ? m_previewSrc.get(): m_src); }
     int getX() { return m_x; }
     int getY() { return m_y+m_row; }
 
@@ -124,7 +133,11 @@ namespace app {
     DocumentLocation m_location;
     Filter* m_filter;
     Image* m_src;
+    base::UniquePtr<Image> m_previewSrc;    // Copy of m_src read by the preview thread
     base::UniquePtr<Image> m_dst;
+    base::UniquePtr<Image> m_previewDst;
+    RgbMap* m_rgbMap;                       // RgbMap used by the filter (resolved in the main thread)
+    base::UniquePtr<RgbMap> m_previewRgbMap; // Own RgbMap for the preview thread
     int m_row;
     int m_x, m_y, m_w, m_h;
     int m_offset_x, m_offset_y;
@@ -23,21 +23,33 @@
 #include "app/commands/filters/filter_preview.h"
 
 #include "app/commands/filters/filter_manager_impl.h"
+#include "app/console.h"
+#include "app/util/render.h"
+#include "base/exception.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
 #include "raster/sprite.h"
 #include "ui/manager.h"
 #include "ui/message.h"
 #include "ui/widget.h"
-#include "app/util/render.h"
 
 namespace app {
 
 using namespace ui;
 using namespace filters;
 
+// Milliseconds between each redraw of the calculated preview rows.
+static const int kFlushPeriod = 20;
+
 FilterPreview::FilterPreview(FilterManagerImpl* filterMgr)
   : Widget(kGenericWidget)
   , m_filterMgr(filterMgr)
-  , m_timer(1, this)
+  , m_timer(kFlushPeriod, this)
+  , m_row(0)
+  , m_flushedRow(0)
+  , m_done(false)
+  , m_cancelled(false)
 {
   setVisible(false);
 }
@@ -49,9 +61,10 @@ FilterPreview::~FilterPreview()
 
 void FilterPreview::stop()
 {
-  if (m_timer.isRunning()) {
+  if (m_thread) {
     ASSERT(m_filterMgr != NULL);
 
+    cancelPreview();
     m_filterMgr->end();
   }
 
@@ -61,10 +74,35 @@ void FilterPreview::stop()
 
 void FilterPreview::restartPreview()
 {
+  cancelPreview();
+
   m_filterMgr->beginForPreview();
+
+  m_row = 0;
+  m_flushedRow = 0;
+  m_done = false;
+  m_cancelled = false;
+  m_error.clear();
+  m_thread.reset(new base::thread(&FilterPreview::thread_proxy, this));
+
   m_timer.start();
 }
 
+void FilterPreview::cancelPreview()
+{
+  if (m_thread) {
+    {
+      base::scoped_lock lock(m_mutex);
+      m_cancelled = true;
+    }
+
+    m_thread->join();
+    m_thread.reset(NULL);
+  }
+
+  m_timer.stop();
+}
+
 FilterManagerImpl* FilterPreview::getFilterManager() const
 {
   return m_filterMgr;
@@ -76,27 +114,100 @@ bool FilterPreview::onProcessMessage(Message* msg)
 
     case kOpenMessage:
       RenderEngine::setPreviewImage(m_filterMgr->getLayer(),
-                                    m_filterMgr->getDestinationImage());
+                                    m_filterMgr->getPreviewImage());
       break;
 
     case kCloseMessage:
       RenderEngine::setPreviewImage(NULL, NULL);
 
-      // Stop the preview timer.
-      m_timer.stop();
+      // Stop the preview thread and timer.
+      cancelPreview();
       break;
 
     case kTimerMessage:
-      if (m_filterMgr) {
-        if (m_filterMgr->applyStep())
-          m_filterMgr->flush();
-        else
-          m_timer.stop();
-      }
+      if (m_filterMgr)
+        onFlush();
       break;
   }
 
   return Widget::onProcessMessage(msg);
 }
 
+// Copies and redraws the rows calculated by the background thread
+// since the last flush.
+//
+// [main thread]
+//
+void FilterPreview::onFlush()
+{
+  // The preview could be cancelled after this timer message was
+  // enqueued.
+  if (!m_thread)
+    return;
+
+  bool done;
+  std::string error;
+  {
+    // The finished rows are copied from the destination image (where
+    // the background thread writes) to the preview image (which is
+    // painted by the editor) while the thread cannot advance.
+    base::scoped_lock lock(m_mutex);
+    done = m_done;
+    error = m_error;
+
+    if (m_flushedRow < m_row) {
+      m_filterMgr->flush(m_flushedRow, m_row);
+      m_flushedRow = m_row;
+    }
+  }
+
+  if (done) {
+    m_thread->join();
+    m_thread.reset(NULL);
+    m_timer.stop();
+
+    // The filter failed in the background thread
+    if (!error.empty())
+      Console::showException(base::Exception(error));
+  }
+}
+
+// Calculates the preview row by row until all rows are calculated or
+// the preview is cancelled. If the filter throws an exception, the
+// preview is stopped and the error is shown in the main thread (see
+// onFlush()).
+//
+// [preview thread]
+//
+void FilterPreview::applyFilterInBackground()
+{
+  std::string error;
+
+  try {
+    for (;;) {
+      {
+        base::scoped_lock lock(m_mutex);
+        if (m_cancelled)
+          break;
+      }
+
+      if (!m_filterMgr->applyStep())
+        break;
+
+      base::scoped_lock lock(m_mutex);
+      ++m_row;
+    }
+  }
+  catch (const std::exception& e) {
+    error = e.what();
+  }
+  catch (...) {
+    error = "Unknown error applying the filter";
+  }
+
+  base::scoped_lock lock(m_mutex);
+  m_error = error;
+  m_done = true;
+}
+
 } // namespace app
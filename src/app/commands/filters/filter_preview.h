@@ -20,14 +20,26 @@
 #define APP_COMMANDS_FILTERS_FILTER_PREVIEW_H_INCLUDED
 
 #include "base/compiler_specific.h"
+#include "base/mutex.h"
+#include "base/unique_ptr.h"
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <string>
+
+namespace base {
+  class thread;
+}
+
 namespace app {
 
   class FilterManagerImpl;
 
   // Invisible widget to control a effect-preview in the current editor.
+  //
+  // The preview is calculated in a background thread (so expensive
+  // filters don't block the user interface), and the timer of this
+  // widget is used to redraw the rows that are already calculated.
   class FilterPreview : public ui::Widget {
   public:
     FilterPreview(FilterManagerImpl* filterMgr);
@@ -35,14 +47,35 @@ namespace app {
 
     void stop();
     void restartPreview();
+
+    // Cancels the preview in progress and waits the background
+    // thread. It must be called before modifying the filter
+    // parameters.
+    void cancelPreview();
+
     FilterManagerImpl* getFilterManager() const;
 
   protected:
     bool onProcessMessage(ui::Message* msg) OVERRIDE;
 
   private:
+    void onFlush();
+    void applyFilterInBackground();
+
+    static void thread_proxy(void* data) {
+      FilterPreview* filterPreview = (FilterPreview*)data;
+      filterPreview->applyFilterInBackground();
+    }
+
     FilterManagerImpl* m_filterMgr;
     ui::Timer m_timer;
+    base::UniquePtr<base::thread> m_thread;
+    base::mutex m_mutex;      // Mutex to access to 'row', 'done' and 'cancelled' fields in different threads (and to flush the calculated rows).
+    int m_row;                // Number of rows calculated by the background thread.
+    int m_flushedRow;         // Number of rows already flushed to the editor.
+    bool m_done;              // Were all rows calculated?
+    bool m_cancelled;         // Must the background thread stop?
+    std::string m_error;      // Message of the exception thrown by the filter in the background thread.
   };
 
 } // namespace app
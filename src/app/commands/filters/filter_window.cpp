@@ -131,8 +131,15 @@ void FilterWindow::restartPreview()
     m_preview.restartPreview();
 }
 
+void FilterWindow::cancelPreview()
+{
+  m_preview.cancelPreview();
+}
+
 void FilterWindow::setNewTarget(Target target)
 {
+  cancelPreview();
+
   m_filterMgr->setTarget(target);
   m_targetButton.setTarget(target);
 }
@@ -156,6 +163,7 @@ void FilterWindow::onShowPreview(Event& ev)
 void FilterWindow::onTargetButtonChange()
 {
   // Change the targets in the filter manager and restart the filter preview.
+  cancelPreview();
   m_filterMgr->setTarget(m_targetButton.getTarget());
   restartPreview();
 }
@@ -166,6 +174,7 @@ void FilterWindow::onTiledChange()
 
   // Call derived class implementation of setupTiledMode() so the
   // filter is modified.
+  cancelPreview();
   setupTiledMode(m_tiledCheck->isSelected() ? TILED_BOTH: TILED_NONE);
 
   // Restart the preview.
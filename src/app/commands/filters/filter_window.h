@@ -54,6 +54,11 @@ namespace app {
     // method each time the user modifies parameters of the Filter.
     void restartPreview();
 
+    // Cancels the preview in progress. As the preview is calculated
+    // in a background thread, you must call this method before
+    // modifying parameters of the Filter (then call restartPreview()).
+    void cancelPreview();
+
   protected:
     // Changes the target buttons. Used by convolution matrix filter
     // which specified different targets for each matrix.
@@ -32,11 +32,14 @@
 #include "app/undoers/add_image.h"
 #include "app/undoers/add_layer.h"
 #include "app/util/boundary.h"
+#include "app/util/mipmap_cache.h"
+#include "app/util/render_cache.h"
 #include "base/memory.h"
 #include "base/mutex.h"
 #include "base/scoped_lock.h"
 #include "base/unique_ptr.h"
 #include "raster/cel.h"
+#include "raster/image.h"
 #include "raster/layer.h"
 #include "raster/mask.h"
 #include "raster/palette.h"
@@ -62,6 +65,8 @@ Document::Document(Sprite* sprite)
     // Extra cel
   , m_extraCel(NULL)
   , m_extraImage(NULL)
+  , m_renderCache(new RenderCache)
+  , m_mipmapCache(new MipmapCache)
   // Mask
   , m_mask(new Mask())
   , m_maskVisible(true)
@@ -144,16 +149,60 @@ void Document::addSprite(Sprite* sprite)
   notifyObservers<DocumentEvent&>(&DocumentObserver::onAddSprite, ev);
 }
 
+// Marks as modified the rows of the stock images used by "layer"
+// touched by the given region (or all images if "layer" is NULL), so
+// their hashes are calculated again (see Image::getHash()).
+static void invalidate_images_content(Sprite* sprite, const Layer* layer, const gfx::Region& region)
+{
+  Stock* stock = sprite->getStock();
+
+  if (!layer) {
+    for (int i=0; i<stock->size(); ++i) {
+      Image* image = stock->getImage(i);
+      if (image)
+        image->invalidateContent();
+    }
+    return;
+  }
+
+  if (!layer->isImage())
+    return;
+
+  gfx::Rect bounds = region.getBounds();
+  const LayerImage* layerImage = static_cast<const LayerImage*>(layer);
+  CelConstIterator it = layerImage->getCelBegin();
+  CelConstIterator end = layerImage->getCelEnd();
+
+  for (; it != end; ++it) {
+    const Cel* cel = *it;
+    Image* image = stock->getImage(cel->getImage());
+    if (image)
+      image->invalidateRows(bounds.y - cel->getY(), bounds.h);
+  }
+}
+
 void Document::notifyGeneralUpdate()
 {
+  // Anything could be changed, so all cached tiles must be rendered again.
+  m_renderCache->invalidate();
+  m_mipmapCache->invalidate();
+  invalidate_images_content(m_sprite, NULL, gfx::Region());
+
   DocumentEvent ev(this);
   notifyObservers<DocumentEvent&>(&DocumentObserver::onGeneralUpdate, ev);
 }
 
-void Document::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region)
+void Document::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, Layer* layer)
 {
+  // The images content is invalidated first so the mipmap cache
+  // knows the version of the images that includes this modification.
+  invalidate_images_content(sprite, layer, region);
+  m_renderCache->invalidateRegion(layer, region);
+  m_mipmapCache->invalidateRegion(layer, region);
+
   DocumentEvent ev(this);
   ev.sprite(sprite);
+  ev.layer(layer);
   ev.region(region);
   notifyObservers<DocumentEvent&>(&DocumentObserver::onSpritePixelsModified, ev);
 }
@@ -210,6 +259,17 @@ void Document::markAsSaved()
   m_associated_to_file = true;
 }
 
+void Document::markAsSaving()
+{
+  m_undo->markSavingState();
+}
+
+void Document::markSavingAsSaved()
+{
+  m_undo->markSavingStateAsSaved();
+  m_associated_to_file = true;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Loaded options from file
 
@@ -262,6 +322,28 @@ void Document::generateMaskBoundaries(Mask* mask)
   }
 }
 
+void Document::setMaskBoundaries(const BoundSeg* seg, int nseg, const gfx::Point& origin)
+{
+  if (m_bound.seg) {
+    base_free(m_bound.seg);
+    m_bound.seg = NULL;
+    m_bound.nseg = 0;
+  }
+
+  if (nseg > 0) {
+    m_bound.seg = (BoundSeg*)base_malloc(sizeof(BoundSeg) * nseg);
+    m_bound.nseg = nseg;
+
+    for (int c=0; c<nseg; c++) {
+      m_bound.seg[c] = seg[c];
+      m_bound.seg[c].x1 += origin.x;
+      m_bound.seg[c].y1 += origin.y;
+      m_bound.seg[c].x2 += origin.x;
+      m_bound.seg[c].y2 += origin.y;
+    }
+  }
+}
+
 //////////////////////////////////////////////////////////////////////
 // Extra Cel (it is used to draw pen preview, pixels in movement, etc.)
 
@@ -54,6 +54,8 @@ namespace app {
   class DocumentObserver;
   class DocumentUndo;
   class FormatOptions;
+  class MipmapCache;
+  class RenderCache;
   struct BoundSeg;
 
   using namespace raster;
@@ -101,7 +103,7 @@ namespace app {
     // Notifications
 
     void notifyGeneralUpdate();
-    void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region);
+    void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, Layer* layer = NULL);
     void notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer);
     void notifyCelMoved(Layer* fromLayer, FrameNumber fromFrame, Layer* toLayer, FrameNumber toFrame);
     void notifyCelCopied(Layer* fromLayer, FrameNumber fromFrame, Layer* toLayer, FrameNumber toFrame);
@@ -116,6 +118,13 @@ namespace app {
     bool isAssociatedToFile() const;
     void markAsSaved();
 
+    // Records the current state as the one that is being saved in
+    // background (from a DocumentSnapshot), and then marks that state
+    // as saved when the file is written (changes done in the meantime
+    // keep the document modified).
+    void markAsSaving();
+    void markSavingAsSaved();
+
     //////////////////////////////////////////////////////////////////////
     // Loaded options from file
 
@@ -129,6 +138,13 @@ namespace app {
 
     void generateMaskBoundaries(Mask* mask = NULL);
 
+    // Replaces the boundaries with a copy of the given segments
+    // (relative to the mask bitmap, as find_mask_boundary() returns
+    // them) displaced to the given mask origin. It can be used to
+    // avoid calculating the boundaries again for a mask that was
+    // just moved.
+    void setMaskBoundaries(const BoundSeg* seg, int nseg, const gfx::Point& origin);
+
     //////////////////////////////////////////////////////////////////////
     // Extra Cel (it is used to draw pen preview, pixels in movement, etc.)
 
@@ -137,6 +153,15 @@ namespace app {
     Cel* getExtraCel() const;
     Image* getExtraCelImage() const;
 
+    //////////////////////////////////////////////////////////////////////
+    // Render cache (flattened layers used by RenderEngine)
+
+    RenderCache* getRenderCache() const { return m_renderCache; }
+
+    // Reduced versions of the stock images (used by RenderEngine to
+    // render zoomed out sprites)
+    MipmapCache* getMipmapCache() const { return m_mipmapCache; }
+
     //////////////////////////////////////////////////////////////////////
     // Mask
 
@@ -229,6 +254,12 @@ namespace app {
     // Image of the extra cel.
     Image* m_extraImage;
 
+    // Tiles of flattened layers to render the sprite faster.
+    base::UniquePtr<RenderCache> m_renderCache;
+
+    // Reduced versions of the stock images for zoomed out views.
+    base::UniquePtr<MipmapCache> m_mipmapCache;
+
     // Current mask.
     base::UniquePtr<Mask> m_mask;
     bool m_maskVisible;
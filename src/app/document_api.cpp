@@ -43,6 +43,7 @@
 #include "app/undoers/remove_palette.h"
 #include "app/undoers/replace_image.h"
 #include "app/undoers/set_cel_frame.h"
+#include "app/undoers/set_cel_image.h"
 #include "app/undoers/set_cel_position.h"
 #include "app/undoers/set_frame_duration.h"
 #include "app/undoers/set_layer_flags.h"
@@ -56,6 +57,7 @@
 #include "app/undoers/set_sprite_size.h"
 #include "app/undoers/set_stock_pixel_format.h"
 #include "app/undoers/set_total_frames.h"
+#include "base/parallel_for.h"
 #include "base/unique_ptr.h"
 #include "raster/algorithm/flip_image.h"
 #include "raster/algorithm/shrink_bounds.h"
@@ -68,9 +70,11 @@
 #include "raster/mask.h"
 #include "raster/palette.h"
 #include "raster/quantization.h"
+#include "raster/rgbmap.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <vector>
 
 
 namespace app {
@@ -140,38 +144,104 @@ void DocumentApi::trimSprite(Sprite* sprite, int bgcolor)
     cropSprite(sprite, bounds, bgcolor);
 }
 
+namespace {
+
+  // Converts the images of a stock to other pixel format. With
+  // several workers, each one converts the images worker,
+  // worker+workers, etc. using its own RgbMap (the table of a RgbMap
+  // is filled on demand, so it cannot be shared between threads). With
+  // one worker, each image is converted in several threads.
+  class ConvertStockImagesTask {
+  public:
+    ConvertStockImagesTask(const Stock* stock, PixelFormat newFormat,
+                           DitheringMethod ditheringMethod,
+                           const RgbMap* rgbmap, const Palette* palette,
+                           bool hasBackgroundLayer, int workers)
+      : m_stock(stock), m_newImages(stock->size(), (Image*)NULL)
+      , m_newFormat(newFormat), m_ditheringMethod(ditheringMethod)
+      , m_rgbmap(rgbmap), m_palette(palette)
+      , m_hasBackgroundLayer(hasBackgroundLayer)
+      , m_workers(workers) {
+    }
+
+    ~ConvertStockImagesTask() {
+      for (size_t i=0; i<m_newImages.size(); ++i)
+        delete m_newImages[i];
+    }
+
+    Image* releaseImage(int i) {
+      Image* image = m_newImages[i];
+      m_newImages[i] = NULL;
+      return image;
+    }
+
+    void operator()(int worker) {
+      RgbMap workerRgbMap;
+      const RgbMap* rgbmap = m_rgbmap;
+      if (m_workers > 1) {
+        workerRgbMap.regenerate(m_palette);
+        rgbmap = &workerRgbMap;
+      }
+
+      for (int i=worker; i<m_stock->size(); i+=m_workers) {
+        const Image* old_image = m_stock->getImage(i);
+        if (!old_image)
+          continue;
+
+        m_newImages[i] = quantization::convert_pixel_format
+          (old_image, m_newFormat, m_ditheringMethod, rgbmap,
+           m_palette, m_hasBackgroundLayer, m_workers > 1 ? 1: 0);
+      }
+    }
+
+  private:
+    const Stock* m_stock;
+    std::vector<Image*> m_newImages;
+    PixelFormat m_newFormat;
+    DitheringMethod m_ditheringMethod;
+    const RgbMap* m_rgbmap;
+    const Palette* m_palette;
+    bool m_hasBackgroundLayer;
+    int m_workers;
+  };
+
+}
+
 void DocumentApi::setPixelFormat(Sprite* sprite, PixelFormat newFormat, DitheringMethod dithering_method)
 {
-  Image* old_image;
-  Image* new_image;
-  int c;
-
   if (sprite->getPixelFormat() == newFormat)
     return;
 
-  // Change pixel format of the stock of images.
-  if (undoEnabled())
-    m_undoers->pushUndoer(new undoers::SetStockPixelFormat(getObjects(), sprite->getStock()));
-
-  sprite->getStock()->setPixelFormat(newFormat);
-
   // TODO Review this, why we use the palette in frame 0?
   FrameNumber frame(0);
 
   // Use the rgbmap for the specified sprite
   const RgbMap* rgbmap = sprite->getRgbMap(frame);
 
-  for (c=0; c<sprite->getStock()->size(); c++) {
-    old_image = sprite->getStock()->getImage(c);
-    if (!old_image)
-      continue;
+  // Convert all images before modifying the sprite. If there are
+  // several images (e.g. frames of an animation) each image is
+  // converted in its own thread, in other case each image is
+  // converted in several threads.
+  Stock* stock = sprite->getStock();
+  int nthreads = base::thread::hardware_concurrency();
+  bool threadPerImage = (stock->size() >= nthreads);
+
+  int workers = (threadPerImage ? nthreads: 1);
+  ConvertStockImagesTask task(stock, newFormat, dithering_method, rgbmap,
+                              sprite->getPalette(frame),
+                              sprite->getBackgroundLayer() != NULL,
+                              workers);
+  base::parallel_for(0, workers, task, workers);
+
+  // Change pixel format of the stock of images.
+  if (undoEnabled())
+    m_undoers->pushUndoer(new undoers::SetStockPixelFormat(getObjects(), stock));
 
-    new_image = quantization::convert_pixel_format
-      (old_image, newFormat, dithering_method, rgbmap,
-       sprite->getPalette(frame),
-       sprite->getBackgroundLayer() != NULL);
+  stock->setPixelFormat(newFormat);
 
-    replaceStockImage(sprite, c, new_image);
+  for (int c=0; c<stock->size(); c++) {
+    if (stock->getImage(c))
+      replaceStockImage(sprite, c, task.releaseImage(c));
   }
 
   // Change sprite's pixel format.
@@ -511,20 +581,9 @@ void DocumentApi::removeCel(LayerImage* layer, Cel* cel)
   ev.cel(cel);
   m_document->notifyObservers<DocumentEvent&>(&DocumentObserver::onRemoveCel, ev);
 
-  // find if the image that use the cel to remove, is used by
-  // another cels
-  bool used = false;
-  for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame) {
-    Cel* it = layer->getCel(frame);
-    if (it && it != cel && it->getImage() == cel->getImage()) {
-      used = true;
-      break;
-    }
-  }
-
-  // if the image is only used by this cel,
+  // if the image is only used by this cel (it isn't a linked cel),
   // we can remove the image from the stock
-  if (!used)
+  if (!layer->isLinkedCel(cel))
     removeImageFromStock(sprite, cel->getImage());
 
   if (undoEnabled())
@@ -570,6 +629,24 @@ void DocumentApi::setCelPosition(Sprite* sprite, Cel* cel, int x, int y)
   m_document->notifyObservers<DocumentEvent&>(&DocumentObserver::onCelPositionChanged, ev);
 }
 
+void DocumentApi::unlinkCel(LayerImage* layer, Cel* cel)
+{
+  ASSERT(layer);
+  ASSERT(cel);
+
+  if (!layer->isLinkedCel(cel))
+    return;
+
+  Sprite* sprite = layer->getSprite();
+  Image* image = Image::createCopy(sprite->getStock()->getImage(cel->getImage()));
+  int imageIndex = addImageInStock(sprite, image);
+
+  if (undoEnabled())
+    m_undoers->pushUndoer(new undoers::SetCelImage(getObjects(), cel));
+
+  cel->setImage(imageIndex);
+}
+
 void DocumentApi::cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h, int bgcolor)
 {
   Image* cel_image = sprite->getStock()->getImage(cel->getImage());
@@ -680,8 +757,11 @@ void DocumentApi::cropLayer(Layer* layer, int x, int y, int w, int h, int bgcolo
   Sprite* sprite = layer->getSprite();
   CelIterator it = ((LayerImage*)layer)->getCelBegin();
   CelIterator end = ((LayerImage*)layer)->getCelEnd();
-  for (; it != end; ++it)
+  for (; it != end; ++it) {
+    // Each linked cel is cropped with its own position
+    unlinkCel(static_cast<LayerImage*>(layer), *it);
     cropCel(sprite, *it, x, y, w, h, bgcolor);
+  }
 }
 
 // Moves every frame in @a layer with the offset (@a dx, @a dy).
@@ -733,6 +813,8 @@ void DocumentApi::backgroundFromLayer(LayerImage* layer, int bgcolor)
 
   for (; it != end; ++it) {
     Cel* cel = *it;
+    unlinkCel(layer, cel);
+
     ASSERT((cel->getImage() > 0) &&
            (cel->getImage() < sprite->getStock()->size()));
 
@@ -832,6 +914,8 @@ void DocumentApi::flattenLayers(Sprite* sprite, int bgcolor)
 
     cel = background->getCel(frame);
     if (cel) {
+      unlinkCel(background, cel);
+
       cel_image = sprite->getStock()->getImage(cel->getImage());
       ASSERT(cel_image != NULL);
 
@@ -929,6 +1013,12 @@ Image* DocumentApi::getCelImage(Sprite* sprite, Cel* cel)
 // Clears the mask region in the current sprite with the specified background color.
 void DocumentApi::clearMask(Layer* layer, Cel* cel, int bgcolor)
 {
+  // Pixels of linked cels are cleared in a copy of the image (the cel
+  // is removed if the mask is not visible in a transparent layer).
+  if (cel && layer->isImage() &&
+      (m_document->isMaskVisible() || layer->isBackground()))
+    unlinkCel(static_cast<LayerImage*>(layer), cel);
+
   Image* image = getCelImage(layer->getSprite(), cel);
   if (!image)
     return;
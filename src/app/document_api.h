@@ -77,6 +77,7 @@ namespace app {
     void removeCel(LayerImage* layer, Cel* cel);
     void setCelFramePosition(Sprite* sprite, Cel* cel, FrameNumber frame);
     void setCelPosition(Sprite* sprite, Cel* cel, int x, int y);
+    void unlinkCel(LayerImage* layer, Cel* cel);
     void cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h, int bgcolor);
 
     // Layers API
@@ -23,23 +23,31 @@
 #include "app/document_exporter.h"
 
 #include "app/document.h"
+#include "app/console.h"
 #include "app/document_api.h"
 #include "app/file/file.h"
 #include "base/compiler_specific.h"
+#include "base/exception.h"
+#include "base/parallel_for.h"
+#include "base/thread.h"
 #include "base/path.h"
 #include "base/unique_ptr.h"
+#include "gfx/packing_rects.h"
 #include "gfx/size.h"
 #include "raster/cel.h"
 #include "raster/dithering_method.h"
 #include "raster/image.h"
 #include "raster/layer.h"
 #include "raster/palette.h"
+#include "raster/primitives.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <map>
 
 using namespace raster;
 
@@ -52,7 +60,8 @@ public:
     m_document(document),
     m_sprite(sprite),
     m_frame(frame),
-    m_filename(filename) {
+    m_filename(filename),
+    m_original(NULL) {
   }
 
   Document* document() const { return m_document; }
@@ -63,6 +72,11 @@ public:
   const gfx::Rect& trimmedBounds() const { return m_trimmedBounds; }
   const gfx::Rect& inTextureBounds() const { return m_inTextureBounds; }
 
+  // Returns the sample with the same pixels as this one (which is
+  // not rendered in the texture again), or NULL if this sample is
+  // not a duplicate.
+  const Sample* original() const { return m_original; }
+
   bool trimmed() const {
     return m_trimmedBounds.x > 0
       || m_trimmedBounds.y > 0
@@ -73,6 +87,7 @@ public:
   void setOriginalSize(const gfx::Size& size) { m_originalSize = size; }
   void setTrimmedBounds(const gfx::Rect& bounds) { m_trimmedBounds = bounds; }
   void setInTextureBounds(const gfx::Rect& bounds) { m_inTextureBounds = bounds; }
+  void setOriginal(const Sample* original) { m_original = original; }
 
 private:
   Document* m_document;
@@ -82,6 +97,7 @@ private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   gfx::Rect m_inTextureBounds;
+  const Sample* m_original;
 };
 
 class DocumentExporter::Samples {
@@ -90,8 +106,9 @@ public:
   typedef List::iterator iterator;
   typedef List::const_iterator const_iterator;
 
-  void addSample(const Sample& sample) {
+  Sample& addSample(const Sample& sample) {
     m_samples.push_back(sample);
+    return m_samples.back();
   }
 
   iterator begin() { return m_samples.begin(); }
@@ -109,34 +126,221 @@ public:
   virtual void layoutSamples(Samples& samples) = 0;
 };
 
-class DocumentExporter::SimpleLayoutSamples :
+// Packs the trimmed samples in the smallest texture that it can find
+// (see gfx::PackingRects). Duplicated samples use the same bounds as
+// their original sample.
+class DocumentExporter::BestFitLayoutSamples :
     public DocumentExporter::LayoutSamples {
 public:
+  BestFitLayoutSamples(int maxTextureSize)
+    : m_maxTextureSize(maxTextureSize) {
+  }
+
   void layoutSamples(Samples& samples) OVERRIDE {
-    const Sprite* oldSprite = NULL;
+    gfx::PackingRects pr;
 
-    gfx::Point framePt(0, 0);
     for (Samples::iterator it=samples.begin(), end=samples.end();
          it != end; ++it) {
-      const Sprite* sprite = it->sprite();
-      gfx::Size size(sprite->getWidth(), sprite->getHeight());
+      if (!it->original() && !it->trimmedBounds().isEmpty())
+        pr.add(it->trimmedBounds().getSize());
+    }
 
-      it->setOriginalSize(size);
-      it->setTrimmedBounds(gfx::Rect(gfx::Point(0, 0), size));
-      it->setInTextureBounds(gfx::Rect(framePt, size));
+    if (pr.size() > 0 &&
+        pr.bestFit(gfx::Size(m_maxTextureSize, m_maxTextureSize)).w == 0)
+      throw base::Exception("The sprite sheet doesn't fit in a %dx%d texture",
+                            m_maxTextureSize, m_maxTextureSize);
 
-      // All frames of each sprite in one row.
-      if (oldSprite != NULL && oldSprite != it->sprite()) {
-        framePt.x = 0;
-        framePt.y += size.h;
-      }
-      else {
-        framePt.x += size.w;
+    int i = 0;
+    for (Samples::iterator it=samples.begin(), end=samples.end();
+         it != end; ++it) {
+      if (it->original())
+        it->setInTextureBounds(it->original()->inTextureBounds());
+      else if (!it->trimmedBounds().isEmpty())
+        it->setInTextureBounds(pr[i++]);
+      else
+        it->setInTextureBounds(gfx::Rect(0, 0, 0, 0));
+    }
+  }
+
+private:
+  int m_maxTextureSize;
+};
+
+static inline bool is_opaque_pixel(RgbTraits::pixel_t c, color_t transparent) {
+  return (rgba_geta(c) != 0);
+}
+
+static inline bool is_opaque_pixel(GrayscaleTraits::pixel_t c, color_t transparent) {
+  return (graya_geta(c) != 0);
+}
+
+static inline bool is_opaque_pixel(IndexedTraits::pixel_t c, color_t transparent) {
+  return (c != transparent);
+}
+
+template<typename Traits>
+static gfx::Rect get_trimmed_bounds_templ(const Image* image, color_t transparent)
+{
+  typedef typename Traits::const_address_t const_address_t;
+  int w = image->getWidth();
+  int x1 = w, y1 = image->getHeight();
+  int x2 = -1, y2 = -1;
+
+  for (int y=0; y<image->getHeight(); ++y) {
+    const_address_t row = (const_address_t)image->getPixelAddress(0, y);
+
+    // First opaque pixel of the row
+    int x = 0;
+    while (x < w && !is_opaque_pixel(row[x], transparent))
+      ++x;
+    if (x == w)
+      continue;
+
+    if (x < x1) x1 = x;
+    if (y < y1) y1 = y;
+    y2 = y;
+
+    // Last opaque pixel of the row (only after the current x2)
+    for (x=w-1; x > x2; --x) {
+      if (is_opaque_pixel(row[x], transparent)) {
+        x2 = x;
+        break;
       }
+    }
+  }
+
+  if (x2 < x1)
+    return gfx::Rect(0, 0, 0, 0);
+  else
+    return gfx::Rect(x1, y1, x2-x1+1, y2-y1+1);
+}
+
+// Returns the bounds of the non-transparent pixels of the image (an
+// empty rectangle if all pixels are transparent).
+static gfx::Rect get_trimmed_bounds(const Image* image, color_t transparent)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB: return get_trimmed_bounds_templ<RgbTraits>(image, transparent);
+    case IMAGE_GRAYSCALE: return get_trimmed_bounds_templ<GrayscaleTraits>(image, transparent);
+    case IMAGE_INDEXED: return get_trimmed_bounds_templ<IndexedTraits>(image, transparent);
+  }
+  return image->getBounds();
+}
+
+// Returns true if two samples with equal pixels will be rendered
+// equally in the texture (e.g. indexed sprites need the same palette).
+static bool are_compatible_samples(const Sprite* a, FrameNumber aFrame,
+                                   const Sprite* b, FrameNumber bFrame)
+{
+  if (a->getPixelFormat() != b->getPixelFormat())
+    return false;
+
+  if (a->getPixelFormat() == IMAGE_INDEXED) {
+    return (a->getTransparentColor() == b->getTransparentColor() &&
+            a->getPalette(aFrame)->countDiff(b->getPalette(bFrame), NULL, NULL) == 0);
+  }
+
+  return true;
+}
+
+static void save_texture_thread(FileOp* fop)
+{
+  fop_operate(fop, NULL);
+}
+
+// Renders a batch of samples in parallel to calculate their trimmed
+// bounds and to get their images (to find duplicates).
+class DocumentExporter::CaptureSampleTask {
+public:
+  CaptureSampleTask(Sample** samples, bool trim, bool hash)
+    : m_samples(samples)
+    , m_trim(trim)
+    , m_hash(hash) {
+    for (int i=0; i<CaptureBatchSize; ++i) {
+      m_images[i] = NULL;
+      m_hashes[i] = 0;
+    }
+  }
+
+  ~CaptureSampleTask() {
+    for (int i=0; i<CaptureBatchSize; ++i)
+      delete m_images[i];
+  }
+
+  // Returns the trimmed image of the sample (the caller owns the
+  // image), or NULL if the sample is empty.
+  Image* image(int i) {
+    Image* image = m_images[i];
+    m_images[i] = NULL;
+    return image;
+  }
+
+  const gfx::Rect& bounds(int i) const { return m_bounds[i]; }
+  uint64_t hash(int i) const { return m_hashes[i]; }
 
-      oldSprite = it->sprite();
+  void operator()(int i) {
+    const Sample* sample = m_samples[i];
+    const Sprite* sprite = sample->sprite();
+    gfx::Rect bounds(gfx::Point(0, 0), sample->originalSize());
+
+    base::UniquePtr<Image> image(Image::create(sprite->getPixelFormat(),
+                                               bounds.w, bounds.h));
+    sprite->render(image, 0, 0, sample->frame());
+
+    if (m_trim) {
+      bounds = get_trimmed_bounds(image, sprite->getTransparentColor());
+      if (bounds.isEmpty()) {
+        // Empty frames don't use space in the texture.
+        m_bounds[i] = gfx::Rect(0, 0, 0, 0);
+        return;
+      }
+      image.reset(crop_image(image, bounds.x, bounds.y, bounds.w, bounds.h, 0));
     }
+
+    m_bounds[i] = bounds;
+    if (m_hash)
+      m_hashes[i] = image->getHash();
+    m_images[i] = image.release();
+  }
+
+private:
+  Sample** m_samples;
+  bool m_trim;
+  bool m_hash;
+  Image* m_images[CaptureBatchSize];
+  gfx::Rect m_bounds[CaptureBatchSize];
+  uint64_t m_hashes[CaptureBatchSize];
+};
+
+// Renders each sample in its region of the texture.
+class DocumentExporter::RenderSampleTask {
+public:
+  RenderSampleTask(const std::vector<const Sample*>& samples, Image* textureImage)
+    : m_samples(samples)
+    , m_textureImage(textureImage) {
+  }
+
+  void operator()(int i) {
+    const Sample* sample = m_samples[i];
+
+    // The sample is rendered in a temporary image so the
+    // transparent borders of the sprite don't overlap other samples.
+    const gfx::Rect& trimmed = sample->trimmedBounds();
+    base::UniquePtr<Image> sampleImage(
+      Image::create(m_textureImage->getPixelFormat(), trimmed.w, trimmed.h));
+
+    sample->sprite()->render(sampleImage, -trimmed.x, -trimmed.y, sample->frame());
+
+    // All samples are copied at the same time in the texture, so its
+    // content is invalidated by renderTexture() after all of them.
+    copy_image_pixels(m_textureImage, sampleImage,
+                      sample->inTextureBounds().x,
+                      sample->inTextureBounds().y);
   }
+
+private:
+  const std::vector<const Sample*>& m_samples;
+  Image* m_textureImage;
 };
 
 void DocumentExporter::exportSheet()
@@ -158,7 +362,7 @@ void DocumentExporter::exportSheet()
   captureSamples(samples);
 
   // 2) Layout those samples in a texture field.
-  SimpleLayoutSamples layout;
+  BestFitLayoutSamples layout(m_maxTextureSize);
   layout.layoutSamples(samples);
 
   // 3) Create and render the texture.
@@ -172,19 +376,39 @@ void DocumentExporter::exportSheet()
 
   renderTexture(samples, textureImage);
 
-  // Save the metadata.
-  createDataFile(samples, os, textureImage);
-
-  // Save the image files.
+  // Save the image file in a background thread while we save the
+  // metadata.
+  FileOp* fop = NULL;
   if (!m_textureFilename.empty()) {
     textureDocument->setFilename(m_textureFilename.c_str());
-    save_document(textureDocument.get());
+    fop = fop_to_save_document(textureDocument);
+  }
+
+  {
+    base::UniquePtr<base::thread> saveThread;
+    if (fop)
+      saveThread.reset(new base::thread(&save_texture_thread, fop));
+
+    createDataFile(samples, os, textureImage);
+
+    if (saveThread)
+      saveThread->join();
+  }
+
+  if (fop) {
+    fop_done(fop);
+    if (fop->has_error()) {
+      Console console;
+      console.printf("%s", fop->error.c_str());
+    }
+    fop_free(fop);
   }
 }
 
 void DocumentExporter::captureSamples(Samples& samples)
 {
   std::vector<char> buf(32);
+  std::vector<Sample*> captureList;
 
   for (std::vector<Document*>::iterator
          it = m_documents.begin(),
@@ -209,9 +433,60 @@ void DocumentExporter::captureSamples(Samples& samples)
         filename = base::join_path(path, title + &buf[0] + "." + ext);
       }
 
-      samples.addSample(Sample(document, sprite, frame, filename));
+      Sample& sample(samples.addSample(Sample(document, sprite, frame, filename)));
+      gfx::Size size(sprite->getWidth(), sprite->getHeight());
+
+      sample.setOriginalSize(size);
+      sample.setTrimmedBounds(gfx::Rect(gfx::Point(0, 0), size));
+
+      if (m_trim || m_mergeDuplicates)
+        captureList.push_back(&sample);
+    }
+  }
+
+  // Trimmed images of the samples that were already captured (used to
+  // find duplicates), indexed by their hash.
+  typedef std::multimap<uint64_t, std::pair<const Sample*, Image*> > CapturedImages;
+  CapturedImages captured;
+
+  // Samples are rendered/trimmed in parallel in batches (to limit the
+  // number of images in memory), and then duplicates are searched in
+  // order (so the first sample is always the original one).
+  for (int begin=0; begin<(int)captureList.size(); begin+=CaptureBatchSize) {
+    int end = std::min(begin+CaptureBatchSize, (int)captureList.size());
+    CaptureSampleTask task(&captureList[begin], m_trim, m_mergeDuplicates);
+    base::parallel_for(0, end-begin, task);
+
+    for (int i=0; i<end-begin; ++i) {
+      Sample& sample(*captureList[begin+i]);
+      base::UniquePtr<Image> image(task.image(i));
+
+      sample.setTrimmedBounds(task.bounds(i));
+      if (!image || !m_mergeDuplicates)
+        continue;
+
+      uint64_t hash = task.hash(i);
+      std::pair<CapturedImages::iterator, CapturedImages::iterator>
+        range = captured.equal_range(hash);
+
+      for (CapturedImages::iterator it=range.first; it!=range.second; ++it) {
+        const Sample* other = it->second.first;
+        if (are_compatible_samples(sample.sprite(), sample.frame(),
+                                   other->sprite(), other->frame()) &&
+            is_same_image(image, it->second.second)) {
+          sample.setOriginal(other);
+          break;
+        }
+      }
+
+      if (!sample.original())
+        captured.insert(std::make_pair(hash, std::make_pair((const Sample*)&sample,
+                                                            image.release())));
     }
   }
+
+  for (CapturedImages::iterator it=captured.begin(), end=captured.end(); it!=end; ++it)
+    delete it->second.second;
 }
 
 Document* DocumentExporter::createEmptyTexture(const Samples& samples)
@@ -246,7 +521,8 @@ Document* DocumentExporter::createEmptyTexture(const Samples& samples)
   }
 
   base::UniquePtr<Document> document(Document::createBasicDocument(pixelFormat,
-      fullTextureBounds.w, fullTextureBounds.h, maxColors));
+      std::max(1, fullTextureBounds.x+fullTextureBounds.w),
+      std::max(1, fullTextureBounds.y+fullTextureBounds.h), maxColors));
 
   if (palette != NULL)
     document->getSprite()->setPalette(palette, false);
@@ -258,6 +534,8 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
 {
   textureImage->clear(0);
 
+  std::vector<const Sample*> renderList;
+
   for (Samples::const_iterator
          it = samples.begin(),
          end = samples.end(); it != end; ++it) {
@@ -269,11 +547,16 @@ void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage
         DITHERING_NONE);
     }
 
-    it->sprite()->render(textureImage,
-      it->inTextureBounds().x - it->trimmedBounds().x,
-      it->inTextureBounds().y - it->trimmedBounds().y,
-      it->frame());
+    // Duplicated and empty samples aren't rendered.
+    if (!it->original() && !it->trimmedBounds().isEmpty())
+      renderList.push_back(&*it);
   }
+
+  // Each sample is rendered in its own region of the texture, so all
+  // of them can be rendered at the same time.
+  RenderSampleTask task(renderList, textureImage);
+  base::parallel_for(0, (int)renderList.size(), task);
+  textureImage->invalidateContent();
 }
 
 void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os, Image* textureImage)
@@ -49,10 +49,17 @@ namespace app {
       DefaultScaleMode
     };
 
+    enum {
+      DefaultMaxTextureSize = 4096
+    };
+
     DocumentExporter() :
       m_dataFormat(DefaultDataFormat),
       m_textureFormat(DefaultTextureFormat),
-      m_scaleMode(DefaultScaleMode) {
+      m_scaleMode(DefaultScaleMode),
+      m_trim(false),
+      m_mergeDuplicates(false),
+      m_maxTextureSize(DefaultMaxTextureSize) {
     }
 
     void setDataFormat(DataFormat format) {
@@ -79,6 +86,24 @@ namespace app {
       m_scaleMode = mode;
     }
 
+    // Removes the transparent borders of each frame in the texture
+    // (the removed space is specified with the "spriteSourceSize"
+    // field in the data file).
+    void setTrim(bool trim) {
+      m_trim = trim;
+    }
+
+    // Identical frames are saved only once in the texture.
+    void setMergeDuplicates(bool merge) {
+      m_mergeDuplicates = merge;
+    }
+
+    // Maximum width and height of the texture. If the frames don't
+    // fit in the texture, exportSheet() throws an exception.
+    void setMaxTextureSize(int size) {
+      m_maxTextureSize = size;
+    }
+
     void addDocument(Document* document) {
       m_documents.push_back(document);
     }
@@ -89,7 +114,12 @@ namespace app {
     class Sample;
     class Samples;
     class LayoutSamples;
-    class SimpleLayoutSamples;
+    class BestFitLayoutSamples;
+    class CaptureSampleTask;
+    class RenderSampleTask;
+
+    // Number of samples rendered in parallel by captureSamples()
+    enum { CaptureBatchSize = 64 };
 
     void captureSamples(Samples& samples);
     Document* createEmptyTexture(const Samples& samples);
@@ -102,6 +132,9 @@ namespace app {
     std::string m_textureFilename;
     double m_scale;
     ScaleMode m_scaleMode;
+    bool m_trim;
+    bool m_mergeDuplicates;
+    int m_maxTextureSize;
     std::vector<Document*> m_documents;
 
     DISABLE_COPYING(DocumentExporter);
@@ -0,0 +1,123 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/document_snapshot.h"
+
+#include "app/document.h"
+#include "app/document_undo.h"
+#include "raster/cel.h"
+#include "raster/image.h"
+#include "raster/layer.h"
+#include "raster/palette.h"
+#include "raster/sprite.h"
+#include "raster/stock.h"
+
+namespace app {
+
+using namespace raster;
+
+DocumentSnapshot::DocumentSnapshot(const Document* document)
+{
+  const Sprite* srcSprite = document->getSprite();
+  base::UniquePtr<Sprite> sprite(new Sprite(srcSprite->getPixelFormat(),
+                                            srcSprite->getWidth(),
+                                            srcSprite->getHeight(),
+                                            srcSprite->getPalette(FrameNumber(0))->size()));
+  Sprite* spritePtr = sprite;
+  m_document.reset(new Document(sprite));
+  sprite.release();
+
+  m_document->setFilename(document->getFilename());
+  m_document->getUndo()->setEnabled(false);
+
+  spritePtr->setTransparentColor(srcSprite->getTransparentColor());
+  spritePtr->setTotalFrames(srcSprite->getTotalFrames());
+  for (FrameNumber i(0); i < srcSprite->getTotalFrames(); ++i)
+    spritePtr->setFrameDuration(i, srcSprite->getFrameDuration(i));
+
+  PalettesList::const_iterator it = srcSprite->getPalettes().begin();
+  PalettesList::const_iterator end = srcSprite->getPalettes().end();
+  for (; it != end; ++it)
+    spritePtr->setPalette(*it, true);
+
+  // Copy-on-write copies of the stock images (with the same indexes,
+  // so cels can be copied as they are). The original images are not
+  // modified here (only marked as shared), so a read-lock is enough.
+  const Stock* srcStock = srcSprite->getStock();
+  Stock* stock = spritePtr->getStock();
+
+  for (int i=1; i<srcStock->size(); ++i) {
+    Image* image = srcStock->getImage(i);
+    if (image)
+      stock->addImage(Image::createCopyOnWrite(image));
+    else
+      stock->addImage(NULL);
+  }
+  ASSERT(stock->size() == srcStock->size());
+
+  copyLayer(srcSprite->getFolder(), spritePtr->getFolder());
+
+  m_document->setMask(document->getMask());
+  m_document->setMaskVisible(document->isMaskVisible());
+}
+
+DocumentSnapshot::~DocumentSnapshot()
+{
+  // The copies of the images are destroyed with the sprite, so the
+  // original images don't need to copy their pixels anymore.
+}
+
+void DocumentSnapshot::copyLayer(const Layer* srcLayer, Layer* dstLayer)
+{
+  dstLayer->setName(srcLayer->getName());
+  dstLayer->setFlags(srcLayer->getFlags());
+
+  if (srcLayer->isImage()) {
+    const LayerImage* src = static_cast<const LayerImage*>(srcLayer);
+    LayerImage* dst = static_cast<LayerImage*>(dstLayer);
+
+    CelConstIterator it = src->getCelBegin();
+    CelConstIterator end = src->getCelEnd();
+    for (; it != end; ++it)
+      dst->addCel(new Cel(**it));
+  }
+  else if (srcLayer->isFolder()) {
+    const LayerFolder* src = static_cast<const LayerFolder*>(srcLayer);
+    LayerFolder* dst = static_cast<LayerFolder*>(dstLayer);
+
+    LayerConstIterator it = src->getLayerBegin();
+    LayerConstIterator end = src->getLayerEnd();
+    for (; it != end; ++it) {
+      base::UniquePtr<Layer> child;
+
+      if ((*it)->isImage())
+        child.reset(new LayerImage(dst->getSprite()));
+      else
+        child.reset(new LayerFolder(dst->getSprite()));
+
+      copyLayer(*it, child);
+      dst->addLayer(child.release());
+    }
+  }
+}
+
+} // namespace app
@@ -0,0 +1,67 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef APP_DOCUMENT_SNAPSHOT_H_INCLUDED
+#define APP_DOCUMENT_SNAPSHOT_H_INCLUDED
+
+#include "base/disable_copying.h"
+#include "base/unique_ptr.h"
+
+namespace raster {
+  class Layer;
+}
+
+namespace app {
+
+  class Document;
+
+  using namespace raster;
+
+  // Read-only copy of a document in a specific point of time. The
+  // sprite structure (layers, cels, frames, palettes, and mask) is
+  // copied, and the images are copy-on-write copies of the original
+  // ones (see Image::createCopyOnWrite()): they share the pixels with
+  // the document until the user modifies them, so only the images
+  // modified while the snapshot exists are copied (by the modified
+  // image), and the copies are released with the snapshot.
+  //
+  // A snapshot can be created in the main thread with the document
+  // locked to read (only for the time needed to create it), and then
+  // a background job (e.g. saving or exporting the file) can read it
+  // without locking the original document, so the user can continue
+  // editing it. The snapshot must be destroyed in the main thread.
+  class DocumentSnapshot {
+  public:
+    explicit DocumentSnapshot(const Document* document);
+    ~DocumentSnapshot();
+
+    // Returns the copy of the document. It is not a const pointer so
+    // it can be used with functions like fop_to_save_document(), but
+    // it must not be modified (its images share their pixels).
+    Document* document() const { return m_document; }
+
+  private:
+    void copyLayer(const Layer* srcLayer, Layer* dstLayer);
+
+    base::UniquePtr<Document> m_document;
+
+    DISABLE_COPYING(DocumentSnapshot);
+  };
+
+} // namespace app
+
+#endif
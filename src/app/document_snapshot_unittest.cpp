@@ -0,0 +1,153 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "app/document.h"
+#include "app/document_snapshot.h"
+#include "base/unique_ptr.h"
+#include "raster/raster.h"
+
+using namespace app;
+using namespace raster;
+
+static Image* get_image(Document* doc, int index)
+{
+  return doc->getSprite()->getStock()->getImage(index);
+}
+
+TEST(DocumentSnapshot, CopiesStructureAndPixels)
+{
+  base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 16, 8, 256));
+  Sprite* sprite = doc->getSprite();
+  LayerImage* layer = static_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+  Cel* cel = layer->getCel(FrameNumber(0));
+  Image* image = get_image(doc, cel->getImage());
+  image->putPixel(3, 4, rgba(255, 0, 0, 255));
+
+  DocumentSnapshot snapshot(doc);
+  Sprite* copy = snapshot.document()->getSprite();
+  LayerImage* copyLayer = static_cast<LayerImage*>(copy->getFolder()->getFirstLayer());
+
+  EXPECT_EQ(16, copy->getWidth());
+  EXPECT_EQ(8, copy->getHeight());
+  EXPECT_EQ(doc->getFilename(), snapshot.document()->getFilename());
+  EXPECT_EQ(layer->getName(), copyLayer->getName());
+  ASSERT_TRUE(copyLayer->getCel(FrameNumber(0)) != NULL);
+  EXPECT_EQ(cel->getImage(), copyLayer->getCel(FrameNumber(0))->getImage());
+
+  Image* copyImage = get_image(snapshot.document(), cel->getImage());
+  EXPECT_NE(image, copyImage);
+  EXPECT_TRUE(is_same_image(image, copyImage));
+
+  // Modifications of the original document don't change the snapshot
+  image->putPixel(3, 4, rgba(0, 0, 255, 255));
+  EXPECT_EQ(rgba(255, 0, 0, 255), copyImage->getPixel(3, 4));
+}
+
+TEST(DocumentSnapshot, SharesUnmodifiedImages)
+{
+  base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, 16, 8, 256));
+  int index = doc->getSprite()->getStock()->size()-1;
+  Image* image = get_image(doc, index);
+  uint8_t* pixels = image->getPixelAddress(0, 0);
+
+  base::UniquePtr<DocumentSnapshot> a(new DocumentSnapshot(doc));
+  base::UniquePtr<DocumentSnapshot> b(new DocumentSnapshot(doc));
+  EXPECT_EQ(pixels, get_image(a->document(), index)->getPixelAddress(0, 0));
+  EXPECT_EQ(pixels, get_image(b->document(), index)->getPixelAddress(0, 0));
+
+  // The modified image copies its pixels, the snapshots keep the
+  // original ones
+  image->putPixel(0, 0, 1);
+  EXPECT_NE(pixels, image->getPixelAddress(0, 0));
+  EXPECT_EQ(pixels, get_image(a->document(), index)->getPixelAddress(0, 0));
+  EXPECT_EQ(0, get_image(a->document(), index)->getPixel(0, 0));
+  EXPECT_EQ(0, get_image(b->document(), index)->getPixel(0, 0));
+
+  base::UniquePtr<DocumentSnapshot> c(new DocumentSnapshot(doc));
+  EXPECT_EQ(image->getPixelAddress(0, 0), get_image(c->document(), index)->getPixelAddress(0, 0));
+  EXPECT_EQ(1, get_image(c->document(), index)->getPixel(0, 0));
+
+  // Snapshots can be destroyed after the document
+  a.reset(NULL);
+  doc.reset(NULL);
+  EXPECT_EQ(0, get_image(b->document(), index)->getPixel(0, 0));
+  EXPECT_EQ(1, get_image(c->document(), index)->getPixel(0, 0));
+}
+
+TEST(DocumentSnapshot, CopiesOnlyWhileTheSnapshotExists)
+{
+  base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, 16, 8, 256));
+  int index = doc->getSprite()->getStock()->size()-1;
+  Image* image = get_image(doc, index);
+  uint8_t* pixels = image->getPixelAddress(0, 0);
+
+  // The image doesn't need to copy its pixels after the snapshot is
+  // destroyed
+  base::UniquePtr<DocumentSnapshot> a(new DocumentSnapshot(doc));
+  a.reset(NULL);
+  image->putPixel(0, 0, 1);
+  EXPECT_EQ(pixels, image->getPixelAddress(0, 0));
+  EXPECT_EQ(1, image->getPixel(0, 0));
+}
+
+TEST(DocumentSnapshot, CopiesOnWriteWithLockedBitsAndDirectWrites)
+{
+  base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 16, 8, 256));
+  int index = doc->getSprite()->getStock()->size()-1;
+  Image* image = get_image(doc, index);
+  clear_image(image, rgba(0, 0, 0, 255));
+
+  // Write all pixels through locked bits
+  base::UniquePtr<DocumentSnapshot> a(new DocumentSnapshot(doc));
+  {
+    LockImageBits<RgbTraits> bits(image, Image::WriteLock);
+    LockImageBits<RgbTraits>::iterator it = bits.begin(), end = bits.end();
+    for (; it != end; ++it)
+      *it = rgba(255, 255, 255, 255);
+  }
+
+  // Write a row directly (invalidating it first)
+  base::UniquePtr<DocumentSnapshot> b(new DocumentSnapshot(doc));
+  image->invalidateRows(4, 1);
+  *(uint32_t*)image->getPixelAddress(0, 4) = rgba(255, 0, 0, 255);
+
+  EXPECT_EQ(rgba(0, 0, 0, 255), get_image(a->document(), index)->getPixel(0, 4));
+  EXPECT_EQ(rgba(0, 0, 0, 255), get_image(a->document(), index)->getPixel(15, 7));
+  EXPECT_EQ(rgba(255, 255, 255, 255), get_image(b->document(), index)->getPixel(0, 4));
+  EXPECT_EQ(rgba(255, 255, 255, 255), get_image(b->document(), index)->getPixel(15, 7));
+  EXPECT_EQ(rgba(255, 0, 0, 255), image->getPixel(0, 4));
+  EXPECT_EQ(rgba(255, 255, 255, 255), image->getPixel(15, 7));
+
+  // Copies have the same hashes as the original images
+  image->getHash();
+  base::UniquePtr<DocumentSnapshot> c(new DocumentSnapshot(doc));
+  EXPECT_EQ(image->getHash(), get_image(c->document(), index)->getHash());
+  EXPECT_NE(image->getHash(), get_image(b->document(), index)->getHash());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
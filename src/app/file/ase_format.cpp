@@ -24,13 +24,19 @@
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/ini_file.h"
 #include "base/cfile.h"
+#include "base/disable_copying.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
+#include "base/parallel_for.h"
 #include "raster/raster.h"
 #include "zlib.h"
 
+#include <algorithm>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
 #define ASE_FILE_MAGIC                  0xA5E0
 #define ASE_FILE_FRAME_MAGIC            0xF1FA
@@ -41,11 +47,29 @@
 #define ASE_FILE_CHUNK_CEL              0x2005
 #define ASE_FILE_CHUNK_MASK             0x2016
 #define ASE_FILE_CHUNK_PATH             0x2017
+#define ASE_FILE_CHUNK_THUMBNAIL        0x2030
 
 #define ASE_FILE_RAW_CEL                0
 #define ASE_FILE_LINK_CEL               1
 #define ASE_FILE_COMPRESSED_CEL         2
 
+// Size of the stdio buffer used to read/write .ase files, and of the
+// buffers used to feed zlib with compressed data.
+#define ASE_FILE_BUFFER_SIZE            (256*1024)
+
+// Size of the buffer used to get the output of zlib when cels are
+// compressed.
+#define ASE_DEFLATE_BUFFER_SIZE         (64*1024)
+
+// Maximum number of cels that are compressed/decompressed in
+// parallel, and maximum size of their data (uncompressed images when
+// the file is saved, compressed data when it's loaded).
+#define ASE_CELS_BATCH_SIZE             64
+#define ASE_CELS_BATCH_BYTES            (64*1024*1024)
+
+// Maximum width/height of the preview stored in the thumbnail chunk.
+#define ASE_THUMBNAIL_SIZE              128
+
 namespace app {
 
 using namespace base;
@@ -75,10 +99,79 @@ struct ASE_FrameHeader {
   uint16_t duration;
 };
 
-// TODO Warning: the writing routines aren't thread-safe
-static ASE_FrameHeader *current_frame_header = NULL;
-static int chunk_type;
-static int chunk_start;
+// Image of a cel chunk that is compressed (when the file is saved)
+// or decompressed (when the file is loaded) in an ASE_CelsBatch.
+struct ASE_CelData {
+  Cel* cel;
+  Image* image;
+  int link_frame;               // Frame to link the cel (saving only)
+  std::vector<uint8_t> data;    // Compressed pixels
+  std::string error;
+
+  ASE_CelData(Cel* cel, Image* image, int link_frame)
+    : cel(cel), image(image), link_frame(link_frame) {
+  }
+};
+
+// Cels are independent chunks, so their images are compressed and
+// decompressed in several threads. To avoid keeping all the
+// compressed data in memory, the cels are processed in batches of
+// ASE_CELS_BATCH_SIZE cels or ASE_CELS_BATCH_BYTES bytes:
+//
+// - When a file is saved, the cels of the next frames are compressed
+//   in parallel, and then written in order (see ase_file_compress_cels()).
+// - When a file is loaded, the compressed data of cel chunks is
+//   stored in the batch and then decompressed in parallel (see
+//   ase_file_decompress_cels()).
+class ASE_CelsBatch {
+public:
+  ASE_CelsBatch() : m_bytes(0) { }
+  ~ASE_CelsBatch() { clear(); }
+
+  int size() const { return (int)m_cels.size(); }
+  size_t bytes() const { return m_bytes; }
+  bool isFull() const {
+    return (size() >= ASE_CELS_BATCH_SIZE ||
+            bytes() >= ASE_CELS_BATCH_BYTES);
+  }
+  ASE_CelData* operator[](int i) const { return m_cels[i]; }
+
+  ASE_CelData* add(Cel* cel, Image* image, int link_frame, size_t bytes) {
+    ASE_CelData* data = new ASE_CelData(cel, image, link_frame);
+    m_cels.push_back(data);
+    m_bytes += bytes;
+    return data;
+  }
+
+  ASE_CelData* find(const Cel* cel) const {
+    for (std::vector<ASE_CelData*>::const_iterator
+           it=m_cels.begin(), end=m_cels.end(); it!=end; ++it) {
+      if ((*it)->cel == cel)
+        return *it;
+    }
+    return NULL;
+  }
+
+  void clear() {
+    for (std::vector<ASE_CelData*>::iterator
+           it=m_cels.begin(), end=m_cels.end(); it!=end; ++it)
+      delete *it;
+    m_cels.clear();
+    m_bytes = 0;
+  }
+
+private:
+  std::vector<ASE_CelData*> m_cels;
+  size_t m_bytes;
+
+  DISABLE_COPYING(ASE_CelsBatch);
+};
+
+// Chunk that is being written (see ase_file_write_start_chunk())
+struct ASE_Chunk {
+  int type;
+  long start;
+};
 
 static bool ase_file_read_header(FILE* f, ASE_Header* header);
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite);
@@ -88,28 +181,39 @@ static void ase_file_read_frame_header(FILE *f, ASE_FrameHeader *frame_header);
 static void ase_file_prepare_frame_header(FILE *f, ASE_FrameHeader *frame_header);
 static void ase_file_write_frame_header(FILE *f, ASE_FrameHeader *frame_header);
 
-static void ase_file_write_layers(FILE *f, Layer *layer);
-static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumber frame);
+static void ase_file_write_layers(FILE *f, ASE_FrameHeader *frame_header, Layer *layer);
+static void ase_file_write_cels(FILE *f, ASE_FrameHeader *frame_header, Sprite *sprite, Layer *layer, FrameNumber frame, const ASE_CelsBatch& batch);
 
 static void ase_file_read_padding(FILE *f, int bytes);
 static void ase_file_write_padding(FILE *f, int bytes);
 static std::string ase_file_read_string(FILE *f);
 static void ase_file_write_string(FILE *f, const std::string& string);
 
-static void ase_file_write_start_chunk(FILE *f, int type);
-static void ase_file_write_close_chunk(FILE *f);
+static void ase_file_write_start_chunk(FILE *f, ASE_FrameHeader *frame_header, int type, ASE_Chunk *chunk);
+static void ase_file_write_close_chunk(FILE *f, const ASE_Chunk *chunk);
 
 static Palette *ase_file_read_color_chunk(FILE *f, Sprite *sprite, FrameNumber frame);
 static Palette *ase_file_read_color2_chunk(FILE *f, Sprite *sprite, FrameNumber frame);
-static void ase_file_write_color2_chunk(FILE *f, Palette *pal);
+static void ase_file_write_color2_chunk(FILE *f, ASE_FrameHeader *frame_header, Palette *pal);
 static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previous_layer, int *current_level);
-static void ase_file_write_layer_chunk(FILE *f, Layer *layer);
-static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp *fop, ASE_Header *header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprite *sprite);
+static void ase_file_write_layer_chunk(FILE *f, ASE_FrameHeader *frame_header, Layer *layer);
+static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp *fop, ASE_Header *header, size_t chunk_end, ASE_CelsBatch& batch);
+static int ase_file_get_link_frame(LayerImage* layer, Cel* cel, Sprite* sprite);
+static FrameNumber ase_file_compress_cels(Sprite* sprite, FrameNumber frame, ASE_CelsBatch& batch);
+static void ase_file_decompress_cels(ASE_CelsBatch& batch, FileOp* fop);
+static void ase_file_write_cel_chunk(FILE *f, ASE_FrameHeader *frame_header, Cel *cel, LayerImage *layer, Sprite *sprite, const ASE_CelData* data);
 static Mask *ase_file_read_mask_chunk(FILE *f);
-static void ase_file_write_mask_chunk(FILE *f, Mask *mask);
+static void ase_file_write_mask_chunk(FILE *f, ASE_FrameHeader *frame_header, Mask *mask);
+static Image* ase_file_read_thumbnail_chunk(FILE *f, size_t chunk_end);
+static void ase_file_write_thumbnail_chunk(FILE *f, ASE_FrameHeader *frame_header, Sprite *sprite);
 
 class AseFormat : public FileFormat {
+  // Data for ASE files.
+  class AseOptions : public FormatOptions {
+  public:
+    bool thumbnail;             // Write the thumbnail chunk
+  };
+
   const char* onGetName() const { return "ase"; }
   const char* onGetExtensions() const { return "ase,aseprite"; }
   int onGetFlags() const {
@@ -123,11 +227,15 @@ class AseFormat : public FileFormat {
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_LAYERS |
       FILE_SUPPORT_FRAMES |
-      FILE_SUPPORT_PALETTES;
+      FILE_SUPPORT_PALETTES |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS |
+      FILE_SUPPORT_THUMBNAILS;
   }
 
   bool onLoad(FileOp* fop);
   bool onSave(FileOp* fop);
+  Image* onLoadThumbnail(const char* filename);
+  SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop);
 };
 
 FileFormat* CreateAseFormat()
@@ -138,6 +246,7 @@ FileFormat* CreateAseFormat()
 bool AseFormat::onLoad(FileOp *fop)
 {
   FileHandle f(open_file_with_exception(fop->filename, "rb"));
+  setvbuf(f, NULL, _IOFBF, ASE_FILE_BUFFER_SIZE);
 
   ASE_Header header;
   if (!ase_file_read_header(f, &header)) {
@@ -165,6 +274,9 @@ bool AseFormat::onLoad(FileOp *fop)
   Layer* last_layer = sprite->getFolder();
   int current_level = -1;
 
+  // Compressed cels that weren't decompressed yet
+  ASE_CelsBatch batch;
+
   /* read frame by frame to end-of-file */
   for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame) {
     /* start frame position */
@@ -229,7 +341,7 @@ bool AseFormat::onLoad(FileOp *fop)
 
             ase_file_read_cel_chunk(f, sprite, frame,
                                     sprite->getPixelFormat(), fop, &header,
-                                    chunk_pos+chunk_size);
+                                    chunk_pos+chunk_size, batch);
             break;
           }
 
@@ -251,6 +363,10 @@ bool AseFormat::onLoad(FileOp *fop)
             /* fop_error(fop, "Path chunk\n"); */
             break;
 
+          case ASE_FILE_CHUNK_THUMBNAIL:
+            // The preview is only used by onLoadThumbnail()
+            break;
+
           default:
             fop_error(fop, "Warning: Unsupported chunk type %d (skipping)\n", chunk_type);
             break;
@@ -264,6 +380,9 @@ bool AseFormat::onLoad(FileOp *fop)
     /* skip frame size */
     fseek(f, frame_pos+frame_header.size, SEEK_SET);
 
+    if (batch.isFull())
+      ase_file_decompress_cels(batch, fop);
+
     /* just one frame? */
     if (fop->oneframe)
       break;
@@ -272,6 +391,8 @@ bool AseFormat::onLoad(FileOp *fop)
       break;
   }
 
+  ase_file_decompress_cels(batch, fop);
+
   fop->document = new Document(sprite);
 
   if (ferror(f)) {
@@ -286,28 +407,42 @@ bool AseFormat::onLoad(FileOp *fop)
 bool AseFormat::onSave(FileOp *fop)
 {
   Sprite* sprite = fop->document->getSprite();
+  SharedPtr<AseOptions> ase_options = fop->seq.format_options;
   ASE_Header header;
   ASE_FrameHeader frame_header;
 
   FileHandle f(open_file_with_exception(fop->filename, "wb"));
+  setvbuf(f, NULL, _IOFBF, ASE_FILE_BUFFER_SIZE);
 
   /* prepare the header */
   ase_file_prepare_header(f, &header, sprite);
 
+  // Cels of the frames [frame, batch_end) with compressed images
+  ASE_CelsBatch batch;
+  FrameNumber batch_end(0);
+
   /* write frame */
   for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame) {
+    if (frame == batch_end)
+      batch_end = ase_file_compress_cels(sprite, frame, batch);
+
     /* prepare the header */
     ase_file_prepare_frame_header(f, &frame_header);
 
     /* frame duration */
     frame_header.duration = sprite->getFrameDuration(frame);
 
+    // The preview is the first chunk of the file, so it can be read
+    // without reading the rest of the file (see onLoadThumbnail())
+    if (frame == 0 && ase_options && ase_options->thumbnail)
+      ase_file_write_thumbnail_chunk(f, &frame_header, sprite);
+
     /* the sprite is indexed and the palette changes? (or is the first frame) */
     if (sprite->getPixelFormat() == IMAGE_INDEXED &&
         (frame == 0 ||
          sprite->getPalette(frame.previous())->countDiff(sprite->getPalette(frame), NULL, NULL) > 0)) {
       /* write the color chunk */
-      ase_file_write_color2_chunk(f, sprite->getPalette(frame));
+      ase_file_write_color2_chunk(f, &frame_header, sprite->getPalette(frame));
     }
 
     /* write extra chunks in the first frame */
@@ -317,11 +452,11 @@ bool AseFormat::onSave(FileOp *fop)
 
       /* write layer chunks */
       for (; it != end; ++it)
-        ase_file_write_layers(f, *it);
+        ase_file_write_layers(f, &frame_header, *it);
     }
 
     /* write cel chunks */
-    ase_file_write_cels(f, sprite, sprite->getFolder(), frame);
+    ase_file_write_cels(f, &frame_header, sprite, sprite->getFolder(), frame, batch);
 
     /* write the frame header */
     ase_file_write_frame_header(f, &frame_header);
@@ -343,6 +478,48 @@ bool AseFormat::onSave(FileOp *fop)
   }
 }
 
+Image* AseFormat::onLoadThumbnail(const char* filename)
+{
+  FileHandle f(open_file(filename, "rb"));
+  if (!f)
+    return NULL;
+
+  ASE_Header header;
+  if (!ase_file_read_header(f, &header) || header.frames < 1)
+    return NULL;
+
+  ASE_FrameHeader frame_header;
+  ase_file_read_frame_header(f, &frame_header);
+  if (frame_header.magic != ASE_FILE_FRAME_MAGIC ||
+      frame_header.chunks < 1)
+    return NULL;
+
+  // Only the first chunk is read (files without preview, e.g. saved
+  // with older versions, have other chunk in this position)
+  int chunk_pos = ftell(f);
+  int chunk_size = fgetl(f);
+  int chunk_type = fgetw(f);
+  if (chunk_type != ASE_FILE_CHUNK_THUMBNAIL)
+    return NULL;
+
+  try {
+    return ase_file_read_thumbnail_chunk(f, chunk_pos+chunk_size);
+  }
+  catch (const std::exception&) {
+    return NULL;
+  }
+}
+
+// The options are taken from the configuration (there is no dialog).
+// The thumbnail chunk is written only if the user enables it, so the
+// files aren't bigger by default.
+SharedPtr<FormatOptions> AseFormat::onGetFormatOptions(FileOp* fop)
+{
+  SharedPtr<AseOptions> ase_options(new AseOptions());
+  ase_options->thumbnail = get_config_bool("ASE", "SaveThumbnail", false);
+  return ase_options;
+}
+
 static bool ase_file_read_header(FILE *f, ASE_Header *header)
 {
   header->pos = ftell(f);
@@ -440,8 +617,6 @@ static void ase_file_prepare_frame_header(FILE *f, ASE_FrameHeader *frame_header
   frame_header->chunks = 0;
   frame_header->duration = 0;
 
-  current_frame_header = frame_header;
-
   fseek(f, pos+16, SEEK_SET);
 }
 
@@ -461,24 +636,22 @@ static void ase_file_write_frame_header(FILE *f, ASE_FrameHeader *frame_header)
   ase_file_write_padding(f, 6);
 
   fseek(f, end, SEEK_SET);
-
-  current_frame_header = NULL;
 }
 
-static void ase_file_write_layers(FILE *f, Layer *layer)
+static void ase_file_write_layers(FILE *f, ASE_FrameHeader *frame_header, Layer *layer)
 {
-  ase_file_write_layer_chunk(f, layer);
+  ase_file_write_layer_chunk(f, frame_header, layer);
 
   if (layer->isFolder()) {
     LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_layers(f, *it);
+      ase_file_write_layers(f, frame_header, *it);
   }
 }
 
-static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumber frame)
+static void ase_file_write_cels(FILE *f, ASE_FrameHeader *frame_header, Sprite *sprite, Layer *layer, FrameNumber frame, const ASE_CelsBatch& batch)
 {
   if (layer->isImage()) {
     Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
@@ -486,7 +659,8 @@ static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumb
 /*       fop_error(fop, "New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, cel, static_cast<LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite,
+                               batch.find(cel));
     }
   }
 
@@ -495,7 +669,7 @@ static void ase_file_write_cels(FILE *f, Sprite *sprite, Layer *layer, FrameNumb
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, batch);
   }
 }
 
@@ -534,24 +708,24 @@ static void ase_file_write_string(FILE *f, const std::string& string)
     fputc(string[c], f);
 }
 
-static void ase_file_write_start_chunk(FILE *f, int type)
+static void ase_file_write_start_chunk(FILE *f, ASE_FrameHeader *frame_header, int type, ASE_Chunk *chunk)
 {
-  current_frame_header->chunks++;
+  frame_header->chunks++;
 
-  chunk_type = type;
-  chunk_start = ftell(f);
+  chunk->type = type;
+  chunk->start = ftell(f);
 
-  fseek(f, chunk_start+6, SEEK_SET);
+  fseek(f, chunk->start+6, SEEK_SET);
 }
 
-static void ase_file_write_close_chunk(FILE *f)
+static void ase_file_write_close_chunk(FILE *f, const ASE_Chunk *chunk)
 {
-  int chunk_end = ftell(f);
-  int chunk_size = chunk_end - chunk_start;
+  long chunk_end = ftell(f);
+  long chunk_size = chunk_end - chunk->start;
 
-  fseek(f, chunk_start, SEEK_SET);
+  fseek(f, chunk->start, SEEK_SET);
   fputl(chunk_size, f);
-  fputw(chunk_type, f);
+  fputw(chunk->type, f);
   fseek(f, chunk_end, SEEK_SET);
 }
 
@@ -610,11 +784,12 @@ static Palette *ase_file_read_color2_chunk(FILE *f, Sprite *sprite, FrameNumber
 }
 
 /* writes the original color chunk in FLI files for the entire palette "pal" */
-static void ase_file_write_color2_chunk(FILE *f, Palette *pal)
+static void ase_file_write_color2_chunk(FILE *f, ASE_FrameHeader *frame_header, Palette *pal)
 {
   int c, color;
 
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_FLI_COLOR2);
+  ASE_Chunk chunk;
+  ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_FLI_COLOR2, &chunk);
 
   fputw(1, f);                  // number of packets
 
@@ -629,7 +804,7 @@ static void ase_file_write_color2_chunk(FILE *f, Palette *pal)
     fputc(rgba_getb(color), f);
   }
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, &chunk);
 }
 
 static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previous_layer, int *current_level)
@@ -682,9 +857,10 @@ static Layer *ase_file_read_layer_chunk(FILE *f, Sprite *sprite, Layer **previou
   return layer;
 }
 
-static void ase_file_write_layer_chunk(FILE *f, Layer *layer)
+static void ase_file_write_layer_chunk(FILE *f, ASE_FrameHeader *frame_header, Layer *layer)
 {
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_LAYER);
+  ASE_Chunk chunk;
+  ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_LAYER, &chunk);
 
   // Flags
   fputw(layer->getFlags(), f);
@@ -712,7 +888,7 @@ static void ase_file_write_layer_chunk(FILE *f, Layer *layer)
   /* layer name */
   ase_file_write_string(f, layer->getName());
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, &chunk);
 
   /* fop_error(fop, "Layer name \"%s\" child level: %d\n", layer->name, child_level); */
 }
@@ -724,29 +900,18 @@ static void ase_file_write_layer_chunk(FILE *f, Layer *layer)
 template<typename ImageTraits>
 class PixelIO {
 public:
-  typename ImageTraits::pixel_t read_pixel(FILE* f);
-  void write_pixel(FILE* f, typename ImageTraits::pixel_t c);
   void read_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
   void write_scanline(typename ImageTraits::address_t address, int w, uint8_t* buffer);
 };
 
+// The read_scanline() functions support "buffer" pointing to the same
+// memory as "address" (each pixel is read before it is written), so
+// scanlines can be decoded in-place in the image rows.
+
 template<>
 class PixelIO<RgbTraits> {
   int r, g, b, a;
 public:
-  RgbTraits::pixel_t read_pixel(FILE* f) {
-    r = fgetc(f);
-    g = fgetc(f);
-    b = fgetc(f);
-    a = fgetc(f);
-    return rgba(r, g, b, a);
-  }
-  void write_pixel(FILE* f, RgbTraits::pixel_t c) {
-    fputc(rgba_getr(c), f);
-    fputc(rgba_getg(c), f);
-    fputc(rgba_getb(c), f);
-    fputc(rgba_geta(c), f);
-  }
   void read_scanline(RgbTraits::address_t address, int w, uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
@@ -773,15 +938,6 @@ template<>
 class PixelIO<GrayscaleTraits> {
   int k, a;
 public:
-  GrayscaleTraits::pixel_t read_pixel(FILE* f) {
-    k = fgetc(f);
-    a = fgetc(f);
-    return graya(k, a);
-  }
-  void write_pixel(FILE* f, GrayscaleTraits::pixel_t c) {
-    fputc(graya_getv(c), f);
-    fputc(graya_geta(c), f);
-  }
   void read_scanline(GrayscaleTraits::address_t address, int w, uint8_t* buffer)
   {
     for (int x=0; x<w; ++x) {
@@ -803,15 +959,10 @@ public:
 template<>
 class PixelIO<IndexedTraits> {
 public:
-  IndexedTraits::pixel_t read_pixel(FILE* f) {
-    return fgetc(f);
-  }
-  void write_pixel(FILE* f, IndexedTraits::pixel_t c) {
-    fputc(c, f);
-  }
   void read_scanline(IndexedTraits::address_t address, int w, uint8_t* buffer)
   {
-    memcpy(address, buffer, w);
+    if (address != buffer)
+      memcpy(address, buffer, w);
   }
   void write_scanline(IndexedTraits::address_t address, int w, uint8_t* buffer)
   {
@@ -827,11 +978,18 @@ template<typename ImageTraits>
 static void read_raw_image(FILE* f, Image* image, FileOp* fop, ASE_Header* header)
 {
   PixelIO<ImageTraits> pixel_io;
-  int x, y;
+  size_t row_bytes = ImageTraits::getRowStrideBytes(image->getWidth());
 
-  for (y=0; y<image->getHeight(); y++) {
-    for (x=0; x<image->getWidth(); x++)
-      put_pixel_fast<ImageTraits>(image, x, y, pixel_io.read_pixel(f));
+  // Each scanline is read directly in its image row and then
+  // converted in-place.
+  for (int y=0; y<image->getHeight(); y++) {
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+    size_t bytes_read = fread(address, 1, row_bytes, f);
+    if (bytes_read < row_bytes)
+      memset(((uint8_t*)address)+bytes_read, 0, row_bytes-bytes_read);
+
+    pixel_io.read_scanline(address, image->getWidth(), (uint8_t*)address);
 
     fop_progress(fop, (float)ftell(f) / (float)header->size);
   }
@@ -841,11 +999,17 @@ template<typename ImageTraits>
 static void write_raw_image(FILE* f, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
-  int x, y;
+  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->getWidth()));
+
+  for (int y=0; y<image->getHeight(); y++) {
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+
+    pixel_io.write_scanline(address, image->getWidth(), &scanline[0]);
 
-  for (y=0; y<image->getHeight(); y++)
-    for (x=0; x<image->getWidth(); x++)
-      pixel_io.write_pixel(f, get_pixel_fast<ImageTraits>(image, x, y));
+    if (fwrite(&scanline[0], 1, scanline.size(), f) != scanline.size())
+      throw base::Exception("Error writing raw image pixels.\n");
+  }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -853,73 +1017,66 @@ static void write_raw_image(FILE* f, Image* image)
 //////////////////////////////////////////////////////////////////////
 
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void read_compressed_image(const std::vector<uint8_t>& data, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
-  int y, err;
+  int err;
 
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
+  zstream.next_in = (Bytef*)(data.empty() ? NULL: &data[0]);
+  zstream.avail_in = data.size();
 
   err = inflateInit(&zstream);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->getWidth()));
-  std::vector<uint8_t> uncompressed(image->getHeight() * ImageTraits::getRowStrideBytes(image->getWidth()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
+  // The data is inflated directly in the rows of the image (without
+  // intermediate buffers), and each row is converted in-place to the
+  // image format.
+  const size_t row_bytes = ImageTraits::getRowStrideBytes(image->getWidth());
+  const int h = image->getHeight();
+  int y = 0;
 
-  while (true) {
-    size_t input_bytes;
+  while (y < h) {
+    uint8_t* row = (uint8_t*)image->getPixelAddress(0, y++);
 
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
+    zstream.next_out = (Bytef*)row;
+    zstream.avail_out = row_bytes;
 
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      inflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in inflate().", err);
     }
-    else
-      input_bytes = compressed.size();
 
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
+    // Rows that are not in the compressed data are cleared.
+    if (zstream.avail_out > 0) {
+      memset(row+row_bytes-zstream.avail_out, 0, zstream.avail_out);
+      pixel_io.read_scanline((typename ImageTraits::address_t)row,
+                             image->getWidth(), row);
 
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
-
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
-
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
-
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
-
-        uncompressed_offset += uncompressed_bytes;
-      }
-    } while (zstream.avail_out == 0);
+      for (; y<h; ++y)
+        memset(image->getPixelAddress(0, y), 0, row_bytes);
+      break;
+    }
 
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
+    pixel_io.read_scanline((typename ImageTraits::address_t)row,
+                           image->getWidth(), row);
   }
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->getHeight(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
-
-    pixel_io.read_scanline(address, image->getWidth(), &uncompressed[uncompressed_offset]);
-
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->getWidth());
+  // The stream must not have more data than the image.
+  if (err == Z_OK && zstream.avail_in > 0) {
+    uint8_t extra;
+    zstream.next_out = (Bytef*)&extra;
+    zstream.avail_out = 1;
+    inflate(&zstream, Z_NO_FLUSH);
+    if (zstream.avail_out == 0) {
+      inflateEnd(&zstream);
+      throw base::Exception("Bad compressed image.");
+    }
   }
 
   err = inflateEnd(&zstream);
@@ -928,7 +1085,7 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
 }
 
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, Image* image)
+static void write_compressed_image(Image* image, std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -942,7 +1099,13 @@ static void write_compressed_image(FILE* f, Image* image)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->getWidth()));
-  std::vector<uint8_t> compressed(4096);
+
+  // The compressed data is generated in a fixed-size buffer and
+  // appended to the output, so the output only takes the compressed
+  // size.
+  std::vector<uint8_t> buffer(std::min<uLong>(ASE_DEFLATE_BUFFER_SIZE,
+                                              deflateBound(&zstream, scanline.size()*image->getHeight())));
+  output.clear();
 
   for (y=0; y<image->getHeight(); y++) {
     typename ImageTraits::address_t address =
@@ -955,21 +1118,23 @@ static void write_compressed_image(FILE* f, Image* image)
     int flush = (y == image->getHeight()-1 ? Z_FINISH: Z_NO_FLUSH);
 
     do {
-      zstream.next_out = (Bytef*)&compressed[0];
-      zstream.avail_out = compressed.size();
+      zstream.next_out = (Bytef*)&buffer[0];
+      zstream.avail_out = buffer.size();
 
-      // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
-
-      int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
       }
+
+      output.insert(output.end(), buffer.begin(),
+                    buffer.begin() + (buffer.size() - zstream.avail_out));
     } while (zstream.avail_out == 0);
+
+    if (zstream.avail_in > 0) {
+      deflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in deflate().", err);
+    }
   }
 
   err = deflateEnd(&zstream);
@@ -977,13 +1142,144 @@ static void write_compressed_image(FILE* f, Image* image)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void read_compressed_image(const std::vector<uint8_t>& data, Image* image)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB:       read_compressed_image<RgbTraits>(data, image); break;
+    case IMAGE_GRAYSCALE: read_compressed_image<GrayscaleTraits>(data, image); break;
+    case IMAGE_INDEXED:   read_compressed_image<IndexedTraits>(data, image); break;
+  }
+}
+
+static void write_compressed_image(Image* image, std::vector<uint8_t>& output)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB:       write_compressed_image<RgbTraits>(image, output); break;
+    case IMAGE_GRAYSCALE: write_compressed_image<GrayscaleTraits>(image, output); break;
+    case IMAGE_INDEXED:   write_compressed_image<IndexedTraits>(image, output); break;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Batch of cels
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+
+  class CompressCelTask {
+  public:
+    CompressCelTask(ASE_CelsBatch& batch) : m_batch(batch) { }
+
+    void operator()(int i) {
+      ASE_CelData* data = m_batch[i];
+      if (!data->image)
+        return;
+
+      try {
+        write_compressed_image(data->image, data->data);
+      }
+      catch (const std::exception& e) {
+        data->error = e.what();
+      }
+    }
+
+  private:
+    ASE_CelsBatch& m_batch;
+  };
+
+  class DecompressCelTask {
+  public:
+    DecompressCelTask(ASE_CelsBatch& batch) : m_batch(batch) { }
+
+    void operator()(int i) {
+      ASE_CelData* data = m_batch[i];
+      try {
+        read_compressed_image(data->data, data->image);
+      }
+      catch (const std::exception& e) {
+        data->error = e.what();
+      }
+      // The compressed data is not needed anymore
+      std::vector<uint8_t>().swap(data->data);
+    }
+
+  private:
+    ASE_CelsBatch& m_batch;
+  };
+
+} // anonymous namespace
+
+static void ase_file_collect_cels(Sprite* sprite, Layer* layer, FrameNumber frame,
+                                  ASE_CelsBatch& batch)
+{
+  if (layer->isImage()) {
+    Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
+    if (cel) {
+      int link_frame = ase_file_get_link_frame(static_cast<LayerImage*>(layer),
+                                               cel, sprite);
+      Image* image = (link_frame < 0 ? sprite->getStock()->getImage(cel->getImage()): NULL);
+      batch.add(cel, image, link_frame,
+                image ? image->getRowStrideSize() * image->getHeight(): 0);
+    }
+  }
+
+  if (layer->isFolder()) {
+    LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+    LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+    for (; it != end; ++it)
+      ase_file_collect_cels(sprite, *it, frame, batch);
+  }
+}
+
+// Fills the batch with the cels from "frame" to the next frames (at
+// least one complete frame, and until the batch is full if it's
+// possible) and compresses their images. Returns the first frame that
+// is not in the batch.
+static FrameNumber ase_file_compress_cels(Sprite* sprite, FrameNumber frame,
+                                          ASE_CelsBatch& batch)
+{
+  batch.clear();
+  do {
+    ase_file_collect_cels(sprite, sprite->getFolder(), frame, batch);
+    ++frame;
+  } while (frame < sprite->getTotalFrames() &&
+           !batch.isFull());
+
+  CompressCelTask task(batch);
+  base::parallel_for(0, batch.size(), task);
+
+  for (int i=0; i<batch.size(); ++i) {
+    if (!batch[i]->error.empty())
+      throw base::Exception(batch[i]->error);
+  }
+  return frame;
+}
+
+// Decompresses the images of all cels in the batch and clears it.
+static void ase_file_decompress_cels(ASE_CelsBatch& batch, FileOp* fop)
+{
+  DecompressCelTask task(batch);
+  base::parallel_for(0, batch.size(), task);
+
+  // OK, in case of error we can show the problem, but continue
+  // loading more cels.
+  for (int i=0; i<batch.size(); ++i) {
+    if (!batch[i]->error.empty())
+      fop_error(fop, "%s", batch[i]->error.c_str());
+  }
+
+  batch.clear();
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
 static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
                                     PixelFormat pixelFormat,
-                                    FileOp *fop, ASE_Header *header, size_t chunk_end)
+                                    FileOp *fop, ASE_Header *header, size_t chunk_end,
+                                    ASE_CelsBatch& batch)
 {
   /* read chunk data */
   LayerIndex layer_index = LayerIndex(fgetw(f));
@@ -1049,9 +1345,9 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
       Cel* link = static_cast<LayerImage*>(layer)->getCel(link_frame);
 
       if (link) {
-        // Create a copy of the linked cel (avoid using links cel)
-        Image* image = Image::createCopy(sprite->getStock()->getImage(link->getImage()));
-        cel->setImage(sprite->getStock()->addImage(image));
+        // Both cels share the same image in the stock (the image is
+        // copied when one of the cels is modified)
+        cel->setImage(link->getImage());
       }
       else {
         // Linked cel doesn't found
@@ -1068,28 +1364,14 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
       if (w > 0 && h > 0) {
         Image* image = Image::create(pixelFormat, w, h);
 
-        // Try to read pixel data
-        try {
-          switch (image->getPixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image, chunk_end, fop, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop_error(fop, e.what());
-        }
+        // Read the compressed data, it's decompressed later in
+        // ase_file_decompress_cels() with other cels.
+        long pos = ftell(f);
+        size_t size = (chunk_end > (size_t)pos ? chunk_end - pos: 0);
+        ASE_CelData* data = batch.add(cel.get(), image, -1, size);
+        data->data.resize(size);
+        if (size > 0)
+          data->data.resize(fread(&data->data[0], 1, size, f));
 
         cel->setImage(sprite->getStock()->addImage(image));
       }
@@ -1103,12 +1385,38 @@ static Cel *ase_file_read_cel_chunk(FILE *f, Sprite *sprite, FrameNumber frame,
   return newCel;
 }
 
-static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprite *sprite)
+// Returns the frame of a previous cel in the layer that can be
+// referenced from a link cel instead of saving the image of the given
+// cel again, or -1 if there is no such cel. The cels are linked only
+// if they share the same image of the stock (cels with different
+// images are saved separately even if their pixels are equal, so they
+// can be modified independently after loading the file).
+static int ase_file_get_link_frame(LayerImage* layer, Cel* cel, Sprite* sprite)
 {
+  if (!sprite->getStock()->getImage(cel->getImage()))
+    return -1;
+
+  int link_frame = -1;
+  for (CelIterator it=layer->getCelBegin(), end=layer->getCelEnd(); it != end; ++it) {
+    Cel* other = *it;
+    if (other->getFrame() < cel->getFrame() &&
+        other->getImage() == cel->getImage() &&
+        (link_frame < 0 || other->getFrame() < link_frame))
+      link_frame = other->getFrame();
+  }
+  return link_frame;
+}
+
+static void ase_file_write_cel_chunk(FILE *f, ASE_FrameHeader *frame_header, Cel *cel, LayerImage *layer, Sprite *sprite,
+                                     const ASE_CelData* data)
+{
+  ASSERT(data != NULL);
   int layer_index = sprite->layerToIndex(layer);
-  int cel_type = ASE_FILE_COMPRESSED_CEL;
+  int link_frame = data->link_frame;
+  int cel_type = (link_frame >= 0 ? ASE_FILE_LINK_CEL: ASE_FILE_COMPRESSED_CEL);
 
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_CEL);
+  ASE_Chunk chunk;
+  ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_CEL, &chunk);
 
   fputw(layer_index, f);
   fputw(cel->getX(), f);
@@ -1153,33 +1461,20 @@ static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprit
 
     case ASE_FILE_LINK_CEL:
       // Linked cel to another frame
-      //fputw(link->frame, f);
-      fputw(0, f);
+      fputw(link_frame, f);
       break;
 
     case ASE_FILE_COMPRESSED_CEL: {
-      Image* image = sprite->getStock()->getImage(cel->getImage());
+      Image* image = data->image;
 
       if (image) {
         // Width and height
         fputw(image->getWidth(), f);
         fputw(image->getHeight(), f);
 
-        // Pixel data
-        switch (image->getPixelFormat()) {
-
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        // Pixel data (compressed in ase_file_compress_cels())
+        if (!data->data.empty())
+          fwrite(&data->data[0], 1, data->data.size(), f);
       }
       else {
         // Width and height
@@ -1190,7 +1485,7 @@ static void ase_file_write_cel_chunk(FILE *f, Cel *cel, LayerImage *layer, Sprit
     }
   }
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, &chunk);
 }
 
 static Mask *ase_file_read_mask_chunk(FILE *f)
@@ -1221,12 +1516,13 @@ static Mask *ase_file_read_mask_chunk(FILE *f)
   return mask;
 }
 
-static void ase_file_write_mask_chunk(FILE *f, Mask *mask)
+static void ase_file_write_mask_chunk(FILE *f, ASE_FrameHeader *frame_header, Mask *mask)
 {
   int c, u, v, byte;
   const gfx::Rect& bounds(mask->getBounds());
 
-  ase_file_write_start_chunk(f, ASE_FILE_CHUNK_MASK);
+  ASE_Chunk chunk;
+  ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_MASK, &chunk);
 
   fputw(bounds.x, f);
   fputw(bounds.y, f);
@@ -1247,7 +1543,74 @@ static void ase_file_write_mask_chunk(FILE *f, Mask *mask)
       fputc(byte, f);
     }
 
-  ase_file_write_close_chunk(f);
+  ase_file_write_close_chunk(f, &chunk);
+}
+
+static Image* ase_file_read_thumbnail_chunk(FILE *f, size_t chunk_end)
+{
+  int w = fgetw(f);
+  int h = fgetw(f);
+  if (w < 1 || w > ASE_THUMBNAIL_SIZE ||
+      h < 1 || h > ASE_THUMBNAIL_SIZE)
+    return NULL;
+
+  // Compressed pixels until the end of the chunk
+  size_t pos = ftell(f);
+  if (pos >= chunk_end)
+    return NULL;
+
+  std::vector<uint8_t> data(chunk_end - pos);
+  if (fread(&data[0], 1, data.size(), f) != data.size())
+    return NULL;
+
+  base::UniquePtr<Image> image(Image::create(IMAGE_RGB, w, h));
+  read_compressed_image<RgbTraits>(data, image);
+  return image.release();
+}
+
+// Writes a flattened and reduced RGB version of the first frame.
+static void ase_file_write_thumbnail_chunk(FILE *f, ASE_FrameHeader *frame_header, Sprite *sprite)
+{
+  int w = sprite->getWidth();
+  int h = sprite->getHeight();
+  int thumb_w = MAX(1, w * ASE_THUMBNAIL_SIZE / MAX(w, h));
+  int thumb_h = MAX(1, h * ASE_THUMBNAIL_SIZE / MAX(w, h));
+  if (MAX(w, h) <= ASE_THUMBNAIL_SIZE) {
+    thumb_w = w;
+    thumb_h = h;
+  }
+
+  // Only the rows of the sprite used by the reduced image are
+  // rendered (one at a time), so big sprites don't need a full size
+  // image.
+  base::UniquePtr<Image> row(Image::create(sprite->getPixelFormat(), w, 1));
+  base::UniquePtr<Image> thumbnail(Image::create(sprite->getPixelFormat(), thumb_w, thumb_h));
+  clear_image(thumbnail, 0);
+
+  for (int v=0; v<thumb_h; ++v) {
+    sprite->render(row, 0, -(h*v/thumb_h), FrameNumber(0));
+    image_scale(thumbnail, row, 0, v, thumb_w, 1);
+  }
+
+  if (thumbnail->getPixelFormat() != IMAGE_RGB) {
+    thumbnail.reset(quantization::convert_pixel_format
+                    (thumbnail, IMAGE_RGB, DITHERING_NONE, NULL,
+                     sprite->getPalette(FrameNumber(0)),
+                     sprite->getBackgroundLayer() != NULL));
+  }
+
+  std::vector<uint8_t> data;
+  write_compressed_image<RgbTraits>(thumbnail, data);
+
+  ASE_Chunk chunk;
+  ase_file_write_start_chunk(f, frame_header, ASE_FILE_CHUNK_THUMBNAIL, &chunk);
+
+  fputw(thumb_w, f);
+  fputw(thumb_h, f);
+  if (!data.empty())
+    fwrite(&data[0], 1, data.size(), f);
+
+  ase_file_write_close_chunk(f, &chunk);
 }
 
 } // namespace app
@@ -652,6 +652,16 @@ void fop_post_load(FileOp* fop)
   }
 
   if (fop->document->getSprite() != NULL) {
+    // The decoders write the pixels directly in the images (without
+    // invalidating the modified rows), so the content of all images
+    // is invalidated here.
+    Stock* stock = fop->document->getSprite()->getStock();
+    for (int i=0; i<stock->size(); ++i) {
+      Image* image = stock->getImage(i);
+      if (image)
+        image->invalidateContent();
+    }
+
     // Creates a suitable palette for RGB images
     if (fop->document->getSprite()->getPixelFormat() == IMAGE_RGB &&
         fop->document->getSprite()->getPalettes().size() <= 1 &&
@@ -67,4 +67,10 @@ void FileFormat::destroyData(FileOp* fop)
   onDestroyData(fop);
 }
 
+raster::Image* FileFormat::loadThumbnail(const char* filename)
+{
+  ASSERT(support(FILE_SUPPORT_THUMBNAILS));
+  return onLoadThumbnail(filename);
+}
+
 } // namespace app
@@ -35,6 +35,11 @@
 #define FILE_SUPPORT_PALETTES           0x00000200
 #define FILE_SUPPORT_SEQUENCES          0x00000400
 #define FILE_SUPPORT_GET_FORMAT_OPTIONS 0x00000800
+#define FILE_SUPPORT_THUMBNAILS         0x00001000
+
+namespace raster {
+  class Image;
+}
 
 namespace app {
 
@@ -62,6 +67,12 @@ namespace app {
     // Destroys the custom data stored in "fop->format_data" field.
     void destroyData(FileOp* fop);
 
+    // Loads only the preview embedded in the file (reading just the
+    // needed parts of it), returning a new RGB image, or NULL if the
+    // file doesn't contain a preview. It can be used only if flags()
+    // returns FILE_SUPPORT_THUMBNAILS.
+    raster::Image* loadThumbnail(const char* filename);
+
     // Returns extra options for this format. It can return != NULL
     // only if flags() returns FILE_SUPPORT_GET_FORMAT_OPTIONS.
     SharedPtr<FormatOptions> getFormatOptions(FileOp* fop) {
@@ -82,6 +93,7 @@ namespace app {
     virtual bool onPostLoad(FileOp* fop) { return true; }
     virtual bool onSave(FileOp* fop) = 0;
     virtual void onDestroyData(FileOp* fop) { }
+    virtual raster::Image* onLoadThumbnail(const char* filename) { return NULL; }
 
     virtual SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) {
       return SharedPtr<FormatOptions>(0);
@@ -20,19 +20,34 @@
 #include "config.h"
 #endif
 
+#include "app/app.h"
+#include "app/console.h"
 #include "app/document.h"
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/find_widget.h"
+#include "app/ini_file.h"
+#include "app/load_widget.h"
 #include "app/modules/gui.h"
 #include "app/util/autocrop.h"
 #include "base/file_handle.h"
+#include "base/parallel_for.h"
+#include "base/thread.h"
 #include "base/unique_ptr.h"
+#include "gfx/region.h"
+#include "raster/color_histogram.h"
+#include "raster/color_tree.h"
 #include "raster/raster.h"
 #include "ui/alert.h"
+#include "ui/ui.h"
 
 #include <gif_lib.h>
 
+// Maximum number of bytes used by the images of a batch of frames
+// rendered by GifFramesRenderer (at least one frame is rendered).
+#define GIF_FRAMES_BATCH_BYTES          (64*1024*1024)
+
 namespace app {
 
 using namespace base;
@@ -72,6 +87,12 @@ struct GifData
 };
 
 class GifFormat : public FileFormat {
+  // Data for GIF files
+  class GifOptions : public FormatOptions {
+  public:
+    bool optimize;              // Global palette and frame-delta optimization
+  };
+
   const char* onGetName() const { return "gif"; }
   const char* onGetExtensions() const { return "gif"; }
   int onGetFlags() const {
@@ -84,13 +105,16 @@ class GifFormat : public FileFormat {
       FILE_SUPPORT_GRAYA |
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_FRAMES |
-      FILE_SUPPORT_PALETTES;
+      FILE_SUPPORT_PALETTES |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS;
   }
 
   bool onLoad(FileOp* fop);
   bool onPostLoad(FileOp* fop) OVERRIDE;
   void onDestroyData(FileOp* fop) OVERRIDE;
   bool onSave(FileOp* fop);
+
+  SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) OVERRIDE;
 };
 
 FileFormat* CreateGifFormat()
@@ -487,8 +511,550 @@ void GifFormat::onDestroyData(FileOp* fop)
   }
 }
 
+// Memoized nearest palette entries of RGB colors. It is a
+// direct-mapped table of exact colors (a color is searched in the
+// palette only the first time it's found in the table slot), so the
+// result is the same as Palette::findBestfit().
+class GifColorIndexCache {
+public:
+  enum { Bits = 14 };
+
+  GifColorIndexCache() : m_palette(NULL), m_entries(1 << Bits) {
+  }
+
+  void setPalette(const Palette* palette) {
+    if (m_palette == palette)
+      return;
+
+    m_palette = palette;
+    m_tree.reset(new ColorTree(palette));
+    std::fill(m_entries.begin(), m_entries.end(), Entry());
+  }
+
+  int getIndex(int r, int g, int b) {
+    // The bit 24 marks used entries
+    uint32_t key = ((r << 16) | (g << 8) | b | (1 << 24));
+    Entry& entry = m_entries[(key * 2654435761u) >> (32 - Bits)];
+
+    if (entry.key != key) {
+      entry.key = key;
+      entry.index = m_tree->findNearest(r, g, b);
+    }
+    return entry.index;
+  }
+
+private:
+  struct Entry {
+    uint32_t key;
+    int index;
+    Entry() : key(0), index(0) { }
+  };
+
+  const Palette* m_palette;
+  UniquePtr<ColorTree> m_tree;
+  std::vector<Entry> m_entries;
+};
+
+// Renders and converts to indexed a batch of consecutive frames of
+// the sprite using several threads. Only the area that changed from
+// the previous frame is converted to indexed, so each indexed image
+// is valid only inside its changed area. The batch has at most
+// maxBatchSize frames, and less if their images would need more than
+// GIF_FRAMES_BATCH_BYTES.
+class GifFramesRenderer {
+public:
+  GifFramesRenderer(const Sprite* sprite, int background_color, int transparent_index,
+                    int maxBatchSize)
+    : m_sprite(sprite)
+    , m_background_color(background_color)
+    , m_transparent_index(transparent_index)
+    , m_previousRendered(NULL)
+    , m_previousPalette(NULL)
+    , m_palette(NULL) {
+    int w = sprite->getWidth();
+    int h = sprite->getHeight();
+    bool indexed = (sprite->getPixelFormat() == IMAGE_INDEXED);
+
+    // Bytes of the indexed image, and the rendered image and colors
+    // cache of RGB/Grayscale sprites
+    int64_t slotBytes = (int64_t)w * h;
+    if (!indexed) {
+      UniquePtr<Image> row(Image::create(sprite->getPixelFormat(), w, 1));
+      slotBytes += (int64_t)row->getRowStrideSize() * h;
+      slotBytes += sizeof(GifColorIndexCache) + (1 << GifColorIndexCache::Bits) * 8;
+    }
+    int batchSize = (int)MID(1, GIF_FRAMES_BATCH_BYTES / MAX(1, slotBytes),
+                             MAX(1, maxBatchSize));
+    m_slots.resize(batchSize);
+
+    for (int i=0; i<batchSize; ++i) {
+      m_slots[i].indexed = Image::create(IMAGE_INDEXED, w, h);
+      m_slots[i].rendered = (indexed ? NULL: Image::create(sprite->getPixelFormat(), w, h));
+      m_slots[i].cache = (indexed ? NULL: new GifColorIndexCache);
+    }
+
+    if (!indexed)
+      m_previousRendered = Image::create(sprite->getPixelFormat(), w, h);
+  }
+
+  ~GifFramesRenderer() {
+    for (int i=0; i<(int)m_slots.size(); ++i) {
+      delete m_slots[i].indexed;
+      delete m_slots[i].rendered;
+      delete m_slots[i].cache;
+    }
+    delete m_previousRendered;
+  }
+
+  int batchSize() const { return (int)m_slots.size(); }
+
+  // Uses the given palette to convert all frames to indexed (instead
+  // of the sprite palette of each frame).
+  void setPalette(const Palette* palette) { m_palette = palette; }
+
+  // Renders "count" frames starting from "first" (frames must be
+  // rendered in order). If "convert" is false, frames are only
+  // rendered (see getRenderedImage()) and the next batch will start
+  // a new sequence of frames.
+  void renderBatch(FrameNumber first, int count, int nthreads, bool convert = true) {
+    ASSERT(count <= batchSize());
+
+    for (int i=0; i<count; ++i)
+      m_slots[i].frame = first.next(i);
+
+    RenderFunc render(this);
+    base::parallel_for(0, count, render, nthreads);
+
+    if (convert && m_sprite->getPixelFormat() != IMAGE_INDEXED) {
+      ConvertFunc convert(this);
+      base::parallel_for(0, count, convert, nthreads);
+
+      // Keep the last frame to compare the first frame of the next batch
+      std::swap(m_slots[count-1].rendered, m_previousRendered);
+      m_previousPalette = getPalette(m_slots[count-1].frame);
+    }
+    else
+      m_previousPalette = NULL;
+  }
+
+  // Rendered image of the i-th frame of the batch (in the sprite
+  // pixel format)
+  const Image* getRenderedImage(int i) const {
+    return (m_slots[i].rendered ? m_slots[i].rendered: m_slots[i].indexed);
+  }
+
+  // Indexed image of the i-th frame of the batch (only valid inside
+  // the changed area)
+  const Image* getIndexedImage(int i) const { return m_slots[i].indexed; }
+
+  // Area that changed from the previous frame
+  const gfx::Rect& getChangedArea(int i) const { return m_slots[i].changed; }
+
+private:
+  struct Slot {
+    FrameNumber frame;
+    Image* rendered;
+    Image* indexed;
+    GifColorIndexCache* cache;
+    gfx::Rect changed;
+  };
+
+  struct RenderFunc {
+    GifFramesRenderer* renderer;
+    RenderFunc(GifFramesRenderer* renderer) : renderer(renderer) { }
+    void operator()(int i) { renderer->renderFrame(i); }
+  };
+
+  struct ConvertFunc {
+    GifFramesRenderer* renderer;
+    ConvertFunc(GifFramesRenderer* renderer) : renderer(renderer) { }
+    void operator()(int i) { renderer->convertFrame(i); }
+  };
+
+  void renderFrame(int i) {
+    Slot& slot = m_slots[i];
+
+    if (slot.rendered) {
+      clear_image(slot.rendered, 0);
+      layer_render(m_sprite->getFolder(), slot.rendered, 0, 0, slot.frame);
+    }
+    // Indexed sprites are rendered directly in the indexed image
+    else {
+      clear_image(slot.indexed, m_background_color);
+      layer_render(m_sprite->getFolder(), slot.indexed, 0, 0, slot.frame);
+      slot.changed = gfx::Rect(0, 0, slot.indexed->getWidth(), slot.indexed->getHeight());
+    }
+  }
+
+  void convertFrame(int i) {
+    Slot& slot = m_slots[i];
+    const Palette* palette = getPalette(slot.frame);
+    const Image* previous;
+    const Palette* previousPalette;
+
+    if (i > 0) {
+      previous = m_slots[i-1].rendered;
+      previousPalette = getPalette(m_slots[i-1].frame);
+    }
+    else {
+      previous = (m_previousPalette ? m_previousRendered: NULL);
+      previousPalette = m_previousPalette;
+    }
+
+    // Get the area that changed from the previous frame
+    int x1, y1, x2, y2;
+    if (!previous || palette != previousPalette)
+      slot.changed = gfx::Rect(0, 0, slot.rendered->getWidth(), slot.rendered->getHeight());
+    else if (get_shrink_rect2(&x1, &y1, &x2, &y2,
+                              slot.rendered, const_cast<Image*>(previous)))
+      slot.changed = gfx::Rect(x1, y1, x2-x1+1, y2-y1+1);
+    else {
+      slot.changed = gfx::Rect();
+      return;
+    }
+
+    GifColorIndexCache* cache = slot.cache;
+    cache->setPalette(palette);
+
+    const gfx::Rect& rc = slot.changed;
+    slot.indexed->invalidateRows(rc.y, rc.h);
+    for (int y=rc.y; y<rc.y+rc.h; ++y) {
+      IndexedTraits::address_t dst =
+        (IndexedTraits::address_t)slot.indexed->getPixelAddress(rc.x, y);
+
+      switch (slot.rendered->getPixelFormat()) {
+
+        // Convert the RGB image to Indexed
+        case IMAGE_RGB: {
+          const uint32_t* src = (const uint32_t*)slot.rendered->getPixelAddress(rc.x, y);
+          for (int x=0; x<rc.w; ++x, ++src, ++dst)
+            *dst = (rgba_geta(*src) >= 128 ?
+                    cache->getIndex(rgba_getr(*src), rgba_getg(*src), rgba_getb(*src)):
+                    m_transparent_index);
+          break;
+        }
+
+        // Convert the Grayscale image to Indexed
+        case IMAGE_GRAYSCALE: {
+          const uint16_t* src = (const uint16_t*)slot.rendered->getPixelAddress(rc.x, y);
+          for (int x=0; x<rc.w; ++x, ++src, ++dst)
+            *dst = (graya_geta(*src) >= 128 ?
+                    cache->getIndex(graya_getv(*src), graya_getv(*src), graya_getv(*src)):
+                    m_transparent_index);
+          break;
+        }
+      }
+    }
+  }
+
+  const Palette* getPalette(FrameNumber frame) const {
+    return (m_palette ? m_palette: m_sprite->getPalette(frame));
+  }
+
+  const Sprite* m_sprite;
+  int m_background_color;
+  int m_transparent_index;
+  std::vector<Slot> m_slots;
+  Image* m_previousRendered;
+  const Palette* m_previousPalette;
+  const Palette* m_palette;
+
+  DISABLE_COPYING(GifFramesRenderer);
+};
+
+// Creates a GIF color map with the entries of the given palette.
+static ColorMapObject* create_color_map(const Palette* palette)
+{
+  ColorMapObject* color_map = MakeMapObject(palette->size(), NULL);
+  for (int i = 0; i < palette->size(); ++i) {
+    color_map->Colors[i].Red   = rgba_getr(palette->getEntry(i));
+    color_map->Colors[i].Green = rgba_getg(palette->getEntry(i));
+    color_map->Colors[i].Blue  = rgba_getb(palette->getEntry(i));
+  }
+  return color_map;
+}
+
+// Writes the graphics extension record (duration, disposal method and
+// transparent index) and the pixels of the given area of "image" as
+// the next frame of the GIF file.
+static void write_frame(GifFileType* gif_file, FrameNumber frame_num,
+                        const Image* image, const gfx::Rect& rc,
+                        int frame_duration, int disposal_method,
+                        int transparent_index,
+                        ColorMapObject* image_color_map,
+                        bool interlace)
+{
+  // Write graphics extension record (to save the duration of the
+  // frame and maybe the transparency index).
+  {
+    unsigned char extension_bytes[5];
+    int frame_delay = frame_duration / 10;
+
+    extension_bytes[0] = (((disposal_method & 7) << 2) |
+                          (transparent_index >= 0 ? 1: 0));
+    extension_bytes[1] = (frame_delay & 0xff);
+    extension_bytes[2] = (frame_delay >> 8) & 0xff;
+    extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
+
+    if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
+      throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
+  }
+
+  // Write the image record.
+  if (EGifPutImageDesc(gif_file,
+                       rc.x, rc.y,
+                       rc.w, rc.h, interlace ? 1: 0,
+                       image_color_map) == GIF_ERROR)
+    throw Exception("Error writing GIF frame %d.\n", (int)frame_num);
+
+  // Write the image data (pixels).
+  if (interlace) {
+    // Need to perform 4 passes on the images.
+    for (int i=0; i<4; ++i)
+      for (int y = interlaced_offset[i]; y < rc.h; y += interlaced_jumps[i]) {
+        IndexedTraits::address_t addr =
+          (IndexedTraits::address_t)image->getPixelAddress(rc.x, rc.y + y);
+
+        if (EGifPutLine(gif_file, addr, rc.w) == GIF_ERROR)
+          throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
+      }
+  }
+  else {
+    // Write all image scanlines (not interlaced in this case).
+    for (int y = 0; y < rc.h; ++y) {
+      IndexedTraits::address_t addr =
+        (IndexedTraits::address_t)image->getPixelAddress(rc.x, rc.y + y);
+
+      if (EGifPutLine(gif_file, addr, rc.w) == GIF_ERROR)
+        throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
+    }
+  }
+}
+
+// Returns the bounds of the pixels of "a" where "pred" is true
+// (indexed images of the same size are compared pixel by pixel).
+template<typename Pred>
+static gfx::Rect get_pixels_bounds(const Image* a, const Image* b, Pred pred)
+{
+  int x1 = a->getWidth(), y1 = -1, x2 = -1, y2 = -1;
+
+  for (int y=0; y<a->getHeight(); ++y) {
+    const uint8_t* pa = (const uint8_t*)a->getPixelAddress(0, y);
+    const uint8_t* pb = (const uint8_t*)b->getPixelAddress(0, y);
+    bool found = false;
+
+    for (int x=0; x<a->getWidth(); ++x) {
+      if (pred(pa[x], pb[x])) {
+        x1 = MIN(x1, x);
+        x2 = MAX(x2, x);
+        found = true;
+      }
+    }
+
+    if (found) {
+      if (y1 < 0)
+        y1 = y;
+      y2 = y;
+    }
+  }
+
+  if (y1 < 0)
+    return gfx::Rect();
+  else
+    return gfx::Rect(x1, y1, x2-x1+1, y2-y1+1);
+}
+
+// Pixels that are different in both images.
+struct DifferentPixel {
+  bool operator()(uint8_t a, uint8_t b) const { return a != b; }
+};
+
+// Opaque pixels of the current frame that are transparent in the next
+// one (the current frame must be disposed to clear them).
+struct ClearedPixel {
+  int transparent_index;
+  ClearedPixel(int transparent_index) : transparent_index(transparent_index) { }
+  bool operator()(uint8_t current, uint8_t next) const {
+    return (current != transparent_index && next == transparent_index);
+  }
+};
+
+// Writes frames of an optimized animation: unchanged pixels (compared
+// with the image displayed by the decoder) are saved as transparent,
+// which improves the LZW compression, and each frame uses the disposal
+// method that keeps most pixels of the next frame.
+class GifOptimizedFramesWriter {
+public:
+  GifOptimizedFramesWriter(GifFileType* gif_file, const Sprite* sprite,
+                           int transparent_index, bool interlace)
+    : m_gif_file(gif_file)
+    , m_sprite(sprite)
+    , m_transparent_index(transparent_index)
+    , m_interlace(interlace)
+    , m_canvas(Image::create(IMAGE_INDEXED, sprite->getWidth(), sprite->getHeight()))
+    , m_encoded(Image::create(IMAGE_INDEXED, sprite->getWidth(), sprite->getHeight()))
+    , m_previousPalette(NULL) {
+    clear_image(m_canvas, (transparent_index >= 0 ? transparent_index: 0));
+  }
+
+  // Writes the given frame image (the next frame is used to choose the
+  // disposal method, it's NULL for the last frame).
+  void writeFrame(FrameNumber frame_num, const Image* image, const Image* next,
+                  const Palette* palette) {
+    int t = m_transparent_index;
+    bool redraw_all = (frame_num == 0 || palette != m_previousPalette);
+    gfx::Rect bounds(0, 0, image->getWidth(), image->getHeight());
+    gfx::Rect rc;
+
+    // Get the pixels that aren't displayed yet (if the palette changes,
+    // the indexes of the displayed image have other colors)
+    if (redraw_all)
+      rc = bounds;
+    else
+      rc = get_pixels_bounds(image, m_canvas.get(), DifferentPixel());
+
+    // If there are opaque pixels that will be transparent in the next
+    // frame, this frame must be restored to the background color
+    // (transparent) after it is displayed.
+    int disposal_method = DISPOSAL_METHOD_DO_NOT_DISPOSE;
+    if (next && t >= 0) {
+      gfx::Rect cleared = get_pixels_bounds(image, next, ClearedPixel(t));
+      if (!cleared.isEmpty()) {
+        disposal_method = DISPOSAL_METHOD_RESTORE_BGCOLOR;
+        rc = rc.createUnion(cleared);
+      }
+    }
+
+    // GIF frames cannot be empty
+    if (rc.isEmpty())
+      rc = gfx::Rect(0, 0, 1, 1);
+
+    // Unchanged pixels are transparent (they keep the displayed ones)
+    m_encoded->invalidateRows(rc.y, rc.h);
+    for (int y=rc.y; y<rc.y+rc.h; ++y) {
+      const uint8_t* src = (const uint8_t*)image->getPixelAddress(rc.x, y);
+      const uint8_t* old = (const uint8_t*)m_canvas->getPixelAddress(rc.x, y);
+      uint8_t* dst = (uint8_t*)m_encoded->getPixelAddress(rc.x, y);
+
+      for (int x=0; x<rc.w; ++x)
+        dst[x] = ((t >= 0 && !redraw_all && src[x] == old[x]) ? t: src[x]);
+    }
+
+    ColorMapObject* image_color_map = NULL;
+    if (frame_num > 0 && palette != m_previousPalette)
+      image_color_map = create_color_map(palette);
+
+    write_frame(m_gif_file, frame_num, m_encoded, rc,
+                m_sprite->getFrameDuration(frame_num), disposal_method, t,
+                image_color_map, m_interlace);
+
+    // Update the image displayed by the decoder
+    gfx::Region rgn(rc);
+    copy_image(m_canvas, image, rgn);
+    if (disposal_method == DISPOSAL_METHOD_RESTORE_BGCOLOR)
+      fill_rect(m_canvas, rc.x, rc.y, rc.x+rc.w-1, rc.y+rc.h-1, t);
+
+    m_previousPalette = palette;
+  }
+
+private:
+  GifFileType* m_gif_file;
+  const Sprite* m_sprite;
+  int m_transparent_index;
+  bool m_interlace;
+  UniquePtr<Image> m_canvas;    // Image displayed by the decoder
+  UniquePtr<Image> m_encoded;   // Pixels of each frame to be written
+  const Palette* m_previousPalette;
+
+  DISABLE_COPYING(GifOptimizedFramesWriter);
+};
+
+// Creates one palette for all frames of a RGB or grayscale sprite
+// (the entry 0 is used for transparent pixels).
+static void create_global_palette(const Sprite* sprite, GifFramesRenderer& renderer,
+                                  int nthreads, Palette* palette)
+{
+  quantization::ColorHistogram<5, 6, 5> histogram;
+  FrameNumber total = sprite->getTotalFrames();
+
+  for (FrameNumber frame(0); frame<total; frame = frame.next(renderer.batchSize())) {
+    int count = MIN(renderer.batchSize(), (int)(total - frame));
+    renderer.renderBatch(frame, count, nthreads, false);
+
+    for (int i=0; i<count; ++i) {
+      const Image* image = renderer.getRenderedImage(i);
+
+      for (int y=0; y<image->getHeight(); ++y) {
+        uint32_t run_color = 0;
+        int run_length = 0;
+
+        for (int x=0; x<image->getWidth(); ++x) {
+          uint32_t color;
+          if (image->getPixelFormat() == IMAGE_RGB) {
+            color = get_pixel_fast<RgbTraits>(image, x, y);
+            color = (rgba_geta(color) >= 128 ? (color | rgba(0, 0, 0, 255)): 0);
+          }
+          else {
+            uint16_t gray = get_pixel_fast<GrayscaleTraits>(image, x, y);
+            color = (graya_geta(gray) >= 128 ?
+                     rgba(graya_getv(gray), graya_getv(gray), graya_getv(gray), 255): 0);
+          }
+
+          // Consecutive pixels of the same color are added together
+          if (run_length > 0 && color != run_color) {
+            if (run_color != 0)
+              histogram.addSamples(run_color, run_length);
+            run_length = 0;
+          }
+          run_color = color;
+          ++run_length;
+        }
+
+        if (run_length > 0 && run_color != 0)
+          histogram.addSamples(run_color, run_length);
+      }
+    }
+  }
+
+  palette->setEntry(0, rgba(0, 0, 0, 255));
+  histogram.createOptimizedPalette(palette, 1, 255);
+}
+
+// Returns an entry of the palette that is not used in any frame of
+// the indexed sprite, or -1 if all entries are used.
+static int find_unused_index(const Sprite* sprite, GifFramesRenderer& renderer,
+                             int nthreads, int palette_size)
+{
+  std::vector<bool> used(256, false);
+  FrameNumber total = sprite->getTotalFrames();
+
+  for (FrameNumber frame(0); frame<total; frame = frame.next(renderer.batchSize())) {
+    int count = MIN(renderer.batchSize(), (int)(total - frame));
+    renderer.renderBatch(frame, count, nthreads, false);
+
+    for (int i=0; i<count; ++i) {
+      const Image* image = renderer.getRenderedImage(i);
+
+      for (int y=0; y<image->getHeight(); ++y) {
+        const uint8_t* address = (const uint8_t*)image->getPixelAddress(0, y);
+        for (int x=0; x<image->getWidth(); ++x)
+          used[address[x]] = true;
+      }
+    }
+  }
+
+  for (int i=0; i<palette_size && i<256; ++i)
+    if (!used[i])
+      return i;
+
+  return -1;
+}
+
 bool GifFormat::onSave(FileOp* fop)
 {
+  SharedPtr<GifOptions> gif_options = fop->seq.format_options;
+  bool optimize = (gif_options != NULL && gif_options->optimize);
+
   UniquePtr<GifFileType, int(*)(GifFileType*)> gif_file
     (EGifOpenFileHandle(open_file_descriptor_with_exception(fop->filename, "wb")),
       EGifCloseFile);
@@ -505,78 +1071,105 @@ bool GifFormat::onSave(FileOp* fop)
   int background_color = (sprite_format == IMAGE_INDEXED ? sprite->getTransparentColor(): 0);
   int transparent_index = (sprite->getBackgroundLayer() ? -1: sprite->getTransparentColor());
 
-  Palette* current_palette = sprite->getPalette(FrameNumber(0));
-  Palette* previous_palette = current_palette;
-  ColorMapObject* color_map = MakeMapObject(current_palette->size(), NULL);
-  for (int i = 0; i < current_palette->size(); ++i) {
-    color_map->Colors[i].Red   = rgba_getr(current_palette->getEntry(i));
-    color_map->Colors[i].Green = rgba_getg(current_palette->getEntry(i));
-    color_map->Colors[i].Blue  = rgba_getb(current_palette->getEntry(i));
+  // Optimized RGB/Grayscale animations always have a transparent
+  // entry (for unchanged pixels).
+  if (optimize && sprite_format != IMAGE_INDEXED)
+    transparent_index = 0;
+
+  // Frames are rendered (and converted to Indexed if it's necessary)
+  // in batches using several threads, and then they are written in
+  // order.
+  int nthreads = base::thread::hardware_concurrency();
+  GifFramesRenderer renderer(sprite, background_color, transparent_index,
+                             MAX(1, nthreads) * 2);
+
+  // Palette for all frames of optimized RGB/Grayscale animations
+  UniquePtr<Palette> global_palette;
+  if (optimize) {
+    if (sprite_format != IMAGE_INDEXED) {
+      global_palette.reset(new Palette(FrameNumber(0), 256));
+      create_global_palette(sprite, renderer, nthreads, global_palette);
+      renderer.setPalette(global_palette);
+    }
+    // Indexed sprites with a background layer need an unused entry
+    // for unchanged pixels.
+    else if (transparent_index < 0) {
+      transparent_index = find_unused_index(sprite, renderer, nthreads,
+                                            sprite->getPalette(FrameNumber(0))->size());
+    }
   }
 
+  Palette* current_palette = (global_palette ? global_palette.get():
+                                               sprite->getPalette(FrameNumber(0)));
+  Palette* previous_palette = current_palette;
+  ColorMapObject* color_map = create_color_map(current_palette);
+
   if (EGifPutScreenDesc(gif_file, sprite_w, sprite_h,
                         color_map->BitsPerPixel,
                         background_color, color_map) == GIF_ERROR)
     throw Exception("Error writing GIF header.\n");
 
-  UniquePtr<Image> buffer_image;
+  // Specify loop extension.
+  if (loop >= 0) {
+    unsigned char extension_bytes[11];
+
+    memcpy(extension_bytes, "NETSCAPE2.0", 11);
+    if (EGifPutExtensionFirst(gif_file, APPLICATION_EXT_FUNC_CODE, 11, extension_bytes) == GIF_ERROR)
+      throw Exception("Error writing GIF graphics extension record for frame %d.\n", 0);
+
+    extension_bytes[0] = 1;
+    extension_bytes[1] = (loop & 0xff);
+    extension_bytes[2] = (loop >> 8) & 0xff;
+    if (EGifPutExtensionNext(gif_file, APPLICATION_EXT_FUNC_CODE, 3, extension_bytes) == GIF_ERROR)
+      throw Exception("Error writing GIF graphics extension record for frame %d.\n", 0);
+
+    if (EGifPutExtensionLast(gif_file, APPLICATION_EXT_FUNC_CODE, 0, NULL) == GIF_ERROR)
+      throw Exception("Error writing GIF graphics extension record for frame %d.\n", 0);
+  }
+
   UniquePtr<Image> current_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
   UniquePtr<Image> previous_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
   int frame_x, frame_y, frame_w, frame_h;
   int u1, v1, u2, v2;
   int i1, j1, i2, j2;
 
-  // If the sprite is not Indexed type, we will need a temporary
-  // buffer to render the full RGB or Grayscale sprite.
-  if (sprite_format != IMAGE_INDEXED)
-    buffer_image.reset(Image::create(sprite_format, sprite_w, sprite_h));
-
   clear_image(current_image, background_color);
   clear_image(previous_image, background_color);
 
-  for (FrameNumber frame_num(0); frame_num<sprite->getTotalFrames(); ++frame_num) {
-    current_palette = sprite->getPalette(frame_num);
-
-    // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
-    if (sprite_format != IMAGE_INDEXED) {
-      clear_image(buffer_image, 0);
-      layer_render(sprite->getFolder(), buffer_image, 0, 0, frame_num);
+  // In optimized animations each frame is written when the next one is
+  // rendered (to choose its disposal method).
+  UniquePtr<GifOptimizedFramesWriter> optimized_writer;
+  if (optimize)
+    optimized_writer.reset(new GifOptimizedFramesWriter(gif_file, sprite,
+                                                        transparent_index, interlace));
 
-      switch (sprite_format) {
+  int batch_index = renderer.batchSize();
 
-        // Convert the RGB image to Indexed
-        case IMAGE_RGB:
-          for (int y = 0; y < sprite_h; ++y)
-            for (int x = 0; x < sprite_w; ++x) {
-              uint32_t pixel_value = get_pixel_fast<RgbTraits>(buffer_image, x, y);
-              put_pixel_fast<IndexedTraits>(current_image, x, y,
-                                            (rgba_geta(pixel_value) >= 128) ?
-                                            current_palette->findBestfit(rgba_getr(pixel_value),
-                                                                         rgba_getg(pixel_value),
-                                                                         rgba_getb(pixel_value)):
-                                            transparent_index);
-            }
-          break;
+  for (FrameNumber frame_num(0); frame_num<sprite->getTotalFrames(); ++frame_num) {
+    current_palette = (global_palette ? global_palette.get():
+                                        sprite->getPalette(frame_num));
+
+    if (batch_index == renderer.batchSize()) {
+      renderer.renderBatch(frame_num,
+                           MIN(renderer.batchSize(), (int)(sprite->getTotalFrames() - frame_num)),
+                           nthreads);
+      batch_index = 0;
+    }
 
-        // Convert the Grayscale image to Indexed
-        case IMAGE_GRAYSCALE:
-          for (int y = 0; y < sprite_h; ++y)
-            for (int x = 0; x < sprite_w; ++x) {
-              uint16_t pixel_value = get_pixel_fast<GrayscaleTraits>(buffer_image, x, y);
-              put_pixel_fast<IndexedTraits>(current_image, x, y,
-                                            (graya_geta(pixel_value) >= 128) ?
-                                            current_palette->findBestfit(graya_getv(pixel_value),
-                                                                         graya_getv(pixel_value),
-                                                                         graya_getv(pixel_value)):
-                                            transparent_index);
-            }
-          break;
+    // Update the changed area of the current frame.
+    gfx::Region changed_area(renderer.getChangedArea(batch_index));
+    copy_image(current_image, renderer.getIndexedImage(batch_index), changed_area);
+    ++batch_index;
+
+    if (optimized_writer) {
+      if (frame_num > 0) {
+        FrameNumber previous_frame = frame_num.previous();
+        optimized_writer->writeFrame(previous_frame, previous_image, current_image,
+                                     (global_palette ? global_palette.get():
+                                                       sprite->getPalette(previous_frame)));
       }
-    }
-    // If the sprite is Indexed, we can render directly into "current_image".
-    else {
-      clear_image(current_image, background_color);
-      layer_render(sprite->getFolder(), current_image, 0, 0, frame_num);
+      copy_image(previous_image, current_image, changed_area);
+      continue;
     }
 
     if (frame_num == 0) {
@@ -598,88 +1191,69 @@ bool GifFormat::onSave(FileOp* fop)
       }
     }
 
-    // Specify loop extension.
-    if (frame_num == 0 && loop >= 0) {
-      unsigned char extension_bytes[11];
+    // Image color map
+    ColorMapObject* image_color_map = NULL;
+    if (current_palette != previous_palette) {
+      image_color_map = create_color_map(current_palette);
+      previous_palette = current_palette;
+    }
 
-      memcpy(extension_bytes, "NETSCAPE2.0", 11);
-      if (EGifPutExtensionFirst(gif_file, APPLICATION_EXT_FUNC_CODE, 11, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
+    write_frame(gif_file, frame_num, current_image,
+                gfx::Rect(frame_x, frame_y, frame_w, frame_h),
+                sprite->getFrameDuration(frame_num),
+                (sprite->getBackgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
+                                                DISPOSAL_METHOD_RESTORE_BGCOLOR),
+                transparent_index, image_color_map, interlace);
 
-      extension_bytes[0] = 1;
-      extension_bytes[1] = (loop & 0xff);
-      extension_bytes[2] = (loop >> 8) & 0xff;
-      if (EGifPutExtensionNext(gif_file, APPLICATION_EXT_FUNC_CODE, 3, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
+    copy_image(previous_image, current_image, changed_area);
+  }
 
-      if (EGifPutExtensionLast(gif_file, APPLICATION_EXT_FUNC_CODE, 0, NULL) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
-    }
+  // Write the last frame of the optimized animation
+  if (optimized_writer) {
+    FrameNumber last_frame = sprite->getLastFrame();
+    optimized_writer->writeFrame(last_frame, previous_image, NULL,
+                                 (global_palette ? global_palette.get():
+                                                   sprite->getPalette(last_frame)));
+  }
 
-    // Write graphics extension record (to save the duration of the
-    // frame and maybe the transparency index).
-    {
-      unsigned char extension_bytes[5];
-      int disposal_method = (sprite->getBackgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
-                                                            DISPOSAL_METHOD_RESTORE_BGCOLOR);
-      int frame_delay = sprite->getFrameDuration(frame_num) / 10;
+  return true;
+}
 
-      extension_bytes[0] = (((disposal_method & 7) << 2) |
-                            (transparent_index >= 0 ? 1: 0));
-      extension_bytes[1] = (frame_delay & 0xff);
-      extension_bytes[2] = (frame_delay >> 8) & 0xff;
-      extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
+// Shows the GIF configuration dialog.
+SharedPtr<FormatOptions> GifFormat::onGetFormatOptions(FileOp* fop)
+{
+  SharedPtr<GifOptions> gif_options(new GifOptions());
+  try {
+    // Configuration parameters
+    gif_options->optimize = get_config_bool("GIF", "Optimize", false);
 
-      if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
-    }
+    // Interactive mode
+    if (!App::instance()->isGui())
+      return gif_options;
 
-    // Image color map
-    ColorMapObject* image_color_map = NULL;
-    if (current_palette != previous_palette) {
-      image_color_map = MakeMapObject(current_palette->size(), NULL);
-      for (int i = 0; i < current_palette->size(); ++i) {
-        image_color_map->Colors[i].Red   = rgba_getr(current_palette->getEntry(i));
-        image_color_map->Colors[i].Green = rgba_getg(current_palette->getEntry(i));
-        image_color_map->Colors[i].Blue  = rgba_getb(current_palette->getEntry(i));
-      }
-      previous_palette = current_palette;
-    }
+    // Load the window to ask to the user the GIF options he wants.
+    UniquePtr<ui::Window> window(app::load_widget<ui::Window>("gif_options.xml", "gif_options"));
+    ui::Widget* optimize = app::find_widget<ui::Widget>(window, "optimize");
+    ui::Widget* ok = app::find_widget<ui::Widget>(window, "ok");
 
-    // Write the image record.
-    if (EGifPutImageDesc(gif_file,
-                         frame_x, frame_y,
-                         frame_w, frame_h, interlace ? 1: 0,
-                         image_color_map) == GIF_ERROR)
-      throw Exception("Error writing GIF frame %d.\n", (int)frame_num);
+    optimize->setSelected(gif_options->optimize);
 
-    // Write the image data (pixels).
-    if (interlace) {
-      // Need to perform 4 passes on the images.
-      for (int i=0; i<4; ++i)
-        for (int y = interlaced_offset[i]; y < frame_h; y += interlaced_jumps[i]) {
-          IndexedTraits::address_t addr =
-            (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
+    window->openWindowInForeground();
 
-          if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
-            throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
-        }
+    if (window->getKiller() == ok) {
+      gif_options->optimize = optimize->isSelected();
+      set_config_bool("GIF", "Optimize", gif_options->optimize);
     }
     else {
-      // Write all image scanlines (not interlaced in this case).
-      for (int y = 0; y < frame_h; ++y) {
-        IndexedTraits::address_t addr =
-          (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
-
-        if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
-          throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
-      }
+      gif_options.reset(NULL);
     }
 
-    copy_image(previous_image, current_image, 0, 0);
+    return gif_options;
+  }
+  catch (std::exception& e) {
+    Console::showException(e);
+    return SharedPtr<GifOptions>(0);
   }
-
-  return true;
 }
 
 } // namespace app
@@ -22,6 +22,7 @@
 
 #include <allegro.h>
 #include <cstdio>
+#include <cstdlib>
 
 #include "app/resource_finder.h"
 #include "base/fs.h"
@@ -175,5 +176,28 @@ void ResourceFinder::findConfigurationFile()
   // $BINDIR/aseprite.ini
   findInBinDir("aseprite.ini");
 }
+
+// The thumbnails cache is per-user (it is never in $BINDIR, which can
+// be shared by all users or read-only).
+void ResourceFinder::findThumbnailsDir()
+{
+#if defined ALLEGRO_UNIX || defined ALLEGRO_MACOSX
+
+  // $HOME/.aseprite-thumbnails
+  findInHomeDir(".aseprite-thumbnails");
+
+#elif defined ALLEGRO_WINDOWS
+
+  // %LOCALAPPDATA%/Aseprite/thumbnails
+  // %APPDATA%/Aseprite/thumbnails
+  const char* vars[] = { "LOCALAPPDATA", "APPDATA" };
+  for (int i=0; i<2; ++i) {
+    char* env = getenv(vars[i]);
+    if ((env) && (*env))
+      addPath(base::join_path(base::join_path(env, "Aseprite"), "thumbnails"));
+  }
+
+#endif
+}
   
 } // namespace app
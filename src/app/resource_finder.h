@@ -38,6 +38,7 @@ namespace app {
     void findInDocsDir(const char* filename);
     void findInHomeDir(const char* filename);
     void findConfigurationFile();
+    void findThumbnailsDir();
 
   private:
     // Disable copy
@@ -25,8 +25,14 @@
 #include "app/app.h"
 #include "app/document.h"
 #include "app/file/file.h"
+#include "app/file/file_format.h"
 #include "app/file_system.h"
+#include "app/resource_finder.h"
 #include "base/bind.h"
+#include "base/cfile.h"
+#include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/path.h"
 #include "base/scoped_lock.h"
 #include "base/thread.h"
 #include "raster/conversion_alleg.h"
@@ -37,76 +43,279 @@
 #include "raster/sprite.h"
 
 #include <allegro.h>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <vector>
 
 #define MAX_THUMBNAIL_SIZE              128
+#define MAX_THUMBNAIL_THREADS           4
+
+// Maximum size of the thumbnails cache. When the cache is bigger, the
+// oldest thumbnails are deleted until it is reduced to 3/4 of this size.
+#define MAX_THUMBNAILS_CACHE_SIZE       (32*1024*1024)
+
+// Magic number of the thumbnail files in the cache ("ATHM")
+#define THUMBNAIL_FILE_MAGIC            0x4d485441
 
 namespace app {
 
+//////////////////////////////////////////////////////////////////////
+// Thumbnails cache
+
+// Modification time and size of a file, used to know if the cached
+// thumbnail is still valid.
+struct FileStamp {
+  uint32_t time;
+  uint32_t sizeLo, sizeHi;
+};
+
+static FileStamp get_file_stamp(const base::string& filename)
+{
+#if (MAKE_VERSION(4, 2, 1) >= MAKE_VERSION(ALLEGRO_VERSION,             \
+                                           ALLEGRO_SUB_VERSION,         \
+                                           ALLEGRO_WIP_VERSION))
+  uint64_t size = file_size(filename.c_str());
+#else
+  uint64_t size = file_size_ex(filename.c_str());
+#endif
+
+  FileStamp stamp;
+  stamp.time = (uint32_t)file_time(filename.c_str());
+  stamp.sizeLo = (uint32_t)(size & 0xffffffff);
+  stamp.sizeHi = (uint32_t)(size >> 32);
+  return stamp;
+}
+
+// Returns the file in the cache directory for the thumbnail of the
+// given file (a FNV-1a hash of its full path).
+static base::string get_cache_filename(const base::string& cacheDir, const base::string& filename)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (base::string::const_iterator it=filename.begin(), end=filename.end(); it!=end; ++it) {
+    hash ^= (uint8_t)*it;
+    hash *= 1099511628211ULL;
+  }
+
+  char buf[32];
+  std::sprintf(buf, "%08x%08x.thumb",
+               (unsigned int)(hash >> 32),
+               (unsigned int)(hash & 0xffffffff));
+  return base::join_path(cacheDir, buf);
+}
+
+// Cached thumbnail file format (little endian):
+//
+//   DWORD   THUMBNAIL_FILE_MAGIC
+//   DWORD   Modification time of the file
+//   DWORD   Size of the file (low part)
+//   DWORD   Size of the file (high part)
+//   WORD    Length of the file name
+//   BYTE[]  File name (UTF-8)
+//   WORD    Thumbnail width
+//   WORD    Thumbnail height
+//   BYTE[]  RGB pixels (3 bytes per pixel)
+//
+static BITMAP* load_cached_thumbnail(const base::string& cacheFilename,
+                                     const base::string& filename,
+                                     const FileStamp& stamp)
+{
+  base::FileHandle handle(base::open_file(cacheFilename, "rb"));
+  FILE* f = handle.get();
+  if (!f)
+    return NULL;
+
+  if ((uint32_t)base::fgetl(f) != THUMBNAIL_FILE_MAGIC ||
+      (uint32_t)base::fgetl(f) != stamp.time ||
+      (uint32_t)base::fgetl(f) != stamp.sizeLo ||
+      (uint32_t)base::fgetl(f) != stamp.sizeHi)
+    return NULL;
+
+  // The file name is compared to avoid hash collisions
+  int len = base::fgetw(f);
+  if (len != (int)filename.size())
+    return NULL;
+
+  std::vector<char> name(len+1);
+  if ((int)std::fread(&name[0], 1, len, f) != len ||
+      filename.compare(0, len, &name[0], len) != 0)
+    return NULL;
+
+  int w = base::fgetw(f);
+  int h = base::fgetw(f);
+  if (w < 1 || w > MAX_THUMBNAIL_SIZE ||
+      h < 1 || h > MAX_THUMBNAIL_SIZE)
+    return NULL;
+
+  std::vector<uint8_t> pixels(w*h*3);
+  if (std::fread(&pixels[0], 1, pixels.size(), f) != pixels.size())
+    return NULL;
+
+  BITMAP* bmp = create_bitmap_ex(16, w, h);
+  if (!bmp)
+    return NULL;
+
+  const uint8_t* p = &pixels[0];
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x, p+=3)
+      putpixel(bmp, x, y, makecol16(p[0], p[1], p[2]));
+
+  return bmp;
+}
+
+// The thumbnail is written in a temporary file which is renamed when
+// it is complete, so other threads (or instances of the program)
+// never read a partially written thumbnail.
+static void save_cached_thumbnail(const base::string& cacheFilename,
+                                  const base::string& filename,
+                                  const FileStamp& stamp,
+                                  BITMAP* bmp)
+{
+  // Unique name for this thread (each thread has its own stack)
+  char suffix[64];
+  std::sprintf(suffix, ".%p.tmp", (void*)&suffix);
+  base::string tmpFilename = cacheFilename + suffix;
+
+  base::FileHandle handle(base::open_file(tmpFilename, "wb"));
+  FILE* f = handle.get();
+  if (!f)
+    return;
+
+  base::fputl(THUMBNAIL_FILE_MAGIC, f);
+  base::fputl(stamp.time, f);
+  base::fputl(stamp.sizeLo, f);
+  base::fputl(stamp.sizeHi, f);
+  base::fputw(filename.size(), f);
+  std::fwrite(filename.c_str(), 1, filename.size(), f);
+  base::fputw(bmp->w, f);
+  base::fputw(bmp->h, f);
+
+  std::vector<uint8_t> pixels(bmp->w*bmp->h*3);
+  uint8_t* p = &pixels[0];
+  for (int y=0; y<bmp->h; ++y)
+    for (int x=0; x<bmp->w; ++x, p+=3) {
+      int c = getpixel(bmp, x, y);
+      p[0] = getr16(c);
+      p[1] = getg16(c);
+      p[2] = getb16(c);
+    }
+
+  std::fwrite(&pixels[0], 1, pixels.size(), f);
+
+  bool ok = (std::ferror(f) == 0);
+  handle.reset();
+
+  if (ok) {
+#ifdef WIN32
+    // rename() doesn't replace existent files on Windows
+    std::remove(cacheFilename.c_str());
+#endif
+    ok = (std::rename(tmpFilename.c_str(), cacheFilename.c_str()) == 0);
+  }
+
+  if (!ok)
+    std::remove(tmpFilename.c_str());
+}
+
+struct CachedFile {
+  base::string filename;
+  time_t time;
+  int64_t size;
+
+  bool operator<(const CachedFile& other) const {
+    return time < other.time;
+  }
+};
+
+// Deletes the oldest thumbnails when the cache is bigger than
+// MAX_THUMBNAILS_CACHE_SIZE, and temporary files of old sessions.
+static void evict_cached_thumbnails(const base::string& cacheDir)
+{
+  std::vector<CachedFile> files;
+  int64_t total = 0;
+
+  struct al_ffblk info;
+  base::string pattern = base::join_path(cacheDir, "*");
+  if (al_findfirst(pattern.c_str(), &info, FA_ALL) != 0)
+    return;
+
+  do {
+    if (info.attrib & FA_DIREC)
+      continue;
+
+    base::string fn = base::join_path(cacheDir, info.name);
+    base::string ext = base::get_file_extension(fn);
+    if (ext == "tmp") {
+      // Temporary files older than one day were left by crashes
+      if (std::time(NULL) - info.time > 24*60*60)
+        std::remove(fn.c_str());
+    }
+    else if (ext == "thumb") {
+      CachedFile file = { fn, info.time, (int64_t)info.size };
+      files.push_back(file);
+      total += file.size;
+    }
+  } while (al_findnext(&info) == 0);
+  al_findclose(&info);
+
+  if (total <= MAX_THUMBNAILS_CACHE_SIZE)
+    return;
+
+  std::sort(files.begin(), files.end());
+  for (std::vector<CachedFile>::iterator it=files.begin(), end=files.end();
+       it != end && total > MAX_THUMBNAILS_CACHE_SIZE/4*3; ++it) {
+    if (std::remove(it->filename.c_str()) == 0)
+      total -= it->size;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Worker (a request to generate the thumbnail of one file)
+
 class ThumbnailGenerator::Worker {
 public:
-  Worker(FileOp* fop, IFileItem* fileitem)
+  Worker(FileOp* fop, IFileItem* fileitem, const base::string& cacheFilename)
     : m_fop(fop)
     , m_fileitem(fileitem)
-    , m_thumbnail(NULL)
-    , m_palette(NULL)
-    , m_thread(Bind<void>(&Worker::loadBgThread, this)) {
+    , m_filename(fileitem->getFileName())
+    , m_cacheFilename(cacheFilename)
+    , m_thumbnail(NULL) {
   }
 
   ~Worker() {
-    fop_stop(m_fop);
-    m_thread.join();
-
     fop_free(m_fop);
+
+    if (m_thumbnail)
+      destroy_bitmap(m_thumbnail);
   }
 
   IFileItem* getFileItem() { return m_fileitem; }
   bool isDone() const { return fop_is_done(m_fop); }
   double getProgress() const { return fop_get_progress(m_fop); }
+  void stop() { fop_stop(m_fop); }
 
-private:
-  void loadBgThread() {
+  // Returns the generated thumbnail (the caller is the new owner).
+  BITMAP* releaseThumbnail() {
+    BITMAP* bmp = m_thumbnail;
+    m_thumbnail = NULL;
+    return bmp;
+  }
+
+  // Called from a worker thread to generate the thumbnail.
+  void generateThumbnail() {
     try {
-      fop_operate(m_fop, NULL);
-
-      // Post load
-      fop_post_load(m_fop);
-
-      // Convert the loaded document into the Allegro bitmap "m_thumbnail".
-      const Sprite* sprite = (m_fop->document && m_fop->document->getSprite()) ? m_fop->document->getSprite():
-                                                                                 NULL;
-      if (!fop_is_stop(m_fop) && sprite) {
-        // The palette to convert the Image to a BITMAP
-        m_palette.reset(new Palette(*sprite->getPalette(FrameNumber(0))));
-
-        // Render the 'sprite' in one plain 'image'
-        base::UniquePtr<Image> image(Image::create(sprite->getPixelFormat(),
-                                             sprite->getWidth(),
-                                             sprite->getHeight()));
-        sprite->render(image, 0, 0, FrameNumber(0));
-
-        // Calculate the thumbnail size
-        int thumb_w = MAX_THUMBNAIL_SIZE * image->getWidth() / MAX(image->getWidth(), image->getHeight());
-        int thumb_h = MAX_THUMBNAIL_SIZE * image->getHeight() / MAX(image->getWidth(), image->getHeight());
-        if (MAX(thumb_w, thumb_h) > MAX(image->getWidth(), image->getHeight())) {
-          thumb_w = image->getWidth();
-          thumb_h = image->getHeight();
-        }
-        thumb_w = MID(1, thumb_w, MAX_THUMBNAIL_SIZE);
-        thumb_h = MID(1, thumb_h, MAX_THUMBNAIL_SIZE);
+      if (!fop_is_stop(m_fop)) {
+        FileStamp stamp = get_file_stamp(m_filename);
 
-        // Stretch the 'image'
-        m_thumbnail.reset(Image::create(image->getPixelFormat(), thumb_w, thumb_h));
-        clear_image(m_thumbnail, 0);
-        image_scale(m_thumbnail, image, 0, 0, thumb_w, thumb_h);
-      }
+        if (!m_cacheFilename.empty())
+          m_thumbnail = load_cached_thumbnail(m_cacheFilename, m_filename, stamp);
 
-      delete m_fop->document;
+        if (!m_thumbnail) {
+          loadThumbnail();
 
-      // Set the thumbnail of the file-item.
-      if (m_thumbnail) {
-        BITMAP* bmp = create_bitmap_ex(16, m_thumbnail->getWidth(), m_thumbnail->getHeight());
-        convert_image_to_allegro(m_thumbnail, bmp, 0, 0, m_palette);
-        m_fileitem->setThumbnail(bmp);
+          if (m_thumbnail && !m_cacheFilename.empty())
+            save_cached_thumbnail(m_cacheFilename, m_filename, stamp, m_thumbnail);
+        }
       }
     }
     catch (const std::exception& e) {
@@ -115,13 +324,76 @@ private:
     fop_done(m_fop);
   }
 
+private:
+  // Loads the document and converts its first frame into the Allegro
+  // bitmap "m_thumbnail".
+  void loadThumbnail() {
+    base::UniquePtr<Image> thumbnail;
+    base::UniquePtr<Palette> palette;
+
+    // Use the preview embedded in the file (if the format supports it)
+    // to avoid decoding the whole document.
+    if (m_fop->format->support(FILE_SUPPORT_THUMBNAILS)) {
+      thumbnail.reset(m_fop->format->loadThumbnail(m_filename.c_str()));
+      if (thumbnail) {
+        m_thumbnail = create_bitmap_ex(16, thumbnail->getWidth(), thumbnail->getHeight());
+        convert_image_to_allegro(thumbnail, m_thumbnail, 0, 0, NULL);
+        return;
+      }
+    }
+
+    fop_operate(m_fop, NULL);
+
+    // Post load
+    fop_post_load(m_fop);
+
+    const Sprite* sprite = (m_fop->document && m_fop->document->getSprite()) ? m_fop->document->getSprite():
+                                                                               NULL;
+    if (!fop_is_stop(m_fop) && sprite) {
+      // The palette to convert the Image to a BITMAP
+      palette.reset(new Palette(*sprite->getPalette(FrameNumber(0))));
+
+      // Render the 'sprite' in one plain 'image'
+      base::UniquePtr<Image> image(Image::create(sprite->getPixelFormat(),
+                                                 sprite->getWidth(),
+                                                 sprite->getHeight()));
+      sprite->render(image, 0, 0, FrameNumber(0));
+
+      // Calculate the thumbnail size
+      int thumb_w = MAX_THUMBNAIL_SIZE * image->getWidth() / MAX(image->getWidth(), image->getHeight());
+      int thumb_h = MAX_THUMBNAIL_SIZE * image->getHeight() / MAX(image->getWidth(), image->getHeight());
+      if (MAX(thumb_w, thumb_h) > MAX(image->getWidth(), image->getHeight())) {
+        thumb_w = image->getWidth();
+        thumb_h = image->getHeight();
+      }
+      thumb_w = MID(1, thumb_w, MAX_THUMBNAIL_SIZE);
+      thumb_h = MID(1, thumb_h, MAX_THUMBNAIL_SIZE);
+
+      // Stretch the 'image'
+      thumbnail.reset(Image::create(image->getPixelFormat(), thumb_w, thumb_h));
+      clear_image(thumbnail, 0);
+      image_scale(thumbnail, image, 0, 0, thumb_w, thumb_h);
+    }
+
+    delete m_fop->document;
+    m_fop->document = NULL;
+
+    if (thumbnail) {
+      m_thumbnail = create_bitmap_ex(16, thumbnail->getWidth(), thumbnail->getHeight());
+      convert_image_to_allegro(thumbnail, m_thumbnail, 0, 0, palette);
+    }
+  }
+
   FileOp* m_fop;
   IFileItem* m_fileitem;
-  base::UniquePtr<Image> m_thumbnail;
-  base::UniquePtr<Palette> m_palette;
-  base::thread m_thread;
+  base::string m_filename;
+  base::string m_cacheFilename;
+  BITMAP* m_thumbnail;
 };
 
+//////////////////////////////////////////////////////////////////////
+// ThumbnailGenerator
+
 static void delete_singleton(ThumbnailGenerator* singleton)
 {
   delete singleton;
@@ -137,6 +409,59 @@ ThumbnailGenerator* ThumbnailGenerator::instance()
   return singleton;
 }
 
+ThumbnailGenerator::ThumbnailGenerator()
+{
+  int nthreads = MID(1, base::thread::hardware_concurrency(), MAX_THUMBNAIL_THREADS);
+  Thread thread = { NULL, false };
+  m_threads.resize(nthreads, thread);
+
+  // Use the first cache directory that exists or can be created.
+  ResourceFinder rf;
+  rf.findThumbnailsDir();
+
+  while (const char* path = rf.next()) {
+    if (!base::directory_exists(path)) {
+      try {
+        // The parent directory could not exist too (e.g. the
+        // "Aseprite" directory in the Windows' application data).
+        base::string parent = base::get_file_path(path);
+        if (!parent.empty() && !base::directory_exists(parent))
+          base::make_directory(parent);
+
+        base::make_directory(path);
+      }
+      catch (const std::exception&) {
+        continue;
+      }
+    }
+    m_cacheDir = path;
+    break;
+  }
+
+  if (!m_cacheDir.empty())
+    evict_cached_thumbnails(m_cacheDir);
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+  stopAllWorkers();
+
+  for (std::vector<Thread>::iterator
+         it=m_threads.begin(), end=m_threads.end(); it!=end; ++it) {
+    if (it->thread) {
+      it->thread->join();
+      delete it->thread;
+    }
+  }
+
+  // The file-items could be already destroyed, so the thumbnails of
+  // finished workers are just discarded.
+  for (WorkerList::iterator
+         it=m_workers.begin(), end=m_workers.end(); it!=end; ++it) {
+    delete *it;
+  }
+}
+
 ThumbnailGenerator::WorkerStatus ThumbnailGenerator::getWorkerStatus(IFileItem* fileitem, double& progress)
 {
   base::scoped_lock hold(m_workersAccess);
@@ -163,8 +488,14 @@ bool ThumbnailGenerator::checkWorkers()
 
   for (WorkerList::iterator
          it=m_workers.begin(); it != m_workers.end(); ) {
-    if ((*it)->isDone()) {
-      delete *it;
+    Worker* worker = *it;
+    if (worker->isDone()) {
+      // Set the thumbnail of the file-item.
+      BITMAP* thumbnail = worker->releaseThumbnail();
+      if (thumbnail)
+        worker->getFileItem()->setThumbnail(thumbnail);
+
+      delete worker;
       it = m_workers.erase(it);
     }
     else {
@@ -194,36 +525,91 @@ void ThumbnailGenerator::addWorkerToGenerateThumbnail(IFileItem* fileitem)
     fop_free(fop);
   }
   else {
-    Worker* worker = new Worker(fop, fileitem);
+    base::string cacheFilename;
+    if (!m_cacheDir.empty())
+      cacheFilename = get_cache_filename(m_cacheDir, fileitem->getFileName());
+
+    Worker* worker = new Worker(fop, fileitem, cacheFilename);
     try {
       base::scoped_lock hold(m_workersAccess);
       m_workers.push_back(worker);
+
+      // The last requested thumbnail is the first one to be generated
+      // (it is the one that the user is waiting for).
+      m_queue.push_front(worker);
     }
     catch (...) {
       delete worker;
       throw;
     }
+
+    startThreads();
   }
 }
 
 void ThumbnailGenerator::stopAllWorkers()
 {
-  base::thread* ptr = new base::thread(Bind<void>(&ThumbnailGenerator::stopAllWorkersBackground, this));
-  m_stopThread.reset(ptr);
+  base::scoped_lock hold(m_workersAccess);
+
+  // Discard pending workers (no thread is using them)
+  for (std::deque<Worker*>::iterator
+         it=m_queue.begin(), end=m_queue.end(); it!=end; ++it) {
+    Worker* worker = *it;
+    m_workers.erase(std::find(m_workers.begin(), m_workers.end(), worker));
+    delete worker;
+  }
+  m_queue.clear();
+
+  // Cancel the current ones
+  for (WorkerList::iterator
+         it=m_workers.begin(), end=m_workers.end(); it!=end; ++it) {
+    (*it)->stop();
+  }
 }
 
-void ThumbnailGenerator::stopAllWorkersBackground()
+void ThumbnailGenerator::startThreads()
 {
-  WorkerList workersCopy;
-  {
-    base::scoped_lock hold(m_workersAccess);
-    workersCopy = m_workers;
-    m_workers.clear();
+  base::scoped_lock hold(m_workersAccess);
+
+  // Number of pending workers without a thread to process them.
+  int pending = (int)m_queue.size();
+
+  for (std::vector<Thread>::iterator
+         it=m_threads.begin(), end=m_threads.end(); it!=end && pending > 0; ++it) {
+    if (it->running) {
+      --pending;
+      continue;
+    }
+
+    // Join the thread if it has finished its previous job.
+    if (it->thread) {
+      it->thread->join();
+      delete it->thread;
+      it->thread = NULL;
+    }
+
+    it->running = true;
+    it->thread = new base::thread(Bind<void>(&ThumbnailGenerator::threadProc, this, &*it));
+    --pending;
   }
+}
 
-  for (WorkerList::iterator
-         it=workersCopy.begin(), end=workersCopy.end(); it!=end; ++it) {
-    delete *it;
+void ThumbnailGenerator::threadProc(Thread* thread)
+{
+  for (;;) {
+    Worker* worker;
+    {
+      base::scoped_lock hold(m_workersAccess);
+      if (m_queue.empty()) {
+        // The thread finishes (it is joined in startThreads() or in
+        // the destructor).
+        thread->running = false;
+        return;
+      }
+      worker = m_queue.front();
+      m_queue.pop_front();
+    }
+    worker->generateThumbnail();
   }
 }
 
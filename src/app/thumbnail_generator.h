@@ -20,8 +20,10 @@
 #define APP_THUMBNAIL_GENERATOR_H_INCLUDED
 
 #include "base/mutex.h"
+#include "base/string.h"
 #include "base/unique_ptr.h"
 
+#include <deque>
 #include <vector>
 
 namespace base {
@@ -31,12 +33,21 @@ namespace base {
 namespace app {
   class IFileItem;
 
+  // Generates thumbnails of files in background threads. Requests are
+  // processed by a fixed number of worker threads, the most recent
+  // request first (e.g. the item that the user has just selected).
+  // Generated thumbnails are saved in a cache directory, so they are
+  // loaded from there the next time (while the file has the same
+  // modification time and size).
   class ThumbnailGenerator {
   public:
     enum WorkerStatus { WithoutWorker, WorkingOnThumbnail, ThumbnailIsDone };
 
     static ThumbnailGenerator* instance();
 
+    ThumbnailGenerator();
+    ~ThumbnailGenerator();
+
     // Generate a thumbnail for the given file-item.  It must be called
     // from the GUI thread.
     void addWorkerToGenerateThumbnail(IFileItem* fileitem);
@@ -45,26 +56,43 @@ namespace app {
     // for the given file.
     WorkerStatus getWorkerStatus(IFileItem* fileitem, double& progress);
 
-    // Checks the status of workers. If there are workers that already
-    // done its job, we've to destroy them. This function must be called
-    // from the GUI thread (because a thread is joint to it).
-    // Returns true if there are workers generating thumbnails.
+    // Checks the status of workers. Generated thumbnails are given to
+    // their file-items, and finished requests are destroyed. This
+    // function must be called from the GUI thread (because threads are
+    // joined to it). Returns true if there are workers generating
+    // thumbnails.
     bool checkWorkers();
 
     // Stops all workers generating thumbnails. This is an non-blocking
-    // operation. The cancelation of all workers is done in a background
-    // thread.
+    // operation: pending requests are discarded, and the current ones
+    // are cancelled (they are destroyed in checkWorkers() when their
+    // threads stop).
     void stopAllWorkers();
 
   private:
-    void stopAllWorkersBackground();
-
     class Worker;
     typedef std::vector<Worker*> WorkerList;
 
+    struct Thread {
+      base::thread* thread;
+      bool running;
+    };
+
+    void startThreads();
+    void threadProc(Thread* thread);
+
+    // All requests that were not checked yet (pending, working, or done).
     WorkerList m_workers;
+
+    // Pending requests (the first one is the next to be processed).
+    std::deque<Worker*> m_queue;
+
+    std::vector<Thread> m_threads;
     base::mutex m_workersAccess;
-    base::UniquePtr<base::thread> m_stopThread;
+
+    // Directory where generated thumbnails are saved (empty if there
+    // is no cache).
+    base::string m_cacheDir;
   };
 } // namespace app
 
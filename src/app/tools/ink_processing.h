@@ -82,6 +82,7 @@ template<typename Derived, typename ImageTraits>
 class SimpleInkProcessing : public InkProcessing<Derived> {
 public:
   void initIterators(ToolLoop* loop, int x1, int y) {
+    loop->getDstImage()->invalidateRows(y, 1);
     m_dstAddress = (typename ImageTraits::address_t)loop->getDstImage()->getPixelAddress(x1, y);
   }
 
@@ -97,6 +98,7 @@ template<typename Derived, typename ImageTraits>
 class DoubleInkProcessing : public InkProcessing<Derived> {
 public:
   void initIterators(ToolLoop* loop, int x1, int y) {
+    loop->getDstImage()->invalidateRows(y, 1);
     m_srcAddress = (typename ImageTraits::address_t)loop->getSrcImage()->getPixelAddress(x1, y);
     m_dstAddress = (typename ImageTraits::address_t)loop->getDstImage()->getPixelAddress(x1, y);
   }
@@ -23,6 +23,7 @@
 #include "app/tools/intertwine.h"
 
 #include "app/tools/point_shape.h"
+#include "app/tools/stroke_spans.h"
 #include "app/tools/tool_loop.h"
 #include "raster/algo.h"
 
@@ -47,5 +48,15 @@ void Intertwine::doPointshapeLine(int x1, int y1, int x2, int y2, ToolLoop* loop
   algo_line(x1, y1, x2, y2, loop, (AlgoPixel)doPointshapePoint);
 }
 
+void Intertwine::doAccumulatePoint(int x, int y, AccumulateData* data)
+{
+  data->loop->getPointShape()->accumulatePoint(data->loop, x, y, *data->spans);
+}
+
+void Intertwine::doAccumulateHline(int x1, int y, int x2, AccumulateData* data)
+{
+  algo_line(x1, y, x2, y, data, (AlgoPixel)doAccumulatePoint);
+}
+
 } // namespace tools
 } // namespace app
@@ -25,6 +25,7 @@
 
 namespace app {
   namespace tools {
+    class StrokeSpans;
     class ToolLoop;
 
     class Intertwine {
@@ -41,6 +42,17 @@ namespace app {
       static void doPointshapePoint(int x, int y, ToolLoop* loop);
       static void doPointshapeHline(int x1, int y, int x2, ToolLoop* loop);
       static void doPointshapeLine(int x1, int y1, int x2, int y2, ToolLoop* loop);
+
+      // Same as doPointshapePoint/Hline() but the shape is added to
+      // data->spans (see PointShape::accumulatePoint()) instead of
+      // drawing it.
+      struct AccumulateData {
+        ToolLoop* loop;
+        StrokeSpans* spans;
+        AccumulateData(ToolLoop* loop, StrokeSpans* spans) : loop(loop), spans(spans) { }
+      };
+      static void doAccumulatePoint(int x, int y, AccumulateData* data);
+      static void doAccumulateHline(int x1, int y, int x2, AccumulateData* data);
     };
 
   } // namespace tools
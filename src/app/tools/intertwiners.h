@@ -43,8 +43,53 @@ public:
     if (points.size() == 0)
       return;
 
+    // If it's possible, we accumulate all the pen stamps of the lines
+    // in scanlines so the ink is applied only once per pixel (with
+    // big pens, each pixel is covered by several stamps).
+    if (loop->getPointShape()->canAccumulate()) {
+      AccumulateData data(loop, &m_spans);
+      m_spans.clear();
+      traceLines(points, loop->getFilled(), &data, (AlgoPixel)doAccumulatePoint);
+      loop->getPointShape()->transformSpans(loop, m_spans);
+    }
+    else {
+      traceLines(points, loop->getFilled(), loop, (AlgoPixel)doPointshapePoint);
+    }
+  }
+
+  void fillPoints(ToolLoop* loop, const Points& points)
+  {
+    if (points.size() < 3) {
+      joinPoints(loop, points);
+      return;
+    }
+
+    if (loop->getPointShape()->canAccumulate()) {
+      AccumulateData data(loop, &m_spans);
+      m_spans.clear();
+
+      // Contour
+      traceLines(points, loop->getFilled(), &data, (AlgoPixel)doAccumulatePoint);
+
+      // Fill content
+      algo_polygon(points.size(), (const int*)&points[0], &data, (AlgoHLine)doAccumulateHline);
+
+      loop->getPointShape()->transformSpans(loop, m_spans);
+    }
+    else {
+      // Contour
+      joinPoints(loop, points);
+
+      // Fill content
+      algo_polygon(points.size(), (const int*)&points[0], loop, (AlgoHLine)doPointshapeHline);
+    }
+  }
+
+private:
+  static void traceLines(const Points& points, bool closed, void* data, AlgoPixel proc)
+  {
     if (points.size() == 1) {
-      doPointshapePoint(points[0].x, points[0].y, loop);
+      proc(points[0].x, points[0].y, data);
     }
     else if (points.size() >= 2) {
       for (size_t c=0; c+1<points.size(); ++c) {
@@ -53,31 +98,19 @@ public:
         int x2 = points[c+1].x;
         int y2 = points[c+1].y;
 
-        algo_line(x1, y1, x2, y2, loop, (AlgoPixel)doPointshapePoint);
+        algo_line(x1, y1, x2, y2, data, proc);
       }
     }
 
     // Closed shape (polygon outline)
-    if (loop->getFilled()) {
+    if (closed) {
       algo_line(points[0].x, points[0].y,
                 points[points.size()-1].x,
-                points[points.size()-1].y, loop, (AlgoPixel)doPointshapePoint);
+                points[points.size()-1].y, data, proc);
     }
   }
 
-  void fillPoints(ToolLoop* loop, const Points& points)
-  {
-    if (points.size() < 3) {
-      joinPoints(loop, points);
-      return;
-    }
-
-    // Contour
-    joinPoints(loop, points);
-
-    // Fill content
-    algo_polygon(points.size(), (const int*)&points[0], loop, (AlgoHLine)doPointshapeHline);
-  }
+  StrokeSpans m_spans;
 };
 
 class IntertwineAsRectangles : public Intertwine {
@@ -24,6 +24,7 @@
 
 #include "app/settings/document_settings.h"
 #include "app/tools/ink.h"
+#include "app/tools/stroke_spans.h"
 #include "app/tools/tool_loop.h"
 #include "raster/image.h"
 
@@ -89,5 +90,10 @@ void PointShape::doInkHline(int x1, int y, int x2, ToolLoop* loop)
   }
 }
 
+void PointShape::transformSpans(ToolLoop* loop, const StrokeSpans& spans)
+{
+  spans.forEachSpan(loop, (AlgoHLine)doInkHline);
+}
+
 } // namespace tools
 } // namespace app
@@ -23,6 +23,7 @@
 
 namespace app {
   namespace tools {
+    class StrokeSpans;
     class ToolLoop;
 
     // Converts a point to a shape to be drawn
@@ -34,6 +35,18 @@ namespace app {
       virtual void transformPoint(ToolLoop* loop, int x, int y) = 0;
       virtual void getModifiedArea(ToolLoop* loop, int x, int y, gfx::Rect& area) = 0;
 
+      // Returns true if the shape can be accumulated in a StrokeSpans
+      // with accumulatePoint() (i.e. it's always the same shape and it
+      // doesn't depend on the image pixels).
+      virtual bool canAccumulate() { return false; }
+
+      // Adds to "spans" the scanlines that transformPoint() would draw.
+      virtual void accumulatePoint(ToolLoop* loop, int x, int y, StrokeSpans& spans) { }
+
+      // Applies the ink in all the accumulated scanlines (only once per
+      // pixel).
+      void transformSpans(ToolLoop* loop, const StrokeSpans& spans);
+
     protected:
       // Calls loop->getInk()->inkHline() function for each horizontal-scanline
       // that should be drawn (applying the "tiled" mode loop->getTiledMode())
@@ -41,6 +41,11 @@ public:
   {
     area = Rect(x, y, 1, 1);
   }
+  bool canAccumulate() { return true; }
+  void accumulatePoint(ToolLoop* loop, int x, int y, StrokeSpans& spans)
+  {
+    spans.addHline(x, y, x);
+  }
 };
 
 class PenPointShape : public PointShape {
@@ -67,6 +72,22 @@ public:
     area.x += x;
     area.y += y;
   }
+  bool canAccumulate() { return true; }
+  void accumulatePoint(ToolLoop* loop, int x, int y, StrokeSpans& spans)
+  {
+    Pen* pen = loop->getPen();
+    std::vector<PenScanline>::const_iterator scanline = pen->get_scanline().begin();
+    register int v, h = pen->getBounds().h;
+
+    x += pen->getBounds().x;
+    y += pen->getBounds().y;
+
+    for (v=0; v<h; ++v) {
+      if (scanline->state)
+        spans.addHline(x+scanline->x1, y+v, x+scanline->x2);
+      ++scanline;
+    }
+  }
 };
 
 class FloodFillPointShape : public PointShape {
@@ -0,0 +1,99 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/tools/stroke_spans.h"
+
+#include <algorithm>
+
+namespace app {
+namespace tools {
+
+StrokeSpans::StrokeSpans()
+  : m_y(0)
+{
+}
+
+void StrokeSpans::clear()
+{
+  m_rows.clear();
+  m_y = 0;
+}
+
+void StrokeSpans::addHline(int x1, int y, int x2)
+{
+  if (x1 > x2)
+    std::swap(x1, x2);
+
+  Spans& row = getRow(y);
+
+  // Skip spans that are completely at the left (and not adjacent)
+  Spans::iterator it = row.begin();
+  while (it != row.end() && it->x2+1 < x1)
+    ++it;
+
+  if (it == row.end() || x2+1 < it->x1) {
+    row.insert(it, Span(x1, x2));
+    return;
+  }
+
+  // Merge the new span with all overlapping/adjacent spans
+  it->x1 = std::min(it->x1, x1);
+  it->x2 = std::max(it->x2, x2);
+
+  Spans::iterator next = it+1;
+  while (next != row.end() && next->x1 <= it->x2+1) {
+    it->x2 = std::max(it->x2, next->x2);
+    ++next;
+  }
+  row.erase(it+1, next);
+}
+
+void StrokeSpans::forEachSpan(void* data, raster::AlgoHLine proc) const
+{
+  int y = m_y;
+
+  for (std::deque<Spans>::const_iterator row=m_rows.begin(), end=m_rows.end();
+       row != end; ++row, ++y) {
+    for (Spans::const_iterator it=row->begin(), end2=row->end(); it != end2; ++it)
+      proc(it->x1, y, it->x2, data);
+  }
+}
+
+StrokeSpans::Spans& StrokeSpans::getRow(int y)
+{
+  if (m_rows.empty()) {
+    m_rows.push_back(Spans());
+    m_y = y;
+  }
+  else if (y < m_y) {
+    m_rows.insert(m_rows.begin(), m_y-y, Spans());
+    m_y = y;
+  }
+  else if (y >= m_y+(int)m_rows.size()) {
+    m_rows.resize(y-m_y+1);
+  }
+
+  return m_rows[y-m_y];
+}
+
+} // namespace tools
+} // namespace app
@@ -0,0 +1,64 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_TOOLS_STROKE_SPANS_H_INCLUDED
+#define APP_TOOLS_STROKE_SPANS_H_INCLUDED
+
+#include "raster/algo.h"
+
+#include <deque>
+#include <vector>
+
+namespace app {
+  namespace tools {
+
+    // Union of horizontal spans grouped by scanline. It's used to
+    // accumulate the footprint of a whole stroke (e.g. the pen stamped
+    // in each point of a line) so then the ink can be applied only
+    // once per pixel.
+    class StrokeSpans {
+    public:
+      StrokeSpans();
+
+      void clear();
+      bool isEmpty() const { return m_rows.empty(); }
+
+      // Adds the pixels from x1 to x2 (inclusive) of the scanline y.
+      void addHline(int x1, int y, int x2);
+
+      // Calls "proc" for each span (from top to bottom and from left
+      // to right). Spans don't overlap each other.
+      void forEachSpan(void* data, raster::AlgoHLine proc) const;
+
+    private:
+      struct Span {
+        int x1, x2;
+        Span(int x1, int x2) : x1(x1), x2(x2) { }
+      };
+      typedef std::vector<Span> Spans;
+
+      Spans& getRow(int y);
+
+      std::deque<Spans> m_rows; // m_rows[i] has the spans of scanline m_y+i
+      int m_y;
+    };
+
+  } // namespace tools
+} // namespace app
+
+#endif
@@ -0,0 +1,128 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "app/tools/stroke_spans.h"
+
+#include <sstream>
+#include <string>
+
+using namespace app::tools;
+
+static void add_span_to_string(int x1, int y, int x2, void* data)
+{
+  std::ostringstream& os = *(std::ostringstream*)data;
+  os << "(" << x1 << "," << y << "," << x2 << ")";
+}
+
+// Returns the spans as a "(x1,y,x2)..." string.
+static std::string spans_string(const StrokeSpans& spans)
+{
+  std::ostringstream os;
+  spans.forEachSpan(&os, add_span_to_string);
+  return os.str();
+}
+
+TEST(StrokeSpans, Empty)
+{
+  StrokeSpans spans;
+  EXPECT_TRUE(spans.isEmpty());
+  EXPECT_EQ("", spans_string(spans));
+
+  spans.addHline(1, 2, 3);
+  EXPECT_FALSE(spans.isEmpty());
+
+  spans.clear();
+  EXPECT_TRUE(spans.isEmpty());
+  EXPECT_EQ("", spans_string(spans));
+}
+
+TEST(StrokeSpans, DisjointSpans)
+{
+  StrokeSpans spans;
+  spans.addHline(10, 0, 12);
+  spans.addHline(0, 0, 2);
+  spans.addHline(5, 0, 7);
+  EXPECT_EQ("(0,0,2)(5,0,7)(10,0,12)", spans_string(spans));
+
+  // Reversed extremes
+  spans.addHline(16, 0, 14);
+  EXPECT_EQ("(0,0,2)(5,0,7)(10,0,12)(14,0,16)", spans_string(spans));
+}
+
+TEST(StrokeSpans, AdjacentSpans)
+{
+  StrokeSpans spans;
+  spans.addHline(0, 0, 2);
+  spans.addHline(3, 0, 5);
+  EXPECT_EQ("(0,0,5)", spans_string(spans));
+
+  spans.addHline(-3, 0, -1);
+  EXPECT_EQ("(-3,0,5)", spans_string(spans));
+
+  // A span that fills the hole between two spans joins them
+  spans.addHline(8, 0, 9);
+  spans.addHline(6, 0, 7);
+  EXPECT_EQ("(-3,0,9)", spans_string(spans));
+}
+
+TEST(StrokeSpans, OverlappingSpans)
+{
+  StrokeSpans spans;
+  spans.addHline(0, 0, 4);
+  spans.addHline(2, 0, 6);
+  EXPECT_EQ("(0,0,6)", spans_string(spans));
+
+  // Inside an existent span
+  spans.addHline(1, 0, 3);
+  EXPECT_EQ("(0,0,6)", spans_string(spans));
+
+  // A span that covers several spans
+  spans.addHline(10, 0, 12);
+  spans.addHline(15, 0, 16);
+  spans.addHline(5, 0, 15);
+  EXPECT_EQ("(0,0,16)", spans_string(spans));
+
+  // The same pixel several times
+  spans.addHline(20, 0, 20);
+  spans.addHline(20, 0, 20);
+  EXPECT_EQ("(0,0,16)(20,0,20)", spans_string(spans));
+}
+
+TEST(StrokeSpans, Scanlines)
+{
+  StrokeSpans spans;
+  spans.addHline(0, 5, 1);
+  spans.addHline(0, 2, 1);
+  spans.addHline(0, 8, 1);
+  spans.addHline(1, 5, 3);
+
+  // From top to bottom (empty scanlines between them don't have spans)
+  EXPECT_EQ("(0,2,1)(0,5,3)(0,8,1)", spans_string(spans));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -27,6 +27,7 @@
 #include "app/tools/ink.h"
 #include "app/tools/intertwine.h"
 #include "app/tools/point_shape.h"
+#include "app/tools/stroke_spans.h"
 #include "app/tools/tool_group.h"
 #include "app/tools/tool_loop.h"
 #include "base/exception.h"
@@ -87,6 +87,10 @@ namespace app {
       // Should return an image where we can write pixels
       virtual Image* getDstImage() = 0;
 
+      // Prepares the given region (in src/dst image coordinates) of
+      // both images, so we can read/write their pixels in that area.
+      virtual void validateImages(const gfx::Region& rgn) = 0;
+
       // Returns the RGB map used to convert RGB values to palette index.
       virtual RgbMap* getRgbMap() = 0;
 
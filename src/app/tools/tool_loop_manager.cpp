@@ -35,6 +35,9 @@
 #include "raster/primitives.h"
 #include "raster/sprite.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 namespace app {
 namespace tools {
 
@@ -61,9 +64,12 @@ void ToolLoopManager::prepareLoop(const Pointer& pointer)
   // Start with no points at all
   m_points.clear();
 
-  // Prepare the image where we will draw on
-  copy_image(m_toolLoop->getDstImage(),
-             m_toolLoop->getSrcImage(), 0, 0);
+  // The destination image starts as a copy of the source image (its
+  // pixels are prepared on demand with ToolLoop::validateImages()).
+  // In tiled mode inks can read/write pixels in any part of the
+  // images, so they are prepared right now.
+  if (m_toolLoop->getDocumentSettings()->getTiledMode() != TILED_NONE)
+    m_toolLoop->validateImages(Region(m_toolLoop->getDstImage()->getBounds()));
 
   // Prepare the ink
   m_toolLoop->getInk()->prepareInk(m_toolLoop);
@@ -72,7 +78,7 @@ void ToolLoopManager::prepareLoop(const Pointer& pointer)
   // Prepare preview image (the destination image will be our preview
   // in the tool-loop time, so we can see what we are drawing)
   RenderEngine::setPreviewImage(m_toolLoop->getLayer(),
-                                m_toolLoop->getDstImage());
+                                m_toolLoop->getDstImage(), this);
 }
 
 void ToolLoopManager::releaseLoop(const Pointer& pointer)
@@ -149,6 +155,11 @@ void ToolLoopManager::movement(const Pointer& pointer)
   doLoopStep(false);
 }
 
+void ToolLoopManager::validatePreviewImage(const Rect& bounds)
+{
+  m_toolLoop->validateImages(Region(bounds));
+}
+
 void ToolLoopManager::doLoopStep(bool last_step)
 {
   Points points_to_interwine;
@@ -161,24 +172,37 @@ void ToolLoopManager::doLoopStep(bool last_step)
   for (size_t i=0; i<points_to_interwine.size(); ++i)
     points_to_interwine[i] += offset;
 
+  // Calculate the area to be updated in all document observers.
+  Region& dirty_area = m_toolLoop->getDirtyArea();
+  calculateDirtyArea(m_toolLoop, points_to_interwine, dirty_area);
+
+  // Prepare the pixels that the tool is going to read/modify.
+  validateImages(dirty_area);
+
   switch (m_toolLoop->getTracePolicy()) {
 
     case TracePolicyAccumulate:
       // Do nothing. We accumulate traces in the destination image.
       break;
 
-    case TracePolicyLast:
+    case TracePolicyLast: {
       // Copy source to destination (reset the previous trace). Useful
       // for tools like Line and Ellipse tools (we kept the last trace only).
-      clear_image(m_toolLoop->getDstImage(), 0);
-      copy_image(m_toolLoop->getDstImage(), m_toolLoop->getSrcImage(), 0, 0);
+      // Both images are different only in the area of the previous trace.
+      Region rgn(m_oldDirtyArea);
+      rgn.offset(offset);
+      copy_image(m_toolLoop->getDstImage(), m_toolLoop->getSrcImage(), rgn);
       break;
+    }
 
-    case TracePolicyOverlap:
+    case TracePolicyOverlap: {
       // Copy destination to source (yes, destination to source). In
       // this way each new trace overlaps the previous one.
-      copy_image(m_toolLoop->getSrcImage(), m_toolLoop->getDstImage(), 0, 0);
+      Region rgn(m_oldDirtyArea);
+      rgn.offset(offset);
+      copy_image(m_toolLoop->getSrcImage(), m_toolLoop->getDstImage(), rgn);
       break;
+    }
   }
 
   // Get the modified area in the sprite with this intertwined set of points
@@ -187,15 +211,12 @@ void ToolLoopManager::doLoopStep(bool last_step)
   else
     m_toolLoop->getIntertwine()->fillPoints(m_toolLoop, points_to_interwine);
 
-  // Calculate the area to be updated in all document observers.
-  Region& dirty_area = m_toolLoop->getDirtyArea();
-  calculateDirtyArea(m_toolLoop, points_to_interwine, dirty_area);
-
-  if (m_toolLoop->getTracePolicy() == TracePolicyLast) {
-    Region prev_dirty_area = dirty_area;
+  // Remember the area of this trace (it's the only area where the
+  // source and destination images can be different).
+  Region prev_dirty_area = dirty_area;
+  if (m_toolLoop->getTracePolicy() == TracePolicyLast)
     dirty_area.createUnion(dirty_area, m_oldDirtyArea);
-    m_oldDirtyArea = prev_dirty_area;
-  }
+  m_oldDirtyArea = prev_dirty_area;
 
   if (!dirty_area.isEmpty())
     m_toolLoop->updateDirtyArea();
@@ -211,6 +232,26 @@ void ToolLoopManager::snapToGrid(Point& point)
   m_toolLoop->getDocumentSettings()->snapToGrid(point);
 }
 
+// Prepares the source/destination images in the given area (in
+// sprite coordinates).
+void ToolLoopManager::validateImages(const Region& area)
+{
+  // Some inks read pixels around the modified area (e.g. blur and
+  // jumble inks).
+  Point speed = m_toolLoop->getSpeed();
+  int border = 1 + std::max(std::abs(speed.x), std::abs(speed.y)) / 4;
+
+  Region rgn;
+  for (Region::const_iterator it=area.begin(), end=area.end(); it != end; ++it) {
+    Rect rc = *it;
+    rc.offset(m_toolLoop->getOffset());
+    rc.enlarge(border);
+    rgn.createUnion(rgn, Region(rc));
+  }
+
+  m_toolLoop->validateImages(rgn);
+}
+
 void ToolLoopManager::calculateDirtyArea(ToolLoop* loop, const Points& points, Region& dirty_area)
 {
   dirty_area.clear();
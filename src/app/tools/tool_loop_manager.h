@@ -21,6 +21,8 @@
 
 #include <vector>
 
+#include "app/util/render.h"
+#include "base/compiler_specific.h"
 #include "gfx/point.h"
 #include "gfx/region.h"
 
@@ -47,7 +49,7 @@ namespace app {
     // 5. When the user release the mouse:
     //    - ToolLoopManager::releaseButton
     //    - ToolLoopManager::releaseLoop
-    class ToolLoopManager {
+    class ToolLoopManager : public PreviewImageDelegate {
     public:
 
       // Simple container of mouse events information.
@@ -93,11 +95,15 @@ namespace app {
       // Should be called each time the user moves the mouse inside the editor.
       void movement(const Pointer& pointer);
 
+      // PreviewImageDelegate implementation
+      void validatePreviewImage(const gfx::Rect& bounds) OVERRIDE;
+
     private:
       typedef std::vector<gfx::Point> Points;
 
       void doLoopStep(bool last_step);
       void snapToGrid(gfx::Point& point);
+      void validateImages(const gfx::Region& area);
 
       static void calculateDirtyArea(ToolLoop* loop,
                                      const Points& points,
@@ -31,6 +31,7 @@
 #include "app/ui/editor/editor.h"
 #include "app/ui_context.h"
 #include "app/util/boundary.h"
+#include "app/util/render.h"
 #include "base/memory.h"
 #include "raster/image.h"
 #include "raster/layer.h"
@@ -320,7 +321,8 @@ void Editor::editor_draw_cursor(int x, int y, bool refresh)
         (m_sprite,
          gfx::Region(gfx::Rect(x+penBounds.x,
                                y+penBounds.y,
-                               penBounds.w, penBounds.h)));
+                               penBounds.w, penBounds.h)),
+         m_layer);
     }
   }
 
@@ -374,7 +376,7 @@ void Editor::editor_move_cursor(int x, int y, bool refresh)
       gfx::Rect rc1(old_x+penBounds.x, old_y+penBounds.y, penBounds.w, penBounds.h);
       gfx::Rect rc2(new_x+penBounds.x, new_y+penBounds.y, penBounds.w, penBounds.h);
       m_document->notifySpritePixelsModified
-        (m_sprite, gfx::Region(rc1.createUnion(rc2)));
+        (m_sprite, gfx::Region(rc1.createUnion(rc2)), m_layer);
     }
 
     /* save area and draw the cursor */
@@ -436,7 +438,8 @@ void Editor::editor_clean_cursor(bool refresh)
         (m_sprite,
          gfx::Region(gfx::Rect(x+penBounds.x,
                                y+penBounds.y,
-                               penBounds.w, penBounds.h)));
+                               penBounds.w, penBounds.h)),
+         m_layer);
     }
   }
 
@@ -572,12 +575,12 @@ static void editor_cursor_cross(Editor* editor, int x, int y, int color, int thi
         editor->editorToScreen(x, y, &xout, &yout);
 
         xout += ((u<3) ?
-                 u-((thickness>>1)<<zoom)-3:
-                 u-((thickness>>1)<<zoom)-3+(thickness<<zoom));
+                 u-apply_zoom(thickness>>1, zoom)-3:
+                 u-apply_zoom(thickness>>1, zoom)-3+apply_zoom(thickness, zoom));
 
         yout += ((v<3)?
-                 v-((thickness>>1)<<zoom)-3:
-                 v-((thickness>>1)<<zoom)-3+(thickness<<zoom));
+                 v-apply_zoom(thickness>>1, zoom)-3:
+                 v-apply_zoom(thickness>>1, zoom)-3+apply_zoom(thickness, zoom));
 
         (*pixel)(ji_screen, xout, yout, color);
       }
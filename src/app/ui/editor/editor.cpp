@@ -89,11 +89,13 @@ public:
 
   void fillRect(const gfx::Rect& rect, uint32_t rgbaColor, int opacity) OVERRIDE
   {
+    gfx::Rect rc = apply_zoom(rect, m_zoom);
+
     blend_rect(m_image,
-               m_offset.x + (rect.x << m_zoom),
-               m_offset.y + (rect.y << m_zoom),
-               m_offset.x + ((rect.x+rect.w) << m_zoom) - 1,
-               m_offset.y + ((rect.y+rect.h) << m_zoom) - 1, rgbaColor, opacity);
+               m_offset.x + rc.x,
+               m_offset.y + rc.y,
+               m_offset.x + rc.x + rc.w - 1,
+               m_offset.y + rc.y + rc.h - 1, rgbaColor, opacity);
   }
 
 private:
@@ -136,6 +138,7 @@ Editor::Editor(Document* document, EditorFlags flags)
   , m_layer(m_sprite->getFolder()->getFirstLayer())
   , m_frame(FrameNumber(0))
   , m_zoom(0)
+  , m_renderBuffer(new ImageBuffer(1))
   , m_mask_timer(100, this)
   , m_customizationDelegate(NULL)
   , m_docView(NULL)
@@ -336,12 +339,14 @@ void Editor::updateEditor()
 void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, int dx, int dy)
 {
   // Output information
-  int source_x = rc.x << m_zoom;
-  int source_y = rc.y << m_zoom;
+  gfx::Rect screenRc = apply_zoom(rc, m_zoom);
+  gfx::Rect spriteRc = apply_zoom(gfx::Rect(0, 0, m_sprite->getWidth(), m_sprite->getHeight()), m_zoom);
+  int source_x = screenRc.x;
+  int source_y = screenRc.y;
   int dest_x   = dx + m_offset_x + source_x;
   int dest_y   = dy + m_offset_y + source_y;
-  int width    = rc.w << m_zoom;
-  int height   = rc.h << m_zoom;
+  int width    = screenRc.w;
+  int height   = screenRc.h;
 
   // Clip from graphics/screen
   const gfx::Rect& clip = g->getClipBounds();
@@ -373,11 +378,11 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, in
     dest_y -= source_y;
     source_y = 0;
   }
-  if (source_x+width > (m_sprite->getWidth() << m_zoom)) {
-    width = (m_sprite->getWidth() << m_zoom) - source_x;
+  if (source_x+width > spriteRc.w) {
+    width = spriteRc.w - source_x;
   }
-  if (source_y+height > (m_sprite->getHeight() << m_zoom)) {
-    height = (m_sprite->getHeight() << m_zoom) - source_y;
+  if (source_y+height > spriteRc.h) {
+    height = spriteRc.h - source_y;
   }
 
   // Draw the sprite
@@ -387,7 +392,7 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, in
     // Generate the rendered image
     base::UniquePtr<Image> rendered
       (renderEngine.renderSprite(source_x, source_y, width, height,
-                                 m_frame, m_zoom, true));
+                                 m_frame, m_zoom, true, m_renderBuffer));
 
     if (rendered) {
       // Pre-render decorator.
@@ -397,10 +402,12 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, in
         m_decorator->preRenderDecorator(&preRender);
       }
 
-      SharedPtr<BITMAP> tmp(create_bitmap(width, height), destroy_bitmap);
-      convert_image_to_allegro(rendered, tmp, 0, 0, m_sprite->getPalette(m_frame));
-
-      g->blit(tmp, 0, 0, dest_x, dest_y, width, height);
+      // Convert the image directly in the Graphics bitmap (the
+      // destination rectangle is already clipped).
+      convert_image_to_allegro(rendered, g->getInternalBitmap(),
+                               g->getInternalDeltaX() + dest_x,
+                               g->getInternalDeltaY() + dest_y,
+                               m_sprite->getPalette(m_frame));
     }
   }
 
@@ -434,11 +441,9 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, in
 void Editor::drawSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc)
 {
   gfx::Rect client = getClientBounds();
-  gfx::Rect spriteRect(
-    client.x + m_offset_x,
-    client.y + m_offset_y,
-    (m_sprite->getWidth() << m_zoom),
-    (m_sprite->getHeight() << m_zoom));
+  gfx::Rect spriteRect =
+    apply_zoom(gfx::Rect(0, 0, m_sprite->getWidth(), m_sprite->getHeight()), m_zoom);
+  spriteRect.offset(client.x + m_offset_x, client.y + m_offset_y);
   gfx::Rect enclosingRect = spriteRect;
 
   // Draw the main sprite at the center.
@@ -547,10 +552,10 @@ void Editor::drawMask()
   const BoundSeg* seg = m_document->getBoundariesSegments();
 
   for (c=0; c<nseg; ++c, ++seg) {
-    x1 = seg->x1<<m_zoom;
-    y1 = seg->y1<<m_zoom;
-    x2 = seg->x2<<m_zoom;
-    y2 = seg->y2<<m_zoom;
+    x1 = apply_zoom(seg->x1, m_zoom);
+    y1 = apply_zoom(seg->y1, m_zoom);
+    x2 = apply_zoom(seg->x2, m_zoom);
+    y2 = apply_zoom(seg->y2, m_zoom);
 
 #if 1                           // Bounds inside mask
     if (!seg->open)
@@ -646,6 +651,10 @@ void Editor::drawGrid(const Rect& gridBounds, const app::Color& color)
   // Convert the "grid" rectangle to screen coordinates
   editorToScreen(grid, &grid);
 
+  // The grid is too small to be drawn (zoomed out)
+  if (grid.w < 1 || grid.h < 1)
+    return;
+
   // Get the grid's color
   int grid_color = color_utils::color_for_allegro(color, bitmap_color_depth(ji_screen));
 
@@ -752,8 +761,8 @@ void Editor::screenToEditor(int xin, int yin, int* xout, int* yout)
   Rect vp = view->getViewportBounds();
   Point scroll = view->getViewScroll();
 
-  *xout = (xin - vp.x + scroll.x - m_offset_x) >> m_zoom;
-  *yout = (yin - vp.y + scroll.y - m_offset_y) >> m_zoom;
+  *xout = remove_zoom(xin - vp.x + scroll.x - m_offset_x, m_zoom);
+  *yout = remove_zoom(yin - vp.y + scroll.y - m_offset_y, m_zoom);
 }
 
 void Editor::screenToEditor(const Rect& in, Rect* out)
@@ -770,8 +779,8 @@ void Editor::editorToScreen(int xin, int yin, int* xout, int* yout)
   Rect vp = view->getViewportBounds();
   Point scroll = view->getViewScroll();
 
-  *xout = (vp.x - scroll.x + m_offset_x + (xin << m_zoom));
-  *yout = (vp.y - scroll.y + m_offset_y + (yin << m_zoom));
+  *xout = (vp.x - scroll.x + m_offset_x + apply_zoom(xin, m_zoom));
+  *yout = (vp.y - scroll.y + m_offset_y + apply_zoom(yin, m_zoom));
 }
 
 void Editor::editorToScreen(const Rect& in, Rect* out)
@@ -863,8 +872,8 @@ void Editor::centerInSpritePoint(int x, int y)
 
   hideDrawingCursor();
 
-  x = m_offset_x - (vp.w/2) + ((1<<m_zoom)>>1) + (x << m_zoom);
-  y = m_offset_y - (vp.h/2) + ((1<<m_zoom)>>1) + (y << m_zoom);
+  x = m_offset_x - (vp.w/2) + (apply_zoom(1, m_zoom)>>1) + apply_zoom(x, m_zoom);
+  y = m_offset_y - (vp.h/2) + (apply_zoom(1, m_zoom)>>1) + apply_zoom(y, m_zoom);
 
   updateEditor();
   setEditorScroll(x, y, false);
@@ -1022,8 +1031,10 @@ void Editor::onPreferredSize(PreferredSizeEvent& ev)
     m_offset_x = std::max<int>(vp.w/2, vp.w - m_sprite->getWidth()/2);
     m_offset_y = std::max<int>(vp.h/2, vp.h - m_sprite->getHeight()/2);
 
-    sz.w = (m_sprite->getWidth() << m_zoom) + m_offset_x*2;
-    sz.h = (m_sprite->getHeight() << m_zoom) + m_offset_y*2;
+    gfx::Rect spriteRc = apply_zoom(gfx::Rect(0, 0, m_sprite->getWidth(), m_sprite->getHeight()), m_zoom);
+
+    sz.w = spriteRc.w + m_offset_x*2;
+    sz.h = spriteRc.h + m_offset_y*2;
   }
   else {
     sz.w = 4;
@@ -1142,8 +1153,8 @@ void Editor::setZoomAndCenterInMouse(int zoom, int mouse_x, int mouse_y)
     my = mouse_y;
   }
 
-  x = m_offset_x - (mx - vp.x) + ((1<<zoom)>>1) + (x << zoom);
-  y = m_offset_y - (my - vp.y) + ((1<<zoom)>>1) + (y << zoom);
+  x = m_offset_x - (mx - vp.x) + (apply_zoom(1, zoom)>>1) + apply_zoom(x, zoom);
+  y = m_offset_y - (my - vp.y) + (apply_zoom(1, zoom)>>1) + apply_zoom(y, zoom);
 
   if ((m_zoom != zoom) ||
       (m_cursor_editor_x != mx) ||
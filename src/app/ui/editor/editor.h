@@ -29,11 +29,12 @@
 #include "base/signal.h"
 #include "gfx/fwd.h"
 #include "raster/frame_number.h"
+#include "raster/image_buffer.h"
 #include "ui/base.h"
 #include "ui/timer.h"
 #include "ui/widget.h"
 
-#define MIN_ZOOM 0
+#define MIN_ZOOM -3
 #define MAX_ZOOM 5
 
 namespace raster {
@@ -226,6 +227,9 @@ namespace app {
     FrameNumber m_frame;          // Active frame in the editor
     int m_zoom;                   // Zoom in the editor
 
+    // Memory reused to render the sprite in each paint
+    raster::ImageBufferPtr m_renderBuffer;
+
     // Drawing cursor
     int m_cursor_thick;
     int m_cursor_screen_x; // Position in the screen (view)
@@ -30,6 +30,7 @@
 #include "app/settings/settings.h"
 #include "app/ui_context.h"
 #include "app/util/expand_cel_canvas.h"
+#include "base/memory.h"
 #include "base/vector2d.h"
 #include "gfx/region.h"
 #include "raster/algorithm/flip_image.h"
@@ -42,6 +43,22 @@
 
 namespace app {
 
+// Returns the bounds of the pixels that can be modified drawing a
+// parallelogram with the given corners.
+static gfx::Rect get_corners_bounds(const gfx::Transformation::Corners& corners)
+{
+  gfx::Point leftTop(corners[0].x, corners[0].y);
+  gfx::Point rightBottom(leftTop);
+  for (size_t i=1; i<corners.size(); ++i) {
+    gfx::Point pt(corners[i].x, corners[i].y);
+    if (leftTop.x > pt.x) leftTop.x = pt.x;
+    if (leftTop.y > pt.y) leftTop.y = pt.y;
+    if (rightBottom.x < pt.x) rightBottom.x = pt.x;
+    if (rightBottom.y < pt.y) rightBottom.y = pt.y;
+  }
+  return gfx::Rect(leftTop, rightBottom+gfx::Point(1, 1));
+}
+
 template<typename T>
 static inline const base::Vector2d<double> point2Vector(const gfx::PointT<T>& pt) {
   return base::Vector2d<double>(pt.x, pt.y);
@@ -61,6 +78,10 @@ PixelsMovement::PixelsMovement(Context* context,
   , m_adjustPivot(false)
   , m_handle(NoHandle)
   , m_originalImage(Image::createCopy(moveThis))
+  , m_rotspriteImage(NULL)
+  , m_rotspriteMask(NULL)
+  , m_maskCornersValid(false)
+  , m_maskBoundariesValid(false)
 {
   m_initialData = gfx::Transformation(gfx::Rect(initialX, initialY, moveThis->getWidth(), moveThis->getHeight()));
   m_currentData = m_initialData;
@@ -84,6 +105,8 @@ PixelsMovement::~PixelsMovement()
 
   delete m_originalImage;
   delete m_initialMask;
+  delete m_rotspriteImage;
+  delete m_rotspriteMask;
   delete m_currentMask;
 }
 
@@ -103,6 +126,9 @@ void PixelsMovement::flipImage(raster::algorithm::FlipType flipType)
                                                     m_initialMask->getBounds().h)),
                                 flipType);
 
+  destroyRotSpriteSources();
+  m_maskCornersValid = false;
+
   {
     ContextWriter writer(m_reader);
 
@@ -112,7 +138,7 @@ void PixelsMovement::flipImage(raster::algorithm::FlipType flipType)
     redrawCurrentMask();
 
     m_document->setMask(m_currentMask);
-    m_document->generateMaskBoundaries(m_currentMask);
+    updateMaskBoundaries();
     update_screen_for_document(m_document);
   }
 }
@@ -174,6 +200,9 @@ void PixelsMovement::maskImage(const Image* image, int x, int y)
 {
   m_currentMask->replace(m_currentData.bounds());
   m_initialMask->copyFrom(m_currentMask);
+  destroyRotSpriteSources();
+  m_maskCornersValid = false;
+  m_maskBoundariesValid = false;
 
   ContextWriter writer(m_reader);
 
@@ -417,7 +446,7 @@ void PixelsMovement::moveImage(int x, int y, MoveModifier moveModifier)
   // If "fullBounds" is empty is because the cel was not moved
   if (!fullBounds.isEmpty()) {
     // Notify the modified region.
-    m_document->notifySpritePixelsModified(m_sprite, gfx::Region(fullBounds));
+    m_document->notifySpritePixelsModified(m_sprite, gfx::Region(fullBounds), m_layer);
   }
 }
 
@@ -461,6 +490,11 @@ void PixelsMovement::stampImage()
       ExpandCelCanvas expandCelCanvas(writer.context(), TILED_NONE,
                                       m_undoTransaction);
 
+      expandCelCanvas.validateCanvas(
+        gfx::Region(gfx::Rect(-expandCelCanvas.getCel()->getX(),
+                              -expandCelCanvas.getCel()->getY(),
+                              image->getWidth(), image->getHeight())));
+
       composite_image(expandCelCanvas.getDestCanvas(), image,
                       -expandCelCanvas.getCel()->getX(),
                       -expandCelCanvas.getCel()->getY(),
@@ -598,17 +632,86 @@ void PixelsMovement::redrawCurrentMask()
   gfx::Transformation::Corners corners;
   m_currentData.transformBox(corners);
 
-  // Transform mask
+  // If the mask was just moved, its bitmap and boundaries are the
+  // same, we only have to displace them.
+  gfx::Point delta;
+  if (isMaskDisplacement(corners, delta)) {
+    m_currentMask->offsetOrigin(delta.x, delta.y);
+    m_maskCorners = corners;
+    return;
+  }
 
-  m_currentMask->replace(0, 0, m_sprite->getWidth(), m_sprite->getHeight());
+  m_maskCorners = corners;
+  m_maskCornersValid = true;
+  m_maskBoundariesValid = false;
+
+  // Transform the mask only in the bounds of the new corners.
+  gfx::Rect bounds = get_corners_bounds(corners).createIntersect(
+    gfx::Rect(0, 0, m_sprite->getWidth(), m_sprite->getHeight()));
+  if (bounds.isEmpty()) {
+    m_currentMask->clear();
+    return;
+  }
+
+  m_currentMask->replace(bounds);
   m_currentMask->freeze();
   clear_image(m_currentMask->getBitmap(), 0);
   drawParallelogram(m_currentMask->getBitmap(), m_initialMask->getBitmap(),
-    corners, gfx::Point(0, 0));
+    corners, bounds.getOrigin());
 
   m_currentMask->unfreeze();
 }
 
+bool PixelsMovement::isMaskDisplacement(const gfx::Transformation::Corners& corners,
+                                        gfx::Point& delta) const
+{
+  if (!m_maskCornersValid)
+    return false;
+
+  // The mask must not be clipped by the sprite bounds in both
+  // positions.
+  gfx::Rect spriteBounds(0, 0, m_sprite->getWidth(), m_sprite->getHeight());
+  if (!spriteBounds.contains(get_corners_bounds(m_maskCorners)) ||
+      !spriteBounds.contains(get_corners_bounds(corners)))
+    return false;
+
+  // All corners (as they are given to drawParallelogram) must be
+  // displaced by the same integer delta.
+  delta.x = int(corners[0].x) - int(m_maskCorners[0].x);
+  delta.y = int(corners[0].y) - int(m_maskCorners[0].y);
+
+  for (size_t i=1; i<corners.size(); ++i) {
+    if (int(corners[i].x) - int(m_maskCorners[i].x) != delta.x ||
+        int(corners[i].y) - int(m_maskCorners[i].y) != delta.y)
+      return false;
+  }
+
+  return true;
+}
+
+void PixelsMovement::updateMaskBoundaries()
+{
+  if (!m_maskBoundariesValid) {
+    m_maskBoundaries.clear();
+
+    if (!m_currentMask->isEmpty()) {
+      int nseg = 0;
+      BoundSeg* seg = find_mask_boundary(m_currentMask->getBitmap(), &nseg,
+                                         IgnoreBounds, 0, 0, 0, 0);
+      if (seg) {
+        m_maskBoundaries.assign(seg, seg+nseg);
+        base_free(seg);
+      }
+    }
+
+    m_maskBoundariesValid = true;
+  }
+
+  m_document->setMaskBoundaries(m_maskBoundaries.empty() ? NULL: &m_maskBoundaries[0],
+                                (int)m_maskBoundaries.size(),
+                                m_currentMask->getBounds().getOrigin());
+}
+
 void PixelsMovement::drawParallelogram(raster::Image* dst, raster::Image* src,
   const gfx::Transformation::Corners& corners,
   const gfx::Point& leftTop)
@@ -624,7 +727,7 @@ void PixelsMovement::drawParallelogram(raster::Image* dst, raster::Image* src,
       break;
 
     case kRotSpriteRotationAlgorithm:
-      image_rotsprite(dst, src,
+      image_rotsprite_prescaled(dst, getRotSpriteSource(src),
         corners.leftTop().x-leftTop.x, corners.leftTop().y-leftTop.y,
         corners.rightTop().x-leftTop.x, corners.rightTop().y-leftTop.y,
         corners.rightBottom().x-leftTop.x, corners.rightBottom().y-leftTop.y,
@@ -634,8 +737,32 @@ void PixelsMovement::drawParallelogram(raster::Image* dst, raster::Image* src,
   }
 }
 
+Image* PixelsMovement::getRotSpriteSource(Image* src)
+{
+  ASSERT(src == m_originalImage || src == m_initialMask->getBitmap());
+
+  // The scaled source is calculated only once for the whole
+  // movement, then each mouse movement just transforms it.
+  Image*& prescaled = (src == m_originalImage ? m_rotspriteImage:
+                                                m_rotspriteMask);
+  if (!prescaled)
+    prescaled = image_rotsprite_prescale(src);
+
+  return prescaled;
+}
+
+void PixelsMovement::destroyRotSpriteSources()
+{
+  delete m_rotspriteImage;
+  delete m_rotspriteMask;
+  m_rotspriteImage = NULL;
+  m_rotspriteMask = NULL;
+}
+
 void PixelsMovement::onSetRotationAlgorithm(RotationAlgorithm algorithm)
 {
+  m_maskCornersValid = false;
+
   redrawExtraImage();
   redrawCurrentMask();
   updateDocumentMask();
@@ -652,7 +779,7 @@ void PixelsMovement::updateDocumentMask()
   else
     m_document->setMask(m_currentMask);
 
-  m_document->generateMaskBoundaries(m_currentMask);
+  updateMaskBoundaries();
 }
 
 } // namespace app
@@ -23,11 +23,14 @@
 #include "app/settings/settings_observers.h"
 #include "app/ui/editor/handle_type.h"
 #include "app/undo_transaction.h"
+#include "app/util/boundary.h"
 #include "base/compiler_specific.h"
 #include "base/shared_ptr.h"
 #include "gfx/size.h"
 #include "raster/algorithm/flip_type.h"
 
+#include <vector>
+
 namespace raster {
   class Image;
   class Sprite;
@@ -106,6 +109,11 @@ namespace app {
     void drawParallelogram(raster::Image* dst, raster::Image* src,
       const gfx::Transformation::Corners& corners,
       const gfx::Point& leftTop);
+    Image* getRotSpriteSource(Image* src);
+    void destroyRotSpriteSources();
+    bool isMaskDisplacement(const gfx::Transformation::Corners& corners,
+                            gfx::Point& delta) const;
+    void updateMaskBoundaries();
     void updateDocumentMask();
 
     const ContextReader m_reader;
@@ -123,6 +131,20 @@ namespace app {
     gfx::Transformation m_currentData;
     Mask* m_initialMask;
     Mask* m_currentMask;
+
+    // Sources for RotSprite (m_originalImage and m_initialMask
+    // pre-scaled), created when they are needed for the first time.
+    Image* m_rotspriteImage;
+    Image* m_rotspriteMask;
+
+    // Corners used to draw m_currentMask and its boundaries (relative
+    // to the mask origin). If the selection is just moved, the mask
+    // and its boundaries are displaced instead of being generated
+    // again.
+    gfx::Transformation::Corners m_maskCorners;
+    bool m_maskCornersValid;
+    std::vector<BoundSeg> m_maskBoundaries;
+    bool m_maskBoundariesValid;
   };
 
   inline PixelsMovement::MoveModifier& operator|=(PixelsMovement::MoveModifier& a,
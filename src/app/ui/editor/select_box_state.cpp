@@ -23,6 +23,7 @@
 #include "app/ui/editor/select_box_state.h"
 
 #include "app/ui/editor/editor.h"
+#include "app/util/render.h"
 #include "gfx/rect.h"
 #include "raster/image.h"
 #include "raster/sprite.h"
@@ -186,8 +187,8 @@ void SelectBoxState::postRenderDecorator(EditorPostRender* render)
   int zoom = editor->getZoom();
   gfx::Rect vp = View::getView(editor)->getViewportBounds();
 
-  vp.w += 1<<zoom;
-  vp.h += 1<<zoom;
+  vp.w += MAX(1, apply_zoom(1, zoom));
+  vp.h += MAX(1, apply_zoom(1, zoom));
   editor->screenToEditor(vp, &vp);
 
   // Paint a grid generated by the box
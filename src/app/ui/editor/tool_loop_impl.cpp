@@ -186,6 +186,10 @@ public:
       // Paint ink
       if (getInk()->isPaint()) {
         m_expandCelCanvas.commit(m_dirtyBounds);
+
+        // The pixels of the cel image were modified (the preview image
+        // was used while the user was drawing).
+        m_document->notifySpritePixelsModified(m_sprite, gfx::Region(m_dirtyBounds), m_layer);
       }
       // Selection ink
       else if (getInk()->isSelection()) {
@@ -212,6 +216,7 @@ public:
   Layer* getLayer() OVERRIDE { return m_layer; }
   Image* getSrcImage() OVERRIDE { return m_expandCelCanvas.getSourceCanvas(); }
   Image* getDstImage() OVERRIDE { return m_expandCelCanvas.getDestCanvas(); }
+  void validateImages(const gfx::Region& rgn) OVERRIDE { m_expandCelCanvas.validateCanvas(rgn); }
   RgbMap* getRgbMap() OVERRIDE { return m_sprite->getRgbMap(m_frame); }
   bool useMask() OVERRIDE { return m_useMask; }
   Mask* getMask() OVERRIDE { return m_mask; }
@@ -259,7 +264,7 @@ public:
   void updateDirtyArea() OVERRIDE
   {
     m_dirtyBounds = m_dirtyBounds.createUnion(m_dirtyArea.getBounds());
-    m_document->notifySpritePixelsModified(m_sprite, m_dirtyArea);
+    m_document->notifySpritePixelsModified(m_sprite, m_dirtyArea, m_layer);
   }
 
   void updateStatusBar(const char* text) OVERRIDE
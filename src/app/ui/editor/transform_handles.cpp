@@ -24,6 +24,7 @@
 
 #include "app/ui/editor/editor.h"
 #include "app/ui/skin/skin_theme.h"
+#include "app/util/render.h"
 
 #include <allegro.h>
 
@@ -205,8 +206,8 @@ gfx::Rect TransformHandles::getPivotHandleBounds(Editor* editor,
 
   editor->editorToScreen(transform.pivot().x, transform.pivot().y, &pvx, &pvy);
 
-  pvx += (1 << editor->getZoom()) / 2;
-  pvy += (1 << editor->getZoom()) / 2;
+  pvx += apply_zoom(1, editor->getZoom()) / 2;
+  pvy += apply_zoom(1, editor->getZoom()) / 2;
 
   return gfx::Rect(pvx-gfx->w/2, pvy-gfx->h/2, gfx->w, gfx->h);
 }
@@ -79,6 +79,9 @@ void FileList::setCurrentFolder(IFileItem* folder)
   ASSERT(folder != NULL);
   ASSERT(folder->isBrowsable());
 
+  // Thumbnails of the old folder are not needed anymore.
+  ThumbnailGenerator::instance()->stopAllWorkers();
+
   m_currentFolder = folder;
   m_req_valid = false;
   m_selected = NULL;
@@ -52,6 +52,7 @@
 #include "ui/ui.h"
 
 #include <allegro.h>
+#include <algorithm>
 #include <cstdio>
 #include <vector>
 
@@ -212,6 +213,7 @@ void Timeline::detachDocument()
     m_editor = NULL;
   }
 
+  m_sameImages.clear();
   invalidate();
 }
 
@@ -1193,6 +1195,58 @@ void Timeline::drawLayer(ui::Graphics* g, int layer_index)
   }
 }
 
+bool Timeline::SameImagesKey::operator<(const SameImagesKey& other) const
+{
+  if (id1 != other.id1) return id1 < other.id1;
+  if (version1 != other.version1) return version1 < other.version1;
+  if (id2 != other.id2) return id2 < other.id2;
+  return version2 < other.version2;
+}
+
+// Returns true if both cels show the same pixels in the same
+// position. The result of comparing two images is cached by their
+// IDs and versions, so they are compared (first using their cached
+// content hashes, then pixel by pixel) only after they are modified.
+bool Timeline::isSameKeyframe(const Cel* a, const Cel* b)
+{
+  if (a->getX() != b->getX() || a->getY() != b->getY())
+    return false;
+
+  if (a->getImage() == b->getImage())
+    return true;
+
+  const Stock* stock = m_sprite->getStock();
+  const Image* i1 = stock->getImage(a->getImage());
+  const Image* i2 = stock->getImage(b->getImage());
+  if (!i1 || !i2)
+    return false;
+
+  if (i1->getId() > i2->getId())
+    std::swap(i1, i2);
+
+  SameImagesKey key = { i1->getId(), i1->getVersion(),
+                        i2->getId(), i2->getVersion() };
+  std::map<SameImagesKey, bool>::iterator it = m_sameImages.find(key);
+  if (it != m_sameImages.end())
+    return it->second;
+
+  // Different hashes discard most of the different images without
+  // comparing their pixels, equal hashes must be confirmed.
+  bool same = (i1->getPixelFormat() == i2->getPixelFormat() &&
+               i1->getWidth() == i2->getWidth() &&
+               i1->getHeight() == i2->getHeight() &&
+               i1->getHash() == i2->getHash() &&
+               is_same_image(i1, i2));
+
+  // Old versions of the images are never asked again, so the cache is
+  // cleared from time to time.
+  if (m_sameImages.size() > 4096)
+    m_sameImages.clear();
+
+  m_sameImages[key] = same;
+  return same;
+}
+
 void Timeline::drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel* cel)
 {
   Layer* layer = m_layers[layer_index];
@@ -1219,18 +1273,10 @@ void Timeline::drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel*
     style = m_timelineEmptyFrameStyle;
   }
   else {
-#if 0 // TODO We must find a fast-way to compare keyframes. Cels could
-      // share images until the user draw over them. Also, we could
-      // calculate a hash for each image (and recalculate it when the
-      // user draw over it), so then we can compare hashes.  Other
-      // option is to use a thread to calculate differences, but I
-      // think it's too much for just UI stuff.
     Cel* left = (layer->isImage() ? static_cast<LayerImage*>(layer)->getCel(frame.previous()): NULL);
     Cel* right = (layer->isImage() ? static_cast<LayerImage*>(layer)->getCel(frame.next()): NULL);
-    Image* leftImg = (left ? m_sprite->getStock()->getImage(left->getImage()): NULL);
-    Image* rightImg = (right ? m_sprite->getStock()->getImage(right->getImage()): NULL);
-    bool fromLeft = (leftImg && count_diff_between_images(image, leftImg) == 0);
-    bool fromRight = (rightImg && count_diff_between_images(image, rightImg) == 0);
+    bool fromLeft = (left && isSameKeyframe(cel, left));
+    bool fromRight = (right && isSameKeyframe(cel, right));
 
     if (fromLeft && fromRight)
       style = m_timelineFromBothStyle;
@@ -1239,7 +1285,6 @@ void Timeline::drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel*
     else if (fromRight)
       style = m_timelineFromRightStyle;
     else
-#endif
       style = m_timelineKeyframeStyle;
   }
   drawPart(g, bounds, NULL, style, is_active, is_hover);
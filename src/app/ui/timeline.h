@@ -27,6 +27,7 @@
 #include "raster/frame_number.h"
 #include "ui/widget.h"
 
+#include <map>
 #include <vector>
 
 namespace raster {
@@ -141,6 +142,7 @@ namespace app {
     void drawHeaderFrame(ui::Graphics* g, FrameNumber frame);
     void drawLayer(ui::Graphics* g, int layer_index);
     void drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel* cel);
+    bool isSameKeyframe(const Cel* a, const Cel* b);
     void drawPaddings(ui::Graphics* g);
     bool drawPart(ui::Graphics* g, int part, int layer, FrameNumber frame);
     gfx::Rect getLayerHeadersBounds() const;
@@ -205,6 +207,15 @@ namespace app {
     FrameNumber m_clk_frame;
     // Old mouse position (for scrolling).
     gfx::Point m_oldPos;
+
+    // Results of comparing the pixels of two images, identified by
+    // their IDs and versions, so images are compared only when one
+    // of them is modified (and not on each repaint).
+    struct SameImagesKey {
+      uint32_t id1, version1, id2, version2;
+      bool operator<(const SameImagesKey& other) const;
+    };
+    std::map<SameImagesKey, bool> m_sameImages;
   };
 
 } // namespace app
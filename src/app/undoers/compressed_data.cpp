@@ -0,0 +1,248 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/undoers/compressed_data.h"
+
+#include "base/exception.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "zlib.h"
+
+#include <cstdio>
+#include <map>
+
+namespace app {
+namespace undoers {
+
+// Default value of CompressedData::setMemoryBudget()
+#define DEFAULT_MEMORY_BUDGET   (32*1024*1024)
+
+// Keeps the list of compressed blocks that are in memory (from the
+// oldest to the newest one) and the temporary file where old blocks
+// are moved when there are too many bytes in memory.
+class CompressedDataArena {
+public:
+  // The arena is never deleted because undoers can be destroyed
+  // after static objects (the temporary file is deleted by the
+  // system when the program ends).
+  static CompressedDataArena* instance() {
+    static CompressedDataArena* arena = new CompressedDataArena;
+    return arena;
+  }
+
+  CompressedDataArena()
+    : m_file(NULL)
+    , m_fileSize(0)
+    , m_memSize(0)
+    , m_budget(DEFAULT_MEMORY_BUDGET) {
+  }
+
+  ~CompressedDataArena() {
+    if (m_file)
+      std::fclose(m_file);
+  }
+
+  base::mutex& mutex() { return m_mutex; }
+
+  void setBudget(size_t budget) {
+    base::scoped_lock lock(m_mutex);
+    m_budget = budget;
+    spillOldBlocks();
+  }
+
+  void add(CompressedData* block) {
+    base::scoped_lock lock(m_mutex);
+    block->m_arenaPos = m_blocks.insert(m_blocks.end(), block);
+    m_memSize += block->m_compressedSize;
+    spillOldBlocks();
+  }
+
+  void remove(CompressedData* block) {
+    base::scoped_lock lock(m_mutex);
+    if (!block->m_data.empty()) {
+      m_blocks.erase(block->m_arenaPos);
+      m_memSize -= block->m_compressedSize;
+    }
+    else if (block->m_filePos >= 0)
+      freeFileSpace(block->m_filePos, block->m_compressedSize);
+  }
+
+  size_t fileSize() {
+    base::scoped_lock lock(m_mutex);
+    return m_fileSize;
+  }
+
+  // Reads the compressed data of a block that is in the temporary
+  // file (the block is kept in the file). The mutex must be locked.
+  void readBlock(const CompressedData* block, std::vector<unsigned char>& output) {
+    output.resize(block->m_compressedSize);
+    if (std::fseek(m_file, block->m_filePos, SEEK_SET) != 0 ||
+        std::fread(&output[0], 1, output.size(), m_file) != output.size())
+      throw base::Exception("Error reading undo data from the temporary file.");
+  }
+
+private:
+  // Moves the oldest blocks to the temporary file until the compressed
+  // data in memory is below the budget.
+  void spillOldBlocks() {
+    while (m_memSize > m_budget && !m_blocks.empty()) {
+      if (!m_file) {
+        m_file = std::tmpfile();
+        if (!m_file)
+          return;               // Keep everything in memory
+      }
+
+      CompressedData* block = m_blocks.front();
+      long pos = allocFileSpace(block->m_compressedSize);
+
+      if (std::fseek(m_file, pos, SEEK_SET) != 0 ||
+          std::fwrite(&block->m_data[0], 1, block->m_data.size(), m_file) != block->m_data.size() ||
+          std::fflush(m_file) != 0) {
+        freeFileSpace(pos, block->m_compressedSize);
+        return;                 // Disk full? Keep the rest in memory
+      }
+
+      block->m_filePos = pos;
+      std::vector<unsigned char>().swap(block->m_data);
+
+      m_blocks.pop_front();
+      m_memSize -= block->m_compressedSize;
+    }
+  }
+
+  // Returns a position in the file with "size" free bytes (reusing
+  // space of deleted blocks when it's possible).
+  long allocFileSpace(size_t size) {
+    for (FreeSpace::iterator it=m_freeSpace.begin(), end=m_freeSpace.end(); it!=end; ++it) {
+      if (it->second >= size) {
+        long pos = it->first;
+        size_t rest = it->second - size;
+        m_freeSpace.erase(it);
+        if (rest > 0)
+          m_freeSpace[pos+size] = rest;
+        return pos;
+      }
+    }
+
+    long pos = m_fileSize;
+    m_fileSize += size;
+    return pos;
+  }
+
+  void freeFileSpace(long pos, size_t size) {
+    FreeSpace::iterator it = m_freeSpace.insert(std::make_pair(pos, size)).first;
+
+    // Join with the next free space
+    FreeSpace::iterator next = it;
+    ++next;
+    if (next != m_freeSpace.end() && it->first + (long)it->second == next->first) {
+      it->second += next->second;
+      m_freeSpace.erase(next);
+    }
+
+    // Join with the previous free space
+    if (it != m_freeSpace.begin()) {
+      FreeSpace::iterator prev = it;
+      --prev;
+      if (prev->first + (long)prev->second == it->first) {
+        prev->second += it->second;
+        m_freeSpace.erase(it);
+        it = prev;
+      }
+    }
+
+    // Free space at the end of the file
+    if (it->first + (long)it->second == m_fileSize) {
+      m_fileSize = it->first;
+      m_freeSpace.erase(it);
+    }
+  }
+
+  typedef std::map<long, size_t> FreeSpace;
+
+  base::mutex m_mutex;
+  std::list<CompressedData*> m_blocks;
+  std::FILE* m_file;
+  long m_fileSize;
+  FreeSpace m_freeSpace;
+  size_t m_memSize;
+  size_t m_budget;
+};
+
+CompressedData::CompressedData(const void* data, size_t size)
+  : m_size(size)
+  , m_compressedSize(0)
+  , m_filePos(-1)
+{
+  uLongf compressedSize = compressBound(size);
+  m_data.resize(compressedSize);
+
+  int err = compress2(&m_data[0], &compressedSize,
+                      (const Bytef*)data, size, Z_BEST_SPEED);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d compressing undo data.", err);
+
+  m_data.resize(compressedSize);
+  std::vector<unsigned char>(m_data).swap(m_data); // Shrink to fit
+  m_compressedSize = compressedSize;
+
+  CompressedDataArena::instance()->add(this);
+}
+
+CompressedData::~CompressedData()
+{
+  CompressedDataArena::instance()->remove(this);
+}
+
+void CompressedData::uncompress(void* output) const
+{
+  if (m_size == 0)
+    return;
+
+  CompressedDataArena* arena = CompressedDataArena::instance();
+  base::scoped_lock lock(arena->mutex());
+
+  std::vector<unsigned char> fileData;
+  const std::vector<unsigned char>* data = &m_data;
+  if (m_data.empty()) {
+    arena->readBlock(this, fileData);
+    data = &fileData;
+  }
+
+  uLongf size = m_size;
+  int err = ::uncompress((Bytef*)output, &size, &(*data)[0], data->size());
+  if (err != Z_OK || size != m_size)
+    throw base::Exception("ZLib error %d uncompressing undo data.", err);
+}
+
+void CompressedData::setMemoryBudget(size_t bytes)
+{
+  CompressedDataArena::instance()->setBudget(bytes);
+}
+
+size_t CompressedData::getTemporaryFileSize()
+{
+  return CompressedDataArena::instance()->fileSize();
+}
+
+} // namespace undoers
+} // namespace app
@@ -0,0 +1,90 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UNDOERS_COMPRESSED_DATA_H_INCLUDED
+#define APP_UNDOERS_COMPRESSED_DATA_H_INCLUDED
+
+#include "base/disable_copying.h"
+
+#include <cstddef>
+#include <list>
+#include <vector>
+
+namespace app {
+  namespace undoers {
+
+    // Immutable block of data compressed with zlib (fast level) used
+    // by undoers to store pixels (see DirtyArea and ImageArea).
+    //
+    // All blocks share a memory budget (see setMemoryBudget()). When
+    // the compressed blocks in memory exceed the budget, the oldest
+    // ones are moved to a temporary file, and they are read again
+    // when uncompress() is called.
+    class CompressedData {
+    public:
+      CompressedData(const void* data, size_t size);
+      ~CompressedData();
+
+      // Size of the original data.
+      size_t size() const { return m_size; }
+
+      // Compressed size (it doesn't matter if the data is in memory
+      // or in the temporary file).
+      size_t getMemSize() const { return sizeof(*this) + m_compressedSize; }
+
+      // Uncompresses the data in "output" (which must have room for
+      // size() bytes).
+      void uncompress(void* output) const;
+      void uncompress(std::vector<unsigned char>& output) const {
+        output.resize(m_size);
+        if (m_size > 0)
+          uncompress(&output[0]);
+      }
+
+      // Maximum number of bytes of compressed data that can be in
+      // memory before it is moved to the temporary file.
+      static void setMemoryBudget(size_t bytes);
+
+      // Size of the temporary file (including the free space between
+      // blocks that can be reused).
+      static size_t getTemporaryFileSize();
+
+    private:
+      friend class CompressedDataArena;
+
+      size_t m_size;
+      size_t m_compressedSize;
+
+      // Compressed data when it is in memory, or empty if it was
+      // moved to the temporary file.
+      mutable std::vector<unsigned char> m_data;
+
+      // Position in the temporary file (when m_data is empty).
+      long m_filePos;
+
+      // Position in the arena's list of blocks in memory (when m_data
+      // is not empty).
+      std::list<CompressedData*>::iterator m_arenaPos;
+
+      DISABLE_COPYING(CompressedData);
+    };
+
+  } // namespace undoers
+} // namespace app
+
+#endif  // UNDOERS_COMPRESSED_DATA_H_INCLUDED
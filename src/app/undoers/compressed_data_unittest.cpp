@@ -0,0 +1,139 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "app/undoers/compressed_data.h"
+#include "base/unique_ptr.h"
+
+#include <vector>
+
+using namespace app::undoers;
+
+// Data that cannot be compressed (so the compressed size is
+// similar to the original size).
+static std::vector<unsigned char> random_data(size_t size, unsigned seed)
+{
+  std::vector<unsigned char> data(size);
+  for (size_t i=0; i<size; ++i) {
+    seed = seed*1103515245 + 12345;
+    data[i] = (seed >> 16) & 0xff;
+  }
+  return data;
+}
+
+static size_t compressed_size(const CompressedData& block)
+{
+  return block.getMemSize() - sizeof(CompressedData);
+}
+
+static void expect_data(const std::vector<unsigned char>& expected, const CompressedData* block)
+{
+  std::vector<unsigned char> output;
+  block->uncompress(output);
+  EXPECT_TRUE(expected == output);
+}
+
+TEST(CompressedData, InMemory)
+{
+  CompressedData::setMemoryBudget(1024*1024);
+
+  std::vector<unsigned char> data(4096, 7);
+  CompressedData block(&data[0], data.size());
+
+  EXPECT_EQ(data.size(), block.size());
+  EXPECT_LT(compressed_size(block), data.size());
+  expect_data(data, &block);
+}
+
+TEST(CompressedData, TemporaryFile)
+{
+  // Everything goes to the temporary file
+  CompressedData::setMemoryBudget(0);
+  ASSERT_EQ(0, CompressedData::getTemporaryFileSize());
+
+  std::vector<unsigned char> a = random_data(1000, 1);
+  std::vector<unsigned char> b = random_data(2000, 2);
+  std::vector<unsigned char> c = random_data(3000, 3);
+
+  base::UniquePtr<CompressedData> blockA(new CompressedData(&a[0], a.size()));
+  base::UniquePtr<CompressedData> blockB(new CompressedData(&b[0], b.size()));
+  base::UniquePtr<CompressedData> blockC(new CompressedData(&c[0], c.size()));
+  size_t sizeA = compressed_size(*blockA);
+  size_t sizeB = compressed_size(*blockB);
+  size_t sizeC = compressed_size(*blockC);
+
+  EXPECT_EQ(sizeA+sizeB+sizeC, CompressedData::getTemporaryFileSize());
+  expect_data(a, blockA);
+  expect_data(b, blockB);
+  expect_data(c, blockC);
+
+  // The space of the first block is reused by a smaller one
+  blockA.reset(NULL);
+  std::vector<unsigned char> d = random_data(500, 4);
+  base::UniquePtr<CompressedData> blockD(new CompressedData(&d[0], d.size()));
+  ASSERT_LE(compressed_size(*blockD), sizeA);
+  EXPECT_EQ(sizeA+sizeB+sizeC, CompressedData::getTemporaryFileSize());
+  expect_data(d, blockD);
+  expect_data(b, blockB);
+
+  // The last block is removed from the end of the file
+  blockC.reset(NULL);
+  EXPECT_EQ(sizeA+sizeB, CompressedData::getTemporaryFileSize());
+
+  // The free space of "A" (after "D") and "B" are joined and the file
+  // is empty
+  blockD.reset(NULL);
+  EXPECT_EQ(sizeA+sizeB, CompressedData::getTemporaryFileSize());
+  blockB.reset(NULL);
+  EXPECT_EQ(0, CompressedData::getTemporaryFileSize());
+
+  CompressedData::setMemoryBudget(32*1024*1024);
+}
+
+TEST(CompressedData, OldBlocksAreMovedToTheTemporaryFile)
+{
+  std::vector<unsigned char> a = random_data(1000, 5);
+  std::vector<unsigned char> b = random_data(1000, 6);
+
+  CompressedData::setMemoryBudget(1500);
+  base::UniquePtr<CompressedData> blockA(new CompressedData(&a[0], a.size()));
+  EXPECT_EQ(0, CompressedData::getTemporaryFileSize());
+
+  // The oldest block ("A") is moved to the file
+  base::UniquePtr<CompressedData> blockB(new CompressedData(&b[0], b.size()));
+  EXPECT_EQ(compressed_size(*blockA), CompressedData::getTemporaryFileSize());
+  expect_data(a, blockA);
+  expect_data(b, blockB);
+
+  blockA.reset(NULL);
+  EXPECT_EQ(0, CompressedData::getTemporaryFileSize());
+  blockB.reset(NULL);
+
+  CompressedData::setMemoryBudget(32*1024*1024);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
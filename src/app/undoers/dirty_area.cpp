@@ -22,6 +22,7 @@
 
 #include "app/undoers/dirty_area.h"
 
+#include "app/undoers/compressed_data.h"
 #include "base/unique_ptr.h"
 #include "raster/dirty.h"
 #include "raster/dirty_io.h"
@@ -29,6 +30,9 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+#include <string>
+
 namespace app {
 namespace undoers {
 
@@ -37,7 +41,11 @@ using namespace undo;
 DirtyArea::DirtyArea(ObjectsContainer* objects, Image* image, Dirty* dirty)
   : m_imageId(objects->addObject(image))
 {
-  raster::write_dirty(m_stream, dirty);
+  std::ostringstream os;
+  raster::write_dirty(os, dirty);
+
+  std::string data = os.str();
+  m_data.reset(new CompressedData(data.data(), data.size()));
 }
 
 void DirtyArea::dispose()
@@ -45,10 +53,21 @@ void DirtyArea::dispose()
   delete this;
 }
 
+size_t DirtyArea::getMemSize() const
+{
+  return sizeof(*this) + m_data->getMemSize();
+}
+
 void DirtyArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Image* image = objects->getObjectT<Image>(m_imageId);
-  base::UniquePtr<Dirty> dirty(raster::read_dirty(m_stream));
+
+  std::string data(m_data->size(), 0);
+  if (!data.empty())
+    m_data->uncompress(&data[0]);
+
+  std::istringstream is(data);
+  base::UniquePtr<Dirty> dirty(raster::read_dirty(is));
 
   // Swap the saved pixels in the dirty with the pixels in the image
   dirty->swapImagePixels(image);
@@ -20,10 +20,9 @@
 #define APP_UNDOERS_DIRTY_AREA_H_INCLUDED
 
 #include "app/undoers/undoer_base.h"
+#include "base/unique_ptr.h"
 #include "undo/object_id.h"
 
-#include <sstream>
-
 namespace raster {
   class Dirty;
   class Image;
@@ -34,21 +33,19 @@ namespace app {
     using namespace raster;
     using namespace undo;
 
+    class CompressedData;
+
     class DirtyArea : public UndoerBase {
     public:
       DirtyArea(ObjectsContainer* objects, Image* image, Dirty* dirty);
 
       void dispose() OVERRIDE;
-      size_t getMemSize() const OVERRIDE { return sizeof(*this) + getStreamSize(); }
+      size_t getMemSize() const OVERRIDE;
       void revert(ObjectsContainer* objects, UndoersCollector* redoers) OVERRIDE;
 
     private:
-      size_t getStreamSize() const {
-        return const_cast<std::stringstream*>(&m_stream)->tellp();
-      }
-
       ObjectId m_imageId;
-      std::stringstream m_stream;
+      base::UniquePtr<CompressedData> m_data; // Serialized Dirty
     };
 
   } // namespace undoers
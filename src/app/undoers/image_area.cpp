@@ -22,11 +22,14 @@
 
 #include "app/undoers/image_area.h"
 
+#include "app/undoers/compressed_data.h"
 #include "raster/image.h"
 #include "undo/objects_container.h"
 #include "undo/undo_exception.h"
 #include "undo/undoers_collector.h"
 
+#include <vector>
+
 namespace app {
 namespace undoers {
 
@@ -37,13 +40,15 @@ ImageArea::ImageArea(ObjectsContainer* objects, Image* image, int x, int y, int
   , m_format(image->getPixelFormat())
   , m_x(x), m_y(y), m_w(w), m_h(h)
   , m_lineSize(image->getRowStrideSize(w))
-  , m_data(m_lineSize * h)
 {
   ASSERT(w >= 1 && h >= 1);
   ASSERT(x >= 0 && y >= 0 && x+w <= image->getWidth() && y+h <= image->getHeight());
 
+  std::vector<uint8_t> data(m_lineSize * h);
   for (int v=0; v<h; ++v)
-    memcpy(&m_data[m_lineSize*v], image->getPixelAddress(x, y+v), m_lineSize);
+    memcpy(&data[m_lineSize*v], image->getPixelAddress(x, y+v), m_lineSize);
+
+  m_data.reset(new CompressedData(&data[0], data.size()));
 }
 
 void ImageArea::dispose()
@@ -51,6 +56,11 @@ void ImageArea::dispose()
   delete this;
 }
 
+size_t ImageArea::getMemSize() const
+{
+  return sizeof(*this) + m_data->getMemSize();
+}
+
 void ImageArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Image* image = objects->getObjectT<Image>(m_imageId);
@@ -62,8 +72,13 @@ void ImageArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   redoers->pushUndoer(new ImageArea(objects, image, m_x, m_y, m_w, m_h));
 
   // Restore the old image portion
+  std::vector<uint8_t> data(m_data->size());
+  m_data->uncompress(&data[0]);
+
+  image->invalidateRows(m_y, m_h);
+
   for (int v=0; v<m_h; ++v)
-    memcpy(image->getPixelAddress(m_x, m_y+v), &m_data[m_lineSize*v], m_lineSize);
+    memcpy(image->getPixelAddress(m_x, m_y+v), &data[m_lineSize*v], m_lineSize);
 }
 
 } // namespace undoers
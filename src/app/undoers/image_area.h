@@ -20,10 +20,9 @@
 #define APP_UNDOERS_IMAGE_AREA_H_INCLUDED
 
 #include "app/undoers/undoer_base.h"
+#include "base/unique_ptr.h"
 #include "undo/object_id.h"
 
-#include <vector>
-
 namespace raster {
   class Image;
 }
@@ -33,12 +32,14 @@ namespace app {
     using namespace raster;
     using namespace undo;
 
+    class CompressedData;
+
     class ImageArea : public UndoerBase {
     public:
       ImageArea(ObjectsContainer* objects, Image* image, int x, int y, int w, int h);
 
       void dispose() OVERRIDE;
-      size_t getMemSize() const OVERRIDE { return sizeof(*this) + m_data.size(); }
+      size_t getMemSize() const OVERRIDE;
       void revert(ObjectsContainer* objects, UndoersCollector* redoers) OVERRIDE;
 
     private:
@@ -46,7 +47,7 @@ namespace app {
       uint8_t m_format;
       uint16_t m_x, m_y, m_w, m_h;
       uint32_t m_lineSize;
-      std::vector<uint8_t> m_data;
+      base::UniquePtr<CompressedData> m_data;
     };
 
   } // namespace undoers
@@ -25,6 +25,7 @@
 #include "app/app.h"
 #include "app/context.h"
 #include "app/document.h"
+#include "app/document_api.h"
 #include "app/document_location.h"
 #include "app/undo_transaction.h"
 #include "app/undoers/add_cel.h"
@@ -40,6 +41,8 @@
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <cstring>
+
 namespace {
 
 static raster::ImageBufferPtr src_buffer;
@@ -119,14 +122,19 @@ ExpandCelCanvas::ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTran
     y2 = m_sprite->getHeight();
   }
 
-  // create two copies of the image region which we'll modify with the tool
-  m_srcImage = crop_image(m_celImage,
-    x1-m_cel->getX(),
-    y1-m_cel->getY(), x2-x1, y2-y1,
-    m_sprite->getTransparentColor(),
-    src_buffer);
+  // Create the two images of the region which we'll modify with the
+  // tool. Their pixels are copied from the cel on demand (see
+  // validateCanvas()).
+  m_srcImage = Image::create(m_celImage->getPixelFormat(), x2-x1, y2-y1, src_buffer);
+  m_dstImage = Image::create(m_celImage->getPixelFormat(), x2-x1, y2-y1, dst_buffer);
+  m_srcImage->setMaskColor(m_celImage->getMaskColor());
+  m_dstImage->setMaskColor(m_celImage->getMaskColor());
+
+  m_celBounds = gfx::Rect(m_cel->getX()-x1, m_cel->getY()-y1,
+                          m_celImage->getWidth(), m_celImage->getHeight());
 
-  m_dstImage = Image::createCopy(m_srcImage, dst_buffer);
+  m_tilesPerRow = (x2-x1+TileSize-1) / TileSize;
+  m_validTiles.resize(m_tilesPerRow * ((y2-y1+TileSize-1) / TileSize), false);
 
   // We have to adjust the cel position to match the m_dstImage
   // position (the new m_dstImage will be used in RenderEngine to
@@ -152,6 +160,13 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
   ASSERT(!m_closed);
   ASSERT(!m_committed);
 
+  // If the cel is linked with other cels, it will be modified in its
+  // own copy of the image.
+  if (!m_celCreated && static_cast<LayerImage*>(m_layer)->isLinkedCel(m_cel)) {
+    m_document->getApi().unlinkCel(static_cast<LayerImage*>(m_layer), m_cel);
+    m_celImage = m_sprite->getStock()->getImage(m_cel->getImage());
+  }
+
   // If the size of each image is the same, we can create an undo
   // with only the differences between both images.
   if (m_cel->getX() == m_originalCelX &&
@@ -162,8 +177,9 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
     if (m_celCreated) {
       // We can keep the m_celImage
 
-      // We copy the destination image to the m_celImage
-      copy_image(m_celImage, m_dstImage, 0, 0);
+      // We copy the modified tiles of the destination image to the
+      // m_celImage (the rest of the m_celImage is already clear)
+      copy_image(m_celImage, m_dstImage, m_validRegion);
 
       // Add the m_celImage in the images stock of the sprite.
       m_cel->setImage(m_sprite->getStock()->addImage(m_celImage));
@@ -186,23 +202,26 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
     }
     // If the m_celImage was already created before the whole process...
     else {
+      // Only the tiles that were copied from the cel can be modified
+      // (the given bounds are in sprite coordinates).
+      gfx::Region dirtyRegion(m_validRegion);
+      if (!bounds.isEmpty()) {
+        gfx::Region boundsRegion(bounds);
+        boundsRegion.offset(-m_cel->getX(), -m_cel->getY());
+        dirtyRegion.createIntersection(dirtyRegion, boundsRegion);
+      }
+
       // Add to the undo history the differences between m_celImage and m_dstImage
       if (m_undo.isEnabled()) {
-        gfx::Rect dirtyBounds;
-        if (bounds.isEmpty())
-          dirtyBounds = m_celImage->getBounds();
-        else
-          dirtyBounds = m_celImage->getBounds().createIntersect(bounds);
-
-        base::UniquePtr<Dirty> dirty(new Dirty(m_celImage, m_dstImage, dirtyBounds));
+        base::UniquePtr<Dirty> dirty(new Dirty(m_celImage, m_dstImage, dirtyRegion));
 
         dirty->saveImagePixels(m_celImage);
         if (dirty != NULL)
           m_undo.pushUndoer(new undoers::DirtyArea(m_undo.getObjects(), m_celImage, dirty));
       }
 
-      // Copy the destination to the cel image.
-      copy_image(m_celImage, m_dstImage, 0, 0);
+      // Copy the modified tiles of the destination to the cel image.
+      copy_image(m_celImage, m_dstImage, m_validRegion);
     }
   }
   // If the size of both images are different, we have to
@@ -224,6 +243,9 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
           m_sprite->getStock(), m_cel->getImage()));
     }
 
+    // The whole m_dstImage will be the new cel image.
+    validateCanvas(gfx::Region(m_dstImage->getBounds()));
+
     // Replace the image in the stock. We need to create a copy of
     // image because m_dstImage's ImageBuffer cannot be shared.
     m_sprite->getStock()->replaceImage(m_cel->getImage(),
@@ -253,4 +275,77 @@ void ExpandCelCanvas::rollback()
   m_closed = true;
 }
 
+void ExpandCelCanvas::validateCanvas(const gfx::Region& rgn)
+{
+  gfx::Rect canvasBounds = m_dstImage->getBounds();
+  gfx::Region newTiles;
+
+  for (gfx::Region::const_iterator it=rgn.begin(), end=rgn.end();
+       it != end; ++it) {
+    gfx::Rect rc = canvasBounds.createIntersect(*it);
+    if (rc.isEmpty())
+      continue;
+
+    int u1 = rc.x / TileSize;
+    int v1 = rc.y / TileSize;
+    int u2 = (rc.x2()-1) / TileSize;
+    int v2 = (rc.y2()-1) / TileSize;
+
+    for (int v=v1; v<=v2; ++v) {
+      // Consecutive tiles of the row are added to the valid region
+      // as one rectangle.
+      gfx::Rect run;
+
+      for (int u=u1; u<=u2; ++u) {
+        std::vector<bool>::reference valid = m_validTiles[v*m_tilesPerRow + u];
+        if (valid)
+          continue;
+        valid = true;
+
+        gfx::Rect tileBounds = canvasBounds.createIntersect(
+          gfx::Rect(u*TileSize, v*TileSize, TileSize, TileSize));
+
+        copyCelPixels(m_srcImage, tileBounds);
+        copyCelPixels(m_dstImage, tileBounds);
+
+        if (!run.isEmpty() && run.x2() == tileBounds.x)
+          run.w += tileBounds.w;
+        else {
+          if (!run.isEmpty())
+            newTiles.createUnion(newTiles, gfx::Region(run));
+          run = tileBounds;
+        }
+      }
+
+      if (!run.isEmpty())
+        newTiles.createUnion(newTiles, gfx::Region(run));
+    }
+  }
+
+  if (!newTiles.isEmpty())
+    m_validRegion.createUnion(m_validRegion, newTiles);
+}
+
+// Copies the cel pixels to the given area of the canvas (the area
+// outside the cel is cleared with the transparent color).
+void ExpandCelCanvas::copyCelPixels(Image* canvas, const gfx::Rect& bounds)
+{
+  gfx::Rect celArea = bounds.createIntersect(m_celBounds);
+
+  if (celArea != bounds)
+    fill_rect(canvas, bounds.x, bounds.y, bounds.x2()-1, bounds.y2()-1,
+              m_sprite->getTransparentColor());
+
+  if (celArea.isEmpty())
+    return;
+
+  canvas->invalidateRows(celArea.y, celArea.h);
+
+  int rowSize = canvas->getRowStrideSize(celArea.w);
+  for (int y=celArea.y; y<celArea.y2(); ++y)
+    std::memcpy(canvas->getPixelAddress(celArea.x, y),
+                m_celImage->getPixelAddress(celArea.x - m_celBounds.x,
+                                            y - m_celBounds.y), rowSize);
+}
+
 } // namespace app
@@ -21,6 +21,9 @@
 
 #include "filters/tiled_mode.h"
 #include "gfx/rect.h"
+#include "gfx/region.h"
+
+#include <vector>
 
 namespace raster {
   class Cel;
@@ -43,20 +46,34 @@ namespace app {
   // state.  If all changes are committed, some undo information is
   // stored in the document's UndoHistory to go back to the original
   // state using "Undo" command.
+  //
+  // The source and destination canvas are not filled at the
+  // beginning: they are divided in tiles and each tile is copied from
+  // the cel only when validateCanvas() is called for that area (so a
+  // stroke in a huge sprite only copies the tiles it touches).
   class ExpandCelCanvas {
   public:
+    enum { TileSize = 64 };
+
     ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTransaction& undo);
     ~ExpandCelCanvas();
 
     // Commit changes made in getDestCanvas() in the cel's image. Adds
     // information in the undo history so the user can undo the
-    // modifications in the canvas.
+    // modifications in the canvas. The optional bounds (in sprite
+    // coordinates) limit the area where the undo information is
+    // calculated.
     void commit(const gfx::Rect& bounds = gfx::Rect());
 
     // Restore the cel as its original state as when ExpandCelCanvas()
     // was created.
     void rollback();
 
+    // Copies the pixels of the cel to the given region (in canvas
+    // coordinates) of the source and destination canvas. It must be
+    // called before reading or writing pixels in that region.
+    void validateCanvas(const gfx::Region& rgn);
+
     // You can read pixels from here
     Image* getSourceCanvas() {    // TODO this should be "const"
       return m_srcImage;
@@ -72,6 +89,8 @@ namespace app {
     }
 
   private:
+    void copyCelPixels(Image* canvas, const gfx::Rect& bounds);
+
     Document* m_document;
     Sprite* m_sprite;
     Layer* m_layer;
@@ -82,6 +101,12 @@ namespace app {
     int m_originalCelY;
     Image* m_srcImage;
     Image* m_dstImage;
+    // Bounds of m_celImage in canvas coordinates.
+    gfx::Rect m_celBounds;
+    // Tiles of the canvas that were already copied from the cel.
+    std::vector<bool> m_validTiles;
+    gfx::Region m_validRegion;
+    int m_tilesPerRow;
     bool m_closed;
     bool m_committed;
     UndoTransaction& m_undo;
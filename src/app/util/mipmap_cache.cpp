@@ -0,0 +1,246 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/mipmap_cache.h"
+
+#include "gfx/point.h"
+#include "gfx/rect.h"
+#include "raster/algorithm/downsample_image.h"
+#include "raster/cel.h"
+#include "raster/image.h"
+#include "raster/layer.h"
+#include "raster/sprite.h"
+#include "raster/stock.h"
+
+namespace app {
+
+using namespace gfx;
+
+MipmapCache::MipmapCache()
+{
+}
+
+MipmapCache::~MipmapCache()
+{
+  destroyEntries();
+}
+
+const Image* MipmapCache::validateLevel(int index, const Image* image,
+                                        int level, const Rect& area)
+{
+  ASSERT(level >= 1 && level <= MaxLevel);
+
+  Entry* entry = getEntry(index, image);
+  Image* dst = entry->levels[level-1];
+  dst->setMaskColor(image->getMaskColor());
+
+  Rect bounds = area.createIntersect(Rect(0, 0, dst->getWidth(), dst->getHeight()));
+  Region invalid(bounds);
+  invalid.createSubtraction(invalid, entry->valid[level-1]);
+  if (invalid.isEmpty())
+    return dst;
+
+  // Each level is a reduction of the previous one (or the original
+  // image for the first level)
+  const Image* src = image;
+  if (level > 1) {
+    Rect rc = invalid.getBounds();
+    src = validateLevel(index, image, level-1,
+                        Rect(rc.x*2, rc.y*2, rc.w*2, rc.h*2));
+  }
+
+  for (Region::const_iterator it=invalid.begin(), end=invalid.end();
+       it != end; ++it) {
+    const Rect& rc = *it;
+    algorithm::downsample_image(dst, rc.x, rc.y, src, rc, 1);
+  }
+
+  entry->valid[level-1].createUnion(entry->valid[level-1], invalid);
+  return dst;
+}
+
+const Image* MipmapCache::getLevel(int index, const Image* image, int level) const
+{
+  ASSERT(level >= 1 && level <= MaxLevel);
+
+  if (index < 0 || index >= (int)m_entries.size())
+    return NULL;
+
+  const Entry* entry = m_entries[index];
+  if (!entry ||
+      entry->imageId != image->getId() ||
+      entry->version != image->getVersion())
+    return NULL;
+
+  return entry->levels[level-1];
+}
+
+void MipmapCache::invalidate()
+{
+  for (std::vector<Entry*>::iterator it=m_entries.begin(), end=m_entries.end();
+       it != end; ++it) {
+    if (*it) {
+      for (int i=0; i<MaxLevel; ++i)
+        (*it)->valid[i].clear();
+    }
+  }
+}
+
+void MipmapCache::invalidateRegion(const Layer* layer, const Region& region)
+{
+  if (!layer) {
+    invalidate();
+    return;
+  }
+
+  if (!layer->isImage())
+    return;
+
+  const Stock* stock = layer->getSprite()->getStock();
+  const LayerImage* layerImage = static_cast<const LayerImage*>(layer);
+  CelConstIterator it = layerImage->getCelBegin();
+  CelConstIterator end = layerImage->getCelEnd();
+
+  for (; it != end; ++it) {
+    const Cel* cel = *it;
+    int index = cel->getImage();
+
+    if (index >= 0 && index < (int)m_entries.size() && m_entries[index]) {
+      Entry* entry = m_entries[index];
+      const Image* image = (index < stock->size() ? stock->getImage(index): NULL);
+      if (!image || entry->imageId != image->getId()) {
+        destroyEntry(index);
+        continue;
+      }
+
+      Region rgn(region);
+      rgn.offset(-cel->getX(), -cel->getY());
+      invalidateEntry(entry, rgn);
+
+      // The notified modification is already included in the
+      // invalidated region.
+      entry->version = image->getVersion();
+    }
+  }
+}
+
+void MipmapCache::removeUnusedEntries(const Stock* stock)
+{
+  for (int index=0; index<(int)m_entries.size(); ++index) {
+    const Entry* entry = m_entries[index];
+    if (!entry)
+      continue;
+
+    const Image* image = (index < stock->size() ? stock->getImage(index): NULL);
+    if (!image || entry->imageId != image->getId())
+      destroyEntry(index);
+  }
+}
+
+// Returns the entry of the given stock image, creating (or resetting)
+// it if the image was replaced.
+MipmapCache::Entry* MipmapCache::getEntry(int index, const Image* image)
+{
+  ASSERT(index >= 0);
+
+  if (index >= (int)m_entries.size())
+    m_entries.resize(index+1, (Entry*)NULL);
+
+  Entry* entry = m_entries[index];
+  if (entry &&
+      entry->imageId == image->getId() &&
+      entry->format == image->getPixelFormat() &&
+      entry->width == image->getWidth() &&
+      entry->height == image->getHeight()) {
+    // The image was modified without notifying the region
+    if (entry->version != image->getVersion()) {
+      for (int i=0; i<MaxLevel; ++i)
+        entry->valid[i].clear();
+      entry->version = image->getVersion();
+    }
+    return entry;
+  }
+
+  if (!entry)
+    entry = m_entries[index] = new Entry;
+  else {
+    for (int i=0; i<MaxLevel; ++i)
+      delete entry->levels[i];
+  }
+
+  entry->imageId = image->getId();
+  entry->version = image->getVersion();
+  entry->format = image->getPixelFormat();
+  entry->width = image->getWidth();
+  entry->height = image->getHeight();
+
+  for (int i=0; i<MaxLevel; ++i) {
+    entry->levels[i] = Image::create(entry->format,
+                                     algorithm::downsampled_size(entry->width, i+1),
+                                     algorithm::downsampled_size(entry->height, i+1));
+    entry->levels[i]->setMaskColor(image->getMaskColor());
+    entry->valid[i].clear();
+  }
+
+  return entry;
+}
+
+// Removes from each level the pixels touched by the given region (in
+// coordinates of the original image).
+void MipmapCache::invalidateEntry(Entry* entry, const Region& region)
+{
+  for (Region::const_iterator it=region.begin(), end=region.end();
+       it != end; ++it) {
+    const Rect& rc = *it;
+
+    for (int i=0; i<MaxLevel; ++i) {
+      int level = i+1;
+      int x1 = (rc.x >> level);
+      int y1 = (rc.y >> level);
+      int x2 = ((rc.x+rc.w-1) >> level);
+      int y2 = ((rc.y+rc.h-1) >> level);
+
+      entry->valid[i].createSubtraction(entry->valid[i],
+                                        Region(Rect(x1, y1, x2-x1+1, y2-y1+1)));
+    }
+  }
+}
+
+void MipmapCache::destroyEntry(int index)
+{
+  Entry* entry = m_entries[index];
+  if (entry) {
+    for (int i=0; i<MaxLevel; ++i)
+      delete entry->levels[i];
+    delete entry;
+    m_entries[index] = NULL;
+  }
+}
+
+void MipmapCache::destroyEntries()
+{
+  for (int index=0; index<(int)m_entries.size(); ++index)
+    destroyEntry(index);
+  m_entries.clear();
+}
+
+} // namespace app
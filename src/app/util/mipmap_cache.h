@@ -0,0 +1,104 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UTIL_MIPMAP_CACHE_H_INCLUDED
+#define APP_UTIL_MIPMAP_CACHE_H_INCLUDED
+
+#include "base/disable_copying.h"
+#include "gfx/region.h"
+#include "raster/pixel_format.h"
+
+#include <vector>
+
+namespace raster {
+  class Image;
+  class Layer;
+  class Stock;
+}
+
+namespace app {
+
+  using namespace raster;
+
+  // Cache of reduced versions of the images in the sprite's stock (each
+  // level is half the size of the previous one). They are used by
+  // RenderEngine to render zoomed out sprites without reading all the
+  // pixels of the original images.
+  //
+  // Each level keeps the region of pixels that are valid, so only the
+  // parts of the images that were modified (notified with
+  // invalidateRegion()) are reduced again. Entries are identified by
+  // the ID of the image (see Image::getId()) and remember its content
+  // version, so if an image is modified without a notification all
+  // its levels are reduced again.
+  //
+  // Each document has its own cache (see Document::getMipmapCache()).
+  class MipmapCache {
+  public:
+    enum { MaxLevel = 3 };
+
+    MipmapCache();
+    ~MipmapCache();
+
+    // Returns the stock image "index" ("image") reduced "level" times,
+    // updating the given "area" (in coordinates of the level) if it's
+    // needed. It must be called from the main thread.
+    const Image* validateLevel(int index, const Image* image,
+                               int level, const gfx::Rect& area);
+
+    // Returns the level of the stock image previously prepared with
+    // validateLevel() or NULL if it is not available. This member
+    // function doesn't modify the cache, so it can be used from the
+    // rendering threads.
+    const Image* getLevel(int index, const Image* image, int level) const;
+
+    // Invalidates all levels of all images.
+    void invalidate();
+
+    // Invalidates the levels of the images of "layer" touched by the
+    // given region (in sprite coordinates). Use NULL if you don't
+    // know the modified layer.
+    void invalidateRegion(const Layer* layer, const gfx::Region& region);
+
+    // Destroys the entries of images that aren't in the stock anymore
+    // (removed or replaced). It must be called from the main thread.
+    void removeUnusedEntries(const Stock* stock);
+
+  private:
+    struct Entry {
+      uint32_t imageId;
+      uint32_t version;         // Version of the image when the valid regions were updated
+      PixelFormat format;
+      int width, height;
+      Image* levels[MaxLevel];
+      gfx::Region valid[MaxLevel];
+    };
+
+    Entry* getEntry(int index, const Image* image);
+    void invalidateEntry(Entry* entry, const gfx::Region& region);
+    void destroyEntry(int index);
+    void destroyEntries();
+
+    std::vector<Entry*> m_entries;
+
+    DISABLE_COPYING(MipmapCache);
+  };
+
+} // namespace app
+
+#endif
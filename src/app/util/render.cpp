@@ -25,61 +25,109 @@
 #include "app/color_utils.h"
 #include "app/document.h"
 #include "app/ini_file.h"
+#include "app/util/mipmap_cache.h"
+#include "app/util/render_cache.h"
 #include "raster/raster.h"
 #include "app/settings/document_settings.h"
 #include "app/settings/settings.h"
 #include "app/ui_context.h"
+#include "base/parallel_for.h"
+#include "base/unique_ptr.h"
+#include "raster/algorithm/downsample_image.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace app {
 
 //////////////////////////////////////////////////////////////////////
 // Zoomed merge
 
+// Returns a color that is not used in the palette (it's used to mark
+// pixels that must be skipped by the row blenders).
+static uint32_t get_unused_color(const Palette* pal, int index)
+{
+  // The color of the given entry is enough if it is not repeated.
+  if (index >= 0 && index < pal->size()) {
+    uint32_t color = pal->getEntry(index);
+    int i;
+    for (i=0; i<pal->size(); ++i)
+      if (i != index && pal->getEntry(i) == color)
+        break;
+    if (i == pal->size())
+      return color;
+  }
+
+  std::vector<uint32_t> colors(pal->size());
+  for (int i=0; i<pal->size(); ++i)
+    colors[i] = pal->getEntry(i);
+  std::sort(colors.begin(), colors.end());
+
+  uint32_t unused = 0;
+  for (std::vector<uint32_t>::iterator it=colors.begin(); it!=colors.end(); ++it) {
+    if (*it == unused)
+      ++unused;
+    else if (*it > unused)
+      break;
+  }
+  return unused;
+}
+
+// Blends a row of source pixels over a row of destination pixels
+// using the row blenders (converting the source pixels to the
+// destination format if it's necessary).
 template<class DstTraits, class SrcTraits>
 class BlenderHelper
 {
-  BLEND_COLOR m_blend_color;
-  uint32_t m_mask_color;
+  typename SrcTraits::row_blender_t m_blender;
+  typename SrcTraits::pixel_t m_mask_color;
 public:
   BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
   {
-    m_blend_color = SrcTraits::get_blender(blend_mode);
+    m_blender = SrcTraits::get_row_blender(blend_mode);
     m_mask_color = src->getMaskColor();
   }
-  inline void operator()(typename DstTraits::pixel_t& scanline,
-                         const typename DstTraits::pixel_t& dst,
-                         const typename SrcTraits::pixel_t& src,
-                         int opacity)
+  inline void operator()(typename DstTraits::pixel_t* scanline,
+                         const typename SrcTraits::pixel_t* src,
+                         int w, int opacity)
   {
-    if (src != m_mask_color)
-      scanline = (*m_blend_color)(dst, src, opacity);
-    else
-      scanline = dst;
+    (*m_blender)(scanline, src, w, opacity, m_mask_color);
   }
 };
 
 template<>
 class BlenderHelper<RgbTraits, GrayscaleTraits>
 {
-  BLEND_COLOR m_blend_color;
+  BLEND_RGBA_ROW m_blender;
   uint32_t m_mask_color;
+  std::vector<uint32_t> m_row;
 public:
   BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
   {
-    m_blend_color = RgbTraits::get_blender(blend_mode);
+    m_blender = RgbTraits::get_row_blender(blend_mode);
     m_mask_color = src->getMaskColor();
   }
-  inline void operator()(RgbTraits::pixel_t& scanline,
-                         const RgbTraits::pixel_t& dst,
-                         const GrayscaleTraits::pixel_t& src,
-                         int opacity)
+  inline void operator()(RgbTraits::pixel_t* scanline,
+                         const GrayscaleTraits::pixel_t* src,
+                         int w, int opacity)
   {
-    if (src != m_mask_color) {
-      int v = graya_getv(src);
-      scanline = (*m_blend_color)(dst, rgba(v, v, v, graya_geta(src)), opacity);
+    // A gray pixel never has different R and G components, so this
+    // color can be used to mark the masked pixels.
+    const uint32_t skip = rgba(0, 1, 0, 0);
+
+    if ((int)m_row.size() < w)
+      m_row.resize(w);
+
+    for (int x=0; x<w; ++x) {
+      if (src[x] != m_mask_color) {
+        int v = graya_getv(src[x]);
+        m_row[x] = rgba(v, v, v, graya_geta(src[x]));
+      }
+      else
+        m_row[x] = skip;
     }
-    else
-      scanline = dst;
+
+    (*m_blender)(scanline, &m_row[0], w, opacity, skip);
   }
 };
 
@@ -88,28 +136,35 @@ class BlenderHelper<RgbTraits, IndexedTraits>
 {
   const Palette* m_pal;
   int m_blend_mode;
+  BLEND_RGBA_ROW m_blender;
   uint32_t m_mask_color;
+  uint32_t m_skip;
+  std::vector<uint32_t> m_row;
 public:
   BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
   {
     m_blend_mode = blend_mode;
+    m_blender = RgbTraits::get_row_blender(BLEND_MODE_NORMAL);
     m_mask_color = src->getMaskColor();
     m_pal = pal;
+    m_skip = (blend_mode != BLEND_MODE_COPY ? get_unused_color(pal, m_mask_color): 0);
   }
-  inline void operator()(RgbTraits::pixel_t& scanline,
-                         const RgbTraits::pixel_t& dst,
-                         const IndexedTraits::pixel_t& src,
-                         int opacity)
+  inline void operator()(RgbTraits::pixel_t* scanline,
+                         const IndexedTraits::pixel_t* src,
+                         int w, int opacity)
   {
     if (m_blend_mode == BLEND_MODE_COPY) {
-      scanline = m_pal->getEntry(src);
+      for (int x=0; x<w; ++x)
+        scanline[x] = m_pal->getEntry(src[x]);
     }
     else {
-      if (src != m_mask_color) {
-        scanline = rgba_blend_normal(dst, m_pal->getEntry(src), opacity);
-      }
-      else
-        scanline = dst;
+      if ((int)m_row.size() < w)
+        m_row.resize(w);
+
+      for (int x=0; x<w; ++x)
+        m_row[x] = (src[x] != m_mask_color ? m_pal->getEntry(src[x]): m_skip);
+
+      (*m_blender)(scanline, &m_row[0], w, opacity, m_skip);
     }
   }
 };
@@ -119,12 +174,16 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
                                int x, int y, int opacity,
                                int blend_mode, int zoom)
 {
+  typedef typename DstTraits::pixel_t dst_pixel_t;
+  typedef typename SrcTraits::pixel_t src_pixel_t;
+
   BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blend_mode);
   int src_x, src_y, src_w, src_h;
   int dst_x, dst_y, dst_w, dst_h;
   int box_x, box_y, box_w, box_h;
   int first_box_w, first_box_h;
   int line_h, bottom;
+  int n, offset;
 
   box_w = 1<<zoom;
   box_h = 1<<zoom;
@@ -175,47 +234,42 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
     return;
 
   bottom = dst_y+dst_h-1;
+  dst->invalidateRows(dst_y, dst_h);
 
-  // the scanline variable is used to blend src/dst pixels one time for each pixel
-  typedef std::vector<typename DstTraits::pixel_t> Scanline;
-  Scanline scanline(src_w);
-  typename Scanline::iterator scanline_it;
-  typename Scanline::iterator scanline_end = scanline.end();
+  // Number of source pixels (boxes) that start inside the 'dst' line
+  offset = 0;
+  for (n=0; n<src_w && offset<dst_w; ++n)
+    offset += ((n == 0) && (first_box_w > 0) ? first_box_w: box_w);
 
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, gfx::Rect(src_x, src_y, src_w, src_h));
-  LockImageBits<DstTraits> dstBits(dst, gfx::Rect(dst_x, dst_y, dst_w, dst_h));
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  // The scanline variable is used to blend src/dst pixels one time for
+  // each box (without zoom, pixels are blended directly in 'dst')
+  std::vector<dst_pixel_t> scanline(zoom > 0 ? n: 0);
 
   // For each line to draw of the source image...
   for (y=0; y<src_h; ++y) {
-    dst_it = dstBits.begin_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
-    dst_end = dstBits.end_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
-
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
-    scanline_it = scanline.begin();
-    for (x=0; x<src_w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-      ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
+    const src_pixel_t* src_address = (const src_pixel_t*)src->getPixelAddress(src_x, src_y);
+    dst_pixel_t* dst_address = (dst_pixel_t*)dst->getPixelAddress(dst_x, dst_y);
 
-      blender(*scanline_it, *dst_it, *src_it, opacity);
+    if (zoom == 0) {
+      blender(dst_address, src_address, n, opacity);
 
-      ++src_it;
-
-      int delta;
-      if ((x == 0) && (first_box_w > 0))
-        delta = first_box_w;
-      else
-        delta = box_w;
+      if (++dst_y > bottom)
+        break;
 
-      while (dst_it != dst_end && delta-- > 0)
-        ++dst_it;
+      ++src_y;
+      continue;
+    }
 
-      ++scanline_it;
+    // Read the first 'dst' pixel of each box, and blend them with
+    // 'src' pixels, the result is in 'scanline'
+    offset = 0;
+    for (x=0; x<n; ++x) {
+      scanline[x] = dst_address[offset];
+      offset += ((x == 0) && (first_box_w > 0) ? first_box_w: box_w);
     }
 
+    blender(&scanline[0], src_address, n, opacity);
+
     // Get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_box_h > 0))
       line_h = first_box_h;
@@ -224,45 +278,16 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
 
     // Draw the line in 'dst'
     for (box_y=0; box_y<line_h; ++box_y) {
-      dst_it = dstBits.begin_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
-      dst_end = dstBits.end_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
-      scanline_it = scanline.begin();
+      dst_pixel_t* dst_it = (dst_pixel_t*)dst->getPixelAddress(dst_x, dst_y);
+      dst_pixel_t* dst_end = dst_it + dst_w;
 
-      x = 0;
-
-      // first pixel
-      if (first_box_w > 0) {
-        for (box_x=0; box_x<first_box_w; ++box_x) {
-          ASSERT(scanline_it != scanline_end);
-          ASSERT(dst_it != dst_end);
-
-          *dst_it = *scanline_it;
-
-          ++dst_it;
-          if (dst_it == dst_end)
-            goto done_with_line;
-        }
+      for (x=0; x<n; ++x) {
+        int w = ((x == 0) && (first_box_w > 0) ? first_box_w: box_w);
 
-        ++scanline_it;
-        ++x;
+        for (box_x=0; box_x<w && dst_it != dst_end; ++box_x)
+          *(dst_it++) = scanline[x];
       }
 
-      // the rest of the line
-      for (; x<src_w; ++x) {
-        for (box_x=0; box_x<box_w; ++box_x) {
-          ASSERT(dst_it !=  dst_end);
-
-          *dst_it = *scanline_it;
-
-          ++dst_it;
-          if (dst_it == dst_end)
-            goto done_with_line;
-        }
-
-        ++scanline_it;
-      }
-
-done_with_line:;
       if (++dst_y > bottom)
         goto done_with_blit;
     }
@@ -282,9 +307,72 @@ static bool checked_bg_zoom;
 static app::Color checked_bg_color1;
 static app::Color checked_bg_color2;
 
-static int global_opacity = 255;
 static const Layer* selected_layer = NULL;
 static Image* rastering_image = NULL;
+static PreviewImageDelegate* rastering_delegate = NULL;
+
+// Returns the size of each checked background tile for the given zoom
+// level (the size is in zoomed pixels, i.e. screen pixels).
+static void get_checked_bg_tile_size(int zoom, int& tile_w, int& tile_h)
+{
+  switch (checked_bg_type) {
+    case RenderEngine::CHECKED_BG_16X16: tile_w = tile_h = 16; break;
+    case RenderEngine::CHECKED_BG_8X8:   tile_w = tile_h = 8; break;
+    case RenderEngine::CHECKED_BG_4X4:   tile_w = tile_h = 4; break;
+    case RenderEngine::CHECKED_BG_2X2:   tile_w = tile_h = 2; break;
+    default:                             tile_w = tile_h = 16; break;
+  }
+
+  if (checked_bg_zoom) {
+    tile_w = apply_zoom(tile_w, zoom);
+    tile_h = apply_zoom(tile_h, zoom);
+  }
+
+  // Tile size
+  int box = MAX(1, apply_zoom(1, zoom));
+  if (tile_w < box) tile_w = box;
+  if (tile_h < box) tile_h = box;
+}
+
+// Returns the checked background tile size in sprite pixels (as it is
+// stored in the render cache, the size in zoomed pixels is always a
+// multiple of 1<<zoom) and its colors.
+static void get_cached_checked_bg(int zoom, int& tile_w, int& tile_h, int& c1, int& c2)
+{
+  get_checked_bg_tile_size(zoom, tile_w, tile_h);
+  tile_w >>= zoom;
+  tile_h >>= zoom;
+  c1 = color_utils::color_for_image(checked_bg_color1, IMAGE_RGB);
+  c2 = color_utils::color_for_image(checked_bg_color2, IMAGE_RGB);
+}
+
+static void draw_checked_background(Image* image,
+                                    int source_x, int source_y,
+                                    int tile_w, int tile_h,
+                                    int c1, int c2)
+{
+  int x, y, u, v;
+
+  // Tile position (u,v) is the number of tile we start in (source_x,source_y) coordinate
+  u = (source_x / tile_w);
+  v = (source_y / tile_h);
+
+  // Position where we start drawing the first tile in "image"
+  int x_start = -(source_x % tile_w);
+  int y_start = -(source_y % tile_h);
+
+  // Draw checked background (tile by tile)
+  int u_start = u;
+  for (y=y_start-tile_h; y<image->getHeight()+tile_h; y+=tile_h) {
+    for (x=x_start-tile_w; x<image->getWidth()+tile_w; x+=tile_w) {
+      fill_rect(image, x, y, x+tile_w-1, y+tile_h-1,
+                (((u+v))&1)? c1: c2);
+      ++u;
+    }
+    u = u_start;
+    ++v;
+  }
+}
 
 // static
 void RenderEngine::loadConfig()
@@ -358,14 +446,123 @@ RenderEngine::RenderEngine(const Document* document,
   , m_sprite(sprite)
   , m_currentLayer(currentLayer)
   , m_currentFrame(currentFrame)
+  , m_layerRange(AllLayers)
+  , m_currentLayerReached(false)
+  , m_globalOpacity(255)
+  , m_onionskin(false)
+  , m_onionskinPrevs(0)
+  , m_onionskinNexts(0)
+  , m_onionskinOpacityBase(0)
+  , m_onionskinOpacityStep(0)
+  , m_previewLevel(NULL)
+  , m_extraLevel(NULL)
 {
 }
 
 // static
-void RenderEngine::setPreviewImage(const Layer* layer, Image* image)
+void RenderEngine::setPreviewImage(const Layer* layer, Image* image,
+                                   PreviewImageDelegate* delegate)
 {
   selected_layer = layer;
   rastering_image = image;
+  rastering_delegate = delegate;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Parallel rendering
+
+// Renders one horizontal band of the output image (each band is
+// rendered in its own image, so bands can be rendered concurrently).
+class RenderEngine::BandTask {
+public:
+  BandTask(const RenderEngine* engine, Image* image,
+           int source_x, int source_y, int bandHeight,
+           FrameNumber frame, int zoom, ZoomedFunc zoomed_func,
+           bool checked_bg, uint32_t bg_color, bool use_cache)
+    : m_engine(engine), m_image(image)
+    , m_source_x(source_x), m_source_y(source_y), m_bandHeight(bandHeight)
+    , m_frame(frame), m_zoom(zoom), m_zoomed_func(zoomed_func)
+    , m_checked_bg(checked_bg), m_bg_color(bg_color), m_use_cache(use_cache) {
+  }
+
+  void operator()(int i) {
+    int y = i*m_bandHeight;
+    int h = MIN(m_bandHeight, m_image->getHeight()-y);
+    base::UniquePtr<Image> band(Image::create(IMAGE_RGB, m_image->getWidth(), h));
+
+    // Each band uses its own copy of the engine state.
+    RenderEngine engine(*m_engine);
+    engine.renderArea(band, m_source_x, m_source_y+y, m_frame, m_zoom,
+                      m_zoomed_func, m_checked_bg, m_bg_color, m_use_cache);
+
+    // All bands are copied at the same time in the image, so its
+    // content is invalidated by renderSprite() after all of them.
+    copy_image_pixels(m_image, band, 0, y);
+  }
+
+private:
+  const RenderEngine* m_engine;
+  Image* m_image;
+  int m_source_x, m_source_y, m_bandHeight;
+  FrameNumber m_frame;
+  int m_zoom;
+  ZoomedFunc m_zoomed_func;
+  bool m_checked_bg;
+  uint32_t m_bg_color;
+  bool m_use_cache;
+};
+
+// Composites the invalid tiles of the render cache (each tile is
+// independent, so they can be composited concurrently).
+class RenderEngine::TileTask {
+public:
+  struct Tile {
+    int u, v;
+    Image* image;
+  };
+
+  TileTask(const RenderEngine* engine, FrameNumber frame, int zoom,
+           ZoomedFunc zoomed_func, bool checked_bg, uint32_t bg_color)
+    : m_engine(engine), m_frame(frame), m_zoom(zoom), m_zoomed_func(zoomed_func)
+    , m_checked_bg(checked_bg), m_bg_color(bg_color) {
+  }
+
+  void addTile(int u, int v, Image* image) {
+    Tile tile = { u, v, image };
+    m_tiles.push_back(tile);
+  }
+
+  int size() const { return (int)m_tiles.size(); }
+  const Tile& tile(int i) const { return m_tiles[i]; }
+
+  void operator()(int i) {
+    RenderEngine engine(*m_engine);
+    engine.compositeCacheTile(m_tiles[i].image, m_tiles[i].u, m_tiles[i].v,
+                              m_frame, m_zoom, m_zoomed_func,
+                              m_checked_bg, m_bg_color);
+  }
+
+private:
+  const RenderEngine* m_engine;
+  std::vector<Tile> m_tiles;
+  FrameNumber m_frame;
+  int m_zoom;
+  ZoomedFunc m_zoomed_func;
+  bool m_checked_bg;
+  uint32_t m_bg_color;
+};
+
+// Returns the number of threads to render an image of the given size
+// (small areas, like the ones repainted while the user draws, are not
+// worth the creation of threads).
+// Threads are created in each render, so it's worth only if each
+// thread has enough pixels to render.
+#define MIN_PIXELS_PER_RENDER_THREAD (256*256)
+
+static int get_render_threads(int width, int height)
+{
+  int nthreads = (width*height) / MIN_PIXELS_PER_RENDER_THREAD;
+  return MID(1, nthreads, base::thread::hardware_concurrency());
 }
 
 /**
@@ -374,13 +571,18 @@ void RenderEngine::setPreviewImage(const Layer* layer, Image* image)
 
    Positions source_x, source_y, width and height must have the
    zoom applied (sorce_x<<zoom, source_y<<zoom, width<<zoom, etc.)
+
+   Big areas are split in horizontal bands that are rendered in
+   several threads (the result is the same as rendering the whole
+   area in one thread).
  */
 Image* RenderEngine::renderSprite(int source_x, int source_y,
                                   int width, int height,
                                   FrameNumber frame, int zoom,
-                                  bool draw_tiled_bg)
+                                  bool draw_tiled_bg,
+                                  const ImageBufferPtr& buffer)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
+  ZoomedFunc zoomed_func;
   const LayerImage* background = m_sprite->getBackgroundLayer();
   bool need_checked_bg = (background != NULL ? !background->isReadable(): true);
   uint32_t bg_color = 0;
@@ -407,43 +609,142 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
   }
 
   // Create a temporary RGB bitmap to draw all to it
-  image = Image::create(IMAGE_RGB, width, height);
+  image = Image::create(IMAGE_RGB, width, height, buffer);
   if (!image)
     return NULL;
 
+  // Onion-skin settings (they are read here because the settings
+  // cannot be accessed from other threads)
+  IDocumentSettings* docSettings = UIContext::instance()
+    ->getSettings()->getDocumentSettings(m_document);
+
+  m_onionskin = docSettings->getUseOnionskin();
+  if (m_onionskin) {
+    m_onionskinPrevs = docSettings->getOnionskinPrevFrames();
+    m_onionskinNexts = docSettings->getOnionskinNextFrames();
+    m_onionskinOpacityBase = docSettings->getOnionskinOpacityBase();
+    m_onionskinOpacityStep = docSettings->getOnionskinOpacityStep();
+  }
+
+  // Stock images already have the transparent color of the sprite
+  // as mask color (see Stock::setMaskColor()), the preview image is
+  // prepared before the rendering (so images are not modified in the
+  // rendering threads)
+  if (rastering_image)
+    rastering_image->setMaskColor(m_sprite->getTransparentColor());
+
+  // Prepare the visible area of the preview image
+  if (rastering_image && rastering_delegate && selected_layer->isImage()) {
+    const Cel* cel = static_cast<const LayerImage*>(selected_layer)->getCel(m_currentFrame);
+    if (cel) {
+      gfx::Rect bounds = remove_zoom(gfx::Rect(source_x, source_y, width, height), zoom);
+      bounds.offset(-cel->getX(), -cel->getY());
+
+      rastering_delegate->validatePreviewImage(bounds);
+    }
+  }
+
+  // Zoomed out: prepare the reduced images of the visible area (the
+  // cache cannot be modified from the rendering threads)
+  if (zoom < 0) {
+    gfx::Rect area(source_x, source_y, width, height);
+
+    m_document->getMipmapCache()->removeUnusedEntries(m_sprite->getStock());
+
+    if (m_onionskin) {
+      for (FrameNumber f=frame.previous(m_onionskinPrevs); f <= frame.next(m_onionskinNexts); ++f) {
+        if (f >= 0 && f <= m_sprite->getLastFrame())
+          prepareMipmaps(m_sprite->getFolder(), f, area, -zoom);
+      }
+    }
+    else
+      prepareMipmaps(m_sprite->getFolder(), frame, area, -zoom);
+
+    prepareTransientLevels(area, -zoom);
+  }
+
+  bool checked_bg = (need_checked_bg && draw_tiled_bg);
+  int nthreads = get_render_threads(width, height);
+
+  // The background and the layers below the current one come from the
+  // document's render cache (when onion-skin is disabled and the
+  // sprite is not zoomed out).
+  bool use_cache = (!m_onionskin && zoom >= 0 &&
+                    prepareRenderCache(source_x, source_y, width, height,
+                                       frame, zoom, zoomed_func,
+                                       checked_bg, bg_color, nthreads));
+
+  if (nthreads > 1) {
+    int box = MAX(1, apply_zoom(1, zoom));
+    int bandHeight = MAX(box, (height / (nthreads*4)) / box * box);
+    int bands = (height + bandHeight - 1) / bandHeight;
+
+    BandTask task(this, image, source_x, source_y, bandHeight,
+                  frame, zoom, zoomed_func, checked_bg, bg_color, use_cache);
+    base::parallel_for(0, bands, task, nthreads);
+    image->invalidateContent();
+  }
+  else {
+    renderArea(image, source_x, source_y, frame, zoom, zoomed_func,
+               checked_bg, bg_color, use_cache);
+  }
+
+  destroyTransientLevels();
+  return image;
+}
+
+void RenderEngine::renderArea(Image* image,
+                              int source_x, int source_y,
+                              FrameNumber frame, int zoom,
+                              ZoomedFunc zoomed_func,
+                              bool checked_bg, uint32_t bg_color,
+                              bool use_cache)
+{
+  // Onion-skin is disabled and the layers below the current one are
+  // cached: we have to draw only the current layer and the layers
+  // above it.
+  if (use_cache) {
+    renderCachedLayers(image, source_x, source_y, zoom, checked_bg);
+
+    m_layerRange = CurrentAndAboveLayers;
+    m_currentLayerReached = false;
+    renderLayer(m_sprite->getFolder(), image,
+                source_x, source_y, frame, zoom, zoomed_func,
+                true, true);
+    m_layerRange = AllLayers;
+    return;
+  }
+
   // Draw checked background
-  if (need_checked_bg && draw_tiled_bg)
+  if (checked_bg)
     renderCheckedBackground(image, source_x, source_y, zoom);
   else
     clear_image(image, bg_color);
 
   // Onion-skin feature: draw the previous frame
-  IDocumentSettings* docSettings = UIContext::instance()
-    ->getSettings()->getDocumentSettings(m_document);
-
-  if (docSettings->getUseOnionskin()) {
+  if (m_onionskin) {
     // Draw background layer of the current frame with opacity=255
-    global_opacity = 255;
+    m_globalOpacity = 255;
     renderLayer(m_sprite->getFolder(), image,
                 source_x, source_y, frame, zoom, zoomed_func,
                 true, false);
 
     // Draw transparent layers of the previous/next frames with different opacity (<255) (it is the onion-skinning)
     {
-      int prevs = docSettings->getOnionskinPrevFrames();
-      int nexts = docSettings->getOnionskinNextFrames();
-      int opacity_base = docSettings->getOnionskinOpacityBase();
-      int opacity_step = docSettings->getOnionskinOpacityStep();
+      int prevs = m_onionskinPrevs;
+      int nexts = m_onionskinNexts;
+      int opacity_base = m_onionskinOpacityBase;
+      int opacity_step = m_onionskinOpacityStep;
 
       for (FrameNumber f=frame.previous(prevs); f <= frame.next(nexts); ++f) {
         if (f == frame || f < 0 || f > m_sprite->getLastFrame())
           continue;
         else if (f < frame)
-          global_opacity = opacity_base - opacity_step * ((frame - f)-1);
+          m_globalOpacity = opacity_base - opacity_step * ((frame - f)-1);
         else
-          global_opacity = opacity_base - opacity_step * ((f - frame)-1);
+          m_globalOpacity = opacity_base - opacity_step * ((f - frame)-1);
 
-        if (global_opacity > 0)
+        if (m_globalOpacity > 0)
           renderLayer(m_sprite->getFolder(), image,
                       source_x, source_y, f, zoom, zoomed_func,
                       false, true);
@@ -451,7 +752,7 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
     }
 
     // Draw transparent layers of the current frame with opacity=255
-    global_opacity = 255;
+    m_globalOpacity = 255;
     renderLayer(m_sprite->getFolder(), image,
                 source_x, source_y, frame, zoom, zoomed_func,
                 false, true);
@@ -462,8 +763,6 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
                 source_x, source_y, frame, zoom, zoomed_func,
                 true, true);
   }
-
-  return image;
 }
 
 // static
@@ -471,93 +770,328 @@ void RenderEngine::renderCheckedBackground(Image* image,
                                            int source_x, int source_y,
                                            int zoom)
 {
-  int x, y, u, v;
-  int tile_w = 16;
-  int tile_h = 16;
+  int tile_w, tile_h;
   int c1 = color_utils::color_for_image(checked_bg_color1, image->getPixelFormat());
   int c2 = color_utils::color_for_image(checked_bg_color2, image->getPixelFormat());
 
-  switch (checked_bg_type) {
+  get_checked_bg_tile_size(zoom, tile_w, tile_h);
+  draw_checked_background(image, source_x, source_y, tile_w, tile_h, c1, c2);
+}
 
-    case CHECKED_BG_16X16:
-      tile_w = 16;
-      tile_h = 16;
-      break;
+// static
+void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette* pal,
+                               int x, int y, int zoom)
+{
+  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
+
+  ASSERT(rgb_image->getPixelFormat() == IMAGE_RGB && "renderImage accepts RGB destination images only");
+
+  switch (src_image->getPixelFormat()) {
 
-    case CHECKED_BG_8X8:
-      tile_w = 8;
-      tile_h = 8;
+    case IMAGE_RGB:
+      zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
       break;
 
-    case CHECKED_BG_4X4:
-      tile_w = 4;
-      tile_h = 4;
+    case IMAGE_GRAYSCALE:
+      zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
       break;
 
-    case CHECKED_BG_2X2:
-      tile_w = 2;
-      tile_h = 2;
+    case IMAGE_INDEXED:
+      zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
       break;
 
+    default:
+      return;
   }
 
-  if (checked_bg_zoom) {
-    tile_w <<= zoom;
-    tile_h <<= zoom;
-  }
+  (*zoomed_func)(rgb_image, src_image, pal, x, y, 255, BLEND_MODE_NORMAL, zoom);
+}
 
-  // Tile size
-  if (tile_w < (1<<zoom)) tile_w = (1<<zoom);
-  if (tile_h < (1<<zoom)) tile_h = (1<<zoom);
+// Prepares the document's RenderCache to render the given area,
+// compositing the invalid tiles of the area (using "nthreads"
+// threads). Returns false if the cache cannot be used for this
+// rendering.
+bool RenderEngine::prepareRenderCache(int source_x, int source_y,
+                                      int width, int height,
+                                      FrameNumber frame, int zoom,
+                                      ZoomedFunc zoomed_func,
+                                      bool checked_bg, uint32_t bg_color,
+                                      int nthreads)
+{
+  RenderCache* cache = m_document->getRenderCache();
+  if (!cache || !m_currentLayer || !m_currentLayer->isImage())
+    return false;
+
+  // The current layer must be reachable to split the layers' stack.
+  for (const Layer* layer = m_currentLayer; layer; layer = layer->getParent())
+    if (!layer->isReadable())
+      return false;
+
+  // Only the sprite area is cached.
+  if (source_x < 0 || source_y < 0 ||
+      source_x+width > (m_sprite->getWidth() << zoom) ||
+      source_y+height > (m_sprite->getHeight() << zoom))
+    return false;
+
+  int tile_w = 0, tile_h = 0, c1 = 0, c2 = 0;
+  if (checked_bg)
+    get_cached_checked_bg(zoom, tile_w, tile_h, c1, c2);
+
+  RenderCacheKey key;
+  key.add(m_sprite->getId());
+  key.add(m_currentLayer->getId());
+  key.add((int)frame);
+  key.add((int)m_sprite->getPixelFormat());
+  key.add((int)m_sprite->getTransparentColor());
+  key.add(m_sprite->getPalette(frame)->getId());
+  key.add(m_sprite->getPalette(frame)->getModifications());
+  key.add(checked_bg ? 1: 0);
+  key.add(checked_bg ? tile_w: (int)bg_color);
+  key.add(tile_h);
+  key.add(c1);
+  key.add(c2);
+
+  m_currentLayerReached = false;
+  if (!addLayersBelowToKey(m_sprite->getFolder(), frame, key))
+    return false;
+
+  cache->setKey(key, m_currentLayer, m_sprite->getWidth(), m_sprite->getHeight());
+
+  // Composite the invalid tiles (at 1:1 scale)
+  const int tileSize = RenderCache::TileSize;
+  int u1 = (source_x >> zoom) / tileSize;
+  int v1 = (source_y >> zoom) / tileSize;
+  int u2 = ((source_x+width-1) >> zoom) / tileSize;
+  int v2 = ((source_y+height-1) >> zoom) / tileSize;
+
+  TileTask task(this, frame, zoom, zoomed_func, checked_bg, bg_color);
+  for (int v=v1; v<=v2; ++v)
+    for (int u=u1; u<=u2; ++u)
+      if (!cache->getValidTile(u, v))
+        task.addTile(u, v, cache->getTileToComposite(u, v));
+
+  base::parallel_for(0, task.size(), task, nthreads);
+
+  // Tiles are valid only when all of them were composited (if a tile
+  // throws an exception, they will be composited again).
+  for (int i=0; i<task.size(); ++i)
+    cache->validateTile(task.tile(i).u, task.tile(i).v);
+  return true;
+}
 
-  // Tile position (u,v) is the number of tile we start in (source_x,source_y) coordinate
-  u = (source_x / tile_w);
-  v = (source_y / tile_h);
+void RenderEngine::compositeCacheTile(Image* tile, int u, int v,
+                                      FrameNumber frame, int zoom,
+                                      ZoomedFunc zoomed_func,
+                                      bool checked_bg, uint32_t bg_color)
+{
+  const int tileSize = RenderCache::TileSize;
 
-  // Position where we start drawing the first tile in "image"
-  int x_start = -(source_x % tile_w);
-  int y_start = -(source_y % tile_h);
+  if (checked_bg) {
+    int tile_w, tile_h, c1, c2;
+    get_cached_checked_bg(zoom, tile_w, tile_h, c1, c2);
+    draw_checked_background(tile, u*tileSize, v*tileSize, tile_w, tile_h, c1, c2);
+  }
+  else
+    clear_image(tile, bg_color);
+
+  m_layerRange = LayersBelowCurrent;
+  m_currentLayerReached = false;
+  renderLayer(m_sprite->getFolder(), tile,
+              u*tileSize, v*tileSize, frame, 0, zoomed_func,
+              true, true);
+  m_layerRange = AllLayers;
+}
 
-  // Draw checked background (tile by tile)
-  int u_start = u;
-  for (y=y_start-tile_h; y<image->getHeight()+tile_h; y+=tile_h) {
-    for (x=x_start-tile_w; x<image->getWidth()+tile_w; x+=tile_w) {
-      fill_rect(image, x, y, x+tile_w-1, y+tile_h-1,
-                (((u+v))&1)? c1: c2);
-      ++u;
+// Draws in "image" the background and all layers below the current
+// one using the tiles of the document's RenderCache (all tiles must
+// be valid, see prepareRenderCache()).
+void RenderEngine::renderCachedLayers(Image* image,
+                                      int source_x, int source_y,
+                                      int zoom, bool checked_bg)
+{
+  RenderCache* cache = m_document->getRenderCache();
+
+  // Pixels with the mask color are skipped in the copy of the tiles.
+  if (!checked_bg)
+    clear_image(image, 0);
+
+  const int tileSize = RenderCache::TileSize;
+  int u1 = (source_x >> zoom) / tileSize;
+  int v1 = (source_y >> zoom) / tileSize;
+  int u2 = ((source_x+image->getWidth()-1) >> zoom) / tileSize;
+  int v2 = ((source_y+image->getHeight()-1) >> zoom) / tileSize;
+
+  for (int v=v1; v<=v2; ++v) {
+    for (int u=u1; u<=u2; ++u) {
+      const Image* tile = cache->getValidTile(u, v);
+      ASSERT(tile != NULL);
+
+      merge_zoomed_image<RgbTraits, RgbTraits>
+        (image, tile, NULL,
+         ((u*tileSize) << zoom) - source_x,
+         ((v*tileSize) << zoom) - source_y,
+         255, BLEND_MODE_COPY, zoom);
     }
-    u = u_start;
-    ++v;
   }
 }
 
-// static
-void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette* pal,
-                               int x, int y, int zoom)
+// Adds to the key the state of each visible layer below the current
+// one. Returns false if those layers cannot be cached.
+bool RenderEngine::addLayersBelowToKey(const Layer* layer, FrameNumber frame,
+                                       RenderCacheKey& key)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
+  if (m_currentLayerReached || !layer->isReadable())
+    return true;
 
-  ASSERT(rgb_image->getPixelFormat() == IMAGE_RGB && "renderImage accepts RGB destination images only");
+  switch (layer->type()) {
 
-  switch (src_image->getPixelFormat()) {
+    case OBJECT_LAYER_IMAGE: {
+      if (layer == m_currentLayer) {
+        m_currentLayerReached = true;
+        break;
+      }
 
-    case IMAGE_RGB:
-      zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
+      // The preview image is modified without notifications.
+      if ((frame == m_currentFrame) &&
+          (selected_layer == layer) &&
+          (rastering_image != NULL))
+        return false;
+
+      key.add(layer->getId());
+      key.add(static_cast<const LayerImage*>(layer)->getBlendMode());
+
+      const Cel* cel = static_cast<const LayerImage*>(layer)->getCel(frame);
+      if (cel != NULL) {
+        key.add(cel->getId());
+        key.add(cel->getX());
+        key.add(cel->getY());
+        key.add(cel->getOpacity());
+
+        const Image* image = NULL;
+        if ((cel->getImage() >= 0) &&
+            (cel->getImage() < m_sprite->getStock()->size()))
+          image = m_sprite->getStock()->getImage(cel->getImage());
+
+        if (image) {
+          key.add(image->getId());
+          key.add(image->getVersion());
+        }
+        else
+          key.add(0);
+      }
       break;
+    }
 
-    case IMAGE_GRAYSCALE:
-      zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
+    case OBJECT_LAYER_FOLDER: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it) {
+        if (!addLayersBelowToKey(*it, frame, key))
+          return false;
+      }
       break;
+    }
 
-    case IMAGE_INDEXED:
-      zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
+  }
+
+  return true;
+}
+
+// Updates the given area (in coordinates of the reduced sprite) of
+// the reduced images of all visible cels in the given frame.
+void RenderEngine::prepareMipmaps(const Layer* layer, FrameNumber frame,
+                                  const gfx::Rect& area, int level)
+{
+  if (!layer->isReadable())
+    return;
+
+  switch (layer->type()) {
+
+    case OBJECT_LAYER_IMAGE: {
+      // The preview image is reduced in prepareTransientLevels()
+      if ((frame == m_currentFrame) &&
+          (selected_layer == layer) &&
+          (rastering_image != NULL))
+        break;
+
+      const Cel* cel = static_cast<const LayerImage*>(layer)->getCel(frame);
+      if (cel != NULL &&
+          (cel->getImage() >= 0) &&
+          (cel->getImage() < m_sprite->getStock()->size())) {
+        const Image* src_image = m_sprite->getStock()->getImage(cel->getImage());
+        if (src_image) {
+          gfx::Rect rc(area);
+          rc.offset(-(cel->getX() >> level), -(cel->getY() >> level));
+
+          m_document->getMipmapCache()
+            ->validateLevel(cel->getImage(), src_image, level, rc);
+        }
+      }
       break;
+    }
+
+    case OBJECT_LAYER_FOLDER: {
+      LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+      LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+      for (; it != end; ++it)
+        prepareMipmaps(*it, frame, area, level);
+      break;
+    }
 
-    default:
-      return;
   }
+}
 
-  (*zoomed_func)(rgb_image, src_image, pal, x, y, 255, BLEND_MODE_NORMAL, zoom);
+// Reduces the visible part of an image that is not in the stock (its
+// pixels change without notifications, so it is not cached). Returns
+// NULL if the image is not visible.
+static Image* create_visible_level(const Image* src, int x, int y,
+                                   const gfx::Rect& area, int level,
+                                   gfx::Point& pos)
+{
+  pos = gfx::Point(x >> level, y >> level);
+
+  gfx::Rect rc(area);
+  rc.offset(-pos.x, -pos.y);
+  rc = rc.createIntersect(gfx::Rect(0, 0,
+                                    algorithm::downsampled_size(src->getWidth(), level),
+                                    algorithm::downsampled_size(src->getHeight(), level)));
+  if (rc.isEmpty())
+    return NULL;
+
+  Image* dst = Image::create(src->getPixelFormat(), rc.w, rc.h);
+  dst->setMaskColor(src->getMaskColor());
+  algorithm::downsample_image(dst, 0, 0, src, rc, level);
+
+  pos.x += rc.x;
+  pos.y += rc.y;
+  return dst;
+}
+
+void RenderEngine::prepareTransientLevels(const gfx::Rect& area, int level)
+{
+  if (rastering_image && selected_layer->isImage()) {
+    const Cel* cel = static_cast<const LayerImage*>(selected_layer)->getCel(m_currentFrame);
+    if (cel)
+      m_previewLevel = create_visible_level(rastering_image,
+                                            cel->getX(), cel->getY(),
+                                            area, level, m_previewLevelPos);
+  }
+
+  Cel* extraCel = m_document->getExtraCel();
+  if (extraCel && extraCel->getOpacity() > 0)
+    m_extraLevel = create_visible_level(m_document->getExtraCelImage(),
+                                        extraCel->getX(), extraCel->getY(),
+                                        area, level, m_extraLevelPos);
+}
+
+void RenderEngine::destroyTransientLevels()
+{
+  delete m_previewLevel;
+  delete m_extraLevel;
+  m_previewLevel = NULL;
+  m_extraLevel = NULL;
 }
 
 void RenderEngine::renderLayer(const Layer* layer,
@@ -572,6 +1106,16 @@ void RenderEngine::renderLayer(const Layer* layer,
   if (!layer->isReadable())
     return;
 
+  // Skip layers outside the range to be drawn (the current layer
+  // splits the stack of image layers in two parts).
+  if (m_layerRange != AllLayers && layer->isImage()) {
+    if (layer == m_currentLayer)
+      m_currentLayerReached = true;
+
+    if ((m_layerRange == LayersBelowCurrent) == m_currentLayerReached)
+      return;
+  }
+
   switch (layer->type()) {
 
     case OBJECT_LAYER_IMAGE: {
@@ -601,15 +1145,36 @@ void RenderEngine::renderLayer(const Layer* layer,
           register int t;
 
           output_opacity = MID(0, cel->getOpacity(), 255);
-          output_opacity = INT_MULT(output_opacity, global_opacity, t);
-
-          src_image->setMaskColor(m_sprite->getTransparentColor());
-
-          (*zoomed_func)(image, src_image, m_sprite->getPalette(frame),
-                         (cel->getX() << zoom) - source_x,
-                         (cel->getY() << zoom) - source_y,
-                         output_opacity,
-                         static_cast<const LayerImage*>(layer)->getBlendMode(), zoom);
+          output_opacity = INT_MULT(output_opacity, m_globalOpacity, t);
+
+          if (zoom >= 0) {
+            (*zoomed_func)(image, src_image, m_sprite->getPalette(frame),
+                           (cel->getX() << zoom) - source_x,
+                           (cel->getY() << zoom) - source_y,
+                           output_opacity,
+                           static_cast<const LayerImage*>(layer)->getBlendMode(), zoom);
+          }
+          else {
+            // Use the reduced image prepared in renderSprite()
+            const Image* level_image;
+            gfx::Point pos;
+
+            if (src_image == rastering_image) {
+              level_image = m_previewLevel;
+              pos = m_previewLevelPos;
+            }
+            else {
+              level_image = m_document->getMipmapCache()
+                ->getLevel(cel->getImage(), src_image, -zoom);
+              pos = gfx::Point(cel->getX() >> -zoom, cel->getY() >> -zoom);
+            }
+
+            if (level_image)
+              (*zoomed_func)(image, level_image, m_sprite->getPalette(frame),
+                             pos.x - source_x, pos.y - source_y,
+                             output_opacity,
+                             static_cast<const LayerImage*>(layer)->getBlendMode(), 0);
+          }
         }
       }
       break;
@@ -638,10 +1203,18 @@ void RenderEngine::renderLayer(const Layer* layer,
     if (extraCel->getOpacity() > 0) {
       Image* extraImage = m_document->getExtraCelImage();
 
-      (*zoomed_func)(image, extraImage, m_sprite->getPalette(frame),
-                     (extraCel->getX() << zoom) - source_x,
-                     (extraCel->getY() << zoom) - source_y,
-                     extraCel->getOpacity(), BLEND_MODE_NORMAL, zoom);
+      if (zoom >= 0) {
+        (*zoomed_func)(image, extraImage, m_sprite->getPalette(frame),
+                       (extraCel->getX() << zoom) - source_x,
+                       (extraCel->getY() << zoom) - source_y,
+                       extraCel->getOpacity(), BLEND_MODE_NORMAL, zoom);
+      }
+      else if (m_extraLevel) {
+        (*zoomed_func)(image, m_extraLevel, m_sprite->getPalette(frame),
+                       m_extraLevelPos.x - source_x,
+                       m_extraLevelPos.y - source_y,
+                       extraCel->getOpacity(), BLEND_MODE_NORMAL, 0);
+      }
     }
   }
 }
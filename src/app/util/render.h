@@ -20,7 +20,10 @@
 #define APP_UTIL_RENDER_H_INCLUDED
 
 #include "app/color.h"
+#include "gfx/point.h"
+#include "gfx/rect.h"
 #include "raster/frame_number.h"
+#include "raster/image_buffer.h"
 
 namespace raster {
   class Image;
@@ -31,9 +34,61 @@ namespace raster {
 
 namespace app {
   class Document;
+  class RenderCacheKey;
 
   using namespace raster;
 
+  // Zoom levels are powers of two: a positive zoom magnifies the sprite
+  // (each pixel is a box of 1<<zoom screen pixels) and a negative zoom
+  // reduces it (each screen pixel is a box of 1<<-zoom sprite pixels).
+
+  // Converts a sprite coordinate/size to screen units.
+  inline int apply_zoom(int value, int zoom) {
+    return (zoom >= 0 ? (value << zoom): (value >> -zoom));
+  }
+
+  // Converts a screen coordinate/size to sprite units.
+  inline int remove_zoom(int value, int zoom) {
+    return (zoom >= 0 ? (value >> zoom): (value << -zoom));
+  }
+
+  // Converts a rectangle in sprite coordinates to screen coordinates
+  // (including partially covered screen pixels).
+  inline gfx::Rect apply_zoom(const gfx::Rect& rc, int zoom) {
+    if (zoom >= 0)
+      return gfx::Rect(rc.x << zoom, rc.y << zoom, rc.w << zoom, rc.h << zoom);
+
+    int x1 = (rc.x >> -zoom);
+    int y1 = (rc.y >> -zoom);
+    int x2 = ((rc.x+rc.w+(1<<-zoom)-1) >> -zoom);
+    int y2 = ((rc.y+rc.h+(1<<-zoom)-1) >> -zoom);
+    return gfx::Rect(x1, y1, x2-x1, y2-y1);
+  }
+
+  // Converts a rectangle in screen coordinates to sprite coordinates
+  // (including partially covered sprite pixels).
+  inline gfx::Rect remove_zoom(const gfx::Rect& rc, int zoom) {
+    if (zoom <= 0)
+      return gfx::Rect(rc.x << -zoom, rc.y << -zoom, rc.w << -zoom, rc.h << -zoom);
+
+    int x1 = (rc.x >> zoom);
+    int y1 = (rc.y >> zoom);
+    int x2 = ((rc.x+rc.w+(1<<zoom)-1) >> zoom);
+    int y2 = ((rc.y+rc.h+(1<<zoom)-1) >> zoom);
+    return gfx::Rect(x1, y1, x2-x1, y2-y1);
+  }
+
+  // Used to prepare the pixels of the preview image before they are
+  // rendered (e.g. when the preview image is filled on demand).
+  class PreviewImageDelegate {
+  public:
+    virtual ~PreviewImageDelegate() { }
+
+    // Called (from the main thread) before rendering the given area
+    // of the preview image (in preview image coordinates).
+    virtual void validatePreviewImage(const gfx::Rect& bounds) = 0;
+  };
+
   class RenderEngine {
   public:
     RenderEngine(const Document* document,
@@ -62,15 +117,20 @@ namespace app {
     //////////////////////////////////////////////////////////////////////
     // Preview image
 
-    static void setPreviewImage(const Layer* layer, Image* drawable);
+    static void setPreviewImage(const Layer* layer, Image* drawable,
+                                PreviewImageDelegate* delegate = NULL);
 
     //////////////////////////////////////////////////////////////////////
-    // Main function used by sprite-editors to render the sprite
+    // Main function used by sprite-editors to render the sprite (the
+    // optional buffer can be used to reuse the memory of the image
+    // between renders). A negative zoom renders the sprite zoomed out
+    // using the document's MipmapCache.
 
     Image* renderSprite(int source_x, int source_y,
                         int width, int height,
                         FrameNumber frame, int zoom,
-                        bool draw_tiled_bg);
+                        bool draw_tiled_bg,
+                        const ImageBufferPtr& buffer = ImageBufferPtr());
 
     //////////////////////////////////////////////////////////////////////
     // Extra functions
@@ -83,6 +143,51 @@ namespace app {
                             int x, int y, int zoom);
 
   private:
+    typedef void (*ZoomedFunc)(Image*, const Image*, const Palette*, int, int, int, int, int);
+
+    // Which layers are drawn by renderLayer() (the current layer is
+    // used to split the layers' stack).
+    enum LayerRange {
+      AllLayers,
+      LayersBelowCurrent,
+      CurrentAndAboveLayers
+    };
+
+    class BandTask;
+    class TileTask;
+
+    void renderArea(Image* image,
+                    int source_x, int source_y,
+                    FrameNumber frame, int zoom,
+                    ZoomedFunc zoomed_func,
+                    bool checked_bg, uint32_t bg_color,
+                    bool use_cache);
+
+    bool prepareRenderCache(int source_x, int source_y,
+                            int width, int height,
+                            FrameNumber frame, int zoom,
+                            ZoomedFunc zoomed_func,
+                            bool checked_bg, uint32_t bg_color,
+                            int nthreads);
+
+    void compositeCacheTile(Image* tile, int u, int v,
+                            FrameNumber frame, int zoom,
+                            ZoomedFunc zoomed_func,
+                            bool checked_bg, uint32_t bg_color);
+
+    void renderCachedLayers(Image* image,
+                            int source_x, int source_y,
+                            int zoom, bool checked_bg);
+
+    bool addLayersBelowToKey(const Layer* layer, FrameNumber frame,
+                             RenderCacheKey& key);
+
+    void prepareMipmaps(const Layer* layer, FrameNumber frame,
+                        const gfx::Rect& area, int level);
+
+    void prepareTransientLevels(const gfx::Rect& area, int level);
+    void destroyTransientLevels();
+
     void renderLayer(const Layer* layer,
                      Image* image,
                      int source_x, int source_y,
@@ -95,6 +200,23 @@ namespace app {
     const Sprite* m_sprite;
     const Layer* m_currentLayer;
     FrameNumber m_currentFrame;
+    LayerRange m_layerRange;
+    bool m_currentLayerReached;
+    int m_globalOpacity;
+
+    // Reduced versions of the visible part of the preview image and the
+    // extra cel (created in renderSprite() for negative zoom levels)
+    Image* m_previewLevel;
+    gfx::Point m_previewLevelPos;
+    Image* m_extraLevel;
+    gfx::Point m_extraLevelPos;
+
+    // Onion-skin settings
+    bool m_onionskin;
+    int m_onionskinPrevs;
+    int m_onionskinNexts;
+    int m_onionskinOpacityBase;
+    int m_onionskinOpacityStep;
   };
 
 } // namespace app
@@ -0,0 +1,129 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/render_cache.h"
+
+#include "gfx/point.h"
+#include "gfx/rect.h"
+#include "gfx/region.h"
+#include "raster/image.h"
+
+#include <algorithm>
+
+namespace app {
+
+RenderCache::RenderCache()
+  : m_currentLayer(NULL)
+  , m_cols(0)
+  , m_rows(0)
+{
+}
+
+RenderCache::~RenderCache()
+{
+  destroyTiles();
+}
+
+void RenderCache::setKey(const RenderCacheKey& key, const Layer* currentLayer,
+                         int width, int height)
+{
+  int cols = (width + TileSize - 1) / TileSize;
+  int rows = (height + TileSize - 1) / TileSize;
+
+  if (m_key == key && m_cols == cols && m_rows == rows)
+    return;
+
+  destroyTiles();
+
+  m_key = key;
+  m_currentLayer = currentLayer;
+  m_cols = cols;
+  m_rows = rows;
+  m_tiles.resize(cols*rows, (Image*)NULL);
+  m_valid.resize(cols*rows, false);
+}
+
+Image* RenderCache::getValidTile(int u, int v) const
+{
+  ASSERT(u >= 0 && u < m_cols);
+  ASSERT(v >= 0 && v < m_rows);
+
+  int i = v*m_cols + u;
+  return (m_valid[i] ? m_tiles[i]: NULL);
+}
+
+Image* RenderCache::getTileToComposite(int u, int v)
+{
+  ASSERT(u >= 0 && u < m_cols);
+  ASSERT(v >= 0 && v < m_rows);
+
+  int i = v*m_cols + u;
+  if (!m_tiles[i])
+    m_tiles[i] = Image::create(IMAGE_RGB, TileSize, TileSize);
+
+  m_valid[i] = false;
+  return m_tiles[i];
+}
+
+void RenderCache::validateTile(int u, int v)
+{
+  ASSERT(u >= 0 && u < m_cols);
+  ASSERT(v >= 0 && v < m_rows);
+  ASSERT(m_tiles[v*m_cols + u] != NULL);
+
+  m_valid[v*m_cols + u] = true;
+}
+
+void RenderCache::invalidate()
+{
+  std::fill(m_valid.begin(), m_valid.end(), false);
+}
+
+void RenderCache::invalidateRegion(const Layer* layer, const gfx::Region& region)
+{
+  // The pixels of the current layer are not cached.
+  if (layer != NULL && layer == m_currentLayer)
+    return;
+
+  for (gfx::Region::const_iterator it=region.begin(), end=region.end();
+       it != end; ++it) {
+    gfx::Rect rc = (*it).createIntersect(gfx::Rect(0, 0, m_cols*TileSize, m_rows*TileSize));
+    if (rc.isEmpty())
+      continue;
+
+    for (int v=rc.y/TileSize; v<=(rc.y+rc.h-1)/TileSize; ++v)
+      for (int u=rc.x/TileSize; u<=(rc.x+rc.w-1)/TileSize; ++u)
+        m_valid[v*m_cols + u] = false;
+  }
+}
+
+void RenderCache::destroyTiles()
+{
+  for (std::vector<Image*>::iterator it=m_tiles.begin(), end=m_tiles.end();
+       it != end; ++it)
+    delete *it;
+
+  m_tiles.clear();
+  m_valid.clear();
+}
+
+} // namespace app
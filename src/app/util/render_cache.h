@@ -0,0 +1,114 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UTIL_RENDER_CACHE_H_INCLUDED
+#define APP_UTIL_RENDER_CACHE_H_INCLUDED
+
+#include "base/disable_copying.h"
+
+#include <vector>
+
+namespace gfx {
+  class Region;
+}
+
+namespace raster {
+  class Image;
+  class Layer;
+}
+
+namespace app {
+
+  using namespace raster;
+
+  // Values that identify what was rendered in the tiles of a
+  // RenderCache (IDs of the sprite, layers, cels and palette, the
+  // palette modifications counter, IDs and versions of the images,
+  // background, positions/opacities of cels, etc.). Objects are
+  // identified by their IDs (see raster::Object::getId()) instead of
+  // their addresses, because the address of a deleted object can be
+  // reused by a new one. Changes in the pixels of the images that
+  // don't change their versions must be notified with
+  // RenderCache::invalidate() or RenderCache::invalidateRegion().
+  class RenderCacheKey {
+  public:
+    void add(int value) { m_values.push_back(value); }
+    void add(uint32_t value) { m_values.push_back(value); }
+
+    bool operator==(const RenderCacheKey& other) const { return m_values == other.m_values; }
+    bool operator!=(const RenderCacheKey& other) const { return m_values != other.m_values; }
+
+  private:
+    std::vector<int64_t> m_values;
+  };
+
+  // Cache of the flattened stack of layers below the current layer
+  // (including the background color or the checked background) of one
+  // frame at 1:1 scale. It is split in tiles so only the parts that
+  // were invalidated by a dirty region must be composited again.
+  //
+  // Each document has its own cache (see Document::getRenderCache()),
+  // and it is filled by RenderEngine::renderSprite().
+  class RenderCache {
+  public:
+    enum { TileSize = 64 };
+
+    RenderCache();
+    ~RenderCache();
+
+    // Changes the key of the cache. If the new key is different from
+    // the current one, all tiles are invalidated.
+    void setKey(const RenderCacheKey& key, const Layer* currentLayer,
+                int width, int height);
+
+    // Returns the tile in the given tile-coordinates (each unit is a
+    // TileSize block of pixels), or NULL if the tile must be
+    // composited again.
+    Image* getValidTile(int u, int v) const;
+
+    // Returns an image to composite the tile in the given position.
+    // The tile isn't valid until validateTile() is called (after it
+    // was filled completely).
+    Image* getTileToComposite(int u, int v);
+    void validateTile(int u, int v);
+
+    // Invalidates all tiles.
+    void invalidate();
+
+    // Invalidates tiles touched by the given region (in sprite
+    // coordinates) because pixels of "layer" were modified. If "layer"
+    // is the current layer, nothing is invalidated as its pixels are
+    // not in the cache. Use NULL if you don't know the modified layer.
+    void invalidateRegion(const Layer* layer, const gfx::Region& region);
+
+  private:
+    void destroyTiles();
+
+    RenderCacheKey m_key;
+    const Layer* m_currentLayer;
+    int m_cols;
+    int m_rows;
+    std::vector<Image*> m_tiles;
+    std::vector<bool> m_valid;
+
+    DISABLE_COPYING(RenderCache);
+  };
+
+} // namespace app
+
+#endif
@@ -0,0 +1,51 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/condition_variable.h"
+
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+
+#ifdef WIN32
+  #include "base/mutex_win32.h"
+  #include "base/condition_variable_win32.h"
+#else
+  #include "base/mutex_pthread.h"
+  #include "base/condition_variable_pthread.h"
+#endif
+
+namespace base {
+
+condition_variable::condition_variable()
+  : m_impl(new condition_variable_impl)
+{
+}
+
+condition_variable::~condition_variable()
+{
+  delete m_impl;
+}
+
+void condition_variable::wait(scoped_lock& lock)
+{
+  m_impl->wait(lock.get_mutex().m_impl->native_handle());
+}
+
+void condition_variable::notify_one()
+{
+  m_impl->notify_one();
+}
+
+void condition_variable::notify_all()
+{
+  m_impl->notify_all();
+}
+
+} // namespace base
@@ -0,0 +1,39 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifndef BASE_CONDITION_VARIABLE_H_INCLUDED
+#define BASE_CONDITION_VARIABLE_H_INCLUDED
+
+#include "base/disable_copying.h"
+
+namespace base {
+
+  class scoped_lock;
+
+  class condition_variable {
+  public:
+    condition_variable();
+    ~condition_variable();
+
+    // Unlocks the mutex of the given lock, waits a notification, and
+    // locks the mutex again. It can return without a notification
+    // (spurious wakeups), so it must be called in a loop that checks
+    // the waited condition.
+    void wait(scoped_lock& lock);
+
+    void notify_one();
+    void notify_all();
+
+  private:
+    class condition_variable_impl;
+    condition_variable_impl* m_impl;
+
+    DISABLE_COPYING(condition_variable);
+  };
+
+} // namespace base
+
+#endif
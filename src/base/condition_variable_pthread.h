@@ -0,0 +1,41 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifndef BASE_CONDITION_VARIABLE_PTHREAD_H_INCLUDED
+#define BASE_CONDITION_VARIABLE_PTHREAD_H_INCLUDED
+
+#include <pthread.h>
+
+class base::condition_variable::condition_variable_impl
+{
+public:
+
+  condition_variable_impl() {
+    pthread_cond_init(&m_handle, NULL);
+  }
+
+  ~condition_variable_impl() {
+    pthread_cond_destroy(&m_handle);
+  }
+
+  void wait(pthread_mutex_t* mutex) {
+    pthread_cond_wait(&m_handle, mutex);
+  }
+
+  void notify_one() {
+    pthread_cond_signal(&m_handle);
+  }
+
+  void notify_all() {
+    pthread_cond_broadcast(&m_handle);
+  }
+
+private:
+  pthread_cond_t m_handle;
+
+};
+
+#endif
@@ -0,0 +1,38 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifndef BASE_CONDITION_VARIABLE_WIN32_H_INCLUDED
+#define BASE_CONDITION_VARIABLE_WIN32_H_INCLUDED
+
+#include <windows.h>
+
+// Condition variables of Windows Vista (they work with the
+// CRITICAL_SECTION of base::mutex).
+class base::condition_variable::condition_variable_impl
+{
+public:
+
+  condition_variable_impl() {
+    InitializeConditionVariable(&m_handle);
+  }
+
+  void wait(CRITICAL_SECTION* mutex) {
+    SleepConditionVariableCS(&m_handle, mutex, INFINITE);
+  }
+
+  void notify_one() {
+    WakeConditionVariable(&m_handle);
+  }
+
+  void notify_all() {
+    WakeAllConditionVariable(&m_handle);
+  }
+
+private:
+  CONDITION_VARIABLE m_handle;
+};
+
+#endif
@@ -21,6 +21,8 @@ namespace base {
     void unlock();
 
   private:
+    friend class condition_variable;
+
     class mutex_impl;
     mutex_impl* m_impl;
 
@@ -34,6 +34,10 @@ public:
     pthread_mutex_unlock(&m_handle);
   }
 
+  pthread_mutex_t* native_handle() {
+    return &m_handle;
+  }
+
 private:
   pthread_mutex_t m_handle;
 
@@ -0,0 +1,169 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifndef BASE_PARALLEL_FOR_H_INCLUDED
+#define BASE_PARALLEL_FOR_H_INCLUDED
+
+#include "base/exception.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "base/thread_pool.h"
+#include "base/unique_ptr.h"
+
+#include <new>
+
+namespace base {
+
+  namespace details {
+
+    // Copy of an exception thrown in a worker thread, so it can be
+    // thrown again from the calling thread.
+    class parallel_for_error {
+    public:
+      virtual ~parallel_for_error() { }
+      virtual void rethrow() const = 0;
+    };
+
+    template<class E>
+    class parallel_for_error_impl : public parallel_for_error {
+    public:
+      parallel_for_error_impl(const E& e) : m_e(e) { }
+      void rethrow() const { throw m_e; }
+    private:
+      E m_e;
+    };
+
+    template<class Func>
+    struct parallel_for_data {
+      Func* func;
+      int next;
+      int end;
+      mutex next_mutex;
+      parallel_for_error* error;
+
+      parallel_for_data() : error(NULL) { }
+      ~parallel_for_data() { delete error; }
+
+      // Stops giving indexes to the workers.
+      void stop() {
+        scoped_lock lock(next_mutex);
+        next = end;
+      }
+
+      void setError(parallel_for_error* newError) {
+        scoped_lock lock(next_mutex);
+        next = end;
+        if (!error)
+          error = newError;
+        else
+          delete newError;
+      }
+    };
+
+    template<class Func>
+    void parallel_for_loop(parallel_for_data<Func>* data)
+    {
+      for (;;) {
+        int i;
+        {
+          scoped_lock lock(data->next_mutex);
+          if (data->next >= data->end)
+            break;
+          i = data->next++;
+        }
+        (*data->func)(i);
+      }
+    }
+
+    template<class Func>
+    void parallel_for_worker(parallel_for_data<Func>* data)
+    {
+      try {
+        parallel_for_loop(data);
+      }
+      catch (const std::bad_alloc& e) {
+        data->setError(new parallel_for_error_impl<std::bad_alloc>(e));
+      }
+      catch (const Exception& e) {
+        data->setError(new parallel_for_error_impl<Exception>(e));
+      }
+      catch (const std::exception& e) {
+        data->setError(new parallel_for_error_impl<Exception>(Exception(std::string(e.what()))));
+      }
+      catch (...) {
+        data->setError(new parallel_for_error_impl<Exception>(Exception(std::string("Unknown error in a worker thread"))));
+      }
+    }
+
+    // Job for the threads of the thread_pool.
+    template<class Func>
+    class parallel_for_job : public thread_pool::job {
+    public:
+      parallel_for_job(parallel_for_data<Func>* data) : m_data(data) { }
+      void run() { parallel_for_worker<Func>(m_data); }
+    private:
+      parallel_for_data<Func>* m_data;
+    };
+
+  } // namespace details
+
+  // Calls func(i) for each "i" in the [begin, end) range using up to
+  // "nthreads" threads (the calling thread is one of them, the others
+  // are from the thread_pool, and zero means one thread for each
+  // CPU). Each index is processed exactly once in some unspecified
+  // order, so "func" must be safe to call concurrently. Returns when
+  // all indexes were processed.
+  //
+  // If "func" throws, the remaining indexes are not processed and,
+  // after all threads finish, the exception is thrown again in the
+  // calling thread. Exceptions thrown in other threads are copied
+  // (std::bad_alloc and base::Exception keep their type, other
+  // std::exception are converted to base::Exception).
+  template<class Func>
+  void parallel_for(int begin, int end, Func& func, int nthreads = 0)
+  {
+    if (nthreads <= 0)
+      nthreads = thread::hardware_concurrency();
+    if (nthreads > end - begin)
+      nthreads = end - begin;
+
+    if (nthreads <= 1) {
+      for (int i=begin; i<end; ++i)
+        func(i);
+      return;
+    }
+
+    details::parallel_for_data<Func> data;
+    data.func = &func;
+    data.next = begin;
+    data.end = end;
+
+    {
+      details::parallel_for_job<Func> job(&data);
+
+      // The destructor of the scoped_job waits the other threads (even
+      // when the original exception is thrown from this thread)
+      thread_pool::scoped_job scopedJob(job, nthreads-1);
+      try {
+        details::parallel_for_loop<Func>(&data);
+      }
+      catch (...) {
+        data.stop();
+        throw;
+      }
+    }
+
+    if (data.error) {
+      UniquePtr<details::parallel_for_error> error(data.error);
+      data.error = NULL;
+      error->rethrow();
+    }
+  }
+
+} // namespace base
+
+#endif
@@ -0,0 +1,97 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace base;
+
+class Increment {
+public:
+  Increment(std::vector<int>& values) : m_values(values) { }
+  void operator()(int i) { ++m_values[i]; }
+private:
+  std::vector<int>& m_values;
+};
+
+TEST(ParallelFor, EachIndexOnce)
+{
+  for (int nthreads=0; nthreads<=8; ++nthreads) {
+    std::vector<int> values(1000, 0);
+    Increment func(values);
+
+    parallel_for(10, 990, func, nthreads);
+
+    for (int i=0; i<1000; ++i)
+      EXPECT_EQ((i >= 10 && i < 990) ? 1: 0, values[i]);
+  }
+}
+
+TEST(ParallelFor, EmptyRange)
+{
+  std::vector<int> values(10, 0);
+  Increment func(values);
+
+  parallel_for(5, 5, func, 4);
+
+  for (int i=0; i<10; ++i)
+    EXPECT_EQ(0, values[i]);
+}
+
+class ThrowAt {
+public:
+  ThrowAt(int index) : m_index(index) { }
+  void operator()(int i) {
+    if (i == m_index)
+      throw Exception("Error at %d", i);
+  }
+private:
+  int m_index;
+};
+
+class BadAllocAt {
+public:
+  BadAllocAt(int index) : m_index(index) { }
+  void operator()(int i) {
+    if (i == m_index)
+      throw std::bad_alloc();
+  }
+private:
+  int m_index;
+};
+
+TEST(ParallelFor, ExceptionsAreThrownInTheCallingThread)
+{
+  for (int nthreads=1; nthreads<=8; ++nthreads) {
+    for (int index=0; index<100; index += 33) {
+      ThrowAt func(index);
+      try {
+        parallel_for(0, 100, func, nthreads);
+        ADD_FAILURE() << "No exception was thrown";
+      }
+      catch (const Exception& e) {
+        char buf[32];
+        std::sprintf(buf, "Error at %d", index);
+        EXPECT_EQ(std::string(buf), e.what());
+      }
+    }
+
+    BadAllocAt func(50);
+    EXPECT_THROW(parallel_for(0, 100, func, nthreads), std::bad_alloc);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
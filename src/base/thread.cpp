@@ -65,10 +65,12 @@ void base::thread::join()
   if (joinable()) {
 #ifdef WIN32
     ::WaitForSingleObject(m_native_handle, INFINITE);
+    ::CloseHandle(m_native_handle);
 #else
     ::pthread_join((pthread_t)m_native_handle, NULL);
 #endif
-    detach();
+    // The thread cannot be joined or detached again
+    m_native_handle = (native_handle_type)0;
   }
 }
 
@@ -77,10 +79,10 @@ void base::thread::detach()
   if (joinable()) {
 #ifdef WIN32
     ::CloseHandle(m_native_handle);
-    m_native_handle = (native_handle_type)0;
 #else
     ::pthread_detach((pthread_t)m_native_handle);
 #endif
+    m_native_handle = (native_handle_type)0;
   }
 }
 
@@ -89,6 +91,22 @@ base::thread::native_handle_type base::thread::native_handle()
   return m_native_handle;
 }
 
+int base::thread::hardware_concurrency()
+{
+#ifdef WIN32
+
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return (info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors: 1);
+
+#else
+
+  long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0 ? (int)n: 1);
+
+#endif
+}
+
 void base::thread::launch_thread(func_wrapper* f)
 {
   m_native_handle = (native_handle_type)0;
@@ -42,6 +42,10 @@ namespace base {                // Based on C++0x threads lib
 
     native_handle_type native_handle();
 
+    // Returns the number of threads that can run concurrently in the
+    // machine (at least 1).
+    static int hardware_concurrency();
+
     class details {
     public:
       static void thread_proxy(void* data);
@@ -0,0 +1,138 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/thread_pool.h"
+
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+#include <algorithm>
+
+namespace base {
+
+struct thread_pool::entry {
+  thread_pool::job* job;
+  int pending;                  // Threads that can start the job yet
+  int running;                  // Threads of the pool running the job
+};
+
+// Created before main() (so it is not created by two threads at the
+// same time) and destroyed at exit.
+thread_pool thread_pool::s_instance;
+
+thread_pool::scoped_job::scoped_job(job& job, int helpers)
+  : m_entry(NULL)
+{
+  if (helpers > 0) {
+    m_entry = new entry;
+    m_entry->job = &job;
+    m_entry->pending = helpers;
+    m_entry->running = 0;
+    thread_pool::instance().add(m_entry);
+  }
+}
+
+thread_pool::scoped_job::~scoped_job()
+{
+  if (m_entry) {
+    thread_pool::instance().remove(m_entry);
+    delete m_entry;
+  }
+}
+
+// static
+thread_pool& thread_pool::instance()
+{
+  return s_instance;
+}
+
+thread_pool::thread_pool()
+  : m_exit(false)
+{
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    scoped_lock lock(m_mutex);
+    m_exit = true;
+    m_newJob.notify_all();
+  }
+
+  for (std::vector<thread*>::iterator it=m_threads.begin(); it!=m_threads.end(); ++it) {
+    (*it)->join();
+    delete *it;
+  }
+}
+
+void thread_pool::add(entry* entry)
+{
+  scoped_lock lock(m_mutex);
+
+  // Create the threads that the job needs (threads running other jobs
+  // are counted too, so the pool doesn't grow with nested jobs)
+  int needed = std::min<int>(entry->pending, max_threads);
+  while ((int)m_threads.size() < needed)
+    m_threads.push_back(new thread(&thread_pool::worker_proc, this));
+
+  m_entries.push_back(entry);
+  if (entry->pending > 1)
+    m_newJob.notify_all();
+  else
+    m_newJob.notify_one();
+}
+
+void thread_pool::remove(entry* entry)
+{
+  scoped_lock lock(m_mutex);
+
+  // No more threads can start the job
+  if (entry->pending > 0) {
+    m_entries.remove(entry);
+    entry->pending = 0;
+  }
+
+  while (entry->running > 0)
+    m_jobDone.wait(lock);
+}
+
+// static
+void thread_pool::worker_proc(thread_pool* pool)
+{
+  pool->worker();
+}
+
+void thread_pool::worker()
+{
+  scoped_lock lock(m_mutex);
+
+  for (;;) {
+    while (!m_exit && m_entries.empty())
+      m_newJob.wait(lock);
+
+    if (m_exit)
+      break;
+
+    entry* entry = m_entries.front();
+    ++entry->running;
+    if (--entry->pending == 0)
+      m_entries.pop_front();
+
+    // job::run() doesn't throw, so the mutex is locked again
+    m_mutex.unlock();
+    entry->job->run();
+    m_mutex.lock();
+
+    if (--entry->running == 0)
+      m_jobDone.notify_all();
+  }
+}
+
+} // namespace base
@@ -0,0 +1,80 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifndef BASE_THREAD_POOL_H_INCLUDED
+#define BASE_THREAD_POOL_H_INCLUDED
+
+#include "base/condition_variable.h"
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+
+#include <list>
+#include <vector>
+
+namespace base {
+
+  class thread;
+
+  // Threads that are created once and wait for jobs, so functions
+  // like parallel_for() don't create and join threads each time they
+  // are called. The pool grows when more threads are needed (up to
+  // thread_pool::max_threads) and its threads are joined at exit.
+  class thread_pool {
+    struct entry;
+
+  public:
+    enum { max_threads = 64 };
+
+    // A job that can be run by several threads at the same time.
+    // run() must not throw exceptions.
+    class job {
+    public:
+      virtual ~job() { }
+      virtual void run() = 0;
+    };
+
+    // The given job is run by up to "helpers" threads of the pool
+    // while the scoped_job is alive (if all threads are busy with
+    // other jobs the job can be run by less threads, or none). The
+    // destructor waits the threads that are running the job.
+    class scoped_job {
+    public:
+      scoped_job(job& job, int helpers);
+      ~scoped_job();
+
+    private:
+      entry* m_entry;
+
+      DISABLE_COPYING(scoped_job);
+    };
+
+    static thread_pool& instance();
+
+    ~thread_pool();
+
+  private:
+    thread_pool();
+
+    void add(entry* entry);
+    void remove(entry* entry);
+    static void worker_proc(thread_pool* pool);
+    void worker();
+
+    mutex m_mutex;
+    condition_variable m_newJob;
+    condition_variable m_jobDone;
+    std::list<entry*> m_entries; // Jobs that need more threads
+    std::vector<thread*> m_threads;
+    bool m_exit;
+
+    static thread_pool s_instance;
+
+    DISABLE_COPYING(thread_pool);
+  };
+
+} // namespace base
+
+#endif
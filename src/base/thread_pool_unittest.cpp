@@ -0,0 +1,80 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+#include "base/thread_pool.h"
+
+#include <vector>
+
+using namespace base;
+
+class CountRuns : public thread_pool::job {
+public:
+  CountRuns() : m_runs(0) { }
+  int runs() const { return m_runs; }
+  void run() {
+    scoped_lock lock(m_mutex);
+    ++m_runs;
+  }
+private:
+  mutex m_mutex;
+  int m_runs;
+};
+
+TEST(ThreadPool, JobIsRunAtMostByHelpers)
+{
+  for (int helpers=0; helpers<=8; ++helpers) {
+    CountRuns job;
+    {
+      thread_pool::scoped_job scopedJob(job, helpers);
+    }
+    // The destructor of scoped_job waits the running threads
+    EXPECT_LE(job.runs(), helpers);
+  }
+}
+
+class NestedLoop {
+public:
+  NestedLoop(std::vector<int>& values) : m_values(values) { }
+  void operator()(int i) {
+    Increment func(m_values, i*10);
+    parallel_for(0, 10, func, 4);
+  }
+private:
+  class Increment {
+  public:
+    Increment(std::vector<int>& values, int offset) : m_values(values), m_offset(offset) { }
+    void operator()(int i) { ++m_values[m_offset+i]; }
+  private:
+    std::vector<int>& m_values;
+    int m_offset;
+  };
+
+  std::vector<int>& m_values;
+};
+
+// The threads of the pool are reused by parallel_for() calls made
+// from other parallel_for() calls.
+TEST(ThreadPool, NestedParallelFor)
+{
+  for (int k=0; k<20; ++k) {
+    std::vector<int> values(1000, 0);
+    NestedLoop func(values);
+
+    parallel_for(0, 100, func, 4);
+
+    for (int i=0; i<1000; ++i)
+      EXPECT_EQ(1, values[i]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,231 @@
+// Aseprite Gfx Library
+// Copyright (C) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gfx/packing_rects.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace gfx {
+
+namespace {
+
+  // Sorts the rectangles to be packed from the biggest to the
+  // smallest, the MaxRects algorithm gives better results in that
+  // order.
+  struct BiggerFirst {
+    const std::vector<Rect>& rects;
+    BiggerFirst(const std::vector<Rect>& rects) : rects(rects) { }
+    bool operator()(int a, int b) const {
+      const Rect& ra = rects[a];
+      const Rect& rb = rects[b];
+      int sa = std::max(ra.w, ra.h);
+      int sb = std::max(rb.w, rb.h);
+      if (sa != sb)
+        return sa > sb;
+      if (ra.w*ra.h != rb.w*rb.h)
+        return ra.w*ra.h > rb.w*rb.h;
+      return a < b;
+    }
+  };
+
+  bool overlaps(const Rect& a, const Rect& b)
+  {
+    return (a.x < b.x+b.w && b.x < a.x+a.w &&
+            a.y < b.y+b.h && b.y < a.y+a.h);
+  }
+
+  bool contains(const Rect& a, const Rect& b)
+  {
+    return (b.x >= a.x && b.y >= a.y &&
+            b.x+b.w <= a.x+a.w &&
+            b.y+b.h <= a.y+a.h);
+  }
+
+} // anonymous namespace
+
+void PackingRects::add(const Size& size)
+{
+  m_rects.push_back(Rect(Point(0, 0), size));
+}
+
+bool PackingRects::pack(const Size& binSize)
+{
+  m_freeRects.clear();
+  m_freeRects.push_back(Rect(Point(0, 0), binSize));
+
+  std::vector<int> order(m_rects.size());
+  for (int i=0; i<(int)order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), BiggerFirst(m_rects));
+
+  for (std::vector<int>::iterator it=order.begin(), end=order.end(); it!=end; ++it) {
+    Rect& rc = m_rects[*it];
+
+    // Empty rectangles don't need space in the bin.
+    if (rc.w <= 0 || rc.h <= 0) {
+      rc.x = rc.y = 0;
+      continue;
+    }
+
+    // Find the best free rectangle to place "rc" (Best Short Side Fit)
+    int bestShortSide = INT_MAX;
+    int bestLongSide = INT_MAX;
+    Point bestPos;
+
+    for (Rects::iterator
+           free=m_freeRects.begin(), freeEnd=m_freeRects.end(); free!=freeEnd; ++free) {
+      if (free->w >= rc.w && free->h >= rc.h) {
+        int dw = free->w - rc.w;
+        int dh = free->h - rc.h;
+        int shortSide = std::min(dw, dh);
+        int longSide = std::max(dw, dh);
+
+        if (shortSide < bestShortSide ||
+            (shortSide == bestShortSide && longSide < bestLongSide)) {
+          bestShortSide = shortSide;
+          bestLongSide = longSide;
+          bestPos = free->getOrigin();
+        }
+      }
+    }
+
+    if (bestShortSide == INT_MAX)
+      return false;
+
+    rc.x = bestPos.x;
+    rc.y = bestPos.y;
+    placeRect(rc);
+  }
+
+  return true;
+}
+
+Size PackingRects::bestFit(const Size& maxSize)
+{
+  int area = 0;
+  Size minSize(1, 1);
+
+  for (Rects::iterator it=m_rects.begin(), end=m_rects.end(); it!=end; ++it) {
+    area += it->w*it->h;
+    minSize.w = std::max(minSize.w, it->w);
+    minSize.h = std::max(minSize.h, it->h);
+  }
+
+  if (minSize.w > maxSize.w || minSize.h > maxSize.h)
+    return Size(0, 0);
+
+  // Try several widths (from a square bin to the widest one), and
+  // for each width look for the smallest height where all rectangles
+  // fit (with a binary search). The layout with the smallest used area
+  // is the result.
+  Size bestSize(0, 0);
+  std::vector<Rect> bestRects;
+
+  int w = std::max(minSize.w, (int)std::ceil(std::sqrt((double)area)));
+  for (;;) {
+    w = std::min(w, maxSize.w);
+
+    int lo = std::max(minSize.h, area / w);
+    int hi = maxSize.h;
+    Size fit(0, 0);
+    std::vector<Rect> fitRects;
+
+    while (lo <= hi) {
+      int h = (lo + hi) / 2;
+      if (pack(Size(w, h))) {
+        fit = usedSize();
+        fitRects = m_rects;
+        hi = h-1;
+      }
+      else
+        lo = h+1;
+    }
+
+    if (fit.w > 0 &&
+        (bestSize.w == 0 ||
+         fit.w*fit.h < bestSize.w*bestSize.h ||
+         (fit.w*fit.h == bestSize.w*bestSize.h &&
+          std::max(fit.w, fit.h) < std::max(bestSize.w, bestSize.h)))) {
+      bestSize = fit;
+      bestRects.swap(fitRects);
+    }
+
+    if (w == maxSize.w)
+      break;
+    w += std::max(1, w/4);
+  }
+
+  if (bestSize.w > 0)
+    m_rects = bestRects;
+
+  return bestSize;
+}
+
+Size PackingRects::usedSize() const
+{
+  Size size(0, 0);
+  for (Rects::const_iterator it=m_rects.begin(), end=m_rects.end(); it!=end; ++it) {
+    size.w = std::max(size.w, it->x+it->w);
+    size.h = std::max(size.h, it->y+it->h);
+  }
+  return size;
+}
+
+// Splits the free rectangles that intersect the new placed rectangle
+// "rc" and removes the free rectangles contained by others.
+void PackingRects::placeRect(const Rect& rc)
+{
+  Rects kept, split;
+
+  for (Rects::iterator it=m_freeRects.begin(), end=m_freeRects.end(); it!=end; ++it) {
+    const Rect free = *it;
+
+    if (!overlaps(free, rc)) {
+      kept.push_back(free);
+      continue;
+    }
+
+    // Left, right, top, and bottom parts of "free" outside "rc"
+    if (rc.x > free.x)
+      split.push_back(Rect(free.x, free.y, rc.x - free.x, free.h));
+    if (rc.x+rc.w < free.x+free.w)
+      split.push_back(Rect(rc.x+rc.w, free.y, free.x+free.w - (rc.x+rc.w), free.h));
+    if (rc.y > free.y)
+      split.push_back(Rect(free.x, free.y, free.w, rc.y - free.y));
+    if (rc.y+rc.h < free.y+free.h)
+      split.push_back(Rect(free.x, rc.y+rc.h, free.w, free.y+free.h - (rc.y+rc.h)));
+  }
+
+  // The kept rectangles weren't redundant before, and a new split
+  // rectangle cannot contain them (it's a part of a previous free
+  // rectangle), so we only have to check the split ones.
+  m_freeRects.swap(kept);
+  int nkept = (int)m_freeRects.size();
+
+  for (int i=0; i<(int)split.size(); ++i) {
+    bool redundant = false;
+
+    for (int j=0; j<nkept && !redundant; ++j)
+      redundant = contains(m_freeRects[j], split[i]);
+
+    for (int j=0; j<(int)split.size() && !redundant; ++j) {
+      if (i != j && contains(split[j], split[i]) &&
+          (split[i] != split[j] || j < i))
+        redundant = true;
+    }
+
+    if (!redundant)
+      m_freeRects.push_back(split[i]);
+  }
+}
+
+} // namespace gfx
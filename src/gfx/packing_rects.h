@@ -0,0 +1,60 @@
+// Aseprite Gfx Library
+// Copyright (C) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#ifndef GFX_PACKING_RECTS_H_INCLUDED
+#define GFX_PACKING_RECTS_H_INCLUDED
+
+#include "gfx/point.h"
+#include "gfx/rect.h"
+#include "gfx/size.h"
+
+#include <vector>
+
+namespace gfx {
+
+  // Packs a set of rectangles in a bin using the MaxRects algorithm
+  // (each free area of the bin is tracked as a list of maximal
+  // rectangles, and each rectangle is placed in the free area where
+  // it fits best by its shortest side).
+  class PackingRects {
+  public:
+    typedef std::vector<Rect> Rects;
+    typedef Rects::const_iterator const_iterator;
+
+    // Adds a new rectangle to be packed. The position of the
+    // rectangle (see operator[]) is valid after pack() or
+    // bestFit().
+    void add(const Size& size);
+
+    int size() const { return (int)m_rects.size(); }
+    const Rect& operator[](int i) const { return m_rects[i]; }
+    const_iterator begin() const { return m_rects.begin(); }
+    const_iterator end() const { return m_rects.end(); }
+
+    // Places all rectangles inside a bin of the given size. Returns
+    // false if some rectangle doesn't fit.
+    bool pack(const Size& binSize);
+
+    // Finds a small bin (with width and height less than or equal to
+    // "maxSize") where all rectangles fit. Returns the bin size, or
+    // an empty size if the rectangles don't fit in "maxSize".
+    Size bestFit(const Size& maxSize);
+
+    // Returns the area that is really used by the packed rectangles
+    // (from the origin to the right-bottom corner of the farthest
+    // rectangle).
+    Size usedSize() const;
+
+  private:
+    void placeRect(const Rect& rc);
+
+    Rects m_rects;
+    Rects m_freeRects;
+  };
+
+} // namespace gfx
+
+#endif
@@ -0,0 +1,110 @@
+// Aseprite Gfx Library
+// Copyright (C) 2001-2013 David Capello
+//
+// This source file is distributed under MIT license,
+// please read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "gfx/packing_rects.h"
+
+#include <cstdlib>
+#include <ostream>
+
+using namespace gfx;
+
+namespace gfx {
+
+  std::ostream& operator<<(std::ostream& os, const Rect& rect)
+  {
+    return os << "("
+              << rect.x << ", "
+              << rect.y << ", "
+              << rect.w << ", "
+              << rect.h << ")";
+  }
+
+  std::ostream& operator<<(std::ostream& os, const Size& size)
+  {
+    return os << "("
+              << size.w << ", "
+              << size.h << ")";
+  }
+
+}
+
+static bool overlaps(const PackingRects& pr)
+{
+  for (int i=0; i<pr.size(); ++i)
+    for (int j=i+1; j<pr.size(); ++j)
+      if (pr[i].x < pr[j].x+pr[j].w && pr[j].x < pr[i].x+pr[i].w &&
+          pr[i].y < pr[j].y+pr[j].h && pr[j].y < pr[i].y+pr[i].h)
+        return true;
+  return false;
+}
+
+TEST(PackingRects, Simple)
+{
+  PackingRects pr;
+  pr.add(Size(256, 128));
+  EXPECT_FALSE(pr.pack(Size(128, 128)));
+  EXPECT_TRUE(pr.pack(Size(256, 128)));
+
+  EXPECT_EQ(Rect(0, 0, 256, 128), pr[0]);
+  EXPECT_EQ(Size(256, 128), pr.usedSize());
+}
+
+TEST(PackingRects, FourQuads)
+{
+  PackingRects pr;
+  for (int i=0; i<4; ++i)
+    pr.add(Size(32, 32));
+
+  EXPECT_FALSE(pr.pack(Size(63, 64)));
+  EXPECT_TRUE(pr.pack(Size(64, 64)));
+  EXPECT_FALSE(overlaps(pr));
+  EXPECT_EQ(Size(64, 64), pr.usedSize());
+}
+
+TEST(PackingRects, BestFit)
+{
+  PackingRects pr;
+  pr.add(Size(10, 12));
+  pr.add(Size(10, 12));
+  pr.add(Size(20, 12));
+  EXPECT_EQ(Size(20, 24), pr.bestFit(Size(1024, 1024)));
+  EXPECT_FALSE(overlaps(pr));
+
+  // Does not fit
+  pr.add(Size(2048, 1));
+  EXPECT_EQ(Size(0, 0), pr.bestFit(Size(1024, 1024)));
+}
+
+TEST(PackingRects, RandomSizes)
+{
+  std::srand(1);
+
+  PackingRects pr;
+  int area = 0;
+  for (int i=0; i<500; ++i) {
+    Size sz(1+std::rand()%40, 1+std::rand()%40);
+    pr.add(sz);
+    area += sz.w*sz.h;
+  }
+
+  Size size = pr.bestFit(Size(2048, 2048));
+  ASSERT_TRUE(size.w > 0 && size.h > 0);
+  EXPECT_FALSE(overlaps(pr));
+  EXPECT_LE(area, size.w*size.h);
+  // The packing should waste less than 20% of the texture.
+  EXPECT_LT(size.w*size.h, area*5/4);
+
+  for (int i=0; i<pr.size(); ++i)
+    EXPECT_TRUE(Rect(Point(0, 0), size).contains(pr[i]));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,154 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "raster/algorithm/downsample_image.h"
+
+#include "gfx/rect.h"
+#include "raster/color.h"
+#include "raster/image.h"
+#include "raster/primitives_fast.h"
+
+#include <algorithm>
+
+namespace raster {
+namespace algorithm {
+
+namespace {
+
+template<typename ImageTraits>
+class Average;
+
+template<>
+class Average<RgbTraits> {
+public:
+  Average() : m_r(0), m_g(0), m_b(0), m_a(0), m_n(0) { }
+
+  void add(RgbTraits::pixel_t c) {
+    int a = rgba_geta(c);
+    m_r += rgba_getr(c) * a;
+    m_g += rgba_getg(c) * a;
+    m_b += rgba_getb(c) * a;
+    m_a += a;
+    ++m_n;
+  }
+
+  RgbTraits::pixel_t get() const {
+    if (m_a == 0)
+      return 0;
+    return rgba(m_r / m_a, m_g / m_a, m_b / m_a, m_a / m_n);
+  }
+
+private:
+  int m_r, m_g, m_b, m_a, m_n;
+};
+
+template<>
+class Average<GrayscaleTraits> {
+public:
+  Average() : m_v(0), m_a(0), m_n(0) { }
+
+  void add(GrayscaleTraits::pixel_t c) {
+    int a = graya_geta(c);
+    m_v += graya_getv(c) * a;
+    m_a += a;
+    ++m_n;
+  }
+
+  GrayscaleTraits::pixel_t get() const {
+    if (m_a == 0)
+      return 0;
+    return graya(m_v / m_a, m_a / m_n);
+  }
+
+private:
+  int m_v, m_a, m_n;
+};
+
+template<typename ImageTraits>
+void downsample_image_templ(Image* dst, int dst_x, int dst_y,
+                            const Image* src, const gfx::Rect& area, int level)
+{
+  const int block = (1 << level);
+
+  for (int v=area.y; v<area.y2(); ++v) {
+    int y1 = (v << level);
+    int y2 = std::min(y1+block, src->getHeight());
+
+    for (int u=area.x; u<area.x2(); ++u) {
+      int x1 = (u << level);
+      int x2 = std::min(x1+block, src->getWidth());
+      Average<ImageTraits> average;
+
+      for (int y=y1; y<y2; ++y) {
+        const typename ImageTraits::pixel_t* address =
+          (const typename ImageTraits::pixel_t*)src->getPixelAddress(x1, y);
+
+        for (int x=x1; x<x2; ++x, ++address)
+          average.add(*address);
+      }
+
+      put_pixel_fast<ImageTraits>(dst, dst_x+u-area.x, dst_y+v-area.y,
+                                  average.get());
+    }
+  }
+}
+
+template<>
+void downsample_image_templ<IndexedTraits>(Image* dst, int dst_x, int dst_y,
+                                           const Image* src, const gfx::Rect& area, int level)
+{
+  for (int v=area.y; v<area.y2(); ++v)
+    for (int u=area.x; u<area.x2(); ++u)
+      put_pixel_fast<IndexedTraits>(dst, dst_x+u-area.x, dst_y+v-area.y,
+                                    get_pixel_fast<IndexedTraits>(src, u << level, v << level));
+}
+
+} // anonymous namespace
+
+void downsample_image(Image* dst, int dst_x, int dst_y,
+                      const Image* src, const gfx::Rect& area, int level)
+{
+  ASSERT(dst->getPixelFormat() == src->getPixelFormat());
+  ASSERT(area.x >= 0 && area.y >= 0);
+  ASSERT(area.x2() <= downsampled_size(src->getWidth(), level));
+  ASSERT(area.y2() <= downsampled_size(src->getHeight(), level));
+
+  dst->invalidateRows(dst_y, area.h);
+
+  switch (src->getPixelFormat()) {
+    case IMAGE_RGB:
+      downsample_image_templ<RgbTraits>(dst, dst_x, dst_y, src, area, level);
+      break;
+    case IMAGE_GRAYSCALE:
+      downsample_image_templ<GrayscaleTraits>(dst, dst_x, dst_y, src, area, level);
+      break;
+    case IMAGE_INDEXED:
+      downsample_image_templ<IndexedTraits>(dst, dst_x, dst_y, src, area, level);
+      break;
+    default:
+      ASSERT(false && "Not implemented for bitmaps");
+      break;
+  }
+}
+
+} // namespace algorithm
+} // namespace raster
@@ -0,0 +1,47 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef RASTER_ALGORITHM_DOWNSAMPLE_IMAGE_H_INCLUDED
+#define RASTER_ALGORITHM_DOWNSAMPLE_IMAGE_H_INCLUDED
+
+#include "gfx/fwd.h"
+
+namespace raster {
+  class Image;
+
+  namespace algorithm {
+
+    // Returns the size of the source image dimension "size" reduced
+    // "level" times by 2 (partial blocks of pixels are included).
+    inline int downsampled_size(int size, int level) {
+      return (size + (1 << level) - 1) >> level;
+    }
+
+    // Reduces the given "area" of the source image "src" (in
+    // coordinates of the reduced image) to the destination image
+    // "dst" at position (dst_x, dst_y). Each destination pixel is the
+    // average of a block of (1<<level)x(1<<level) source pixels
+    // (weighted by alpha). Indexed images use the top-left pixel of
+    // each block.
+    void downsample_image(Image* dst, int dst_x, int dst_y,
+                          const Image* src, const gfx::Rect& area, int level);
+
+  }
+}
+
+#endif
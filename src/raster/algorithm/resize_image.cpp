@@ -157,7 +157,7 @@ void fixup_image_transparent_colors(Image* image)
 
     case IMAGE_RGB: {
       int r, g, b, count;
-      LockImageBits<RgbTraits> bits(image);
+      LockImageBits<RgbTraits> bits(image, Image::ReadWriteLock);
       LockImageBits<RgbTraits>::iterator it = bits.begin();
 
       for (y=0; y<image->getHeight(); ++y) {
@@ -197,7 +197,7 @@ void fixup_image_transparent_colors(Image* image)
 
     case IMAGE_GRAYSCALE: {
       int k, count;
-      LockImageBits<GrayscaleTraits> bits(image);
+      LockImageBits<GrayscaleTraits> bits(image, Image::ReadWriteLock);
       LockImageBits<GrayscaleTraits>::iterator it = bits.begin();
 
       for (y=0; y<image->getHeight(); ++y) {
@@ -23,6 +23,13 @@
 #include "raster/blend.h"
 #include "raster/image.h"
 
+// SSE2 is available in all x86-64 CPUs, and in 32-bit builds only if
+// the compiler was configured to generate SSE2 code.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define RASTER_BLEND_SSE2
+  #include <emmintrin.h>
+#endif
+
 namespace raster {
 
 BLEND_COLOR rgba_blenders[] =
@@ -41,7 +48,7 @@ BLEND_COLOR graya_blenders[] =
 /* RGB blenders                                                       */
 /**********************************************************************/
 
-int rgba_blend_normal(int back, int front, int opacity)
+static inline int blend_rgba_normal(int back, int front, int opacity)
 {
   register int t;
 
@@ -78,6 +85,11 @@ int rgba_blend_normal(int back, int front, int opacity)
   }
 }
 
+int rgba_blend_normal(int back, int front, int opacity)
+{
+  return blend_rgba_normal(back, front, opacity);
+}
+
 int rgba_blend_copy(int back, int front, int opacity)
 {
   return front;
@@ -137,7 +149,7 @@ int rgba_blend_merge(int back, int front, int opacity)
 /* Grayscale blenders                                                 */
 /**********************************************************************/
 
-int graya_blend_normal(int back, int front, int opacity)
+static inline int blend_graya_normal(int back, int front, int opacity)
 {
   register int t;
 
@@ -168,6 +180,11 @@ int graya_blend_normal(int back, int front, int opacity)
   }
 }
 
+int graya_blend_normal(int back, int front, int opacity)
+{
+  return blend_graya_normal(back, front, opacity);
+}
+
 int graya_blend_copy(int back, int front, int opacity)
 {
   return front;
@@ -211,4 +228,142 @@ int graya_blend_merge(int back, int front, int opacity)
   return graya(D_k, D_a);
 }
 
+/**********************************************************************/
+/* Row blenders                                                       */
+/**********************************************************************/
+
+static void rgba_blend_normal_row(uint32_t* dst, const uint32_t* src, int w, int opacity, uint32_t mask_color)
+{
+  for (int x=0; x<w; ++x) {
+    if (src[x] != mask_color)
+      dst[x] = blend_rgba_normal(dst[x], src[x], opacity);
+  }
+}
+
+static void rgba_blend_copy_row(uint32_t* dst, const uint32_t* src, int w, int opacity, uint32_t mask_color)
+{
+  for (int x=0; x<w; ++x) {
+    if (src[x] != mask_color)
+      dst[x] = src[x];
+  }
+}
+
+static void graya_blend_normal_row(uint16_t* dst, const uint16_t* src, int w, int opacity, uint16_t mask_color)
+{
+  for (int x=0; x<w; ++x) {
+    if (src[x] != mask_color)
+      dst[x] = blend_graya_normal(dst[x], src[x], opacity);
+  }
+}
+
+static void graya_blend_copy_row(uint16_t* dst, const uint16_t* src, int w, int opacity, uint16_t mask_color)
+{
+  for (int x=0; x<w; ++x) {
+    if (src[x] != mask_color)
+      dst[x] = src[x];
+  }
+}
+
+#ifdef RASTER_BLEND_SSE2
+
+// Same as INT_MULT() for four 32-bit values in the 0-255 range (the
+// product fits in 16 bits, so _mm_mullo_epi16() is enough).
+static inline __m128i int_mult_sse2(__m128i a, __m128i b)
+{
+  __m128i t = _mm_add_epi32(_mm_mullo_epi16(a, b), _mm_set1_epi32(0x80));
+  return _mm_srli_epi32(_mm_add_epi32(_mm_srli_epi32(t, 8), t), 8);
+}
+
+static inline __m128i select_sse2(__m128i cond, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(cond, a), _mm_andnot_si128(cond, b));
+}
+
+// Returns B + (F-B)*F_a/D_a for one channel. The division is done with
+// floats: the quotient magnitude is at most 255, so the rounding error
+// is always smaller than the distance to the next integer and the
+// truncation gives the same result as the integer division.
+static inline __m128i blend_channel_sse2(__m128i B, __m128i F, __m128 F_a, __m128 D_a)
+{
+  __m128 n = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(F, B)), F_a);
+  return _mm_add_epi32(B, _mm_cvttps_epi32(_mm_div_ps(n, D_a)));
+}
+
+static void rgba_blend_normal_row_sse2(uint32_t* dst, const uint32_t* src, int w, int opacity, uint32_t mask_color)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i rgb = _mm_set1_epi32(0xffffff);
+  const __m128i opa = _mm_set1_epi32(opacity);
+  const __m128i mask = _mm_set1_epi32(mask_color);
+  int x = 0;
+
+  for (; x+4<=w; x+=4) {
+    __m128i B = _mm_loadu_si128((const __m128i*)(dst+x));
+    __m128i F = _mm_loadu_si128((const __m128i*)(src+x));
+
+    __m128i B_a = _mm_srli_epi32(B, rgba_a_shift);
+    __m128i F_a = _mm_srli_epi32(F, rgba_a_shift);
+    __m128i F_a2 = int_mult_sse2(F_a, opa);
+    __m128i D_a = _mm_sub_epi32(_mm_add_epi32(B_a, F_a2), int_mult_sse2(B_a, F_a2));
+
+    __m128 fF_a = _mm_cvtepi32_ps(F_a2);
+    __m128 fD_a = _mm_cvtepi32_ps(D_a);
+
+    __m128i D_r = blend_channel_sse2(_mm_and_si128(_mm_srli_epi32(B, rgba_r_shift), ff),
+                                     _mm_and_si128(_mm_srli_epi32(F, rgba_r_shift), ff), fF_a, fD_a);
+    __m128i D_g = blend_channel_sse2(_mm_and_si128(_mm_srli_epi32(B, rgba_g_shift), ff),
+                                     _mm_and_si128(_mm_srli_epi32(F, rgba_g_shift), ff), fF_a, fD_a);
+    __m128i D_b = blend_channel_sse2(_mm_and_si128(_mm_srli_epi32(B, rgba_b_shift), ff),
+                                     _mm_and_si128(_mm_srli_epi32(F, rgba_b_shift), ff), fF_a, fD_a);
+
+    __m128i result =
+      _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(D_r, ff), rgba_r_shift),
+                                _mm_slli_epi32(_mm_and_si128(D_g, ff), rgba_g_shift)),
+                   _mm_or_si128(_mm_slli_epi32(_mm_and_si128(D_b, ff), rgba_b_shift),
+                                _mm_slli_epi32(D_a, rgba_a_shift)));
+
+    // Same cases as blend_rgba_normal() (from the last to the first one)
+    result = select_sse2(_mm_cmpeq_epi32(F_a, zero), B, result);
+    result = select_sse2(_mm_cmpeq_epi32(B_a, zero),
+                         _mm_or_si128(_mm_and_si128(F, rgb), _mm_slli_epi32(F_a2, rgba_a_shift)),
+                         result);
+    result = select_sse2(_mm_cmpeq_epi32(F, mask), B, result);
+
+    _mm_storeu_si128((__m128i*)(dst+x), result);
+  }
+
+  rgba_blend_normal_row(dst+x, src+x, w-x, opacity, mask_color);
+}
+
+#endif
+
+BLEND_RGBA_ROW get_rgba_row_blender(int blend_mode)
+{
+  ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
+
+  switch (blend_mode) {
+    case BLEND_MODE_COPY:
+      return rgba_blend_copy_row;
+    default:
+#ifdef RASTER_BLEND_SSE2
+      return rgba_blend_normal_row_sse2;
+#else
+      return rgba_blend_normal_row;
+#endif
+  }
+}
+
+BLEND_GRAYA_ROW get_graya_row_blender(int blend_mode)
+{
+  ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
+
+  switch (blend_mode) {
+    case BLEND_MODE_COPY:
+      return graya_blend_copy_row;
+    default:
+      return graya_blend_normal_row;
+  }
+}
+
 } // namespace raster
@@ -32,9 +32,23 @@ namespace raster {
 
   typedef int (*BLEND_COLOR)(int back, int front, int opacity);
 
+  // Blends "w" pixels of the "src" row over the "dst" row (the result
+  // is stored in "dst"). Pixels of "src" equal to "mask_color" are
+  // skipped.
+  typedef void (*BLEND_RGBA_ROW)(uint32_t* dst, const uint32_t* src, int w, int opacity, uint32_t mask_color);
+  typedef void (*BLEND_GRAYA_ROW)(uint16_t* dst, const uint16_t* src, int w, int opacity, uint16_t mask_color);
+
   extern BLEND_COLOR rgba_blenders[];
   extern BLEND_COLOR graya_blenders[];
 
+  // Returns the row blender for the given mode. The SSE2 version is
+  // selected at compile time (when the compiler generates SSE2 code,
+  // see RASTER_BLEND_SSE2 in blend.cpp), there is no runtime CPU
+  // detection. The result is the same as calling the BLEND_COLOR
+  // function for each pixel.
+  BLEND_RGBA_ROW get_rgba_row_blender(int blend_mode);
+  BLEND_GRAYA_ROW get_graya_row_blender(int blend_mode);
+
   int rgba_blend_normal(int back, int front, int opacity);
   int rgba_blend_copy(int back, int front, int opacity);
   int rgba_blend_forpath(int back, int front, int opacity);
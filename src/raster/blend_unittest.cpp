@@ -0,0 +1,117 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "raster/blend.h"
+#include "raster/color.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace raster;
+
+// Returns a random component, with more chances for 0 and 255.
+static int random_component()
+{
+  switch (std::rand() % 4) {
+    case 0: return 0;
+    case 1: return 255;
+    default: return std::rand() % 256;
+  }
+}
+
+TEST(Blend, RgbaRowBlendersMatchPixelBlenders)
+{
+  const int w = 1027;           // Not a multiple of 4 to test the tail
+  std::vector<uint32_t> back(w), front(w), dst(w);
+  int opacities[] = { 0, 1, 64, 128, 254, 255 };
+
+  for (int blend_mode=0; blend_mode<BLEND_MODE_MAX; ++blend_mode) {
+    BLEND_COLOR pixel_blender = rgba_blenders[blend_mode];
+    BLEND_RGBA_ROW row_blender = get_rgba_row_blender(blend_mode);
+
+    for (int i=0; i<int(sizeof(opacities)/sizeof(int)); ++i) {
+      int opacity = opacities[i];
+      uint32_t mask_color = rgba(0, 0, 0, 0);
+
+      for (int x=0; x<w; ++x) {
+        back[x] = rgba(random_component(), random_component(),
+                       random_component(), random_component());
+        front[x] = rgba(random_component(), random_component(),
+                        random_component(), random_component());
+      }
+
+      dst = back;
+      row_blender(&dst[0], &front[0], w, opacity, mask_color);
+
+      for (int x=0; x<w; ++x) {
+        uint32_t expected =
+          (front[x] != mask_color ?
+           (uint32_t)pixel_blender(back[x], front[x], opacity): back[x]);
+
+        ASSERT_EQ(expected, dst[x])
+          << "blend_mode=" << blend_mode << " opacity=" << opacity
+          << " back=" << std::hex << back[x] << " front=" << front[x];
+      }
+    }
+  }
+}
+
+TEST(Blend, GrayaRowBlendersMatchPixelBlenders)
+{
+  const int w = 1027;
+  std::vector<uint16_t> back(w), front(w), dst(w);
+  int opacities[] = { 0, 1, 64, 128, 254, 255 };
+
+  for (int blend_mode=0; blend_mode<BLEND_MODE_MAX; ++blend_mode) {
+    BLEND_COLOR pixel_blender = graya_blenders[blend_mode];
+    BLEND_GRAYA_ROW row_blender = get_graya_row_blender(blend_mode);
+
+    for (int i=0; i<int(sizeof(opacities)/sizeof(int)); ++i) {
+      int opacity = opacities[i];
+      uint16_t mask_color = graya(0, 0);
+
+      for (int x=0; x<w; ++x) {
+        back[x] = graya(random_component(), random_component());
+        front[x] = graya(random_component(), random_component());
+      }
+
+      dst = back;
+      row_blender(&dst[0], &front[0], w, opacity, mask_color);
+
+      for (int x=0; x<w; ++x) {
+        uint16_t expected =
+          (front[x] != mask_color ?
+           (uint16_t)pixel_blender(back[x], front[x], opacity): back[x]);
+
+        ASSERT_EQ(expected, dst[x]);
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,152 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "raster/color_tree.h"
+
+#include "raster/palette.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace raster {
+
+// Weights of each component (in the same order that Node::c[]: green,
+// red and blue), from Allegro's bestfit_color().
+static const int weights[3] = { 59*59, 30*30, 11*11 };
+
+namespace {
+
+  class NodeAxisPredicate {
+  public:
+    NodeAxisPredicate(int axis) : m_axis(axis) { }
+
+    template<class Node>
+    bool operator()(const Node& a, const Node& b) const {
+      return (a.c[m_axis] < b.c[m_axis] ||
+              (a.c[m_axis] == b.c[m_axis] && a.index < b.index));
+    }
+
+  private:
+    int m_axis;
+  };
+
+}
+
+ColorTree::ColorTree(const Palette* palette)
+{
+  for (int i=1; i<palette->size(); ++i) {
+    color_t color = palette->getEntry(i);
+    Node node;
+    node.c[0] = rgba_getg(color);
+    node.c[1] = rgba_getr(color);
+    node.c[2] = rgba_getb(color);
+    node.index = i;
+    node.axis = 0;
+    node.left = node.right = -1;
+    m_nodes.push_back(node);
+  }
+
+  m_root = build(0, m_nodes.size());
+}
+
+int ColorTree::findNearest(int r, int g, int b) const
+{
+  ASSERT(r >= 0 && r <= 255);
+  ASSERT(g >= 0 && g <= 255);
+  ASSERT(b >= 0 && b <= 255);
+
+  int c[3] = { g, r, b };
+  int bestIndex = 0;
+  int bestDist = INT_MAX;
+
+  if (m_root >= 0)
+    search(m_root, c, bestIndex, bestDist);
+
+  return bestIndex;
+}
+
+// Builds the subtree of nodes in the [begin, end) range, the median
+// node of the component with the biggest weighted spread is the root
+// of the subtree (it's placed in the "begin" position).
+int ColorTree::build(int begin, int end)
+{
+  if (begin >= end)
+    return -1;
+
+  int axis = 0;
+  int maxSpread = -1;
+  for (int i=0; i<3; ++i) {
+    int min = 255, max = 0;
+    for (int j=begin; j<end; ++j) {
+      min = std::min(min, m_nodes[j].c[i]);
+      max = std::max(max, m_nodes[j].c[i]);
+    }
+    int spread = (max - min) * (max - min) * weights[i];
+    if (spread > maxSpread) {
+      maxSpread = spread;
+      axis = i;
+    }
+  }
+
+  int median = begin + (end - begin) / 2;
+  std::nth_element(m_nodes.begin()+begin,
+                   m_nodes.begin()+median,
+                   m_nodes.begin()+end, NodeAxisPredicate(axis));
+  std::swap(m_nodes[begin], m_nodes[median]);
+
+  // Nodes in [begin+1, median] are less than or equal to the root,
+  // and nodes in (median, end) are greater than or equal to it.
+  m_nodes[begin].axis = axis;
+  m_nodes[begin].left = build(begin+1, median+1);
+  m_nodes[begin].right = build(median+1, end);
+  return begin;
+}
+
+void ColorTree::search(int n, const int c[3], int& bestIndex, int& bestDist) const
+{
+  const Node& node = m_nodes[n];
+
+  int dist = 0;
+  for (int i=0; i<3; ++i) {
+    int d = c[i] - node.c[i];
+    dist += d * d * weights[i];
+  }
+
+  if (dist < bestDist || (dist == bestDist && node.index < bestIndex)) {
+    bestDist = dist;
+    bestIndex = node.index;
+  }
+
+  int d = c[node.axis] - node.c[node.axis];
+  int nearChild = (d < 0 ? node.left: node.right);
+  int farChild = (d < 0 ? node.right: node.left);
+
+  if (nearChild >= 0)
+    search(nearChild, c, bestIndex, bestDist);
+
+  // Entries at the same distance must be visited too (to return the
+  // lowest index)
+  if (farChild >= 0 && d * d * weights[node.axis] <= bestDist)
+    search(farChild, c, bestIndex, bestDist);
+}
+
+} // namespace raster
@@ -0,0 +1,65 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef RASTER_COLOR_TREE_H_INCLUDED
+#define RASTER_COLOR_TREE_H_INCLUDED
+
+#include "base/disable_copying.h"
+
+#include <vector>
+
+namespace raster {
+
+  class Palette;
+
+  // k-d tree of the entries of a palette to find the nearest entry of
+  // an arbitrary RGB color with full 8-bit precision. The distance is
+  // the same weighted euclidean distance used by Allegro's
+  // bestfit_color() (green weights more than red, and red more than
+  // blue). The entry 0 is not included in the tree (as it is the mask
+  // color of indexed images).
+  class ColorTree {
+  public:
+    ColorTree(const Palette* palette);
+
+    // Returns the index of the nearest palette entry to the given
+    // color. If there are several entries at the same distance, the
+    // lowest index is returned. Returns 0 if the palette has only one
+    // entry.
+    int findNearest(int r, int g, int b) const;
+
+  private:
+    struct Node {
+      int c[3];                 // Green, red and blue components
+      int index;                // Palette index
+      int axis;                 // Split component (0, 1 or 2)
+      int left, right;          // Children nodes (or -1)
+    };
+
+    int build(int begin, int end);
+    void search(int node, const int c[3], int& bestIndex, int& bestDist) const;
+
+    std::vector<Node> m_nodes;
+    int m_root;
+
+    DISABLE_COPYING(ColorTree);
+  };
+
+} // namespace raster
+
+#endif
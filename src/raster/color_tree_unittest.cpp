@@ -0,0 +1,110 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "raster/color_tree.h"
+#include "raster/palette.h"
+
+#include <climits>
+#include <cstdlib>
+
+using namespace raster;
+
+// Linear search of the nearest color (with the same metric of ColorTree).
+static int find_nearest_linear(const Palette* palette, int r, int g, int b)
+{
+  int bestIndex = 0;
+  int bestDist = INT_MAX;
+
+  for (int i=1; i<palette->size(); ++i) {
+    color_t color = palette->getEntry(i);
+    int dr = r - rgba_getr(color);
+    int dg = g - rgba_getg(color);
+    int db = b - rgba_getb(color);
+    int dist = dr*dr*30*30 + dg*dg*59*59 + db*db*11*11;
+    if (dist < bestDist) {
+      bestDist = dist;
+      bestIndex = i;
+    }
+  }
+
+  return bestIndex;
+}
+
+TEST(ColorTree, MatchesLinearSearch)
+{
+  int sizes[] = { 1, 2, 3, 16, 255, 256 };
+
+  for (int s=0; s<int(sizeof(sizes)/sizeof(int)); ++s) {
+    Palette palette(FrameNumber(0), sizes[s]);
+
+    // Use few different values to get repeated entries and ties
+    for (int i=0; i<palette.size(); ++i)
+      palette.setEntry(i, rgba((std::rand() % 8) * 36,
+                               (std::rand() % 8) * 36,
+                               (std::rand() % 256), 255));
+
+    ColorTree tree(&palette);
+
+    for (int j=0; j<5000; ++j) {
+      int r = std::rand() % 256;
+      int g = std::rand() % 256;
+      int b = std::rand() % 256;
+
+      ASSERT_EQ(find_nearest_linear(&palette, r, g, b),
+                tree.findNearest(r, g, b));
+    }
+  }
+}
+
+TEST(ColorTree, ExactColors)
+{
+  Palette* palette = Palette::createGrayscale();
+  ColorTree tree(palette);
+
+  EXPECT_EQ(1, tree.findNearest(0, 0, 0)); // The entry 0 is skipped
+  for (int i=1; i<palette->size(); ++i)
+    EXPECT_EQ(i, tree.findNearest(i, i, i));
+
+  delete palette;
+}
+
+TEST(Palette, FindBestfitAfterModifications)
+{
+  Palette palette(FrameNumber(0), 4);
+  palette.setEntry(1, rgba(255, 0, 0, 255));
+  palette.setEntry(2, rgba(0, 255, 0, 255));
+  palette.setEntry(3, rgba(0, 0, 255, 255));
+
+  EXPECT_EQ(1, palette.findBestfit(200, 10, 10));
+  EXPECT_EQ(3, palette.findBestfit(10, 10, 200));
+
+  palette.setEntry(3, rgba(200, 10, 10, 255));
+  EXPECT_EQ(3, palette.findBestfit(200, 10, 10));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -80,6 +80,18 @@ inline bool shrink_row(const Image* image, const Image* image_diff, int& x1, int
   return true;
 }
 
+static bool shrink_row(const Image* image, const Image* image_diff, int& x1, int y, int& x2)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB: return shrink_row<RgbTraits>(image, image_diff, x1, y, x2);
+    case IMAGE_GRAYSCALE: return shrink_row<GrayscaleTraits>(image, image_diff, x1, y, x2);
+    case IMAGE_INDEXED: return shrink_row<IndexedTraits>(image, image_diff, x1, y, x2);
+    default:
+      ASSERT(false && "Not implemented for bitmaps");
+      return false;
+  }
+}
+
 Dirty::Dirty(Image* image, Image* image_diff, const gfx::Rect& bounds)
   : m_format(image->getPixelFormat())
   , m_x1(bounds.x), m_y1(bounds.y)
@@ -91,25 +103,7 @@ Dirty::Dirty(Image* image, Image* image_diff, const gfx::Rect& bounds)
     x1 = m_x1;
     x2 = m_x2;
 
-    bool res;
-    switch (image->getPixelFormat()) {
-      case IMAGE_RGB:
-        res = shrink_row<RgbTraits>(image, image_diff, x1, y, x2);
-        break;
-
-      case IMAGE_GRAYSCALE:
-        res = shrink_row<GrayscaleTraits>(image, image_diff, x1, y, x2);
-        break;
-
-      case IMAGE_INDEXED:
-        res = shrink_row<IndexedTraits>(image, image_diff, x1, y, x2);
-        break;
-
-      default:
-        ASSERT(false && "Not implemented for bitmaps");
-        return;
-    }
-    if (!res)
+    if (!shrink_row(image, image_diff, x1, y, x2))
       continue;
 
     Col* col = new Col(x1, x2-x1+1);
@@ -122,6 +116,52 @@ Dirty::Dirty(Image* image, Image* image_diff, const gfx::Rect& bounds)
   }
 }
 
+Dirty::Dirty(Image* image, Image* image_diff, const gfx::Region& region)
+  : m_format(image->getPixelFormat())
+{
+  gfx::Rect bounds = region.getBounds();
+  m_x1 = bounds.x;
+  m_y1 = bounds.y;
+  m_x2 = bounds.x2()-1;
+  m_y2 = bounds.y2()-1;
+
+  // Rectangles in the region are sorted by bands (rectangles with
+  // the same "y" and "h"), and inside each band they are sorted by
+  // "x", so rows and columns are created in order.
+  std::vector<gfx::Rect> rects(region.begin(), region.end());
+
+  for (size_t band=0; band<rects.size(); ) {
+    size_t bandEnd = band+1;
+    while (bandEnd < rects.size() &&
+           rects[bandEnd].y == rects[band].y &&
+           rects[bandEnd].h == rects[band].h)
+      ++bandEnd;
+
+    for (int y=rects[band].y; y<rects[band].y2(); ++y) {
+      Row* row = NULL;
+
+      for (size_t i=band; i<bandEnd; ++i) {
+        int x1 = rects[i].x;
+        int x2 = rects[i].x2()-1;
+
+        if (!shrink_row(image, image_diff, x1, y, x2))
+          continue;
+
+        Col* col = new Col(x1, x2-x1+1);
+        col->data.resize(getLineSize(col->w));
+
+        if (!row) {
+          row = new Row(y);
+          m_rows.push_back(row);
+        }
+        row->cols.push_back(col);
+      }
+    }
+
+    band = bandEnd;
+  }
+}
+
 Dirty::~Dirty()
 {
   RowsList::iterator row_it = m_rows.begin();
@@ -188,6 +228,7 @@ void Dirty::swapImagePixels(Image* image)
     for (; col_it != col_end; ++col_it) {
       Col* col = *col_it;
 
+      image->invalidateRows(row->y, 1);
       uint8_t* address = (uint8_t*)image->getPixelAddress(col->x, row->y);
       std::swap_ranges(address, address+getLineSize(col->w), col->data.begin());
     }
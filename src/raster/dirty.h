@@ -19,6 +19,7 @@
 #ifndef RASTER_DIRTY_H_INCLUDED
 #define RASTER_DIRTY_H_INCLUDED
 
+#include "gfx/region.h"
 #include "raster/image.h"
 
 #include <vector>
@@ -58,6 +59,7 @@ public:
     Dirty(PixelFormat format, int x1, int y1, int x2, int y2);
     Dirty(const Dirty& src);
     Dirty(Image* image1, Image* image2, const gfx::Rect& bounds);
+    Dirty(Image* image1, Image* image2, const gfx::Region& region);
     ~Dirty();
 
     int getMemSize() const;
@@ -0,0 +1,77 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "gfx/region.h"
+#include "raster/dirty.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+
+using namespace base;
+using namespace raster;
+
+TEST(Dirty, DiffInsideRegion)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 32, 32));
+  UniquePtr<Image> b(Image::create(IMAGE_RGB, 32, 32));
+  clear_image(a, 0);
+  clear_image(b, 0);
+
+  put_pixel(b, 2, 1, 1);
+  put_pixel(b, 5, 1, 1);
+  put_pixel(b, 20, 1, 1);
+  put_pixel(b, 30, 30, 1);     // Outside the region
+
+  gfx::Region rgn(gfx::Rect(0, 0, 8, 8));
+  rgn.createUnion(rgn, gfx::Region(gfx::Rect(16, 0, 8, 8)));
+
+  Dirty dirty(a, b, rgn);
+  EXPECT_EQ(0, dirty.x1());
+  EXPECT_EQ(0, dirty.y1());
+  EXPECT_EQ(23, dirty.x2());
+  EXPECT_EQ(7, dirty.y2());
+
+  ASSERT_EQ(1, dirty.getRowsCount());
+  const Dirty::Row& row = dirty.getRow(0);
+  EXPECT_EQ(1, row.y);
+  ASSERT_EQ(2, row.cols.size());
+  EXPECT_EQ(2, row.cols[0]->x);
+  EXPECT_EQ(4, row.cols[0]->w);
+  EXPECT_EQ(20, row.cols[1]->x);
+  EXPECT_EQ(1, row.cols[1]->w);
+
+  // Restore the original pixels in "b"
+  dirty.saveImagePixels(a);
+  dirty.swapImagePixels(b);
+  EXPECT_EQ(0, get_pixel(b, 2, 1));
+  EXPECT_EQ(0, get_pixel(b, 5, 1));
+  EXPECT_EQ(0, get_pixel(b, 20, 1));
+  EXPECT_EQ(1, get_pixel(b, 30, 30));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -25,6 +25,7 @@ namespace raster {
   enum DitheringMethod {
     DITHERING_NONE,
     DITHERING_ORDERED,
+    DITHERING_ERROR_DIFFUSION,
   };
 
 } // namespace raster
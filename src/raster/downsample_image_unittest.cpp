@@ -0,0 +1,100 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "gfx/rect.h"
+#include "raster/algorithm/downsample_image.h"
+#include "raster/color.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+
+using namespace raster;
+
+TEST(DownsampleImage, DownsampledSize)
+{
+  EXPECT_EQ(4, algorithm::downsampled_size(8, 1));
+  EXPECT_EQ(5, algorithm::downsampled_size(9, 1));
+  EXPECT_EQ(1, algorithm::downsampled_size(3, 2));
+  EXPECT_EQ(1, algorithm::downsampled_size(1, 3));
+}
+
+TEST(DownsampleImage, AverageRGB)
+{
+  Image* src = Image::create(IMAGE_RGB, 3, 2);
+  put_pixel(src, 0, 0, rgba(0, 0, 0, 255));
+  put_pixel(src, 1, 0, rgba(255, 255, 255, 255));
+  put_pixel(src, 0, 1, rgba(0, 0, 0, 255));
+  put_pixel(src, 1, 1, rgba(255, 255, 255, 255));
+  put_pixel(src, 2, 0, rgba(100, 50, 0, 255));
+  put_pixel(src, 2, 1, rgba(0, 0, 0, 0));
+
+  Image* dst = Image::create(IMAGE_RGB, 2, 1);
+  algorithm::downsample_image(dst, 0, 0, src, gfx::Rect(0, 0, 2, 1), 1);
+
+  EXPECT_EQ(rgba(127, 127, 127, 255), get_pixel(dst, 0, 0));
+  // Transparent pixels don't contribute to the color, only to the alpha
+  EXPECT_EQ(rgba(100, 50, 0, 127), get_pixel(dst, 1, 0));
+
+  delete dst;
+  delete src;
+}
+
+TEST(DownsampleImage, PartialArea)
+{
+  Image* src = Image::create(IMAGE_GRAYSCALE, 8, 8);
+  clear_image(src, graya(0, 255));
+  fill_rect(src, 4, 4, 7, 7, graya(200, 255));
+
+  Image* dst = Image::create(IMAGE_GRAYSCALE, 2, 2);
+  clear_image(dst, graya(0, 0));
+  algorithm::downsample_image(dst, 1, 1, src, gfx::Rect(1, 1, 1, 1), 2);
+
+  EXPECT_EQ(graya(0, 0), get_pixel(dst, 0, 0));
+  EXPECT_EQ(graya(200, 255), get_pixel(dst, 1, 1));
+
+  delete dst;
+  delete src;
+}
+
+TEST(DownsampleImage, IndexedUsesTopLeftPixel)
+{
+  Image* src = Image::create(IMAGE_INDEXED, 4, 4);
+  clear_image(src, 3);
+  put_pixel(src, 2, 0, 7);
+
+  Image* dst = Image::create(IMAGE_INDEXED, 2, 2);
+  algorithm::downsample_image(dst, 0, 0, src, gfx::Rect(0, 0, 2, 2), 1);
+
+  EXPECT_EQ(3, get_pixel(dst, 0, 0));
+  EXPECT_EQ(7, get_pixel(dst, 1, 0));
+  EXPECT_EQ(3, get_pixel(dst, 1, 1));
+
+  delete dst;
+  delete src;
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -22,6 +22,7 @@
 
 #include "raster/image.h"
 
+#include "base/mutex.h"
 #include "raster/algo.h"
 #include "raster/blend.h"
 #include "raster/image_impl.h"
@@ -30,15 +31,74 @@
 #include "raster/primitives.h"
 #include "raster/rgbmap.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace raster {
 
+// Each 64-bit word is mixed with the finalizer of SplitMix64 (so a
+// change in any bit of the word changes all bits of the result)
+// before it's combined with the hash of the previous words.
+static const uint64_t kHashOffset = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t mix_word(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static inline uint64_t hash_word(uint64_t hash, uint64_t word)
+{
+  return mix_word(hash + kHashOffset + mix_word(word));
+}
+
+static uint64_t hash_bytes(const uint8_t* data, int bytes)
+{
+  uint64_t hash = kHashOffset;
+  uint64_t word;
+
+  for (; bytes >= 8; bytes -= 8, data += 8) {
+    std::memcpy(&word, data, 8);
+    hash = hash_word(hash, word);
+  }
+
+  if (bytes > 0) {
+    word = 0;
+    std::memcpy(&word, data, bytes);
+    hash = hash_word(hash, word);
+  }
+
+  return hash;
+}
+
+static base::mutex shared_pixels_mutex;
+
+Image::SharedPixelsLock::SharedPixelsLock()
+{
+  shared_pixels_mutex.lock();
+}
+
+Image::SharedPixelsLock::~SharedPixelsLock()
+{
+  shared_pixels_mutex.unlock();
+}
+
 Image::Image(PixelFormat format, int width, int height)
   : Object(OBJECT_IMAGE)
+  , m_sharedPixels(false)
   , m_format(format)
 {
   m_width = width;
   m_height = height;
   m_maskColor = 0;
+  m_version = 0;
+  m_hash = 0;
+  m_dirtyRow1 = 0;
+  m_dirtyRow2 = height;
 }
 
 Image::~Image()
@@ -50,6 +110,38 @@ int Image::getMemSize() const
   return sizeof(Image) + getRowStrideSize()*m_height;
 }
 
+uint64_t Image::getHash() const
+{
+  int y1 = std::max(m_dirtyRow1, 0);
+  int y2 = std::min(m_dirtyRow2, m_height);
+
+  if ((int)m_rowHashes.size() != m_height) {
+    m_rowHashes.resize(m_height);
+    y1 = 0;
+    y2 = m_height;
+  }
+
+  if (y1 < y2) {
+    if (m_width > 0) {
+      int bytes = getRowStrideSize();
+      for (int y=y1; y<y2; ++y)
+        m_rowHashes[y] = hash_bytes(getPixelAddress(0, y), bytes);
+    }
+
+    m_hash = kHashOffset;
+    m_hash = hash_word(m_hash, m_format);
+    m_hash = hash_word(m_hash, m_width);
+    m_hash = hash_word(m_hash, m_height);
+    for (int y=0; y<m_height; ++y)
+      m_hash = hash_word(m_hash, m_rowHashes[y]);
+
+    m_dirtyRow1 = m_height;
+    m_dirtyRow2 = 0;
+  }
+
+  return m_hash;
+}
+
 int Image::getRowStrideSize() const
 {
   return getRowStrideSize(m_width);
@@ -57,7 +149,7 @@ int Image::getRowStrideSize() const
 
 int Image::getRowStrideSize(int pixels_per_row) const
 {
-  return calculate_rowstride_bytes(getPixelFormat(), m_width);
+  return calculate_rowstride_bytes(getPixelFormat(), pixels_per_row);
 }
 
 // static
@@ -80,4 +172,32 @@ Image* Image::createCopy(const Image* image, const ImageBufferPtr& buffer)
   return crop_image(image, 0, 0, image->getWidth(), image->getHeight(), 0, buffer);
 }
 
+// static
+Image* Image::createCopyOnWrite(Image* image)
+{
+  ASSERT(image);
+  Image* copy = NULL;
+  {
+    SharedPixelsLock lock;
+    switch (image->getPixelFormat()) {
+      case IMAGE_RGB:       copy = new ImageImpl<RgbTraits>(static_cast<ImageImpl<RgbTraits>*>(image)); break;
+      case IMAGE_GRAYSCALE: copy = new ImageImpl<GrayscaleTraits>(static_cast<ImageImpl<GrayscaleTraits>*>(image)); break;
+      case IMAGE_INDEXED:   copy = new ImageImpl<IndexedTraits>(static_cast<ImageImpl<IndexedTraits>*>(image)); break;
+      case IMAGE_BITMAP:    copy = new ImageImpl<BitmapTraits>(static_cast<ImageImpl<BitmapTraits>*>(image)); break;
+    }
+  }
+  ASSERT(copy);
+
+  image->m_sharedPixels = true;
+  copy->m_sharedPixels = true;
+  copy->m_maskColor = image->m_maskColor;
+
+  // The copy has the same pixels, so it has the same hashes too.
+  copy->m_hash = image->m_hash;
+  copy->m_rowHashes = image->m_rowHashes;
+  copy->m_dirtyRow1 = image->m_dirtyRow1;
+  copy->m_dirtyRow2 = image->m_dirtyRow2;
+  return copy;
+}
+
 } // namespace raster
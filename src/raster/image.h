@@ -28,6 +28,8 @@
 #include "raster/object.h"
 #include "raster/pixel_format.h"
 
+#include <vector>
+
 namespace raster {
 
   template<typename ImageTraits> class ImageBits;
@@ -48,6 +50,14 @@ namespace raster {
     static Image* createCopy(const Image* image,
                              const ImageBufferPtr& buffer = ImageBufferPtr());
 
+    // Creates a copy of the image that shares its pixels until one of
+    // both images is modified: the first one that invalidates its
+    // rows (see invalidateRows()) copies the pixels to a new buffer,
+    // so the other image keeps the original ones. Pixels must be
+    // invalidated before they are written (never after) in images
+    // that can be shared.
+    static Image* createCopyOnWrite(Image* image);
+
     virtual ~Image();
 
     PixelFormat getPixelFormat() const { return m_format; }
@@ -55,6 +65,7 @@ namespace raster {
     int getHeight() const { return m_height; }
     gfx::Size getSize() const { return gfx::Size(m_width, m_height); }
     gfx::Rect getBounds() const { return gfx::Rect(0, 0, m_width, m_height); }
+
     color_t getMaskColor() const { return m_maskColor; }
     void setMaskColor(color_t c) { m_maskColor = c; }
 
@@ -64,6 +75,8 @@ namespace raster {
 
     template<typename ImageTraits>
     ImageBits<ImageTraits> lockBits(LockType lockType, const gfx::Rect& bounds) {
+      if (lockType != ReadLock)
+        invalidateRows(bounds.y, bounds.h);
       return ImageBits<ImageTraits>(this, bounds);
     }
 
@@ -90,14 +103,73 @@ namespace raster {
     virtual void fillRect(int x1, int y1, int x2, int y2, color_t color) = 0;
     virtual void blendRect(int x1, int y1, int x2, int y2, color_t color, int opacity) = 0;
 
+    // Content version of the image. It is incremented each time the
+    // pixels are modified with the member functions of this class
+    // (or locking bits for writing), or when invalidateRows() is
+    // called (which must be used before writing pixels directly
+    // through getPixelAddress()).
+    uint32_t getVersion() const { return m_version; }
+
+    // Marks the given rows as modified. It must be called before
+    // modifying them, because it copies the pixels of the image if
+    // they are shared (see createCopyOnWrite()).
+    void invalidateRows(int y, int h) {
+      if (m_sharedPixels)
+        unsharePixels();
+
+      ++m_version;
+      if (m_dirtyRow1 > y) m_dirtyRow1 = y;
+      if (m_dirtyRow2 < y+h) m_dirtyRow2 = y+h;
+    }
+
+    void invalidateContent() {
+      invalidateRows(0, m_height);
+    }
+
+    // Returns a 64-bit hash of the format, size and pixels of the
+    // image. The hash of each row is cached, so only the rows that
+    // were modified since the last call are hashed again. Images with
+    // different hashes have different pixels (images with the same
+    // hash are equal with a very high probability).
+    //
+    // Warning: This function updates the cached hashes, so it cannot
+    // be called from several threads at the same time (unless the
+    // hash was already calculated and the image wasn't modified
+    // after that, in which case nothing is updated).
+    uint64_t getHash() const;
+
   protected:
     Image(PixelFormat format, int width, int height);
 
+    // Copies the pixels to a new buffer if they are still shared with
+    // other image.
+    virtual void unsharePixels() = 0;
+
+    // Locks the buffers shared by createCopyOnWrite() to copy or
+    // release them (their reference counters aren't thread-safe, and
+    // each image can be modified or destroyed from a different
+    // thread).
+    class SharedPixelsLock {
+    public:
+      SharedPixelsLock();
+      ~SharedPixelsLock();
+    };
+
+    // True if the pixels were shared by createCopyOnWrite() and this
+    // image didn't copy them yet.
+    bool m_sharedPixels;
+
   private:
     PixelFormat m_format;
     int m_width;
     int m_height;
     color_t m_maskColor;  // Skipped color in merge process.
+
+    // Content version and cached hashes.
+    uint32_t m_version;
+    mutable uint64_t m_hash;
+    mutable std::vector<uint64_t> m_rowHashes;
+    mutable int m_dirtyRow1, m_dirtyRow2; // Rows to hash again [m_dirtyRow1, m_dirtyRow2)
   };
 
 } // namespace raster
@@ -25,6 +25,8 @@
 #include "raster/image_iterator.h"
 #include "raster/palette.h"
 
+#include <algorithm>
+
 namespace raster {
 
   template<class Traits>
@@ -55,6 +57,47 @@ namespace raster {
       return m_rows[y];
     }
 
+    size_t getRequiredBufferSize() const {
+      return sizeof(address_t) * getHeight()
+        + Traits::getRowStrideBytes(getWidth()) * getHeight();
+    }
+
+    // Fills the table of rows at the beginning of the buffer.
+    void setupRows() {
+      size_t for_rows = sizeof(address_t) * getHeight();
+      size_t rowstride_bytes = Traits::getRowStrideBytes(getWidth());
+
+      m_rows = (address_t*)m_buffer->buffer();
+      m_bits = (address_t)(m_buffer->buffer() + for_rows);
+
+      address_t addr = m_bits;
+      for (int y=0; y<getHeight(); ++y) {
+        m_rows[y] = addr;
+        addr = (address_t)(((uint8_t*)addr) + rowstride_bytes);
+      }
+    }
+
+  protected:
+    void unsharePixels() OVERRIDE {
+      SharedPixelsLock lock;
+
+      if (!m_buffer.unique()) {
+        ImageBufferPtr buffer(new ImageBuffer(getRequiredBufferSize()));
+        const_address_t bits = m_bits;
+
+        m_buffer = buffer;
+        setupRows();
+
+        std::copy((const uint8_t*)bits,
+                  (const uint8_t*)bits + Traits::getRowStrideBytes(getWidth()) * getHeight(),
+                  (uint8_t*)m_bits);
+      }
+
+      m_sharedPixels = false;
+    }
+
+  private:
+
   public:
     inline address_t address(int x, int y) const {
       return (address_t)(m_rows[y] + x / (Traits::pixels_per_byte == 0 ? 1 : Traits::pixels_per_byte));
@@ -65,22 +108,30 @@ namespace raster {
       : Image(static_cast<PixelFormat>(Traits::pixel_format), width, height)
       , m_buffer(buffer)
     {
-      size_t for_rows = sizeof(address_t) * height;
-      size_t rowstride_bytes = Traits::getRowStrideBytes(width);
-      size_t required_size = for_rows + rowstride_bytes*height;
+      size_t required_size = getRequiredBufferSize();
 
       if (!m_buffer)
         m_buffer.reset(new ImageBuffer(required_size));
       else
         m_buffer->resizeIfNecessary(required_size);
 
-      m_rows = (address_t*)m_buffer->buffer();
-      m_bits = (address_t)(m_buffer->buffer() + for_rows);
+      setupRows();
+    }
 
-      address_t addr = m_bits;
-      for (int y=0; y<height; ++y) {
-        m_rows[y] = addr;
-        addr = (address_t)(((uint8_t*)addr) + rowstride_bytes);
+    // Creates an image that shares the pixels (and the table of rows)
+    // of the given one (see Image::createCopyOnWrite()).
+    explicit ImageImpl(ImageImpl* image)
+      : Image(static_cast<PixelFormat>(Traits::pixel_format), image->getWidth(), image->getHeight())
+      , m_buffer(image->m_buffer)
+      , m_bits(image->m_bits)
+      , m_rows(image->m_rows)
+    {
+    }
+
+    ~ImageImpl() {
+      if (m_sharedPixels) {
+        SharedPixelsLock lock;
+        m_buffer.reset();
       }
     }
 
@@ -102,10 +153,14 @@ namespace raster {
       ASSERT(x >= 0 && x < getWidth());
       ASSERT(y >= 0 && y < getHeight());
 
+      invalidateRows(y, 1);
+
       *address(x, y) = color;
     }
 
     void clear(color_t color) OVERRIDE {
+      invalidateContent();
+
       LockImageBits<Traits> bits(this);
       typename LockImageBits<Traits>::iterator it(bits.begin());
       typename LockImageBits<Traits>::iterator end(bits.end());
@@ -155,6 +210,8 @@ namespace raster {
 
       // Copy process
 
+      invalidateRows(ybeg, yend-ybeg+1);
+
       bytes = Traits::getRowStrideBytes(xend - xbeg + 1);
 
       for (ydst=ybeg; ydst<=yend; ++ydst, ++ysrc) {
@@ -166,14 +223,12 @@ namespace raster {
     }
 
     void merge(const Image* _src, int x, int y, int opacity, int blend_mode) OVERRIDE {
-      BLEND_COLOR blender = Traits::get_blender(blend_mode);
+      typename Traits::row_blender_t blender = Traits::get_row_blender(blend_mode);
       const ImageImpl<Traits>* src = (const ImageImpl<Traits>*)_src;
       ImageImpl<Traits>* dst = this;
-      address_t src_address;
-      address_t dst_address;
-      int xbeg, xend, xsrc, xdst;
+      int xbeg, xend, xsrc;
       int ybeg, yend, ysrc, ydst;
-      register uint32_t mask_color = src->getMaskColor();
+      typename Traits::pixel_t mask_color = src->getMaskColor();
 
       // nothing to do
       if (!opacity)
@@ -209,23 +264,20 @@ namespace raster {
       if (yend >= dst->getHeight())
         yend = dst->getHeight()-1;
 
-      // Merge process
+      // Merge process (row by row)
 
-      for (ydst=ybeg; ydst<=yend; ++ydst, ++ysrc) {
-        src_address = (address_t)src->address(xsrc, ysrc);
-        dst_address = (address_t)dst->address(xbeg, ydst);
+      invalidateRows(ybeg, yend-ybeg+1);
 
-        for (xdst=xbeg; xdst<=xend; ++xdst) {
-          if (*src_address != mask_color)
-            *dst_address = (*blender)(*dst_address, *src_address, opacity);
-
-          ++dst_address;
-          ++src_address;
-        }
+      for (ydst=ybeg; ydst<=yend; ++ydst, ++ysrc) {
+        (*blender)(dst->address(xbeg, ydst),
+                   src->address(xsrc, ysrc),
+                   xend - xbeg + 1, opacity, mask_color);
       }
     }
 
     void drawHLine(int x1, int y, int x2, color_t color) OVERRIDE {
+      invalidateRows(y, 1);
+
       LockImageBits<Traits> bits(this, gfx::Rect(x1, y, x2 - x1 + 1, 1));
       typename LockImageBits<Traits>::iterator it(bits.begin());
       typename LockImageBits<Traits>::iterator end(bits.end());
@@ -249,11 +301,13 @@ namespace raster {
 
   template<>
   inline void ImageImpl<IndexedTraits>::clear(color_t color) {
+    invalidateContent();
     memset(m_bits, color, getWidth()*getHeight());
   }
 
   template<>
   inline void ImageImpl<BitmapTraits>::clear(color_t color) {
+    invalidateContent();
     memset(m_bits, (color ? 0xff: 0x00),
            BitmapTraits::getRowStrideBytes(getWidth()) * getHeight());
   }
@@ -272,6 +326,8 @@ namespace raster {
     ASSERT(x >= 0 && x < getWidth());
     ASSERT(y >= 0 && y < getHeight());
 
+    invalidateRows(y, 1);
+
     div_t d = div(x, 8);
     if (color)
       (*(m_rows[y] + d.quot)) |= (1 << d.rem);
@@ -284,6 +340,8 @@ namespace raster {
     address_t addr;
     int x, y;
 
+    invalidateRows(y1, y2-y1+1);
+
     for (y=y1; y<=y2; ++y) {
       addr = (address_t)getPixelAddress(x1, y);
       for (x=x1; x<=x2; ++x) {
@@ -333,6 +391,8 @@ namespace raster {
 
     // merge process
 
+    invalidateRows(ybeg, yend-ybeg+1);
+
     // direct copy
     if (blend_mode == BLEND_MODE_COPY) {
       for (ydst=ybeg; ydst<=yend; ++ydst, ++ysrc) {
@@ -404,6 +464,8 @@ namespace raster {
 
     // copy process
 
+    invalidateRows(ybeg, yend-ybeg+1);
+
     int w = xend - xbeg + 1;
     int h = yend - ybeg + 1;
     ImageConstIterator<BitmapTraits> src_it(src, gfx::Rect(xsrc, ysrc, w, h), xsrc, ysrc);
@@ -456,6 +518,8 @@ namespace raster {
 
     // merge process
 
+    invalidateRows(ybeg, yend-ybeg+1);
+
     int w = xend - xbeg + 1;
     int h = yend - ybeg + 1;
     ImageConstIterator<BitmapTraits> src_it(src, gfx::Rect(xsrc, ysrc, w, h), xsrc, ysrc);
@@ -51,6 +51,13 @@ namespace raster {
       ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
       return rgba_blenders[blend_mode];
     }
+
+    typedef BLEND_RGBA_ROW row_blender_t;
+
+    static inline BLEND_RGBA_ROW get_row_blender(int blend_mode)
+    {
+      return get_rgba_row_blender(blend_mode);
+    }
   };
 
   struct GrayscaleTraits {
@@ -81,6 +88,13 @@ namespace raster {
       ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
       return graya_blenders[blend_mode];
     }
+
+    typedef BLEND_GRAYA_ROW row_blender_t;
+
+    static inline BLEND_GRAYA_ROW get_row_blender(int blend_mode)
+    {
+      return get_graya_row_blender(blend_mode);
+    }
   };
 
   struct IndexedTraits {
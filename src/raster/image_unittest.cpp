@@ -23,6 +23,8 @@
 #include <gtest/gtest.h>
 
 #include "base/unique_ptr.h"
+#include "gfx/point.h"
+#include "gfx/region.h"
 #include "raster/image.h"
 #include "raster/image_bits.h"
 #include "raster/primitives.h"
@@ -191,6 +193,132 @@ TYPED_TEST(ImageAllTypes, DrawHLine)
   }
 }
 
+TYPED_TEST(ImageAllTypes, IsSameImage)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, 33, 17));
+  UniquePtr<Image> b(Image::create(ImageTraits::pixel_format, 33, 17));
+  UniquePtr<Image> c(Image::create(ImageTraits::pixel_format, 17, 33));
+  a->clear(0);
+  b->clear(0);
+  c->clear(0);
+
+  EXPECT_TRUE(is_same_image(a, b));
+  EXPECT_FALSE(is_same_image(a, c));
+
+  b->putPixel(32, 16, 1);
+  EXPECT_FALSE(is_same_image(a, b));
+
+  a->putPixel(32, 16, 1);
+  EXPECT_TRUE(is_same_image(a, b));
+}
+
+TYPED_TEST(ImageAllTypes, ContentHash)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, 33, 17));
+  UniquePtr<Image> b(Image::create(ImageTraits::pixel_format, 33, 17));
+  a->clear(0);
+  b->clear(0);
+
+  uint32_t version = a->getVersion();
+  uint64_t hash = a->getHash();
+  EXPECT_EQ(hash, b->getHash());
+
+  a->putPixel(3, 7, 1);
+  EXPECT_NE(version, a->getVersion());
+  EXPECT_NE(hash, a->getHash());
+
+  b->putPixel(3, 7, 1);
+  EXPECT_EQ(a->getHash(), b->getHash());
+
+  a->putPixel(3, 7, 0);
+  EXPECT_EQ(hash, a->getHash());
+
+  // Writes through a write lock invalidate the locked rows
+  {
+    LockImageBits<ImageTraits> bits(b, Image::WriteLock, gfx::Rect(0, 7, 33, 1));
+    typename LockImageBits<ImageTraits>::iterator it = bits.begin(), end = bits.end();
+    for (; it != end; ++it)
+      *it = 0;
+  }
+  EXPECT_EQ(hash, b->getHash());
+}
+
+TYPED_TEST(ImageAllTypes, CopyRegion)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, 33, 17));
+  UniquePtr<Image> b(Image::create(ImageTraits::pixel_format, 33, 17));
+  a->clear(0);
+  b->clear(1);
+
+  gfx::Region rgn(gfx::Rect(1, 2, 9, 3));
+  rgn.createUnion(rgn, gfx::Region(gfx::Rect(30, 10, 10, 10)));
+  uint64_t hash = a->getHash();
+  copy_image(a, b, rgn);
+  EXPECT_NE(hash, a->getHash());
+
+  for (int y=0; y<a->getHeight(); ++y)
+    for (int x=0; x<a->getWidth(); ++x)
+      EXPECT_EQ(rgn.contains(gfx::Point(x, y)) ? 1: 0, a->getPixel(x, y));
+}
+
+TEST(Image, HashOfChangesInHighBits)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 8, 1));
+  UniquePtr<Image> b(Image::create(IMAGE_RGB, 8, 1));
+  clear_image(a, rgba(0, 0, 0, 255));
+  clear_image(b, rgba(0, 0, 0, 255));
+
+  // The same change in two pixels of the same 64-bit word
+  put_pixel(a, 0, 0, rgba(0, 0, 0, 127));
+  put_pixel(b, 1, 0, rgba(0, 0, 0, 127));
+  EXPECT_NE(a->getHash(), b->getHash());
+
+  clear_image(a, rgba(0, 0, 0, 255));
+  clear_image(b, rgba(0, 0, 0, 255));
+  put_pixel(a, 1, 0, rgba(0, 0, 0, 127));
+  put_pixel(b, 3, 0, rgba(0, 0, 0, 127));
+  EXPECT_NE(a->getHash(), b->getHash());
+}
+
+TEST(Image, CopyPixels)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 16, 16));
+  UniquePtr<Image> b(Image::create(IMAGE_RGB, 8, 8));
+  clear_image(a, rgba(0, 0, 0, 0));
+  clear_image(b, rgba(255, 0, 0, 255));
+
+  uint64_t hash = a->getHash();
+  copy_image_pixels(a, b, 12, -4);
+
+  // The modified rows must be invalidated by the caller
+  a->invalidateContent();
+  EXPECT_NE(hash, a->getHash());
+
+  for (int y=0; y<a->getHeight(); ++y)
+    for (int x=0; x<a->getWidth(); ++x)
+      EXPECT_EQ(x >= 12 && y < 4 ? rgba(255, 0, 0, 255): rgba(0, 0, 0, 0),
+                get_pixel(a, x, y));
+}
+
+TEST(Image, UniqueIds)
+{
+  UniquePtr<Image> a(Image::create(IMAGE_RGB, 4, 4));
+  uint32_t id = a->getId();
+
+  // IDs aren't reused (even if the new image has the same address)
+  a.reset(Image::create(IMAGE_RGB, 4, 4));
+  EXPECT_NE(id, a->getId());
+
+  UniquePtr<Image> b(Image::createCopy(a));
+  EXPECT_NE(a->getId(), b->getId());
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -128,10 +128,12 @@ void LayerImage::destroyAllCels()
     Cel* cel = *it;
     Image* image = getSprite()->getStock()->getImage(cel->getImage());
 
-    ASSERT(image != NULL);
-
-    getSprite()->getStock()->removeImage(image);
-    delete image;
+    // The image can be already removed if it was shared with other
+    // cel (linked cels)
+    if (image) {
+      getSprite()->getStock()->removeImage(image);
+      delete image;
+    }
     delete cel;
   }
   m_cels.clear();
@@ -146,6 +148,20 @@ void LayerImage::getCels(CelList& cels)
     cels.push_back(*it);
 }
 
+bool LayerImage::isLinkedCel(const Cel* cel) const
+{
+  CelConstIterator it = getCelBegin();
+  CelConstIterator end = getCelEnd();
+
+  for (; it != end; ++it) {
+    const Cel* other = *it;
+    if (other != cel && other->getImage() == cel->getImage())
+      return true;
+  }
+
+  return false;
+}
+
 void LayerImage::addCel(Cel *cel)
 {
   CelIterator it = getCelBegin();
@@ -318,7 +334,11 @@ void layer_render(const Layer* layer, Image* image, int x, int y, FrameNumber fr
         src_image = layer->getSprite()->getStock()->getImage(cel->getImage());
         ASSERT(src_image != NULL);
 
-        src_image->setMaskColor(layer->getSprite()->getTransparentColor());
+        // The mask color is changed only if it's necessary, so the
+        // sprite can be rendered from several threads if all mask
+        // colors are already set.
+        if (src_image->getMaskColor() != layer->getSprite()->getTransparentColor())
+          src_image->setMaskColor(layer->getSprite()->getTransparentColor());
 
         composite_image(image, src_image,
                         cel->getX() + x,
@@ -111,6 +111,10 @@ namespace raster {
 
     void getCels(CelList& cels);
 
+    // Returns true if the image of the given cel is used by other cels
+    // of this layer too (linked cels).
+    bool isLinkedCel(const Cel* cel) const;
+
     void configureAsBackground();
 
     CelIterator getCelBegin() { return m_cels.begin(); }
@@ -30,6 +30,7 @@
 #include "raster/stock.h"
 
 #include <iostream>
+#include <set>
 #include <vector>
 
 namespace raster {
@@ -59,14 +60,25 @@ void write_layer(std::ostream& os, LayerSubObjectsSerializer* subObjects, Layer*
       CelIterator it = static_cast<LayerImage*>(layer)->getCelBegin();
       CelIterator end = static_cast<LayerImage*>(layer)->getCelEnd();
 
+      // Images of linked cels are written only with the first cel
+      // that uses them
+      std::set<int> writtenImages;
+
       for (; it != end; ++it) {
         Cel* cel = *it;
         subObjects->write_cel(os, cel);
 
-        Image* image = layer->getSprite()->getStock()->getImage(cel->getImage());
-        ASSERT(image != NULL);
+        if (writtenImages.find(cel->getImage()) == writtenImages.end()) {
+          writtenImages.insert(cel->getImage());
+
+          Image* image = layer->getSprite()->getStock()->getImage(cel->getImage());
+          ASSERT(image != NULL);
 
-        subObjects->write_image(os, image);
+          write8(os, 1);                        // The image is here
+          subObjects->write_image(os, image);
+        }
+        else
+          write8(os, 0);                        // Linked cel
       }
       break;
     }
@@ -117,10 +129,12 @@ Layer* read_layer(std::istream& is, LayerSubObjectsSerializer* subObjects, Sprit
         // Add the cel in the layer
         static_cast<LayerImage*>(layer.get())->addCel(cel);
 
-        // Read the cel's image
-        Image* image = subObjects->read_image(is);
-
-        sprite->getStock()->replaceImage(cel->getImage(), image);
+        // Read the cel's image (only in the first cel that uses it,
+        // linked cels have the same image index)
+        if (read8(is)) {
+          Image* image = subObjects->read_image(is);
+          sprite->getStock()->replaceImage(cel->getImage(), image);
+        }
       }
       break;
     }
@@ -0,0 +1,113 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/cel.h"
+#include "raster/cel_io.h"
+#include "raster/image.h"
+#include "raster/image_io.h"
+#include "raster/layer.h"
+#include "raster/layer_io.h"
+#include "raster/primitives.h"
+#include "raster/sprite.h"
+#include "raster/stock.h"
+
+#include <sstream>
+
+using namespace base;
+using namespace raster;
+
+class TestSerializer : public LayerSubObjectsSerializer {
+public:
+  TestSerializer(Sprite* sprite) : m_sprite(sprite), m_readImages(0) { }
+
+  int readImages() const { return m_readImages; }
+
+  void write_cel(std::ostream& os, Cel* cel) { raster::write_cel(os, cel); }
+  void write_image(std::ostream& os, Image* image) { raster::write_image(os, image); }
+  void write_layer(std::ostream& os, Layer* layer) { raster::write_layer(os, this, layer); }
+
+  Cel* read_cel(std::istream& is) { return raster::read_cel(is); }
+  Image* read_image(std::istream& is) { ++m_readImages; return raster::read_image(is); }
+  Layer* read_layer(std::istream& is) { return raster::read_layer(is, this, m_sprite); }
+
+private:
+  Sprite* m_sprite;
+  int m_readImages;
+};
+
+TEST(LayerIO, LinkedCelsShareTheImage)
+{
+  Sprite sprite(IMAGE_RGB, 4, 4, 256);
+  sprite.setTotalFrames(FrameNumber(3));
+
+  LayerImage* layer = new LayerImage(&sprite);
+  sprite.getFolder()->addLayer(layer);
+
+  Image* image = Image::create(IMAGE_RGB, 4, 4);
+  clear_image(image, 0);
+  put_pixel(image, 1, 2, rgba(255, 0, 0, 255));
+  int imageIndex = sprite.getStock()->addImage(image);
+  int otherIndex = sprite.getStock()->addImage(Image::createCopy(image));
+
+  layer->addCel(new Cel(FrameNumber(0), imageIndex));
+  layer->addCel(new Cel(FrameNumber(1), imageIndex));
+  layer->addCel(new Cel(FrameNumber(2), otherIndex));
+
+  std::stringstream stream;
+  TestSerializer serializer(&sprite);
+  write_layer(stream, &serializer, layer);
+
+  // Remove the layer and its images (as RemoveLayer does)
+  sprite.getFolder()->removeLayer(layer);
+  delete layer;
+  delete sprite.getStock()->getImage(imageIndex);
+  delete sprite.getStock()->getImage(otherIndex);
+  sprite.getStock()->replaceImage(imageIndex, NULL);
+  sprite.getStock()->replaceImage(otherIndex, NULL);
+
+  UniquePtr<Layer> newLayer(read_layer(stream, &serializer, &sprite));
+  ASSERT_TRUE(newLayer != NULL);
+  ASSERT_TRUE(newLayer->isImage());
+  EXPECT_EQ(2, serializer.readImages());
+
+  LayerImage* newLayerImage = static_cast<LayerImage*>(newLayer.get());
+  ASSERT_EQ(3, newLayerImage->getCelsCount());
+  EXPECT_EQ(imageIndex, newLayerImage->getCel(FrameNumber(0))->getImage());
+  EXPECT_EQ(imageIndex, newLayerImage->getCel(FrameNumber(1))->getImage());
+  EXPECT_EQ(otherIndex, newLayerImage->getCel(FrameNumber(2))->getImage());
+  EXPECT_TRUE(newLayerImage->isLinkedCel(newLayerImage->getCel(FrameNumber(0))));
+  EXPECT_FALSE(newLayerImage->isLinkedCel(newLayerImage->getCel(FrameNumber(2))));
+
+  Image* newImage = sprite.getStock()->getImage(imageIndex);
+  ASSERT_TRUE(newImage != NULL);
+  EXPECT_EQ(rgba(255, 0, 0, 255), get_pixel(newImage, 1, 2));
+  EXPECT_TRUE(sprite.getStock()->getImage(otherIndex) != NULL);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
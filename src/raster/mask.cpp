@@ -138,7 +138,7 @@ void Mask::clear()
 void Mask::invert()
 {
   if (m_bitmap) {
-    LockImageBits<BitmapTraits> bits(m_bitmap);
+    LockImageBits<BitmapTraits> bits(m_bitmap, Image::ReadWriteLock);
     LockImageBits<BitmapTraits>::iterator it = bits.begin(), end = bits.end();
 
     for (; it != end; ++it)
@@ -19,6 +19,7 @@
 #ifndef RASTER_MEDIAN_CUT_H_INCLUDED
 #define RASTER_MEDIAN_CUT_H_INCLUDED
 
+#include <cassert>
 #include <list>
 #include <queue>
 
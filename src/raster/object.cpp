@@ -22,16 +22,32 @@
 
 #include "raster/object.h"
 
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+
 namespace raster {
-  
+
+// Objects can be created from several threads (e.g. images of
+// rendering bands)
+static base::mutex next_id_mutex;
+static uint32_t next_id = 0;
+
+static uint32_t generate_id()
+{
+  base::scoped_lock lock(next_id_mutex);
+  return ++next_id;
+}
+
 Object::Object(ObjectType type)
+  : m_type(type)
+  , m_id(generate_id())
 {
-  m_type = type;
 }
 
 Object::Object(const Object& object)
+  : m_type(object.m_type)
+  , m_id(generate_id())
 {
-  m_type = object.m_type;
 }
 
 Object::~Object()
@@ -55,12 +55,19 @@ namespace raster {
 
     ObjectType type() const { return m_type; }
 
+    // Returns a number that identifies this object. It is unique for
+    // each created object (it isn't reused as the address of a deleted
+    // object can be, and copies have their own ID), so it can be used
+    // as a key of caches.
+    uint32_t getId() const { return m_id; }
+
     // Returns the approximate amount of memory (in bytes) which this
     // object use.
     virtual int getMemSize() const;
 
   private:
     ObjectType m_type;
+    uint32_t m_id;
 
     Object& operator=(const Object&);
   };
@@ -25,6 +25,7 @@
 #include "base/path.h"
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
+#include "raster/color_tree.h"
 #include "raster/conversion_alleg.h"
 #include "raster/file/col_file.h"
 #include "raster/file/gpl_file.h"
@@ -46,6 +47,7 @@ Palette::Palette(FrameNumber frame, int ncolors)
   m_frame = frame;
   m_colors.resize(ncolors);
   m_modifications = 0;
+  m_colorTreeModifications = 0;
 
   std::fill(m_colors.begin(), m_colors.end(), rgba(0, 0, 0, 255));
 }
@@ -56,6 +58,7 @@ Palette::Palette(const Palette& palette)
   m_frame = palette.m_frame;
   m_colors = palette.m_colors;
   m_modifications = 0;
+  m_colorTreeModifications = 0;
 }
 
 Palette::~Palette()
@@ -393,6 +396,8 @@ void Palette::sort(int from, int to, SortPalette* sort_palette, std::vector<int>
     m_colors[from+i] = temp[i].color;
     mapping[from+i] = temp[i].index;
   }
+
+  ++m_modifications;
 }
 
 // End of Sort stuff
@@ -462,67 +467,24 @@ bool Palette::save(const char *filename) const
   return success;
 }
 
-//////////////////////////////////////////////////////////////////////
-// Based on Allegro's bestfit_color
-
-static unsigned int col_diff[3*128];
-
-static void bestfit_init()
-{
-  register int i, k;
-
-  for (i=1; i<64; i++) {
-    k = i * i;
-    col_diff[0  +i] = col_diff[0  +128-i] = k * (59 * 59);
-    col_diff[128+i] = col_diff[128+128-i] = k * (30 * 30);
-    col_diff[256+i] = col_diff[256+128-i] = k * (11 * 11);
-  }
-}
-
 int Palette::findBestfit(int r, int g, int b) const
 {
-#ifdef __GNUC__
-  register int bestfit asm("%eax");
-#else
-  register int bestfit;
-#endif
-  int i, coldiff, lowest;
-
   ASSERT(r >= 0 && r <= 255);
   ASSERT(g >= 0 && g <= 255);
   ASSERT(b >= 0 && b <= 255);
 
-  if (col_diff[1] == 0)
-    bestfit_init();
-
-  bestfit = 0;
-  lowest = INT_MAX;
-
-  r >>= 3;
-  g >>= 3;
-  b >>= 3;
-
-  i = 1;
-  while (i < size()) {
-    color_t rgb = m_colors[i];
-
-    coldiff = (col_diff + 0) [ ((rgba_getg(rgb)>>3) - g) & 0x7F ];
-    if (coldiff < lowest) {
-      coldiff += (col_diff + 128) [ ((rgba_getr(rgb)>>3) - r) & 0x7F ];
-      if (coldiff < lowest) {
-        coldiff += (col_diff + 256) [ ((rgba_getb(rgb)>>3) - b) & 0x7F ];
-        if (coldiff < lowest) {
-          bestfit = i;
-          if (coldiff == 0)
-            return bestfit;
-          lowest = coldiff;
-        }
-      }
-    }
-    i++;
-  }
+  buildColorTree();
 
-  return bestfit;
+  return m_colorTree->findNearest(r, g, b);
+}
+
+void Palette::buildColorTree() const
+{
+  // Regenerate the tree if the palette was modified
+  if (!m_colorTree || m_colorTreeModifications != m_modifications) {
+    m_colorTree.reset(new ColorTree(this));
+    m_colorTreeModifications = m_modifications;
+  }
 }
 
 } // namespace raster
@@ -19,6 +19,7 @@
 #ifndef RASTER_PALETTE_H_INCLUDED
 #define RASTER_PALETTE_H_INCLUDED
 
+#include "base/unique_ptr.h"
 #include "raster/color.h"
 #include "raster/frame_number.h"
 #include "raster/object.h"
@@ -27,6 +28,8 @@
 
 namespace raster {
 
+  class ColorTree;
+
   class SortPalette {
   public:
     enum Channel {
@@ -94,12 +97,25 @@ namespace raster {
     static Palette* load(const char *filename);
     bool save(const char *filename) const;
 
+    // Returns the nearest entry to the given color (the entry 0 is
+    // never returned unless it is the only one). It uses a ColorTree
+    // that is regenerated the first time it's needed after the
+    // palette is modified. For a lot of colors use a RgbMap, it has a
+    // table of 64x64x64 entries with the results of the tree.
     int findBestfit(int r, int g, int b) const;
 
+    // Regenerates the ColorTree used by findBestfit() if the palette
+    // was modified. Call it from the main thread before using
+    // findBestfit() from several threads (then the palette must not
+    // be modified until they finish).
+    void buildColorTree() const;
+
   private:
     FrameNumber m_frame;
     std::vector<color_t> m_colors;
     int m_modifications;
+    mutable base::UniquePtr<ColorTree> m_colorTree;
+    mutable int m_colorTreeModifications;
   };
 
 } // namespace raster
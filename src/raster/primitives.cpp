@@ -22,6 +22,7 @@
 
 #include "raster/primitives.h"
 
+#include "gfx/region.h"
 #include "raster/algo.h"
 #include "raster/blend.h"
 #include "raster/image.h"
@@ -30,6 +31,7 @@
 #include "raster/pen.h"
 #include "raster/rgbmap.h"
 
+#include <cstring>
 #include <stdexcept>
 
 namespace raster {
@@ -82,6 +84,59 @@ void copy_image(Image* dst, const Image* src, int x, int y)
   dst->copy(src, x, y);
 }
 
+// Copies the pixels of "src" inside the given region to the same
+// position in "dst" (both images must have the same pixel format).
+void copy_image(Image* dst, const Image* src, const gfx::Region& rgn)
+{
+  ASSERT(dst->getPixelFormat() == src->getPixelFormat());
+
+  gfx::Rect bounds = dst->getBounds().createIntersect(src->getBounds());
+
+  for (gfx::Region::const_iterator it=rgn.begin(), end=rgn.end();
+       it != end; ++it) {
+    gfx::Rect rc = bounds.createIntersect(*it);
+    if (rc.isEmpty())
+      continue;
+
+    // Bitmap pixels aren't aligned to bytes
+    if (dst->getPixelFormat() == IMAGE_BITMAP) {
+      for (int y=rc.y; y<rc.y2(); ++y)
+        for (int x=rc.x; x<rc.x2(); ++x)
+          dst->putPixel(x, y, src->getPixel(x, y));
+      continue;
+    }
+
+    dst->invalidateRows(rc.y, rc.h);
+
+    int rowSize = dst->getRowStrideSize(rc.w);
+    for (int y=rc.y; y<rc.y2(); ++y)
+      std::memcpy(dst->getPixelAddress(rc.x, y),
+                  src->getPixelAddress(rc.x, y), rowSize);
+  }
+}
+
+// Copies "src" in "dst" at the given position writing the pixels
+// directly, so the modified rows of "dst" aren't invalidated (see
+// Image::invalidateRows()). Several threads can copy in different
+// areas of the same image at the same time, and then the caller must
+// invalidate "dst" when all of them finished ("dst" cannot share its
+// pixels, see Image::createCopyOnWrite()).
+void copy_image_pixels(Image* dst, const Image* src, int x, int y)
+{
+  ASSERT(dst->getPixelFormat() == src->getPixelFormat());
+  ASSERT(dst->getPixelFormat() != IMAGE_BITMAP);
+
+  gfx::Rect rc = dst->getBounds().createIntersect(
+    gfx::Rect(x, y, src->getWidth(), src->getHeight()));
+  if (rc.isEmpty())
+    return;
+
+  int rowSize = dst->getRowStrideSize(rc.w);
+  for (int v=rc.y; v<rc.y2(); ++v)
+    std::memcpy(dst->getPixelAddress(rc.x, v),
+                src->getPixelAddress(rc.x-x, v-y), rowSize);
+}
+
 void composite_image(Image* dst, const Image* src, int x, int y, int opacity, int blend_mode)
 {
   dst->merge(src, x, y, opacity, blend_mode);
@@ -334,4 +389,29 @@ int count_diff_between_images(const Image* i1, const Image* i2)
   return -1;
 }
 
+bool is_same_image(const Image* i1, const Image* i2)
+{
+  if ((i1->getPixelFormat() != i2->getPixelFormat()) ||
+      (i1->getWidth() != i2->getWidth()) || (i1->getHeight() != i2->getHeight()))
+    return false;
+
+  // Unused bits at the end of each row of a bitmap can be different
+  if (i1->getPixelFormat() == IMAGE_BITMAP)
+    return (count_diff_between_images(i1, i2) == 0);
+
+  // Different hashes means different pixels (equal hashes must be
+  // confirmed comparing the whole content).
+  if (i1->getHash() != i2->getHash())
+    return false;
+
+  int rowBytes = i1->getRowStrideSize();
+  for (int y=0; y<i1->getHeight(); ++y) {
+    if (std::memcmp(i1->getPixelAddress(0, y),
+                    i2->getPixelAddress(0, y), rowBytes) != 0)
+      return false;
+  }
+
+  return true;
+}
+
 } // namespace raster
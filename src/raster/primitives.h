@@ -22,6 +22,10 @@
 #include "raster/color.h"
 #include "raster/image_buffer.h"
 
+namespace gfx {
+  class Region;
+}
+
 namespace raster {
   class Image;
   class Palette;
@@ -34,6 +38,8 @@ namespace raster {
   void clear_image(Image* image, color_t bg);
 
   void copy_image(Image* dst, const Image* src, int x, int y);
+  void copy_image(Image* dst, const Image* src, const gfx::Region& rgn);
+  void copy_image_pixels(Image* dst, const Image* src, int x, int y);
   void composite_image(Image* dst, const Image* src, int x, int y, int opacity, int blend_mode);
 
   Image* crop_image(const Image* image, int x, int y, int w, int h, color_t bg, const ImageBufferPtr& buffer = ImageBufferPtr());
@@ -50,6 +56,9 @@ namespace raster {
 
   int count_diff_between_images(const Image* i1, const Image* i2);
 
+  // Returns true if both images have the same format, size and pixels.
+  bool is_same_image(const Image* i1, const Image* i2);
+
 } // namespace raster
 
 #endif
@@ -22,6 +22,9 @@
 
 #include "raster/quantization.h"
 
+#include "base/parallel_for.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
 #include "raster/blend.h"
@@ -44,11 +47,23 @@ namespace quantization {
 
 using namespace gfx;
 
-// Converts a RGB image to indexed with ordered dithering method.
-static Image* ordered_dithering(const Image* src_image,
-                                int offsetx, int offsety,
-                                const RgbMap* rgbmap,
-                                const Palette* palette);
+static void rgb_to_indexed(const Image* src_image, Image* dst_image,
+                           int y1, int y2,
+                           const RgbMap* rgbmap);
+
+// Converts rows of a RGB image to indexed with ordered dithering method.
+static void ordered_dithering(const Image* src_image, Image* dst_image,
+                              int y1, int y2,
+                              int offsetx, int offsety,
+                              const RgbMap* rgbmap,
+                              const Palette* palette);
+
+// Converts rows of a RGB image to indexed with Floyd-Steinberg error
+// diffusion.
+static void error_diffusion(const Image* src_image, Image* dst_image,
+                            int y1, int y2,
+                            const RgbMap* rgbmap,
+                            const Palette* palette);
 
 static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palette* palette, bool has_background_layer);
 
@@ -84,21 +99,103 @@ Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber)
   return palette;
 }
 
+namespace {
+
+  // Converts a RGB image to indexed in horizontal bands of fixed
+  // height. Bands are independent (the ordered dithering depends only
+  // on the pixel position, and the error diffusion is restarted in
+  // each band), so they can be converted in any order/thread and the
+  // result is always the same.
+  //
+  // Each worker converts the bands worker, worker+workers, etc. The
+  // table of a RgbMap is filled on demand, so when there are several
+  // workers each one uses its own RgbMap.
+  class RgbToIndexedTask {
+  public:
+    enum { BandHeight = 64 };
+
+    RgbToIndexedTask(const Image* src_image, Image* dst_image,
+                     DitheringMethod ditheringMethod,
+                     const RgbMap* rgbmap,
+                     const Palette* palette,
+                     int workers)
+      : m_src(src_image), m_dst(dst_image)
+      , m_ditheringMethod(ditheringMethod)
+      , m_rgbmap(rgbmap), m_palette(palette)
+      , m_workers(workers) {
+      ASSERT(m_workers == 1 || m_palette);
+    }
+
+    int bands() const {
+      return (m_src->getHeight() + BandHeight - 1) / BandHeight;
+    }
+
+    void operator()(int worker) {
+      RgbMap workerRgbMap;
+      const RgbMap* rgbmap = m_rgbmap;
+      if (m_workers > 1) {
+        workerRgbMap.regenerate(m_palette);
+        rgbmap = &workerRgbMap;
+      }
+
+      for (int i=worker; i<bands(); i+=m_workers)
+        convertBand(i, rgbmap);
+    }
+
+  private:
+    void convertBand(int i, const RgbMap* rgbmap) {
+      int y1 = i*BandHeight;
+      int y2 = std::min<int>(y1+BandHeight, m_src->getHeight());
+
+      switch (m_ditheringMethod) {
+        case DITHERING_NONE:
+          rgb_to_indexed(m_src, m_dst, y1, y2, rgbmap);
+          break;
+        case DITHERING_ORDERED:
+          ordered_dithering(m_src, m_dst, y1, y2, 0, 0, rgbmap, m_palette);
+          break;
+        case DITHERING_ERROR_DIFFUSION:
+          error_diffusion(m_src, m_dst, y1, y2, rgbmap, m_palette);
+          break;
+      }
+    }
+
+    const Image* m_src;
+    Image* m_dst;
+    DitheringMethod m_ditheringMethod;
+    const RgbMap* m_rgbmap;
+    const Palette* m_palette;
+    int m_workers;
+  };
+
+}
+
 Image* convert_pixel_format(const Image* image,
                             PixelFormat pixelFormat,
                             DitheringMethod ditheringMethod,
                             const RgbMap* rgbmap,
                             const Palette* palette,
-                            bool has_background_layer)
+                            bool has_background_layer,
+                            int nthreads)
 {
   // no convertion
   if (image->getPixelFormat() == pixelFormat)
     return NULL;
-  // RGB -> Indexed with ordered dithering
+  // RGB -> Indexed
   else if (image->getPixelFormat() == IMAGE_RGB &&
-           pixelFormat == IMAGE_INDEXED &&
-           ditheringMethod == DITHERING_ORDERED) {
-    return ordered_dithering(image, 0, 0, rgbmap, palette);
+           pixelFormat == IMAGE_INDEXED) {
+    base::UniquePtr<Image> new_image(Image::create(IMAGE_INDEXED, image->getWidth(), image->getHeight()));
+    int bands = (image->getHeight() + RgbToIndexedTask::BandHeight - 1) / RgbToIndexedTask::BandHeight;
+    if (nthreads <= 0)
+      nthreads = base::thread::hardware_concurrency();
+    // Each thread needs the palette to create its own RgbMap
+    if (!palette)
+      nthreads = 1;
+    nthreads = std::max(1, std::min(nthreads, bands));
+
+    RgbToIndexedTask task(image, new_image, ditheringMethod, rgbmap, palette, nthreads);
+    base::parallel_for(0, nthreads, task, nthreads);
+    return new_image.release();
   }
 
   Image* new_image = Image::create(pixelFormat, image->getWidth(), image->getHeight());
@@ -131,27 +228,6 @@ Image* convert_pixel_format(const Image* image,
           ASSERT(dst_it == dst_end);
           break;
         }
-
-        // RGB -> Indexed
-        case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
-          LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
-
-          for (; src_it != src_end; ++src_it, ++dst_it) {
-            ASSERT(dst_it != dst_end);
-            c = *src_it;
-
-            r = rgba_getr(c);
-            g = rgba_getg(c);
-            b = rgba_getb(c);
-            if (rgba_geta(c) == 0)
-              *dst_it = 0;
-            else
-              *dst_it = rgbmap->mapColor(r, g, b);
-          }
-          ASSERT(dst_it == dst_end);
-          break;
-        }
       }
       break;
     }
@@ -289,13 +365,13 @@ static int pattern[8][8] = {
                                  4 * ((g1)-(g2)) * ((g1)-(g2)) +        \
                                  2 * ((b1)-(b2)) * ((b1)-(b2)))
 
-static Image* ordered_dithering(const Image* src_image,
-                                int offsetx, int offsety,
-                                const RgbMap* rgbmap,
-                                const Palette* palette)
+static void ordered_dithering(const Image* src_image, Image* dst_image,
+                              int y1, int y2,
+                              int offsetx, int offsety,
+                              const RgbMap* rgbmap,
+                              const Palette* palette)
 {
   int oppr, oppg, oppb, oppnrcm;
-  Image *dst_image;
   int dither_const;
   int nr, ng, nb;
   int r, g, b, a;
@@ -303,21 +379,12 @@ static Image* ordered_dithering(const Image* src_image,
   int x, y;
   color_t c;
 
-  dst_image = Image::create(IMAGE_INDEXED, src_image->getWidth(), src_image->getHeight());
-  if (!dst_image)
-    return NULL;
-
-  const LockImageBits<RgbTraits> src_bits(src_image);
-  LockImageBits<IndexedTraits> dst_bits(dst_image);
-  LockImageBits<RgbTraits>::const_iterator src_it = src_bits.begin();
-  LockImageBits<IndexedTraits>::iterator dst_it = dst_bits.begin();
-
-  for (y=0; y<src_image->getHeight(); ++y) {
-    for (x=0; x<src_image->getWidth(); ++x, ++src_it, ++dst_it) {
-      ASSERT(src_it != src_bits.end());
-      ASSERT(dst_it != dst_bits.end());
+  for (y=y1; y<y2; ++y) {
+    const uint32_t* src_address = (const uint32_t*)src_image->getPixelAddress(0, y);
+    uint8_t* dst_address = (uint8_t*)dst_image->getPixelAddress(0, y);
 
-      c = *src_it;
+    for (x=0; x<src_image->getWidth(); ++x, ++src_address, ++dst_address) {
+      c = *src_address;
 
       r = rgba_getr(c);
       g = rgba_getg(c);
@@ -362,11 +429,88 @@ static Image* ordered_dithering(const Image* src_image,
       else
         nearestcm = 0;
 
-      *dst_it = nearestcm;
+      *dst_address = nearestcm;
     }
   }
+}
 
-  return dst_image;
+static void rgb_to_indexed(const Image* src_image, Image* dst_image,
+                           int y1, int y2,
+                           const RgbMap* rgbmap)
+{
+  for (int y=y1; y<y2; ++y) {
+    const uint32_t* src_address = (const uint32_t*)src_image->getPixelAddress(0, y);
+    uint8_t* dst_address = (uint8_t*)dst_image->getPixelAddress(0, y);
+
+    for (int x=0; x<src_image->getWidth(); ++x, ++src_address, ++dst_address) {
+      color_t c = *src_address;
+
+      if (rgba_geta(c) == 0)
+        *dst_address = 0;
+      else
+        *dst_address = rgbmap->mapColor(rgba_getr(c),
+                                        rgba_getg(c),
+                                        rgba_getb(c));
+    }
+  }
+}
+
+// Number of rows above each band that are processed (without writing
+// them) to accumulate the error that comes from the previous band, so
+// the seams between bands are not visible.
+const int ErrorDiffusionSeamRows = 8;
+
+static void error_diffusion(const Image* src_image, Image* dst_image,
+                            int y1, int y2,
+                            const RgbMap* rgbmap,
+                            const Palette* palette)
+{
+  int w = src_image->getWidth();
+
+  // Accumulated errors (r, g, b) of the current and next rows (with
+  // one extra pixel at each side to avoid checking the borders).
+  std::vector<int> curErrBuf((w+2)*3, 0);
+  std::vector<int> nextErrBuf((w+2)*3, 0);
+  int* curErr = &curErrBuf[3];
+  int* nextErr = &nextErrBuf[3];
+
+  for (int y=std::max(0, y1-ErrorDiffusionSeamRows); y<y2; ++y) {
+    const uint32_t* src_address = (const uint32_t*)src_image->getPixelAddress(0, y);
+    uint8_t* dst_address = (y >= y1 ? (uint8_t*)dst_image->getPixelAddress(0, y): NULL);
+
+    for (int x=0; x<w; ++x) {
+      color_t c = src_address[x];
+      int index = 0;
+
+      if (rgba_geta(c) != 0) {
+        int v[3] = { rgba_getr(c), rgba_getg(c), rgba_getb(c) };
+        for (int i=0; i<3; ++i)
+          v[i] = MID(0, v[i] + curErr[x*3+i] / 16, 255);
+
+        index = rgbmap->mapColor(v[0], v[1], v[2]);
+
+        color_t n = palette->getEntry(index);
+        int err[3] = { v[0] - rgba_getr(n),
+                       v[1] - rgba_getg(n),
+                       v[2] - rgba_getb(n) };
+
+        // Floyd-Steinberg distribution (the errors are multiplied by
+        // 16, they are divided when they are applied)
+        for (int i=0; i<3; ++i) {
+          curErr[(x+1)*3+i] += err[i] * 7;
+          nextErr[(x-1)*3+i] += err[i] * 3;
+          nextErr[x*3+i] += err[i] * 5;
+          nextErr[(x+1)*3+i] += err[i];
+        }
+      }
+
+      if (dst_address)
+        dst_address[x] = index;
+    }
+
+    std::swap(curErr, nextErr);
+    std::fill(nextErr-3, nextErr+(w+1)*3, 0);
+  }
 }
 
 //////////////////////////////////////////////////////////////////////
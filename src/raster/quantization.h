@@ -37,13 +37,17 @@ namespace raster {
     Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber);
 
     // Changes the image pixel format. The dithering method is used only
-    // when you want to convert from RGB to Indexed.
+    // when you want to convert from RGB to Indexed. RGB to Indexed
+    // conversions are done in horizontal bands using up to "nthreads"
+    // threads (0 means one thread for each CPU), the result doesn't
+    // depend on the number of threads.
     Image* convert_pixel_format(const Image* image,
                                 PixelFormat pixelFormat,
                                 DitheringMethod ditheringMethod,
                                 const RgbMap* rgbmap,
                                 const Palette* palette,
-                                bool has_background_layer);
+                                bool has_background_layer,
+                                int nthreads = 0);
 
   } // namespace quantization
 } // namespace raster
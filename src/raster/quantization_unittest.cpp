@@ -0,0 +1,103 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/primitives.h"
+#include "raster/quantization.h"
+#include "raster/rgbmap.h"
+
+#include <cstdlib>
+
+using namespace base;
+using namespace raster;
+
+static Image* create_random_rgb_image(int w, int h)
+{
+  Image* image = Image::create(IMAGE_RGB, w, h);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel(image, x, y, rgba(std::rand() % 256,
+                                  std::rand() % 256,
+                                  std::rand() % 256,
+                                  (std::rand() % 8) ? 255: 0));
+  return image;
+}
+
+static Palette* create_random_palette()
+{
+  Palette* palette = new Palette(FrameNumber(0), 256);
+  for (int i=0; i<palette->size(); ++i)
+    palette->setEntry(i, rgba(std::rand() % 256,
+                              std::rand() % 256,
+                              std::rand() % 256, 255));
+  return palette;
+}
+
+TEST(Quantization, RgbToIndexedWithoutDithering)
+{
+  UniquePtr<Image> src(create_random_rgb_image(100, 150));
+  UniquePtr<Palette> palette(create_random_palette());
+  RgbMap rgbmap;
+  rgbmap.regenerate(palette);
+
+  UniquePtr<Image> dst(quantization::convert_pixel_format
+                       (src, IMAGE_INDEXED, DITHERING_NONE, &rgbmap, palette, false));
+
+  for (int y=0; y<src->getHeight(); ++y)
+    for (int x=0; x<src->getWidth(); ++x) {
+      color_t c = get_pixel(src, x, y);
+      color_t expected = (rgba_geta(c) == 0 ? 0:
+                          rgbmap.mapColor(rgba_getr(c), rgba_getg(c), rgba_getb(c)));
+      ASSERT_EQ(expected, get_pixel(dst, x, y));
+    }
+}
+
+TEST(Quantization, RgbToIndexedDoesntDependOnThreads)
+{
+  UniquePtr<Image> src(create_random_rgb_image(77, 300));
+  UniquePtr<Palette> palette(create_random_palette());
+  RgbMap rgbmap;
+  rgbmap.regenerate(palette);
+
+  DitheringMethod methods[] = { DITHERING_NONE,
+                                DITHERING_ORDERED,
+                                DITHERING_ERROR_DIFFUSION };
+
+  for (int i=0; i<int(sizeof(methods)/sizeof(methods[0])); ++i) {
+    UniquePtr<Image> a(quantization::convert_pixel_format
+                       (src, IMAGE_INDEXED, methods[i], &rgbmap, palette, false, 1));
+    UniquePtr<Image> b(quantization::convert_pixel_format
+                       (src, IMAGE_INDEXED, methods[i], &rgbmap, palette, false, 4));
+
+    ASSERT_EQ(0, count_diff_between_images(a, b));
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
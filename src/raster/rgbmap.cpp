@@ -22,25 +22,33 @@
 
 #include "raster/rgbmap.h"
 
-#include "raster/conversion_alleg.h"
+#include "base/unique_ptr.h"
+#include "raster/color_tree.h"
 #include "raster/palette.h"
 
-#include <allegro.h>
+#include <algorithm>
+#include <vector>
 
 namespace raster {
 
+// Bits of each component used to index the table of mapped colors.
+const int MapBits = 6;
+const int MapSize = 1 << MapBits;
+
+// Value of the table entries that were not calculated yet.
+const uint16_t Unmapped = 0xffff;
+
+// The table of mapped colors is filled on demand (each entry is
+// calculated with the ColorTree the first time it is used), so the
+// regeneration of the map is cheap when the palette is modified.
 class RgbMapImpl {
 public:
-  RgbMapImpl() {
-    m_allegMap = new RGB_MAP;
+  RgbMapImpl()
+    : m_map(MapSize*MapSize*MapSize, Unmapped) {
     m_palette = NULL;
     m_modifications = 0;
   }
 
-  ~RgbMapImpl() {
-    delete m_allegMap;
-  }
-
   bool match(const Palette* palette) const {
     return (m_palette == palette &&
             m_modifications == palette->getModifications());
@@ -50,29 +58,34 @@ public:
     m_palette = palette;
     m_modifications = palette->getModifications();
 
-    PALETTE allegPal;
-    convert_palette_to_allegro(palette, allegPal);
-    create_rgb_table(m_allegMap, allegPal, NULL);
-
-    for (int r=0; r<32; ++r)
-      for (int g=0; g<32; ++g)
-        for (int b=0; b<32; ++b) {
-          if (m_allegMap->data[r][g][b] >= palette->size())
-            m_allegMap->data[r][g][b] = palette->findBestfit(_rgb_scale_5[r],
-                                                             _rgb_scale_5[g],
-                                                             _rgb_scale_5[b]);
-        }
+    m_tree.reset(new ColorTree(palette));
+    std::fill(m_map.begin(), m_map.end(), Unmapped);
   }
 
   int mapColor(int r, int g, int b) const {
     ASSERT(r >= 0 && r < 256);
     ASSERT(g >= 0 && g < 256);
     ASSERT(b >= 0 && b < 256);
-    return m_allegMap->data[r>>3][g>>3][b>>3];
+
+    r >>= 8-MapBits;
+    g >>= 8-MapBits;
+    b >>= 8-MapBits;
+
+    uint16_t& index = m_map[(r << (2*MapBits)) | (g << MapBits) | b];
+    if (index == Unmapped)
+      index = m_tree->findNearest(scale(r), scale(g), scale(b));
+
+    return index;
   }
 
 private:
-  RGB_MAP* m_allegMap;
+  // Converts a MapBits component to a 8-bit component.
+  static int scale(int v) {
+    return (v << (8-MapBits)) | (v >> (2*MapBits-8));
+  }
+
+  mutable std::vector<uint16_t> m_map;
+  base::UniquePtr<ColorTree> m_tree;
   const Palette* m_palette;
   int m_modifications;
 };
@@ -26,6 +26,10 @@ namespace raster {
 
   class Palette;
 
+  // Maps RGB colors to the nearest palette entries. The table of
+  // results is filled on demand (even from the const mapColor()), so
+  // a RgbMap must be used from one thread only (each worker thread
+  // needs its own RgbMap).
   class RgbMap : public Object {
   public:
     RgbMap();
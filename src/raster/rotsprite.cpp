@@ -21,12 +21,17 @@
 #endif
 
 #include "base/unique_ptr.h"
+#include "gfx/point.h"
+#include "gfx/rect.h"
 #include "raster/blend.h"
 #include "raster/image.h"
 #include "raster/image_bits.h"
 #include "raster/primitives.h"
 #include "raster/primitives_fast.h"
 #include "raster/rotate.h"
+#include "raster/rotsprite.h"
+
+#include <algorithm>
 
 namespace raster {
 
@@ -35,165 +40,134 @@ namespace raster {
 // http://scale2x.sourceforge.net/algorithm.html
 // http://scale2x.sourceforge.net/scale2xandepx.html
 template<typename ImageTraits>
-static void image_scale2x_tpl(Image* dst, const Image* src, int src_w, int src_h)
+static void image_scale2x_tpl(Image* dst, const Image* src)
 {
-#if 0      // TODO complete this implementation that should be faster
-           // than using a lot of get/put_pixel_fast calls.
+  typedef typename LockImageBits<ImageTraits>::iterator DstIterator;
+  typedef typename LockImageBits<ImageTraits>::const_iterator SrcIterator;
+
+  int src_w = src->getWidth();
+  int src_h = src->getHeight();
   int dst_w = src_w*2;
-  int dst_h = src_h*2;
 
-  LockImageBits<ImageTraits> dstBits(dst, Image::WriteLock, gfx::Rect(0, 0, dst_w, dst_h));
-  const LockImageBits<ImageTraits> srcBits(src);
+  ASSERT(dst->getWidth() == src_w*2);
+  ASSERT(dst->getHeight() == src_h*2);
 
-  LockImageBits<ImageTraits>::iterator dstRow0_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow1_it = dstBits.begin();
-  LockImageBits<ImageTraits>::iterator dstRow0_end = dstBits.end();
-  LockImageBits<ImageTraits>::iterator dstRow1_end = dstBits.end();
+  LockImageBits<ImageTraits> dstBits(dst, Image::WriteLock);
+  const LockImageBits<ImageTraits> srcBits(src);
 
-  // Iterators:
+  // Pixels around P:
   //   A
   // C P B
   //   D
   //
-  // These iterators are displaced through src image and are modified in this way:
-  //
-  // P: is the simplest one, we just start from (0, 0) to srcEnd.
-  // A: starts from row 0 (so A = P in the first row), then we start
-  //    again from the row 0.
-  // B: It starts from (1, row) and in the last pixel we don't moved it.
-  // C: It starts from (0, 0) and then it is moved with a delay.
-  // D: It starts from row 1 and continues until we reach the last
-  //    row, in that case we start D iterator again.
-  //
-  LockImageBits<ImageTraits>::const_iterator itP, itA, itB, itC, itD, savedD;
-  LockImageBits<ImageTraits>::const_iterator srcEnd = srcBits.end();
+  // A and D are read from the previous and next rows (the same row
+  // in the borders), C and B are the previous and next pixels in the
+  // current row, so we keep them in a sliding window.
   color_t P, A, B, C, D;
 
-  // Adjust iterators
-  itP = itA = itB = itC = itD = savedD = srcBits.begin();
-  dstRow1_it += dst_w;
-  itD += src->getWidth();
-
   for (int y=0; y<src_h; ++y) {
-    if (y == 1) itA = srcBits.begin();
-    if (y == src_h-2) savedD = itD;
-    if (y == src_h-1) itD = savedD;
-    ++itB;
+    SrcIterator itA = srcBits.begin_area(gfx::Rect(0, std::max(y-1, 0), src_w, 1));
+    SrcIterator itP = srcBits.begin_area(gfx::Rect(0, y, src_w, 1));
+    SrcIterator itD = srcBits.begin_area(gfx::Rect(0, std::min(y+1, src_h-1), src_w, 1));
+    DstIterator dstRow0 = dstBits.begin_area(gfx::Rect(0, 2*y, dst_w, 1));
+    DstIterator dstRow1 = dstBits.begin_area(gfx::Rect(0, 2*y+1, dst_w, 1));
+
+    P = C = *itP;
 
     for (int x=0; x<src_w; ++x) {
-      ASSERT(itP != srcEnd);
-      ASSERT(itA != srcEnd);
-      ASSERT(itB != srcEnd);
-      ASSERT(itC != srcEnd);
-      ASSERT(itD != srcEnd);
-      ASSERT(dstRow0_it != dstRow0_end);
-      ASSERT(dstRow1_it != dstRow1_end);
-
-      P = *itP;
-      A = *itA;                 // y-1
-      B = *itB;                 // x+1
-      C = *itC;                 // x-1
-      D = *itD;                 // y+1
-
-      *dstRow0_it = (C == A && C != D && A != B ? A: P);
-      ++dstRow0_it;
-      *dstRow0_it = (A == B && A != C && B != D ? B: P);
-      ++dstRow0_it;
-
-      *dstRow1_it = (D == C && D != B && C != A ? C: P);
-      ++dstRow1_it;
-      *dstRow1_it = (B == D && B != A && D != C ? D: P);
-      ++dstRow1_it;
-
-      ++itP;
+      A = *itA;
+      D = *itD;
+      if (x < src_w-1) {
+        ++itP;
+        B = *itP;
+      }
+      else
+        B = P;
+
+      *dstRow0 = (C == A && C != D && A != B ? A: P);
+      ++dstRow0;
+      *dstRow0 = (A == B && A != C && B != D ? B: P);
+      ++dstRow0;
+
+      *dstRow1 = (D == C && D != B && C != A ? C: P);
+      ++dstRow1;
+      *dstRow1 = (B == D && B != A && D != C ? D: P);
+      ++dstRow1;
+
+      C = P;
+      P = B;
       ++itA;
-      if (x < src_w-2) ++itB;
-      if (x > 0) ++itC;
       ++itD;
     }
-
-    // Adjust iterators for the next two rows.
-    ++itB;
-    ++itC;
-    dstRow0_it += dst_w;
-    if (y < src_h-1)
-      dstRow1_it += dst_w;
   }
+}
 
-  // ASSERT(itP == srcEnd);
-  // ASSERT(itA == srcEnd);
-  // ASSERT(itB == srcEnd);
-  // ASSERT(itC == srcEnd);
-  // ASSERT(itD == srcEnd);
-  ASSERT(dstRow0_it == dstRow0_end);
-  ASSERT(dstRow1_it == dstRow1_end);
-#else
-
-#define A c[0]
-#define B c[1]
-#define C c[2]
-#define D c[3]
-#define P c[4]
-
-  color_t c[5];
-  for (int y=0; y<src_h; ++y) {
-    for (int x=0; x<src_w; ++x) {
-      P = get_pixel_fast<ImageTraits>(src, x, y);
-      A = (y > 0 ? get_pixel_fast<ImageTraits>(src, x, y-1): P);
-      B = (x < src_w-1 ? get_pixel_fast<ImageTraits>(src, x+1, y): P);
-      C = (x > 0 ? get_pixel_fast<ImageTraits>(src, x-1, y): P);
-      D = (y < src_h-1 ? get_pixel_fast<ImageTraits>(src, x, y+1): P);
-
-      put_pixel_fast<ImageTraits>(dst, 2*x,   2*y,   (C == A && C != D && A != B ? A: P));
-      put_pixel_fast<ImageTraits>(dst, 2*x+1, 2*y,   (A == B && A != C && B != D ? B: P));
-      put_pixel_fast<ImageTraits>(dst, 2*x,   2*y+1, (D == C && D != B && C != A ? C: P));
-      put_pixel_fast<ImageTraits>(dst, 2*x+1, 2*y+1, (B == D && B != A && D != C ? D: P));
-    }
+static void image_scale2x(Image* dst, const Image* src)
+{
+  switch (src->getPixelFormat()) {
+    case IMAGE_RGB:       image_scale2x_tpl<RgbTraits>(dst, src); break;
+    case IMAGE_GRAYSCALE: image_scale2x_tpl<GrayscaleTraits>(dst, src); break;
+    case IMAGE_INDEXED:   image_scale2x_tpl<IndexedTraits>(dst, src); break;
+    case IMAGE_BITMAP:    image_scale2x_tpl<BitmapTraits>(dst, src); break;
   }
-
-#endif
 }
 
-static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
+Image* image_rotsprite_prescale(const Image* spr)
 {
-  switch (src->getPixelFormat()) {
-    case IMAGE_RGB:       image_scale2x_tpl<RgbTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_GRAYSCALE: image_scale2x_tpl<GrayscaleTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_INDEXED:   image_scale2x_tpl<IndexedTraits>(dst, src, src_w, src_h); break;
-    case IMAGE_BITMAP:    image_scale2x_tpl<BitmapTraits>(dst, src, src_w, src_h); break;
+  base::UniquePtr<Image> result(Image::createCopy(spr));
+
+  for (int i=0; i<3; ++i) {
+    base::UniquePtr<Image> tmp(Image::create(spr->getPixelFormat(),
+                                             result->getWidth()*2,
+                                             result->getHeight()*2));
+    image_scale2x(tmp, result);
+    result.reset(tmp.release());
   }
+
+  result->setMaskColor(spr->getMaskColor());
+  return result.release();
 }
 
 void image_rotsprite(Image* bmp, Image* spr,
                      int x1, int y1, int x2, int y2,
                      int x3, int y3, int x4, int y4)
 {
-  static ImageBufferPtr buf1, buf2, buf3;
+  base::UniquePtr<Image> prescaled(image_rotsprite_prescale(spr));
 
-  if (!buf1) buf1.reset(new ImageBuffer(1));
-  if (!buf2) buf2.reset(new ImageBuffer(1));
-  if (!buf3) buf3.reset(new ImageBuffer(1));
-
-  int scale = 8;
-  base::UniquePtr<Image> bmp_copy(Image::create(bmp->getPixelFormat(), bmp->getWidth()*scale, bmp->getHeight()*scale, buf1));
-  base::UniquePtr<Image> tmp_copy(Image::create(spr->getPixelFormat(), spr->getWidth()*scale, spr->getHeight()*scale, buf2));
-  base::UniquePtr<Image> spr_copy(Image::create(spr->getPixelFormat(), spr->getWidth()*scale, spr->getHeight()*scale, buf3));
+  image_rotsprite_prescaled(bmp, prescaled,
+    x1, y1, x2, y2,
+    x3, y3, x4, y4);
+}
 
+void image_rotsprite_prescaled(Image* bmp, Image* prescaled,
+                               int x1, int y1, int x2, int y2,
+                               int x3, int y3, int x4, int y4)
+{
+  static ImageBufferPtr buf;
+  if (!buf) buf.reset(new ImageBuffer(1));
+
+  const int scale = RotSpritePrescale;
+
+  // Only the bounding box of the parallelogram (clipped to "bmp") is
+  // transformed at the bigger scale, so the temporary image doesn't
+  // depend on the size of "bmp".
+  gfx::Rect bounds(gfx::Point(std::min(std::min(x1, x2), std::min(x3, x4)),
+                              std::min(std::min(y1, y2), std::min(y3, y4))),
+                   gfx::Point(std::max(std::max(x1, x2), std::max(x3, x4))+1,
+                              std::max(std::max(y1, y2), std::max(y3, y4))+1));
+  bounds = bounds.createIntersect(bmp->getBounds());
+  if (bounds.isEmpty())
+    return;
+
+  base::UniquePtr<Image> bmp_copy(Image::create(bmp->getPixelFormat(),
+                                                bounds.w*scale, bounds.h*scale, buf));
   bmp_copy->clear(0);
-  spr_copy->clear(0);
-  spr_copy->copy(spr, 0, 0);
-
-  for (int i=0; i<3; ++i) {
-    tmp_copy->clear(0);
-    image_scale2x(tmp_copy, spr_copy, spr->getWidth()*(1<<i), spr->getHeight()*(1<<i));
-    spr_copy->copy(tmp_copy, 0, 0);
-  }
 
-  image_parallelogram(bmp_copy, spr_copy,
-    x1*scale, y1*scale, x2*scale, y2*scale,
-    x3*scale, y3*scale, x4*scale, y4*scale);
+  image_parallelogram(bmp_copy, prescaled,
+    (x1-bounds.x)*scale, (y1-bounds.y)*scale, (x2-bounds.x)*scale, (y2-bounds.y)*scale,
+    (x3-bounds.x)*scale, (y3-bounds.y)*scale, (x4-bounds.x)*scale, (y4-bounds.y)*scale);
 
-  image_scale(bmp, bmp_copy, 0, 0, bmp->getWidth(), bmp->getHeight());
+  image_scale(bmp, bmp_copy, bounds.x, bounds.y, bounds.w, bounds.h);
 }
 
 } // namespace raster
@@ -22,10 +22,25 @@
 namespace raster {
   class Image;
 
+  // Scale factor of the images returned by image_rotsprite_prescale().
+  const int RotSpritePrescale = 8;
+
   void image_rotsprite(Image* bmp, Image* spr,
     int x1, int y1, int x2, int y2,
     int x3, int y3, int x4, int y4);
 
+  // Returns a new image with "spr" scaled RotSpritePrescale times
+  // with Scale2x. It can be used to call image_rotsprite_prescaled()
+  // several times (e.g. while the user rotates a selection) without
+  // scaling the same source image again.
+  Image* image_rotsprite_prescale(const Image* spr);
+
+  // Same as image_rotsprite() but using a source image returned by
+  // image_rotsprite_prescale().
+  void image_rotsprite_prescaled(Image* bmp, Image* prescaled,
+    int x1, int y1, int x2, int y2,
+    int x3, int y3, int x4, int y4);
+
 } // namespace raster
 
 #endif
@@ -0,0 +1,141 @@
+/* Aseprite
+ * Copyright (C) 2001-2013  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+#include "raster/rotate.h"
+#include "raster/rotsprite.h"
+
+#include <cstdlib>
+
+using namespace base;
+using namespace raster;
+
+template<typename T>
+class RotSpriteAllTypes : public testing::Test {
+protected:
+  RotSpriteAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits, BitmapTraits> RotSpriteAllTraits;
+TYPED_TEST_CASE(RotSpriteAllTypes, RotSpriteAllTraits);
+
+// Straightforward Scale2x implementation using get/put_pixel.
+static Image* scale2x(const Image* src)
+{
+  int w = src->getWidth();
+  int h = src->getHeight();
+  Image* dst = Image::create(src->getPixelFormat(), w*2, h*2);
+
+  for (int y=0; y<h; ++y) {
+    for (int x=0; x<w; ++x) {
+      color_t P = get_pixel(src, x, y);
+      color_t A = (y > 0 ? get_pixel(src, x, y-1): P);
+      color_t B = (x < w-1 ? get_pixel(src, x+1, y): P);
+      color_t C = (x > 0 ? get_pixel(src, x-1, y): P);
+      color_t D = (y < h-1 ? get_pixel(src, x, y+1): P);
+
+      put_pixel(dst, 2*x,   2*y,   (C == A && C != D && A != B ? A: P));
+      put_pixel(dst, 2*x+1, 2*y,   (A == B && A != C && B != D ? B: P));
+      put_pixel(dst, 2*x,   2*y+1, (D == C && D != B && C != A ? C: P));
+      put_pixel(dst, 2*x+1, 2*y+1, (B == D && B != A && D != C ? D: P));
+    }
+  }
+
+  return dst;
+}
+
+TYPED_TEST(RotSpriteAllTypes, Prescale)
+{
+  typedef TypeParam ImageTraits;
+
+  int sizes[] = { 1, 2, 3, 7, 9, 16 };
+  for (int i=0; i<(int)(sizeof(sizes)/sizeof(int)); ++i) {
+    int w = sizes[i];
+    int h = sizes[(i+2) % (sizeof(sizes)/sizeof(int))];
+    UniquePtr<Image> image(Image::create(ImageTraits::pixel_format, w, h));
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        put_pixel(image, x, y, std::rand() % 2);
+
+    UniquePtr<Image> expected(Image::createCopy(image));
+    for (int j=0; j<3; ++j)
+      expected.reset(scale2x(expected));
+
+    UniquePtr<Image> prescaled(image_rotsprite_prescale(image));
+    ASSERT_EQ(w*RotSpritePrescale, prescaled->getWidth());
+    ASSERT_EQ(h*RotSpritePrescale, prescaled->getHeight());
+
+    for (int y=0; y<expected->getHeight(); ++y)
+      for (int x=0; x<expected->getWidth(); ++x)
+        ASSERT_EQ(get_pixel(expected, x, y), get_pixel(prescaled, x, y));
+  }
+}
+
+// The result must be the same as transforming the whole destination
+// image at the bigger scale (image_rotsprite() only uses the bounds
+// of the parallelogram).
+TEST(RotSprite, TransformOnlyParallelogramBounds)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_INDEXED, 5, 3));
+  for (int y=0; y<3; ++y)
+    for (int x=0; x<5; ++x)
+      put_pixel(image, x, y, 1 + (x+y) % 3);
+
+  UniquePtr<Image> prescaled(image_rotsprite_prescale(image));
+  const int scale = RotSpritePrescale;
+
+  //  (10,5)
+  //             (20,9)
+  // (6,15)
+  //          (16,19)
+  UniquePtr<Image> expected(Image::create(IMAGE_INDEXED, 32, 32));
+  UniquePtr<Image> expected_big(Image::create(IMAGE_INDEXED, 32*scale, 32*scale));
+  clear_image(expected, 0);
+  clear_image(expected_big, 0);
+  image_parallelogram(expected_big, prescaled,
+    10*scale, 5*scale, 20*scale, 9*scale,
+    16*scale, 19*scale, 6*scale, 15*scale);
+  image_scale(expected, expected_big, 0, 0, 32, 32);
+
+  UniquePtr<Image> dst(Image::create(IMAGE_INDEXED, 32, 32));
+  clear_image(dst, 0);
+  image_rotsprite_prescaled(dst, prescaled, 10, 5, 20, 9, 16, 19, 6, 15);
+
+  int count = 0;
+  for (int y=0; y<32; ++y)
+    for (int x=0; x<32; ++x) {
+      EXPECT_EQ(get_pixel(expected, x, y), get_pixel(dst, x, y));
+      if (get_pixel(dst, x, y) != 0)
+        ++count;
+    }
+  EXPECT_LT(0, count);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -30,6 +30,7 @@
 #include "raster/raster.h"
 
 #include <cstring>
+#include <set>
 #include <vector>
 
 namespace raster {
@@ -135,6 +136,7 @@ bool Sprite::needAlpha() const
 void Sprite::setTransparentColor(uint32_t color)
 {
   m_transparentColor = color;
+  m_stock->setMaskColor(color);
 }
 
 int Sprite::getMemSize() const
@@ -360,14 +362,18 @@ void Sprite::remapImages(FrameNumber frameFrom, FrameNumber frameTo, const std::
   CelList cels;
   getCels(cels);
 
+  // Images shared by several cels (linked cels) are remapped once
+  std::set<int> remappedImages;
+
   for (CelIterator it = cels.begin(); it != cels.end(); ++it) {
     Cel* cel = *it;
 
     // Remap this Cel because is inside the specified range
     if (cel->getFrame() >= frameFrom &&
-        cel->getFrame() <= frameTo) {
+        cel->getFrame() <= frameTo &&
+        remappedImages.insert(cel->getImage()).second) {
       Image* image = getStock()->getImage(cel->getImage());
-      LockImageBits<IndexedTraits> bits(image);
+      LockImageBits<IndexedTraits> bits(image, Image::ReadWriteLock);
       LockImageBits<IndexedTraits>::iterator
         it = bits.begin(),
         end = bits.end();
@@ -31,6 +31,7 @@ namespace raster {
 Stock::Stock(PixelFormat format)
   : Object(OBJECT_STOCK)
   , m_format(format)
+  , m_maskColor(0)
 {
   // Image with index=0 is always NULL.
   m_image.push_back(NULL);
@@ -39,6 +40,7 @@ Stock::Stock(PixelFormat format)
 Stock::Stock(const Stock& stock)
   : Object(stock)
   , m_format(stock.getPixelFormat())
+  , m_maskColor(stock.getMaskColor())
 {
   try {
     for (int i=0; i<stock.size(); ++i) {
@@ -79,6 +81,16 @@ void Stock::setPixelFormat(PixelFormat pixelFormat)
   m_format = pixelFormat;
 }
 
+void Stock::setMaskColor(color_t color)
+{
+  m_maskColor = color;
+
+  for (int i=0; i<size(); ++i) {
+    if (m_image[i])
+      m_image[i]->setMaskColor(color);
+  }
+}
+
 Image* Stock::getImage(int index) const
 {
   ASSERT((index >= 0) && (index < size()));
@@ -97,6 +109,8 @@ int Stock::addImage(Image* image)
     throw;
   }
   m_image[i] = image;
+  if (image)
+    image->setMaskColor(m_maskColor);
   return i;
 }
 
@@ -115,6 +129,8 @@ void Stock::replaceImage(int index, Image* image)
 {
   ASSERT((index > 0) && (index < size()));
   m_image[index] = image;
+  if (image)
+    image->setMaskColor(m_maskColor);
 }
 
 } // namespace raster
@@ -19,6 +19,7 @@
 #ifndef RASTER_STOCK_H_INCLUDED
 #define RASTER_STOCK_H_INCLUDED
 
+#include "raster/color.h"
 #include "raster/object.h"
 #include "raster/pixel_format.h"
 
@@ -39,6 +40,12 @@ namespace raster {
     PixelFormat getPixelFormat() const;
     void setPixelFormat(PixelFormat format);
 
+    // Mask color of all images in the stock (it's the transparent
+    // color of the sprite). It's set in each image when it's added to
+    // the stock, so images don't have to be modified to render them.
+    color_t getMaskColor() const { return m_maskColor; }
+    void setMaskColor(color_t color);
+
     // Returns the number of image in the stock.
     int size() const {
       return m_image.size();
@@ -68,6 +75,9 @@ namespace raster {
     //private: TODO uncomment this line
     PixelFormat m_format; // Type of images (all images in the stock must be of this type).
     ImagesList m_image;   // The images-array where the images are.
+
+  private:
+    color_t m_maskColor;
   };
 
 } // namespace raster
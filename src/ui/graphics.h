@@ -48,6 +48,13 @@ namespace ui {
 
     void blit(BITMAP* src, int srcx, int srcy, int dstx, int dsty, int w, int h);
 
+    // Direct access to the bitmap where this Graphics draws (to write
+    // pixels without intermediate bitmaps). Graphics coordinates must
+    // be translated with getInternalDeltaX/Y() to bitmap coordinates.
+    BITMAP* getInternalBitmap() { return m_bmp; }
+    int getInternalDeltaX() const { return m_dx; }
+    int getInternalDeltaY() const { return m_dy; }
+
     // ======================================================================
     // FONT & TEXT
     // ======================================================================
@@ -24,6 +24,7 @@ UndoHistory::UndoHistory(UndoHistoryDelegate* delegate)
   m_groupLevel = 0;
   m_diffCount = 0;
   m_diffSaved = 0;
+  m_diffSaving = -1;
 
   m_undoers = new UndoersStack(this);
   try {
@@ -72,6 +73,10 @@ void UndoHistory::clearRedo()
   // impossible to be equal to m_diffCount.
   if (m_diffCount < m_diffSaved)
     m_diffSaved = -1;
+
+  // The same for the state that is being saved.
+  if (m_diffCount < m_diffSaving)
+    m_diffSaving = -1;
 }
 
 Undoer* UndoHistory::getNextUndoer()
@@ -100,6 +105,16 @@ void UndoHistory::markSavedState()
   m_diffSaved = m_diffCount;
 }
 
+void UndoHistory::markSavingState()
+{
+  m_diffSaving = m_diffCount;
+}
+
+void UndoHistory::markSavingStateAsSaved()
+{
+  m_diffSaved = m_diffSaving;
+}
+
 void UndoHistory::runUndo(Direction direction)
 {
   UndoersStack* undoers = ((direction == UndoDirection)? m_undoers: m_redoers);
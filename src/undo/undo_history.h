@@ -48,6 +48,12 @@ namespace undo {
     bool isSavedState() const;
     void markSavedState();
 
+    // Records the current state as the one that is being saved, so
+    // it can be marked as the saved state later (with
+    // markSavingStateAsSaved()) even if there are new changes.
+    void markSavingState();
+    void markSavingStateAsSaved();
+
     ObjectsContainer* getObjects() const { return m_delegate->getObjects(); }
 
     // UndoersCollector interface
@@ -72,6 +78,7 @@ namespace undo {
     int m_groupLevel;
     int m_diffCount;
     int m_diffSaved;
+    int m_diffSaving;
   };
 
 } // namespace undo